@@ -0,0 +1,432 @@
+// HI/LO integer multiply/divide and the COP1 floating-point unit shared by the simulators.
+// Values are computed with host arithmetic at issue; simulators that model timing use isaUnit()
+// and arithOperands() to decide when a result becomes visible. Doubles use even/odd register pairs
+// (FR=0), the even register holding the low word. sqrt is exact integer arithmetic, so nothing here
+// needs libm.
+#ifndef ARITH_H
+#define ARITH_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FMT_S 0x10 // COP1 fmt field
+#define FMT_D 0x11
+#define FMT_W 0x14
+#define COP1_MF 0x00 // COP1 rs field of the moves and branches
+#define COP1_CF 0x02
+#define COP1_MT 0x04
+#define COP1_CT 0x06
+#define COP1_BC 0x08
+#define FCSR_RM_MASK 0x3 // Rounding mode: 0 nearest, 1 toward zero, 2 up, 3 down
+#define FCSR_CC0 23 // Condition code 0; codes 1-7 are bits 25-31
+#define ARITH_INVALID_WORD 0x7FFFFFFF // Result of an out-of-range conversion to word
+
+typedef struct {
+    uint32_t hi, lo;
+    uint32_t fpr[32]; // Raw register bits
+    uint32_t fcsr;
+} ArithState;
+
+typedef enum { UNIT_NONE, UNIT_INT_MUL, UNIT_INT_DIV, UNIT_FP_ADD, UNIT_FP_MUL, UNIT_FP_DIV, UNIT_COUNT } ArithUnit;
+
+typedef struct {
+    const char* name;
+    int latency; // Cycles from issue until a dependent instruction can use the result
+    int pipelined; // Accepts a new operation every cycle; otherwise busy for the whole latency
+} ArithUnitConfig;
+
+static ArithUnitConfig arith_units[UNIT_COUNT] = {
+    [UNIT_NONE] = { "none", 1, 1 },
+    [UNIT_INT_MUL] = { "imul", 4, 1 },
+    [UNIT_INT_DIV] = { "idiv", 35, 0 },
+    [UNIT_FP_ADD] = { "fadd", 4, 1 },
+    [UNIT_FP_MUL] = { "fmul", 5, 1 },
+    [UNIT_FP_DIV] = { "fdiv", 20, 0 },
+};
+
+// Registers an instruction reads and writes beyond the integer register file
+#define ARITH_READ_HILO 0x1
+#define ARITH_WRITE_HILO 0x2
+#define ARITH_READ_FCSR 0x4
+#define ARITH_WRITE_FCSR 0x8
+typedef struct {
+    uint32_t fp_read, fp_write; // One bit per FP register; doubles set both halves
+    int flags;
+    int gpr_write; // Integer register written through a multi-cycle unit (SPECIAL2 mul), 0 if none
+} ArithOperands;
+
+// "name:latency[:p|n]" - p pipelined, n not pipelined; returns 0 on a malformed spec
+static inline int arithConfigureUnit(const char* spec) {
+    char name[16];
+    int latency;
+    char mode = 0;
+    if (sscanf(spec, "%15[^:]:%d:%c", name, &latency, &mode) < 2 || latency < 1) {
+        return 0;
+    }
+    for (int unit = UNIT_INT_MUL; unit < UNIT_COUNT; ++unit) {
+        if (strcmp(name, arith_units[unit].name) == 0) {
+            arith_units[unit].latency = latency;
+            if (mode == 'p' || mode == 'n') {
+                arith_units[unit].pipelined = mode == 'p';
+            } else if (mode != 0) {
+                return 0;
+            }
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static inline float arithGetSingle(const ArithState* state, uint32_t reg) {
+    float value;
+    memcpy(&value, &state->fpr[reg], 4);
+    return value;
+}
+
+static inline void arithSetSingle(ArithState* state, uint32_t reg, float value) {
+    memcpy(&state->fpr[reg], &value, 4);
+}
+
+static inline double arithGetDouble(const ArithState* state, uint32_t reg) {
+    uint64_t bits = (uint64_t)state->fpr[(reg & ~1u) + 1] << 32 | state->fpr[reg & ~1u];
+    double value;
+    memcpy(&value, &bits, 8);
+    return value;
+}
+
+static inline void arithSetDouble(ArithState* state, uint32_t reg, double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, 8);
+    state->fpr[reg & ~1u] = (uint32_t)bits;
+    state->fpr[(reg & ~1u) + 1] = (uint32_t)(bits >> 32);
+}
+
+// Correctly rounded square root: 54-bit integer root of the scaled mantissa, then round to nearest even
+static inline double arithSqrt(double x) {
+    uint64_t bits;
+    memcpy(&bits, &x, 8);
+    int exponent = (bits >> 52) & 0x7FF;
+    if (x != x || x == 0 || exponent == 0x7FF) {
+        return x < 0 ? x - x : x; // NaN, zero, infinity; -inf gives NaN
+    }
+    if (x < 0) {
+        return (x - x) / (x - x); // NaN
+    }
+    uint64_t mantissa = bits & ((1ull << 52) - 1);
+    if (exponent == 0) { // Subnormal
+        exponent = 1;
+        while (!(mantissa & (1ull << 52))) {
+            mantissa <<= 1;
+            exponent--;
+        }
+    } else {
+        mantissa |= 1ull << 52;
+    }
+    int power = exponent - 1023 - 52; // x = mantissa * 2^power
+    if (power & 1) {
+        mantissa <<= 1;
+        power--;
+    }
+    unsigned __int128 remainder = (unsigned __int128)mantissa << 54, root = 0;
+    unsigned __int128 bit = (unsigned __int128)1 << 126;
+    while (bit > remainder) {
+        bit >>= 2;
+    }
+    while (bit != 0) { // Digit-by-digit integer square root
+        if (remainder >= root + bit) {
+            remainder -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    uint64_t result = (uint64_t)(root >> 1);
+    if ((root & 1) && (remainder != 0 || (result & 1))) {
+        result++; // A carry into bit 53 moves into the exponent below
+    }
+    int result_exponent = power / 2 + 26;
+    bits = ((uint64_t)(result_exponent + 1023) << 52) + result - (1ull << 52);
+    double value;
+    memcpy(&value, &bits, 8);
+    return value;
+}
+
+// Conversion to a 32-bit word with an FCSR rounding mode
+static inline uint32_t arithToWord(double x, int mode) {
+    if (!(x > -2147483649.0 && x < 2147483648.0)) {
+        return ARITH_INVALID_WORD;
+    }
+    int64_t value = (int64_t)x; // Truncates
+    double fraction = x - (double)value;
+    switch (mode) {
+        case 0:
+            if (fraction > 0.5 || (fraction == 0.5 && (value & 1))) {
+                value++;
+            } else if (fraction < -0.5 || (fraction == -0.5 && (value & 1))) {
+                value--;
+            }
+            break;
+        case 2:
+            value += fraction > 0;
+            break;
+        case 3:
+            value -= fraction < 0;
+            break;
+    }
+    return value > INT32_MAX || value < INT32_MIN ? ARITH_INVALID_WORD : (uint32_t)(int32_t)value;
+}
+
+static inline int arithCondition(const ArithState* state, uint32_t cc) {
+    return (state->fcsr >> (cc == 0 ? FCSR_CC0 : 24 + cc)) & 1;
+}
+
+static inline void arithSetCondition(ArithState* state, uint32_t cc, int value) {
+    uint32_t mask = 1u << (cc == 0 ? FCSR_CC0 : 24 + cc);
+    state->fcsr = value ? state->fcsr | mask : state->fcsr & ~mask;
+}
+
+// mult, multu, div, divu, mthi, mtlo (SPECIAL funct); returns 0 for any other funct
+static inline int arithMulDiv(ArithState* state, uint32_t funct, uint32_t rs_value, uint32_t rt_value) {
+    switch (funct) {
+        case 0x11: // mthi
+            state->hi = rs_value;
+            return 1;
+        case 0x13: // mtlo
+            state->lo = rs_value;
+            return 1;
+        case 0x18: { // mult
+            int64_t product = (int64_t)(int32_t)rs_value * (int32_t)rt_value;
+            state->hi = (uint32_t)((uint64_t)product >> 32);
+            state->lo = (uint32_t)product;
+            return 1;
+        }
+        case 0x19: { // multu
+            uint64_t product = (uint64_t)rs_value * rt_value;
+            state->hi = (uint32_t)(product >> 32);
+            state->lo = (uint32_t)product;
+            return 1;
+        }
+        case 0x1A: // div; results of a zero divisor are unpredictable, HI/LO keep their value
+            if (rt_value != 0) {
+                if ((int32_t)rs_value == INT32_MIN && (int32_t)rt_value == -1) {
+                    state->lo = rs_value; // Overflow wraps
+                    state->hi = 0;
+                } else {
+                    state->lo = (uint32_t)((int32_t)rs_value / (int32_t)rt_value);
+                    state->hi = (uint32_t)((int32_t)rs_value % (int32_t)rt_value);
+                }
+            }
+            return 1;
+        case 0x1B: // divu
+            if (rt_value != 0) {
+                state->lo = rs_value / rt_value;
+                state->hi = rs_value % rt_value;
+            }
+            return 1;
+    }
+    return 0;
+}
+
+// COP1 arithmetic, conversions, compares and register moves (fmt S, D or W).
+// mfc1 and cfc1 leave their result in *gpr_value and return 2; returns 0 for an unsupported instruction.
+static inline int arithCop1(ArithState* state, uint32_t instruction, uint32_t rt_value, uint32_t* gpr_value) {
+    uint32_t fmt = (instruction >> 21) & 0x1F;
+    uint32_t ft = (instruction >> 16) & 0x1F;
+    uint32_t fs = (instruction >> 11) & 0x1F;
+    uint32_t fd = (instruction >> 6) & 0x1F;
+    uint32_t funct = instruction & 0x3F;
+
+    switch (fmt) {
+        case COP1_MF:
+            *gpr_value = state->fpr[fs];
+            return 2;
+        case COP1_CF:
+            *gpr_value = fs == 31 ? state->fcsr : 0; // Only FCSR is implemented
+            return 2;
+        case COP1_MT:
+            state->fpr[fs] = rt_value;
+            return 1;
+        case COP1_CT:
+            if (fs == 31) {
+                state->fcsr = rt_value;
+            }
+            return 1;
+    }
+    if (fmt != FMT_S && fmt != FMT_D && fmt != FMT_W) {
+        return 0;
+    }
+    if (fmt != FMT_W && funct >= 0x05 && funct <= 0x07) { // abs, mov, neg only touch the sign bit
+        uint32_t high = fmt == FMT_D ? (fs & ~1u) + 1 : fs;
+        uint32_t sign = funct == 0x05 ? state->fpr[high] & ~0x80000000u : funct == 0x07 ? state->fpr[high] ^ 0x80000000u
+                                                                                       : state->fpr[high];
+        if (fmt == FMT_D) {
+            state->fpr[fd & ~1u] = state->fpr[fs & ~1u];
+            state->fpr[(fd & ~1u) + 1] = sign;
+        } else {
+            state->fpr[fd] = sign;
+        }
+        return 1;
+    }
+
+    double a, b;
+    if (fmt == FMT_S) {
+        a = arithGetSingle(state, fs);
+        b = arithGetSingle(state, ft);
+    } else if (fmt == FMT_D) {
+        a = arithGetDouble(state, fs);
+        b = arithGetDouble(state, ft);
+    } else {
+        a = (int32_t)state->fpr[fs];
+        b = 0;
+    }
+    if (funct >= 0x30) { // c.cond.fmt: bit 0 unordered, bit 1 equal, bit 2 less than
+        int unordered = a != a || b != b;
+        int result = ((funct & 0x1) && unordered) || ((funct & 0x2) && a == b) || ((funct & 0x4) && a < b);
+        arithSetCondition(state, fd >> 2, result);
+        return 1;
+    }
+
+    double result;
+    int word_mode = -1;
+    switch (funct) {
+        case 0x00: result = a + b; break;
+        case 0x01: result = a - b; break;
+        case 0x02: result = a * b; break;
+        case 0x03: result = a / b; break;
+        case 0x04: result = arithSqrt(a); break;
+        case 0x0C: word_mode = 0; break; // round.w
+        case 0x0D: word_mode = 1; break; // trunc.w
+        case 0x0E: word_mode = 2; break; // ceil.w
+        case 0x0F: word_mode = 3; break; // floor.w
+        case 0x24: word_mode = state->fcsr & FCSR_RM_MASK; break; // cvt.w
+        case 0x20: // cvt.s
+            arithSetSingle(state, fd, (float)a);
+            return 1;
+        case 0x21: // cvt.d
+            arithSetDouble(state, fd, a);
+            return 1;
+        default:
+            return 0;
+    }
+    if (word_mode >= 0) {
+        state->fpr[fd] = arithToWord(a, word_mode);
+    } else if (fmt == FMT_S) {
+        arithSetSingle(state, fd, (float)result); // Double carries enough bits that rounding twice is exact
+    } else if (fmt == FMT_D) {
+        arithSetDouble(state, fd, result);
+    } else {
+        return 0; // Arithmetic on fmt W does not exist
+    }
+    return 1;
+}
+
+// Functional unit of a COP1 instruction; UNIT_NONE for moves and branches. isa.h has the rest.
+static inline ArithUnit arithUnit(uint32_t instruction) {
+    uint32_t opcode = instruction >> 26;
+    uint32_t funct = instruction & 0x3F;
+    uint32_t fmt = (instruction >> 21) & 0x1F;
+    if (opcode != 0x11 || (fmt != FMT_S && fmt != FMT_D && fmt != FMT_W)) {
+        return UNIT_NONE;
+    }
+    return funct == 0x02 ? UNIT_FP_MUL : funct == 0x03 || funct == 0x04 ? UNIT_FP_DIV : UNIT_FP_ADD;
+}
+
+static inline uint32_t arithRegisterMask(uint32_t reg, int is_double) {
+    return is_double ? 3u << (reg & ~1u) : 1u << reg;
+}
+
+static inline ArithOperands arithOperands(uint32_t instruction) {
+    ArithOperands operands = { 0, 0, 0, 0 };
+    uint32_t opcode = instruction >> 26;
+    uint32_t fmt = (instruction >> 21) & 0x1F;
+    uint32_t ft = (instruction >> 16) & 0x1F;
+    uint32_t fs = (instruction >> 11) & 0x1F;
+    uint32_t fd = (instruction >> 6) & 0x1F;
+    uint32_t funct = instruction & 0x3F;
+
+    switch (opcode) {
+        case 0x00:
+            if (funct == 0x10 || funct == 0x12) { // mfhi, mflo
+                operands.flags = ARITH_READ_HILO;
+            } else if (funct == 0x11 || funct == 0x13 || (funct >= 0x18 && funct <= 0x1B)) {
+                operands.flags = ARITH_WRITE_HILO;
+            }
+            break;
+        case 0x1C:
+            if (funct == 0x02) {
+                operands.gpr_write = fs; // rd
+            }
+            break;
+        case 0x31: operands.fp_write = arithRegisterMask(ft, 0); break; // lwc1
+        case 0x35: operands.fp_write = arithRegisterMask(ft, 1); break; // ldc1
+        case 0x39: operands.fp_read = arithRegisterMask(ft, 0); break; // swc1
+        case 0x3D: operands.fp_read = arithRegisterMask(ft, 1); break; // sdc1
+        case 0x11:
+            if (fmt == COP1_MF) {
+                operands.fp_read = arithRegisterMask(fs, 0);
+            } else if (fmt == COP1_MT) {
+                operands.fp_write = arithRegisterMask(fs, 0);
+            } else if (fmt == COP1_CF || fmt == COP1_BC) {
+                operands.flags = ARITH_READ_FCSR;
+            } else if (fmt == COP1_CT) {
+                operands.flags = ARITH_WRITE_FCSR;
+            } else if (fmt == FMT_S || fmt == FMT_D || fmt == FMT_W) {
+                int is_double = fmt == FMT_D;
+                int unary = funct >= 0x04 && funct < 0x30;
+                operands.fp_read = arithRegisterMask(fs, is_double) | (unary ? 0 : arithRegisterMask(ft, is_double));
+                if (funct >= 0x30) {
+                    operands.flags = ARITH_WRITE_FCSR;
+                } else {
+                    int result_double = funct == 0x21 || (is_double && funct < 0x0C);
+                    operands.fp_write = arithRegisterMask(fd, result_double);
+                }
+            }
+            break;
+    }
+    return operands;
+}
+
+// Text of a COP1 instruction; returns 0 for anything else. isa.h disassembles the rest.
+static inline int arithDisassemble(uint32_t instruction, char* text, size_t size) {
+    static const char* fp_names[64] = {
+        [0x00] = "add", [0x01] = "sub", [0x02] = "mul", [0x03] = "div", [0x04] = "sqrt", [0x05] = "abs",
+        [0x06] = "mov", [0x07] = "neg", [0x0C] = "round.w", [0x0D] = "trunc.w", [0x0E] = "ceil.w",
+        [0x0F] = "floor.w", [0x20] = "cvt.s", [0x21] = "cvt.d", [0x24] = "cvt.w", [0x30] = "c.f", [0x31] = "c.un",
+        [0x32] = "c.eq", [0x33] = "c.ueq", [0x34] = "c.olt", [0x35] = "c.ult", [0x36] = "c.ole", [0x37] = "c.ule",
+        [0x38] = "c.sf", [0x39] = "c.ngle", [0x3A] = "c.seq", [0x3B] = "c.ngl", [0x3C] = "c.lt", [0x3D] = "c.nge",
+        [0x3E] = "c.le", [0x3F] = "c.ngt",
+    };
+    uint32_t opcode = instruction >> 26;
+    uint32_t rs = (instruction >> 21) & 0x1F;
+    uint32_t rt = (instruction >> 16) & 0x1F;
+    uint32_t rd = (instruction >> 11) & 0x1F;
+    uint32_t fd = (instruction >> 6) & 0x1F;
+    uint32_t funct = instruction & 0x3F;
+    int16_t immediate = instruction & 0xFFFF;
+
+    if (opcode != 0x11) {
+        return 0;
+    } else if (rs == COP1_MF || rs == COP1_CF || rs == COP1_MT || rs == COP1_CT) {
+        const char* name = rs == COP1_MF ? "mfc1" : rs == COP1_CF ? "cfc1" : rs == COP1_MT ? "mtc1" : "ctc1";
+        snprintf(text, size, "%s $%d, $%s%d", name, rt, rs == COP1_CF || rs == COP1_CT ? "" : "f", rd);
+    } else if (rs == COP1_BC) {
+        snprintf(text, size, "bc1%c %d, %d", rt & 1 ? 't' : 'f', rt >> 2, immediate);
+    } else if ((rs == FMT_S || rs == FMT_D || rs == FMT_W) && fp_names[funct] != NULL) {
+        char format = rs == FMT_S ? 's' : rs == FMT_D ? 'd' : 'w';
+        if (funct >= 0x30) {
+            snprintf(text, size, "%s.%c %d, $f%d, $f%d", fp_names[funct], format, fd >> 2, rd, rt);
+        } else if (funct >= 0x04) {
+            snprintf(text, size, "%s.%c $f%d, $f%d", fp_names[funct], format, fd, rd);
+        } else {
+            snprintf(text, size, "%s.%c $f%d, $f%d, $f%d", fp_names[funct], format, fd, rd, rt);
+        }
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+#endif
@@ -0,0 +1,556 @@
+// Guest code profiler shared by the simulators. Every retired guest instruction is charged to its PC,
+// its basic block and the call path rebuilt from JAL/JALR (push) and JR $ra (pop). Results are
+// collapsed stacks for flamegraph.pl (one file per metric) and per-function and per-block hot lists.
+// Function names come from the symbol table of an ELF image linked at the address the raw binary is
+// loaded at; without one, functions are named by their entry address.
+#ifndef GUESTPROF_H
+#define GUESTPROF_H
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define GUESTPROF_PCS 8192 // Distinct PCs tracked; more are counted in the overflow entry
+#define GUESTPROF_BLOCKS 4096 // Distinct basic blocks tracked
+#define GUESTPROF_NODES 4096 // Call tree nodes (distinct call paths)
+#define GUESTPROF_DEPTH 256 // Call stack frames kept; deeper calls are charged to the deepest kept frame
+#define GUESTPROF_HOT_COUNT 10 // Entries in each hot list
+#define GUESTPROF_MAX_SYMBOLS 4096
+#define GUESTPROF_SYMBOL_SIZE 64
+
+typedef enum { GP_INSTRUCTIONS, GP_CYCLES, GP_MISSES, GP_MISPREDICTS, GP_METRIC_COUNT } GuestMetric;
+#define GP_METRIC(metric) (1u << (metric))
+
+typedef struct {
+    uint64_t value[GP_METRIC_COUNT];
+} GuestCounts;
+
+typedef struct {
+    uint32_t pc;
+    int used;
+    GuestCounts counts;
+} GuestPc;
+
+typedef struct {
+    uint32_t start, end; // First and last instruction seen
+    uint32_t function; // Entry of the function the block was first seen in
+    int used;
+    uint64_t executions;
+    GuestCounts counts;
+} GuestBlock;
+
+// Call tree node: one distinct call path; node 0 is the entry function
+typedef struct {
+    uint32_t function;
+    int parent;
+    GuestCounts self;
+} GuestNode;
+
+typedef struct {
+    uint32_t return_address;
+    int node;
+} GuestFrame;
+
+typedef struct {
+    unsigned metrics; // GP_METRIC bits the simulator supplies
+    GuestPc pcs[GUESTPROF_PCS];
+    GuestCounts pc_overflow;
+    GuestBlock blocks[GUESTPROF_BLOCKS];
+    GuestCounts block_overflow;
+    GuestNode nodes[GUESTPROF_NODES];
+    int node_count;
+    int children[2 * GUESTPROF_NODES]; // Hash of (parent, function) to node index + 1
+    GuestFrame stack[GUESTPROF_DEPTH];
+    int depth; // Frames in stack; frame 0 is the entry function
+    int lost_frames; // Calls beyond GUESTPROF_DEPTH still to be returned from
+    int block; // Block of the last retired instruction, -1 before the first one
+    uint32_t last_pc;
+    int block_ended; // Last instruction transferred control
+} GuestProfile;
+
+typedef struct {
+    uint32_t address, size;
+    char name[GUESTPROF_SYMBOL_SIZE];
+} GuestSymbol;
+
+static GuestSymbol guestprof_symbols[GUESTPROF_MAX_SYMBOLS];
+static int guestprof_symbol_count = 0;
+static const char* const guestprof_metric_names[GP_METRIC_COUNT] = { "instructions", "cycles", "misses", "mispredicts" };
+static const char* const guestprof_metric_labels[GP_METRIC_COUNT] = { "insts", "cycles", "misses", "mispred" };
+
+static inline GuestProfile* guestprofCreate(unsigned metrics) {
+    GuestProfile* profile = calloc(1, sizeof(GuestProfile));
+    if (profile == NULL) {
+        perror("Error allocating guest profile");
+        exit(1);
+    }
+    profile->metrics = metrics | GP_METRIC(GP_INSTRUCTIONS);
+    profile->block = -1;
+    return profile;
+}
+
+static inline uint32_t guestprofHash(uint32_t key) {
+    key ^= key >> 16;
+    key *= 0x7FEB352D;
+    key ^= key >> 15;
+    return key;
+}
+
+static inline void guestprofAdd(GuestCounts* counts, const GuestCounts* delta) {
+    for (int m = 0; m < GP_METRIC_COUNT; ++m) {
+        counts->value[m] += delta->value[m];
+    }
+}
+
+static inline GuestCounts* guestprofPcCounts(GuestProfile* profile, uint32_t pc) {
+    uint32_t index = guestprofHash(pc) % GUESTPROF_PCS;
+    for (int probe = 0; probe < GUESTPROF_PCS; ++probe) {
+        GuestPc* entry = &profile->pcs[(index + probe) % GUESTPROF_PCS];
+        if (!entry->used) {
+            entry->used = 1;
+            entry->pc = pc;
+        }
+        if (entry->pc == pc) {
+            return &entry->counts;
+        }
+    }
+    return &profile->pc_overflow;
+}
+
+// Index of the block starting at start, -1 once the table is full
+static inline int guestprofBlock(GuestProfile* profile, uint32_t start, uint32_t function) {
+    uint32_t index = guestprofHash(start) % GUESTPROF_BLOCKS;
+    for (int probe = 0; probe < GUESTPROF_BLOCKS; ++probe) {
+        int slot = (index + probe) % GUESTPROF_BLOCKS;
+        GuestBlock* block = &profile->blocks[slot];
+        if (!block->used) {
+            block->used = 1;
+            block->start = block->end = start;
+            block->function = function;
+        }
+        if (block->start == start) {
+            return slot;
+        }
+    }
+    return -1;
+}
+
+// Child of parent for a call to function; the parent itself once the tree is full
+static inline int guestprofChild(GuestProfile* profile, int parent, uint32_t function) {
+    uint32_t index = guestprofHash(function ^ guestprofHash(parent)) % (2 * GUESTPROF_NODES);
+    for (int probe = 0; probe < 2 * GUESTPROF_NODES; ++probe) {
+        int* slot = &profile->children[(index + probe) % (2 * GUESTPROF_NODES)];
+        if (*slot == 0) {
+            if (profile->node_count == GUESTPROF_NODES) {
+                return parent;
+            }
+            GuestNode* node = &profile->nodes[profile->node_count];
+            node->function = function;
+            node->parent = parent;
+            *slot = ++profile->node_count;
+            return *slot - 1;
+        }
+        GuestNode* node = &profile->nodes[*slot - 1];
+        if (node->parent == parent && node->function == function) {
+            return *slot - 1;
+        }
+    }
+    return parent;
+}
+
+static inline void guestprofCall(GuestProfile* profile, uint32_t target, uint32_t return_address) {
+    if (profile->depth == GUESTPROF_DEPTH) {
+        profile->lost_frames++;
+        return;
+    }
+    int node = guestprofChild(profile, profile->stack[profile->depth - 1].node, target);
+    profile->stack[profile->depth++] = (GuestFrame){ return_address, node };
+}
+
+// Pops to the frame the target returns from; a return that matches no frame pops one
+static inline void guestprofReturn(GuestProfile* profile, uint32_t target) {
+    if (profile->lost_frames > 0) {
+        profile->lost_frames--;
+        return;
+    }
+    for (int i = profile->depth - 1; i > 0; --i) {
+        if (profile->stack[i].return_address == target) {
+            profile->depth = i;
+            return;
+        }
+    }
+    if (profile->depth > 1) {
+        profile->depth--;
+    }
+}
+
+// Charges one retired instruction and the cycles, misses and mispredicts it caused, then follows the
+// control transfer it made. next_pc is the PC after the instruction and is only used for JR and JALR.
+static inline void guestprofRetire(GuestProfile* profile, uint32_t pc, uint32_t instruction, uint32_t next_pc,
+                                   uint64_t cycles, uint64_t misses, uint64_t mispredicts) {
+    if (profile->depth == 0) {
+        profile->nodes[0].function = pc; // Entry function
+        profile->node_count = 1;
+        profile->stack[0] = (GuestFrame){ 0xFFFFFFFF, 0 };
+        profile->depth = 1;
+    }
+    GuestCounts delta = { { 1, cycles, misses, mispredicts } };
+    GuestFrame* frame = &profile->stack[profile->depth - 1];
+    guestprofAdd(&profile->nodes[frame->node].self, &delta);
+    guestprofAdd(guestprofPcCounts(profile, pc), &delta);
+
+    if (profile->block < 0 || profile->block_ended || pc != profile->last_pc + 4) {
+        profile->block = guestprofBlock(profile, pc, profile->nodes[frame->node].function);
+        if (profile->block >= 0) {
+            profile->blocks[profile->block].executions++;
+        }
+    }
+    if (profile->block >= 0) {
+        GuestBlock* block = &profile->blocks[profile->block];
+        guestprofAdd(&block->counts, &delta);
+        if (pc > block->end) {
+            block->end = pc;
+        }
+    } else {
+        guestprofAdd(&profile->block_overflow, &delta);
+    }
+    profile->last_pc = pc;
+
+    uint32_t opcode = instruction >> 26;
+    uint32_t funct = instruction & 0x3F;
+    uint32_t rs = (instruction >> 21) & 0x1F;
+    if (opcode == 0x03) { // JAL
+        guestprofCall(profile, ((pc + 4) & 0xF0000000) | ((instruction & 0x3FFFFFF) << 2), pc + 4);
+    } else if (opcode == 0x00 && funct == 0x09) { // JALR
+        guestprofCall(profile, next_pc, pc + 4);
+    } else if (opcode == 0x00 && funct == 0x08 && rs == 31) { // JR $ra
+        guestprofReturn(profile, next_pc);
+    }
+    profile->block_ended = opcode == 0x01 || (opcode >= 0x02 && opcode <= 0x07) || (opcode >= 0x14 && opcode <= 0x17) ||
+                           (opcode == 0x00 && (funct == 0x08 || funct == 0x09 || funct == 0x0C));
+}
+
+static inline uint32_t guestprofRead(const uint8_t* data, int big_endian, int size) {
+    uint32_t value = 0;
+    for (int i = 0; i < size; ++i) {
+        value |= (uint32_t)data[big_endian ? i : size - 1 - i] << (8 * (size - 1 - i));
+    }
+    return value;
+}
+
+static inline int guestprofCompareSymbols(const void* a, const void* b) {
+    uint32_t x = ((const GuestSymbol*)a)->address, y = ((const GuestSymbol*)b)->address;
+    return x < y ? -1 : x > y;
+}
+
+// Functions and code labels of a 32-bit ELF file (either byte order); returns the number loaded
+static inline int guestprofLoadSymbols(const char* filename) {
+    FILE* file = fopen(filename, "rb");
+    if (file == NULL) {
+        perror("Error opening symbol file");
+        exit(1);
+    }
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    uint8_t* image = malloc(length);
+    if (image == NULL || fread(image, 1, length, file) != (size_t)length || length < 52 ||
+        memcmp(image, "\177ELF", 4) != 0 || image[4] != 1) {
+        fprintf(stderr, "%s is not a 32-bit ELF file\n", filename);
+        exit(1);
+    }
+    fclose(file);
+    int be = image[5] == 2;
+    uint32_t shoff = guestprofRead(image + 32, be, 4);
+    uint32_t shentsize = guestprofRead(image + 46, be, 2);
+    uint32_t shnum = guestprofRead(image + 48, be, 2);
+    if (shoff + (uint64_t)shnum * shentsize > (uint64_t)length) {
+        fprintf(stderr, "%s: section headers out of range\n", filename);
+        exit(1);
+    }
+    for (uint32_t s = 0; s < shnum; ++s) {
+        const uint8_t* section = image + shoff + s * shentsize;
+        if (guestprofRead(section + 4, be, 4) != 2) { // SHT_SYMTAB
+            continue;
+        }
+        uint32_t offset = guestprofRead(section + 16, be, 4);
+        uint32_t size = guestprofRead(section + 20, be, 4);
+        uint32_t link = guestprofRead(section + 24, be, 4);
+        if (link >= shnum) {
+            continue;
+        }
+        const uint8_t* strtab_header = image + shoff + link * shentsize;
+        const char* strtab = (const char*)image + guestprofRead(strtab_header + 16, be, 4);
+        for (uint32_t entry = offset; entry + 16 <= offset + size && entry + 16 <= (uint32_t)length; entry += 16) {
+            const uint8_t* symbol = image + entry;
+            uint32_t type = symbol[12] & 0xF, binding = symbol[12] >> 4;
+            uint32_t index = guestprofRead(symbol + 14, be, 2);
+            if (!(type == 2 || (type == 0 && binding != 0)) || index == 0 || index >= shnum) {
+                continue; // Functions and global labels in a section; local labels are loop heads and the like
+            }
+            const uint8_t* target = image + shoff + index * shentsize;
+            const char* name = strtab + guestprofRead(symbol, be, 4);
+            if (!(guestprofRead(target + 8, be, 4) & 0x4) || name[0] == '\0' || name[0] == '$' ||
+                guestprof_symbol_count == GUESTPROF_MAX_SYMBOLS) { // Executable sections only
+                continue;
+            }
+            GuestSymbol* out = &guestprof_symbols[guestprof_symbol_count++];
+            out->address = guestprofRead(symbol + 4, be, 4);
+            out->size = guestprofRead(symbol + 8, be, 4);
+            snprintf(out->name, sizeof(out->name), "%s", name);
+        }
+    }
+    free(image);
+    qsort(guestprof_symbols, guestprof_symbol_count, sizeof(GuestSymbol), guestprofCompareSymbols);
+    for (int i = 0; i + 1 < guestprof_symbol_count; ++i) {
+        if (guestprof_symbols[i].size == 0) { // Labels extend to the next symbol
+            guestprof_symbols[i].size = guestprof_symbols[i + 1].address - guestprof_symbols[i].address;
+        }
+    }
+    return guestprof_symbol_count;
+}
+
+// Symbol containing address, or the address itself
+static inline const char* guestprofName(uint32_t address, char* buffer, size_t size) {
+    int low = 0, high = guestprof_symbol_count - 1, found = -1;
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        if (guestprof_symbols[mid].address <= address) {
+            found = mid;
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+    if (found >= 0 && address - guestprof_symbols[found].address < (guestprof_symbols[found].size ? guestprof_symbols[found].size : 1)) {
+        if (address == guestprof_symbols[found].address) {
+            return guestprof_symbols[found].name;
+        }
+        snprintf(buffer, size, "%s+0x%x", guestprof_symbols[found].name, address - guestprof_symbols[found].address);
+        return buffer;
+    }
+    snprintf(buffer, size, "0x%08x", address);
+    return buffer;
+}
+
+// Metric the hot lists are sorted by: cycles when the simulator counts them
+static inline GuestMetric guestprofSortMetric(unsigned metrics) {
+    return metrics & GP_METRIC(GP_CYCLES) ? GP_CYCLES : GP_INSTRUCTIONS;
+}
+
+static inline FILE* guestprofOpen(const char* prefix, const char* suffix) {
+    char filename[512];
+    snprintf(filename, sizeof(filename), "%s.%s", prefix, suffix);
+    FILE* file = fopen(filename, "w");
+    if (file == NULL) {
+        perror("Error opening guest profile output");
+        exit(1);
+    }
+    return file;
+}
+
+// One collapsed-stack file per metric, prefix.<metric>.folded, where several profiles get a "coreN" root
+// frame, and every PC in prefix.pcs.csv
+static inline void guestprofWrite(GuestProfile** profiles, int count, const char* prefix) {
+    for (int m = 0; m < GP_METRIC_COUNT; ++m) {
+        if (!(profiles[0]->metrics & GP_METRIC(m))) {
+            continue;
+        }
+        char suffix[64];
+        snprintf(suffix, sizeof(suffix), "%s.folded", guestprof_metric_names[m]);
+        FILE* file = guestprofOpen(prefix, suffix);
+        for (int p = 0; p < count; ++p) {
+            GuestProfile* profile = profiles[p];
+            for (int n = 0; n < profile->node_count; ++n) {
+                if (profile->nodes[n].self.value[m] == 0) {
+                    continue;
+                }
+                int path[GUESTPROF_DEPTH];
+                int depth = 0;
+                for (int node = n; depth < GUESTPROF_DEPTH; node = profile->nodes[node].parent) {
+                    path[depth++] = node;
+                    if (node == 0) {
+                        break;
+                    }
+                }
+                if (count > 1) {
+                    fprintf(file, "core%d;", p);
+                }
+                for (int i = depth - 1; i >= 0; --i) {
+                    char buffer[GUESTPROF_SYMBOL_SIZE + 16];
+                    fprintf(file, "%s%c", guestprofName(profile->nodes[path[i]].function, buffer, sizeof(buffer)),
+                            i > 0 ? ';' : ' ');
+                }
+                fprintf(file, "%" PRIu64 "\n", profile->nodes[n].self.value[m]);
+            }
+        }
+        fclose(file);
+    }
+
+    FILE* file = guestprofOpen(prefix, "pcs.csv");
+    fprintf(file, "%spc,symbol", count > 1 ? "core," : "");
+    for (int m = 0; m < GP_METRIC_COUNT; ++m) {
+        if (profiles[0]->metrics & GP_METRIC(m)) {
+            fprintf(file, ",%s", guestprof_metric_names[m]);
+        }
+    }
+    fprintf(file, "\n");
+    for (int p = 0; p < count; ++p) {
+        for (int i = 0; i < GUESTPROF_PCS; ++i) {
+            GuestPc* entry = &profiles[p]->pcs[i];
+            if (!entry->used) {
+                continue;
+            }
+            char buffer[GUESTPROF_SYMBOL_SIZE + 16];
+            if (count > 1) {
+                fprintf(file, "%d,", p);
+            }
+            fprintf(file, "0x%08x,%s", entry->pc, guestprof_symbol_count ? guestprofName(entry->pc, buffer, sizeof(buffer)) : "");
+            for (int m = 0; m < GP_METRIC_COUNT; ++m) {
+                if (profiles[p]->metrics & GP_METRIC(m)) {
+                    fprintf(file, ",%" PRIu64, entry->counts.value[m]);
+                }
+            }
+            fprintf(file, "\n");
+        }
+    }
+    fclose(file);
+}
+
+typedef struct {
+    uint32_t address;
+    GuestCounts self, total;
+    uint64_t executions; // Blocks only
+    uint32_t end, function;
+} GuestHotEntry;
+
+static GuestMetric guestprof_sort_metric;
+
+static inline int guestprofCompareHot(const void* a, const void* b) {
+    uint64_t x = ((const GuestHotEntry*)a)->self.value[guestprof_sort_metric];
+    uint64_t y = ((const GuestHotEntry*)b)->self.value[guestprof_sort_metric];
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static inline GuestHotEntry* guestprofHotEntry(GuestHotEntry* entries, int* count, int capacity, uint32_t address) {
+    for (int i = 0; i < *count; ++i) {
+        if (entries[i].address == address) {
+            return &entries[i];
+        }
+    }
+    if (*count == capacity) {
+        return NULL;
+    }
+    GuestHotEntry* entry = &entries[(*count)++];
+    memset(entry, 0, sizeof(*entry));
+    entry->address = address;
+    return entry;
+}
+
+static inline void guestprofPrintCounts(FILE* file, unsigned metrics, const GuestCounts* counts) {
+    for (int m = 0; m < GP_METRIC_COUNT; ++m) {
+        if (metrics & GP_METRIC(m)) {
+            fprintf(file, " %12" PRIu64, counts->value[m]);
+        }
+    }
+}
+
+static inline void guestprofPrintHeader(FILE* file, unsigned metrics, const char* suffix) {
+    for (int m = 0; m < GP_METRIC_COUNT; ++m) {
+        if (metrics & GP_METRIC(m)) {
+            char label[32];
+            snprintf(label, sizeof(label), "%s%s", suffix, guestprof_metric_labels[m]);
+            fprintf(file, " %12.12s", label);
+        }
+    }
+}
+
+// Hot functions (self and inclusive, merged over all profiles by entry address) and hot basic blocks
+static inline void guestprofPrint(FILE* file, GuestProfile** profiles, int count) {
+    unsigned metrics = profiles[0]->metrics;
+    guestprof_sort_metric = guestprofSortMetric(metrics);
+    GuestHotEntry* functions = calloc(GUESTPROF_NODES, sizeof(GuestHotEntry));
+    GuestHotEntry* blocks = calloc(GUESTPROF_BLOCKS, sizeof(GuestHotEntry));
+    int function_count = 0, block_count = 0;
+    GuestCounts total = { { 0 } };
+
+    for (int p = 0; p < count; ++p) {
+        GuestProfile* profile = profiles[p];
+        for (int n = 0; n < profile->node_count; ++n) {
+            GuestNode* node = &profile->nodes[n];
+            guestprofAdd(&total, &node->self);
+            GuestHotEntry* entry = guestprofHotEntry(functions, &function_count, GUESTPROF_NODES, node->function);
+            if (entry != NULL) {
+                guestprofAdd(&entry->self, &node->self);
+            }
+            // Inclusive: every distinct function on the path, so recursion is counted once
+            uint32_t seen[GUESTPROF_DEPTH];
+            int seen_count = 0;
+            for (int a = n; seen_count < GUESTPROF_DEPTH; a = profile->nodes[a].parent) {
+                uint32_t function = profile->nodes[a].function;
+                int duplicate = 0;
+                for (int i = 0; i < seen_count; ++i) {
+                    duplicate |= seen[i] == function;
+                }
+                if (!duplicate) {
+                    seen[seen_count++] = function;
+                    GuestHotEntry* outer = guestprofHotEntry(functions, &function_count, GUESTPROF_NODES, function);
+                    if (outer != NULL) {
+                        guestprofAdd(&outer->total, &node->self);
+                    }
+                }
+                if (a == 0) {
+                    break;
+                }
+            }
+        }
+        for (int b = 0; b < GUESTPROF_BLOCKS; ++b) {
+            GuestBlock* block = &profile->blocks[b];
+            if (!block->used) {
+                continue;
+            }
+            GuestHotEntry* entry = guestprofHotEntry(blocks, &block_count, GUESTPROF_BLOCKS, block->start);
+            if (entry != NULL) {
+                guestprofAdd(&entry->self, &block->counts);
+                entry->executions += block->executions;
+                entry->end = block->end > entry->end ? block->end : entry->end;
+                entry->function = block->function;
+            }
+        }
+    }
+    qsort(functions, function_count, sizeof(GuestHotEntry), guestprofCompareHot);
+    qsort(blocks, block_count, sizeof(GuestHotEntry), guestprofCompareHot);
+
+    fprintf(file, "\n*********** Guest profile ************\n");
+    fprintf(file, "Total:");
+    guestprofPrintCounts(file, metrics, &total);
+    fprintf(file, " (%s)\n", guestprof_symbol_count ? "ELF symbols" : "no symbols, functions named by entry address");
+    fprintf(file, "Hot functions by self %s:\n%-32s", guestprof_metric_names[guestprof_sort_metric], "Function");
+    guestprofPrintHeader(file, metrics, "");
+    guestprofPrintHeader(file, metrics, "incl ");
+    fprintf(file, "\n");
+    for (int i = 0; i < function_count && i < GUESTPROF_HOT_COUNT; ++i) {
+        char buffer[GUESTPROF_SYMBOL_SIZE + 16];
+        fprintf(file, "%-32s", guestprofName(functions[i].address, buffer, sizeof(buffer)));
+        guestprofPrintCounts(file, metrics, &functions[i].self);
+        guestprofPrintCounts(file, metrics, &functions[i].total);
+        fprintf(file, "\n");
+    }
+    fprintf(file, "Hot basic blocks by %s:\n%-19s %-24s %10s", guestprof_metric_names[guestprof_sort_metric], "Block",
+            "Function", "Executed");
+    guestprofPrintHeader(file, metrics, "");
+    fprintf(file, "\n");
+    for (int i = 0; i < block_count && i < GUESTPROF_HOT_COUNT; ++i) {
+        char buffer[GUESTPROF_SYMBOL_SIZE + 16];
+        fprintf(file, "%08X-%08X  %-24s %10" PRIu64, blocks[i].address, blocks[i].end,
+                guestprofName(blocks[i].function, buffer, sizeof(buffer)), blocks[i].executions);
+        guestprofPrintCounts(file, metrics, &blocks[i].self);
+        fprintf(file, "\n");
+    }
+    free(functions);
+    free(blocks);
+}
+
+#endif
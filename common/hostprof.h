@@ -0,0 +1,291 @@
+// Host-side self-profiling of the simulators: rdtsc scoped timers per named region and per guest
+// opcode, optionally with Linux perf_event counters. Build with -DHOST_PROFILE to enable; without it
+// every PROF_* macro expands to nothing and this header declares nothing else.
+//
+// Each simulator lists its regions in an enum plus a name table and calls PROF_INIT once. A region is
+// timed from PROF_SCOPE to the end of the enclosing block (GCC/Clang cleanup attribute), so early
+// returns are covered. The outermost scope of a thread is one simulated step; its time goes to the
+// opcode named by PROF_OPCODE inside it.
+#ifndef HOSTPROF_H
+#define HOSTPROF_H
+
+#ifdef HOST_PROFILE
+
+#include <inttypes.h>
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define HOSTPROF_MAX_REGIONS 32
+#define HOSTPROF_OPCODES 64 // Primary opcode field
+#define HOSTPROF_PERF_EVENTS 4
+
+typedef struct {
+    uint64_t calls;
+    uint64_t cycles; // Inclusive
+    uint64_t self_cycles; // Minus nested regions
+    uint64_t perf[HOSTPROF_PERF_EVENTS]; // Inclusive
+} HostProfRegion;
+
+typedef struct {
+    uint64_t count;
+    uint64_t cycles;
+} HostProfOpcode;
+
+typedef struct HostProfScope {
+    int region;
+    uint64_t start;
+    uint64_t child_cycles;
+    uint64_t perf_start[HOSTPROF_PERF_EVENTS];
+    struct HostProfScope* parent;
+} HostProfScope;
+
+// Per host thread, merged into the totals when the thread finishes
+typedef struct {
+    HostProfRegion regions[HOSTPROF_MAX_REGIONS];
+    HostProfOpcode opcodes[HOSTPROF_OPCODES];
+    HostProfScope* current;
+    int opcode; // Opcode of the step in progress, -1 if none
+    int perf_fd; // Group leader, -1 without perf counters
+    int perf_opened;
+} HostProfThread;
+
+static const char* const* hostprof_names = NULL;
+static int hostprof_region_count = 0;
+static int hostprof_use_perf = 0;
+static HostProfRegion hostprof_regions[HOSTPROF_MAX_REGIONS];
+static HostProfOpcode hostprof_opcodes[HOSTPROF_OPCODES];
+static int hostprof_threads = 0; // Threads merged so far
+static pthread_mutex_t hostprof_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t hostprof_start_cycles, hostprof_start_ns;
+static __thread HostProfThread hostprof_thread = { .opcode = -1, .perf_fd = -1 };
+static const char* const hostprof_perf_names[HOSTPROF_PERF_EVENTS] = { "cycles", "instr", "llc_miss", "br_miss" };
+
+static inline uint64_t hostprofNanoseconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+// Falls back to nanoseconds where there is no time stamp counter
+static inline uint64_t hostprofCycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return hostprofNanoseconds();
+#endif
+}
+
+// cycles, instructions, last-level cache misses and branch misses of this thread, user space only
+static inline void hostprofOpenPerf(HostProfThread* thread) {
+    static const uint64_t configs[HOSTPROF_PERF_EVENTS] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+    };
+    thread->perf_opened = 1;
+    for (int i = 0; i < HOSTPROF_PERF_EVENTS; ++i) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = configs[i];
+        attr.read_format = PERF_FORMAT_GROUP;
+        attr.disabled = i == 0;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        int fd = syscall(SYS_perf_event_open, &attr, 0, -1, i == 0 ? -1 : thread->perf_fd, 0);
+        if (fd < 0) {
+            if (thread->perf_fd >= 0) {
+                close(thread->perf_fd); // Members go with the leader
+                thread->perf_fd = -1;
+            }
+            if (__atomic_exchange_n(&hostprof_use_perf, 0, __ATOMIC_RELAXED)) { // Other threads stop trying
+                fprintf(stderr, "perf_event_open failed, host profile continues without perf counters\n");
+            }
+            return;
+        }
+        if (i == 0) {
+            thread->perf_fd = fd;
+        }
+    }
+    ioctl(thread->perf_fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(thread->perf_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+static inline void hostprofReadPerf(HostProfThread* thread, uint64_t* values) {
+    uint64_t buffer[1 + HOSTPROF_PERF_EVENTS];
+    if (thread->perf_fd < 0 || read(thread->perf_fd, buffer, sizeof(buffer)) != (ssize_t)sizeof(buffer)) {
+        memset(values, 0, HOSTPROF_PERF_EVENTS * sizeof(uint64_t));
+        return;
+    }
+    memcpy(values, buffer + 1, HOSTPROF_PERF_EVENTS * sizeof(uint64_t));
+}
+
+static inline void hostprofInit(const char* const* names, int count, int use_perf) {
+    hostprof_names = names;
+    hostprof_region_count = count < HOSTPROF_MAX_REGIONS ? count : HOSTPROF_MAX_REGIONS;
+    hostprof_use_perf = use_perf;
+    hostprof_start_ns = hostprofNanoseconds();
+    hostprof_start_cycles = hostprofCycles();
+}
+
+static inline HostProfScope hostprofEnter(int region) {
+    HostProfThread* thread = &hostprof_thread;
+    HostProfScope scope;
+    scope.region = region;
+    scope.child_cycles = 0;
+    scope.parent = thread->current;
+    if (hostprof_use_perf) {
+        if (!thread->perf_opened) {
+            hostprofOpenPerf(thread);
+        }
+        hostprofReadPerf(thread, scope.perf_start);
+    }
+    scope.start = hostprofCycles();
+    return scope;
+}
+
+// Cleanup handler of PROF_SCOPE; the scope variable lives on the caller's stack
+static inline void hostprofLeave(HostProfScope* scope) {
+    uint64_t elapsed = hostprofCycles() - scope->start;
+    HostProfThread* thread = &hostprof_thread;
+    HostProfRegion* region = &thread->regions[scope->region];
+    region->calls++;
+    region->cycles += elapsed;
+    region->self_cycles += elapsed - scope->child_cycles;
+    if (hostprof_use_perf && thread->perf_fd >= 0) {
+        uint64_t perf[HOSTPROF_PERF_EVENTS];
+        hostprofReadPerf(thread, perf);
+        for (int i = 0; i < HOSTPROF_PERF_EVENTS; ++i) {
+            region->perf[i] += perf[i] - scope->perf_start[i];
+        }
+    }
+    if (scope->parent != NULL) {
+        scope->parent->child_cycles += elapsed;
+    } else if (thread->opcode >= 0) {
+        thread->opcodes[thread->opcode].count++;
+        thread->opcodes[thread->opcode].cycles += elapsed;
+        thread->opcode = -1;
+    }
+    thread->current = scope->parent;
+}
+
+// The scope has to be linked after it reached its final address, so this runs right after the declaration
+static inline void hostprofLink(HostProfScope* scope) {
+    hostprof_thread.current = scope;
+}
+
+static inline void hostprofOpcode(uint32_t opcode) {
+    hostprof_thread.opcode = opcode & (HOSTPROF_OPCODES - 1);
+}
+
+// Adds this thread's counts to the totals; every thread that ran scopes calls it before it exits
+static inline void hostprofThreadExit() {
+    HostProfThread* thread = &hostprof_thread;
+    int ran = 0;
+    pthread_mutex_lock(&hostprof_lock);
+    for (int r = 0; r < hostprof_region_count; ++r) {
+        ran |= thread->regions[r].calls > 0;
+        hostprof_regions[r].calls += thread->regions[r].calls;
+        hostprof_regions[r].cycles += thread->regions[r].cycles;
+        hostprof_regions[r].self_cycles += thread->regions[r].self_cycles;
+        for (int i = 0; i < HOSTPROF_PERF_EVENTS; ++i) {
+            hostprof_regions[r].perf[i] += thread->regions[r].perf[i];
+        }
+    }
+    for (int op = 0; op < HOSTPROF_OPCODES; ++op) {
+        hostprof_opcodes[op].count += thread->opcodes[op].count;
+        hostprof_opcodes[op].cycles += thread->opcodes[op].cycles;
+    }
+    hostprof_threads += ran;
+    pthread_mutex_unlock(&hostprof_lock);
+    memset(thread->regions, 0, sizeof(thread->regions));
+    memset(thread->opcodes, 0, sizeof(thread->opcodes));
+    if (thread->perf_fd >= 0) {
+        close(thread->perf_fd);
+        thread->perf_fd = -1;
+    }
+}
+
+// Wall time and time stamp counter since PROF_INIT give the cycle to nanosecond ratio
+static inline void hostprofReport(FILE* file, uint64_t instructions) {
+    hostprofThreadExit(); // Calling thread
+    uint64_t total_ns = hostprofNanoseconds() - hostprof_start_ns;
+    uint64_t total_cycles = hostprofCycles() - hostprof_start_cycles;
+    double ns_per_cycle = total_cycles ? (double)total_ns / total_cycles : 0.0;
+    double per_instruction = instructions ? 1.0 / instructions : 0.0;
+
+    fprintf(file, "\n*********** Host profile ************\n");
+    fprintf(file, "Host time: %.3f ms, %" PRIu64 " host cycles (%.3f GHz), %" PRIu64 " simulated instructions\n",
+            total_ns / 1e6, total_cycles, ns_per_cycle > 0 ? 1.0 / ns_per_cycle : 0.0, instructions);
+    fprintf(file, "Per simulated instruction: %.1f host ns, %.1f host cycles\n", total_ns * per_instruction,
+            total_cycles * per_instruction);
+    fprintf(file, "%-16s %12s %16s %16s %7s %12s %12s", "Region", "Calls", "Cycles", "Self cycles", "Self%",
+            "Cycles/inst", "ns/inst");
+    if (hostprof_use_perf) {
+        for (int i = 0; i < HOSTPROF_PERF_EVENTS; ++i) {
+            fprintf(file, " %14s", hostprof_perf_names[i]);
+        }
+    }
+    fprintf(file, "\n");
+    for (int r = 0; r < hostprof_region_count; ++r) {
+        HostProfRegion* region = &hostprof_regions[r];
+        if (region->calls == 0) {
+            continue;
+        }
+        fprintf(file, "%-16s %12" PRIu64 " %16" PRIu64 " %16" PRIu64 " %6.1f%% %12.1f %12.1f", hostprof_names[r],
+                region->calls, region->cycles, region->self_cycles,
+                total_cycles ? 100.0 * region->self_cycles / total_cycles : 0.0, region->cycles * per_instruction,
+                region->cycles * per_instruction * ns_per_cycle);
+        if (hostprof_use_perf) {
+            for (int i = 0; i < HOSTPROF_PERF_EVENTS; ++i) {
+                fprintf(file, " %14" PRIu64, region->perf[i]);
+            }
+        }
+        fprintf(file, "\n");
+    }
+    fprintf(file, "%-8s %12s %16s %12s %12s\n", "Opcode", "Count", "Cycles", "Cycles/inst", "ns/inst");
+    for (int op = 0; op < HOSTPROF_OPCODES; ++op) {
+        HostProfOpcode* opcode = &hostprof_opcodes[op];
+        if (opcode->count == 0) {
+            continue;
+        }
+        double cycles = (double)opcode->cycles / opcode->count;
+        fprintf(file, "0x%02X     %12" PRIu64 " %16" PRIu64 " %12.1f %12.1f\n", op, opcode->count, opcode->cycles,
+                cycles, cycles * ns_per_cycle);
+    }
+    if (hostprof_threads > 1) {
+        fprintf(file, "Region and opcode cycles add up over %d host threads; Self%% is relative to the wall clock\n",
+                hostprof_threads);
+    }
+}
+
+#define PROF_CONCAT_(a, b) a##b
+#define PROF_CONCAT(a, b) PROF_CONCAT_(a, b)
+#define PROF_SCOPE(region)                                                                                            \
+    HostProfScope PROF_CONCAT(prof_scope_, __LINE__) __attribute__((cleanup(hostprofLeave))) = hostprofEnter(region); \
+    hostprofLink(&PROF_CONCAT(prof_scope_, __LINE__))
+#define PROF_OPCODE(opcode) hostprofOpcode(opcode)
+#define PROF_INIT(names, count, use_perf) hostprofInit(names, count, use_perf)
+#define PROF_THREAD_EXIT() hostprofThreadExit()
+#define PROF_REPORT(file, instructions) hostprofReport(file, instructions)
+
+#else
+
+#define PROF_SCOPE(region)
+#define PROF_OPCODE(opcode)
+#define PROF_INIT(names, count, use_perf)
+#define PROF_THREAD_EXIT()
+#define PROF_REPORT(file, instructions)
+
+#endif
+
+#endif
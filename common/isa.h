@@ -0,0 +1,307 @@
+// The instruction set shared by the simulators and the assembler: one row per instruction, from which
+// the dense decode tables, the operand fields, the ALU semantics and the disassembly are generated.
+// Simulators decode once with isaDecode() and dispatch on the instruction class, computing results
+// with isaAluResult(); adding an instruction of an existing class only needs a row here.
+// COP1 arithmetic is further decoded by arith.h.
+#ifndef ISA_H
+#define ISA_H
+
+#include "arith.h"
+
+// X(id, mnemonic, key, syntax, operands, immediate, alu, class, unit, counter, format)
+//   key: primary opcode, funct (SPECIAL, SPECIAL2) or rs field (COP1)
+//   operands: registers read and written; immediate: how the 16/26-bit field is extended
+//   unit: latency class (arith.h); COP1 arithmetic asks arithUnit() for its format and funct
+//   counter: statistic the instruction counts toward; format: R/I/J encoding for the hw2 counters
+#define ISA_PRIMARY_LIST(X) \
+    X(J,     "j",     0x02, JUMP,   ISA_NO_OPERANDS,              TARGET, NONE, JUMP,              NONE,    JUMP,     J) \
+    X(JAL,   "jal",   0x03, JUMP,   ISA_WRITE_RA,                TARGET, NONE, JUMP,              NONE,    JUMP,     J) \
+    X(BEQ,   "beq",   0x04, BRANCH, ISA_READ_RS | ISA_READ_RT,   SIGNED, EQ,   BRANCH,            NONE,    BRANCH,   I) \
+    X(BNE,   "bne",   0x05, BRANCH, ISA_READ_RS | ISA_READ_RT,   SIGNED, NE,   BRANCH,            NONE,    BRANCH,   I) \
+    X(ADDI,  "addi",  0x08, I,      ISA_READ_RS | ISA_WRITE_RT,  SIGNED, ADD,  ALU,               NONE,    REGISTER, I) \
+    X(ADDIU, "addiu", 0x09, I,      ISA_READ_RS | ISA_WRITE_RT,  SIGNED, ADD,  ALU,               NONE,    REGISTER, I) \
+    X(SLTI,  "slti",  0x0A, I,      ISA_READ_RS | ISA_WRITE_RT,  SIGNED, SLT,  ALU,               NONE,    REGISTER, I) \
+    X(SLTIU, "sltiu", 0x0B, I,      ISA_READ_RS | ISA_WRITE_RT,  SIGNED, SLTU, ALU,               NONE,    REGISTER, I) \
+    X(ANDI,  "andi",  0x0C, I,      ISA_READ_RS | ISA_WRITE_RT,  ZERO,   AND,  ALU,               NONE,    REGISTER, I) \
+    X(ORI,   "ori",   0x0D, I,      ISA_READ_RS | ISA_WRITE_RT,  ZERO,   OR,   ALU,               NONE,    REGISTER, I) \
+    X(XORI,  "xori",  0x0E, I,      ISA_READ_RS | ISA_WRITE_RT,  ZERO,   XOR,  ALU,               NONE,    REGISTER, I) \
+    X(LUI,   "lui",   0x0F, LUI,    ISA_WRITE_RT,                ZERO,   LUI,  ALU,               NONE,    REGISTER, I) \
+    X(LW,    "lw",    0x23, MEM,    ISA_READ_RS | ISA_WRITE_RT,  SIGNED, NONE, LOAD,              NONE,    MEMORY,   I) \
+    X(SW,    "sw",    0x2B, MEM,    ISA_READ_RS | ISA_READ_RT,   SIGNED, NONE, STORE,             NONE,    MEMORY,   I) \
+    X(LL,    "ll",    0x30, MEM,    ISA_READ_RS | ISA_WRITE_RT,  SIGNED, NONE, LOAD_LINKED,       NONE,    MEMORY,   I) \
+    X(LWC1,  "lwc1",  0x31, FMEM,   ISA_READ_RS,                 SIGNED, NONE, FP_LOAD,           NONE,    MEMORY,   I) \
+    X(LDC1,  "ldc1",  0x35, FMEM,   ISA_READ_RS | ISA_DOUBLE,    SIGNED, NONE, FP_LOAD,           NONE,    MEMORY,   I) \
+    X(SC,    "sc",    0x38, MEM,    ISA_READ_RS | ISA_READ_RT | ISA_WRITE_RT, SIGNED, NONE, STORE_CONDITIONAL, NONE, MEMORY, I) \
+    X(SWC1,  "swc1",  0x39, FMEM,   ISA_READ_RS,                 SIGNED, NONE, FP_STORE,          NONE,    MEMORY,   I) \
+    X(SDC1,  "sdc1",  0x3D, FMEM,   ISA_READ_RS | ISA_DOUBLE,    SIGNED, NONE, FP_STORE,          NONE,    MEMORY,   I)
+
+#define ISA_SPECIAL_LIST(X) \
+    X(SLL,     "sll",     0x00, SHIFT,  ISA_READ_RT | ISA_WRITE_RD,               SHAMT, SLL,  ALU,      NONE,    REGISTER, R) \
+    X(SRL,     "srl",     0x02, SHIFT,  ISA_READ_RT | ISA_WRITE_RD,               SHAMT, SRL,  ALU,      NONE,    REGISTER, R) \
+    X(JR,      "jr",      0x08, RS,     ISA_READ_RS,                              NONE,  NONE, JUMP_REG, NONE,    JUMP,     R) \
+    X(SYSCALL, "syscall", 0x0C, NONE,   ISA_NO_OPERANDS,                           NONE,  NONE, SYSCALL,  NONE,    NONE,     R) \
+    X(MFHI,    "mfhi",    0x10, RD,     ISA_WRITE_RD,                             NONE,  HI,   HILO,     NONE,    REGISTER, R) \
+    X(MTHI,    "mthi",    0x11, RS,     ISA_READ_RS,                              NONE,  NONE, MULDIV,   NONE,    REGISTER, R) \
+    X(MFLO,    "mflo",    0x12, RD,     ISA_WRITE_RD,                             NONE,  LO,   HILO,     NONE,    REGISTER, R) \
+    X(MTLO,    "mtlo",    0x13, RS,     ISA_READ_RS,                              NONE,  NONE, MULDIV,   NONE,    REGISTER, R) \
+    X(MULT,    "mult",    0x18, RS_RT,  ISA_READ_RS | ISA_READ_RT,                NONE,  NONE, MULDIV,   INT_MUL, REGISTER, R) \
+    X(MULTU,   "multu",   0x19, RS_RT,  ISA_READ_RS | ISA_READ_RT,                NONE,  NONE, MULDIV,   INT_MUL, REGISTER, R) \
+    X(DIV,     "div",     0x1A, RS_RT,  ISA_READ_RS | ISA_READ_RT,                NONE,  NONE, MULDIV,   INT_DIV, REGISTER, R) \
+    X(DIVU,    "divu",    0x1B, RS_RT,  ISA_READ_RS | ISA_READ_RT,                NONE,  NONE, MULDIV,   INT_DIV, REGISTER, R) \
+    X(ADD,     "add",     0x20, R3,     ISA_READ_RS | ISA_READ_RT | ISA_WRITE_RD, NONE,  ADD,  ALU,      NONE,    REGISTER, R) \
+    X(ADDU,    "addu",    0x21, R3,     ISA_READ_RS | ISA_READ_RT | ISA_WRITE_RD, NONE,  ADD,  ALU,      NONE,    REGISTER, R) \
+    X(SUB,     "sub",     0x22, R3,     ISA_READ_RS | ISA_READ_RT | ISA_WRITE_RD, NONE,  SUB,  ALU,      NONE,    REGISTER, R) \
+    X(SUBU,    "subu",    0x23, R3,     ISA_READ_RS | ISA_READ_RT | ISA_WRITE_RD, NONE,  SUB,  ALU,      NONE,    REGISTER, R) \
+    X(AND,     "and",     0x24, R3,     ISA_READ_RS | ISA_READ_RT | ISA_WRITE_RD, NONE,  AND,  ALU,      NONE,    REGISTER, R) \
+    X(OR,      "or",      0x25, R3,     ISA_READ_RS | ISA_READ_RT | ISA_WRITE_RD, NONE,  OR,   ALU,      NONE,    REGISTER, R) \
+    X(XOR,     "xor",     0x26, R3,     ISA_READ_RS | ISA_READ_RT | ISA_WRITE_RD, NONE,  XOR,  ALU,      NONE,    REGISTER, R) \
+    X(NOR,     "nor",     0x27, R3,     ISA_READ_RS | ISA_READ_RT | ISA_WRITE_RD, NONE,  NOR,  ALU,      NONE,    REGISTER, R) \
+    X(SLT,     "slt",     0x2A, R3,     ISA_READ_RS | ISA_READ_RT | ISA_WRITE_RD, NONE,  SLT,  ALU,      NONE,    REGISTER, R) \
+    X(SLTU,    "sltu",    0x2B, R3,     ISA_READ_RS | ISA_READ_RT | ISA_WRITE_RD, NONE,  SLTU, ALU,      NONE,    REGISTER, R)
+
+#define ISA_SPECIAL2_LIST(X) \
+    X(MUL, "mul", 0x02, R3, ISA_READ_RS | ISA_READ_RT | ISA_WRITE_RD, NONE, MUL, ALU, INT_MUL, REGISTER, R)
+
+// COP1 is keyed by its rs field; arith.h decodes the rest
+#define ISA_COP1_LIST(X) \
+    X(MFC1,   "mfc1",   0x00, COP1,   ISA_WRITE_RT,  NONE,   NONE, COP1,      NONE, REGISTER, R) \
+    X(CFC1,   "cfc1",   0x02, COP1,   ISA_WRITE_RT,  NONE,   NONE, COP1,      NONE, REGISTER, R) \
+    X(MTC1,   "mtc1",   0x04, COP1,   ISA_READ_RT,   NONE,   NONE, COP1,      NONE, REGISTER, R) \
+    X(CTC1,   "ctc1",   0x06, COP1,   ISA_READ_RT,   NONE,   NONE, COP1,      NONE, REGISTER, R) \
+    X(BC1,    "bc1",    0x08, COP1,   ISA_NO_OPERANDS, SIGNED, NONE, BRANCH_FP, NONE, BRANCH,   I) \
+    X(COP1_S, "cop1.s", 0x10, COP1,   ISA_NO_OPERANDS, NONE,   NONE, COP1,      NONE, REGISTER, R) \
+    X(COP1_D, "cop1.d", 0x11, COP1,   ISA_NO_OPERANDS, NONE,   NONE, COP1,      NONE, REGISTER, R) \
+    X(COP1_W, "cop1.w", 0x14, COP1,   ISA_NO_OPERANDS, NONE,   NONE, COP1,      NONE, REGISTER, R)
+
+#define ISA_LIST(X) ISA_PRIMARY_LIST(X) ISA_SPECIAL_LIST(X) ISA_SPECIAL2_LIST(X) ISA_COP1_LIST(X)
+
+// Operand fields
+#define ISA_NO_OPERANDS 0x00
+#define ISA_READ_RS 0x01
+#define ISA_READ_RT 0x02
+#define ISA_WRITE_RD 0x04
+#define ISA_WRITE_RT 0x08
+#define ISA_WRITE_RA 0x10
+#define ISA_DOUBLE 0x20 // FP loads and stores of a register pair
+
+typedef enum { ISA_IMM_NONE, ISA_IMM_SIGNED, ISA_IMM_ZERO, ISA_IMM_SHAMT, ISA_IMM_TARGET } IsaImmediate;
+
+// Operand syntax, shared with the assembler
+typedef enum {
+    ISA_SYNTAX_NONE, // syscall
+    ISA_SYNTAX_R3, // rd, rs, rt
+    ISA_SYNTAX_SHIFT, // rd, rt, shamt
+    ISA_SYNTAX_RS, // jr, mthi, mtlo
+    ISA_SYNTAX_RD, // mfhi, mflo
+    ISA_SYNTAX_RS_RT, // mult, div
+    ISA_SYNTAX_I, // rt, rs, immediate
+    ISA_SYNTAX_LUI, // rt, immediate
+    ISA_SYNTAX_BRANCH, // rs, rt, label
+    ISA_SYNTAX_JUMP, // label
+    ISA_SYNTAX_MEM, // rt, offset(rs)
+    ISA_SYNTAX_FMEM, // ft, offset(rs)
+    ISA_SYNTAX_COP1, // Written and parsed by arith.h and mipsasm.h
+} IsaSyntax;
+
+typedef enum {
+    ISA_ALU_NONE, ISA_ALU_ADD, ISA_ALU_SUB, ISA_ALU_AND, ISA_ALU_OR, ISA_ALU_XOR, ISA_ALU_NOR, ISA_ALU_SLT,
+    ISA_ALU_SLTU, ISA_ALU_SLL, ISA_ALU_SRL, ISA_ALU_LUI, ISA_ALU_MUL, ISA_ALU_EQ, ISA_ALU_NE, ISA_ALU_HI, ISA_ALU_LO,
+    ISA_ALU_COUNT
+} IsaAlu;
+
+// What the engines dispatch on
+#define ISA_CLASS_LIST(X) \
+    X(INVALID) X(ALU) X(HILO) X(MULDIV) X(BRANCH) X(BRANCH_FP) X(JUMP) X(JUMP_REG) X(LOAD) X(STORE) \
+    X(LOAD_LINKED) X(STORE_CONDITIONAL) X(FP_LOAD) X(FP_STORE) X(COP1) X(SYSCALL)
+#define ISA_CLASS_ENUM(name) ISA_CLASS_##name,
+typedef enum { ISA_CLASS_LIST(ISA_CLASS_ENUM) ISA_CLASS_COUNT } IsaClass;
+// Computed-goto table of an engine, which defines one class_<NAME> label per class:
+//   static void* const handlers[ISA_CLASS_COUNT] = { ISA_CLASS_LIST(ISA_CLASS_HANDLER) };
+//   goto *handlers[d->cls];
+#define ISA_CLASS_HANDLER(name) [ISA_CLASS_##name] = &&class_##name,
+
+typedef enum { ISA_COUNT_NONE, ISA_COUNT_REGISTER, ISA_COUNT_MEMORY, ISA_COUNT_BRANCH, ISA_COUNT_JUMP } IsaCounter;
+typedef enum { ISA_FORMAT_R, ISA_FORMAT_I, ISA_FORMAT_J } IsaFormat;
+
+#define ISA_OP_ENUM(id, ...) ISA_##id,
+typedef enum { ISA_INVALID, ISA_NOP, ISA_LIST(ISA_OP_ENUM) ISA_OP_COUNT } IsaOp;
+
+typedef struct {
+    const char* name;
+    uint8_t opcode; // Primary opcode: 0x00 SPECIAL, 0x1C SPECIAL2, 0x11 COP1 or the instruction's own
+    uint8_t key; // funct within SPECIAL/SPECIAL2, rs within COP1, else the opcode again
+    uint8_t syntax; // IsaSyntax
+    uint8_t operands;
+    uint8_t immediate; // IsaImmediate
+    uint8_t alu; // IsaAlu
+    uint8_t cls; // IsaClass
+    uint8_t unit; // ArithUnit
+    uint8_t counter; // IsaCounter
+    uint8_t format; // IsaFormat
+} IsaInfo;
+
+#define ISA_INFO(opcode, id, name, key, syntax, operands, immediate, alu, cls, unit, counter, format) \
+    [ISA_##id] = { name, opcode, key, ISA_SYNTAX_##syntax, operands, ISA_IMM_##immediate, ISA_ALU_##alu, ISA_CLASS_##cls, \
+                   UNIT_##unit, ISA_COUNT_##counter, ISA_FORMAT_##format },
+#define ISA_INFO_PRIMARY(id, name, key, ...) ISA_INFO(key, id, name, key, __VA_ARGS__)
+#define ISA_INFO_SPECIAL(...) ISA_INFO(0x00, __VA_ARGS__)
+#define ISA_INFO_SPECIAL2(...) ISA_INFO(0x1C, __VA_ARGS__)
+#define ISA_INFO_COP1(...) ISA_INFO(0x11, __VA_ARGS__)
+static const IsaInfo isa_info[ISA_OP_COUNT] = {
+    [ISA_INVALID] = { "invalid", 0, 0, ISA_SYNTAX_NONE, 0, ISA_IMM_NONE, ISA_ALU_NONE, ISA_CLASS_INVALID, UNIT_NONE,
+                      ISA_COUNT_NONE, ISA_FORMAT_I },
+    // sll $0, $0, 0; counted as nothing so padding does not inflate the register operations
+    [ISA_NOP] = { "nop", 0, 0, ISA_SYNTAX_NONE, 0, ISA_IMM_NONE, ISA_ALU_NONE, ISA_CLASS_ALU, UNIT_NONE, ISA_COUNT_NONE,
+                  ISA_FORMAT_R },
+    ISA_PRIMARY_LIST(ISA_INFO_PRIMARY) ISA_SPECIAL_LIST(ISA_INFO_SPECIAL) ISA_SPECIAL2_LIST(ISA_INFO_SPECIAL2)
+    ISA_COP1_LIST(ISA_INFO_COP1)
+};
+
+// Dense decode tables; unlisted encodings stay ISA_INVALID (0)
+#define ISA_TABLE_ENTRY(id, name, key, ...) [key] = ISA_##id,
+static const uint8_t isa_primary[64] = { ISA_PRIMARY_LIST(ISA_TABLE_ENTRY) };
+static const uint8_t isa_special[64] = { ISA_SPECIAL_LIST(ISA_TABLE_ENTRY) };
+static const uint8_t isa_special2[64] = { ISA_SPECIAL2_LIST(ISA_TABLE_ENTRY) };
+static const uint8_t isa_cop1[32] = { ISA_COP1_LIST(ISA_TABLE_ENTRY) };
+
+typedef struct {
+    uint32_t instruction;
+    uint8_t op; // IsaOp
+    uint8_t cls; // IsaClass, copied from isa_info for the dispatch
+    uint8_t rs, rt, rd, shamt, funct;
+    uint8_t dest; // Integer register written, 0 if none
+    uint32_t immediate; // Extended as the instruction requires
+} IsaDecoded;
+
+static inline IsaOp isaOp(uint32_t instruction) {
+    uint32_t opcode = instruction >> 26;
+    uint32_t funct = instruction & 0x3F;
+    if (instruction == 0) {
+        return ISA_NOP;
+    }
+    switch (opcode) { // Three sub-tables; everything else is one load
+        case 0x00: return (IsaOp)isa_special[funct];
+        case 0x1C: return (IsaOp)isa_special2[funct];
+        case 0x11: return (IsaOp)isa_cop1[(instruction >> 21) & 0x1F];
+        default: return (IsaOp)isa_primary[opcode];
+    }
+}
+
+static inline IsaDecoded isaDecode(uint32_t instruction) {
+    IsaDecoded d;
+    d.instruction = instruction;
+    d.op = isaOp(instruction);
+    const IsaInfo* info = &isa_info[d.op];
+    d.cls = info->cls;
+    d.rs = (instruction >> 21) & 0x1F;
+    d.rt = (instruction >> 16) & 0x1F;
+    d.rd = (instruction >> 11) & 0x1F;
+    d.shamt = (instruction >> 6) & 0x1F;
+    d.funct = instruction & 0x3F;
+    d.dest = info->operands & ISA_WRITE_RD ? d.rd : info->operands & ISA_WRITE_RT ? d.rt :
+             info->operands & ISA_WRITE_RA ? 31 : 0;
+    switch (info->immediate) {
+        case ISA_IMM_SIGNED: d.immediate = (uint32_t)(int32_t)(int16_t)(instruction & 0xFFFF); break;
+        case ISA_IMM_ZERO: d.immediate = instruction & 0xFFFF; break;
+        case ISA_IMM_SHAMT: d.immediate = d.shamt; break;
+        case ISA_IMM_TARGET: d.immediate = (instruction & 0x3FFFFFF) << 2; break;
+        default: d.immediate = 0; break;
+    }
+    return d;
+}
+
+static inline const IsaInfo* isaInfo(const IsaDecoded* d) {
+    return &isa_info[d->op];
+}
+
+// Semantics of every ALU operation, branch condition and HI/LO move
+static inline uint32_t isaAlu(IsaAlu alu, uint32_t a, uint32_t b) {
+#define ISA_ALU_LABEL(name) [ISA_ALU_##name] = &&alu_##name
+    static void* const handlers[ISA_ALU_COUNT] = {
+        ISA_ALU_LABEL(NONE), ISA_ALU_LABEL(ADD), ISA_ALU_LABEL(SUB), ISA_ALU_LABEL(AND), ISA_ALU_LABEL(OR),
+        ISA_ALU_LABEL(XOR), ISA_ALU_LABEL(NOR), ISA_ALU_LABEL(SLT), ISA_ALU_LABEL(SLTU), ISA_ALU_LABEL(SLL),
+        ISA_ALU_LABEL(SRL), ISA_ALU_LABEL(LUI), ISA_ALU_LABEL(MUL), ISA_ALU_LABEL(EQ), ISA_ALU_LABEL(NE),
+        ISA_ALU_LABEL(HI), ISA_ALU_LABEL(LO),
+    };
+#undef ISA_ALU_LABEL
+    goto *handlers[alu];
+alu_NONE: return 0;
+alu_ADD: return a + b; // No overflow traps
+alu_SUB: return a - b;
+alu_AND: return a & b;
+alu_OR: return a | b;
+alu_XOR: return a ^ b;
+alu_NOR: return ~(a | b);
+alu_SLT: return (int32_t)a < (int32_t)b;
+alu_SLTU: return a < b;
+alu_SLL: return a << (b & 0x1F);
+alu_SRL: return a >> (b & 0x1F);
+alu_LUI: return b << 16;
+alu_MUL: return a * b;
+alu_EQ: return a == b;
+alu_NE: return a != b;
+alu_HI: return a;
+alu_LO: return b;
+}
+
+// Shifts operate on rt by shamt; branches compare rs with rt; other immediates are the second operand
+static inline uint32_t isaAluResult(const IsaDecoded* d, uint32_t rs_value, uint32_t rt_value) {
+    const IsaInfo* info = &isa_info[d->op];
+    if (info->immediate == ISA_IMM_SHAMT) {
+        return isaAlu((IsaAlu)info->alu, rt_value, d->immediate);
+    }
+    uint32_t b = info->operands & ISA_READ_RT ? rt_value : d->immediate;
+    return isaAlu((IsaAlu)info->alu, rs_value, b);
+}
+
+static inline uint32_t isaBranchTarget(const IsaDecoded* d, uint32_t pc) {
+    return pc + 4 + (d->immediate << 2);
+}
+
+static inline uint32_t isaJumpTarget(const IsaDecoded* d, uint32_t pc) {
+    return ((pc + 4) & 0xF0000000) | d->immediate;
+}
+
+// Words are big-endian in the binary and in the simulators' memories
+static inline uint32_t isaWordFromBytes(const uint8_t* bytes) {
+    return ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) | ((uint32_t)bytes[2] << 8) | bytes[3];
+}
+
+static inline void isaWordToBytes(uint8_t* bytes, uint32_t value) {
+    bytes[0] = (value >> 24) & 0xFF;
+    bytes[1] = (value >> 16) & 0xFF;
+    bytes[2] = (value >> 8) & 0xFF;
+    bytes[3] = value & 0xFF;
+}
+
+static inline ArithUnit isaUnit(const IsaDecoded* d) {
+    return d->cls == ISA_CLASS_COP1 ? arithUnit(d->instruction) : (ArithUnit)isa_info[d->op].unit;
+}
+
+static inline int isaDisassemble(uint32_t instruction, char* text, size_t size) {
+    IsaDecoded d = isaDecode(instruction);
+    const IsaInfo* info = isaInfo(&d);
+    int16_t offset = instruction & 0xFFFF;
+    if (d.op == ISA_INVALID || (info->syntax == ISA_SYNTAX_COP1 && !arithDisassemble(instruction, text, size))) {
+        snprintf(text, size, ".word 0x%08X", instruction);
+        return 0;
+    }
+    switch (info->syntax) {
+        case ISA_SYNTAX_NONE: snprintf(text, size, "%s", info->name); break;
+        case ISA_SYNTAX_R3: snprintf(text, size, "%s $%d, $%d, $%d", info->name, d.rd, d.rs, d.rt); break;
+        case ISA_SYNTAX_SHIFT: snprintf(text, size, "%s $%d, $%d, %d", info->name, d.rd, d.rt, d.shamt); break;
+        case ISA_SYNTAX_RS: snprintf(text, size, "%s $%d", info->name, d.rs); break;
+        case ISA_SYNTAX_RD: snprintf(text, size, "%s $%d", info->name, d.rd); break;
+        case ISA_SYNTAX_RS_RT: snprintf(text, size, "%s $%d, $%d", info->name, d.rs, d.rt); break;
+        case ISA_SYNTAX_I: snprintf(text, size, "%s $%d, $%d, %d", info->name, d.rt, d.rs, (int32_t)d.immediate); break;
+        case ISA_SYNTAX_LUI: snprintf(text, size, "%s $%d, 0x%04X", info->name, d.rt, d.immediate); break;
+        case ISA_SYNTAX_BRANCH: snprintf(text, size, "%s $%d, $%d, %d", info->name, d.rs, d.rt, offset); break;
+        case ISA_SYNTAX_JUMP: snprintf(text, size, "%s 0x%08X", info->name, d.immediate); break;
+        case ISA_SYNTAX_MEM: snprintf(text, size, "%s $%d, %d($%d)", info->name, d.rt, offset, d.rs); break;
+        case ISA_SYNTAX_FMEM: snprintf(text, size, "%s $f%d, %d($%d)", info->name, d.rt, offset, d.rs); break;
+        case ISA_SYNTAX_COP1: break; // Written above
+    }
+    return 1;
+}
+
+#endif
@@ -0,0 +1,419 @@
+// Synthetic memory-access kernels for the simulators, assembled with mipsasm.h into a big-endian image.
+// Build: gcc -O2 -o kernelgen kernelgen.c    Usage: kernelgen kernel [options] output.bin
+// The kernels target hw4's memory hierarchy, though every simulator runs them alike: the assembler puts a
+// nop in each delay slot, which only hw3 has. Each returns a checksum in $v0 and, with -c, splits the
+// working set by the core id hw4 passes in $a0.
+#include "mipsasm.h"
+
+#define STACK_TOP 0x1000000 // Initial SP of core 0
+#define STACK_STRIDE 0x100000 // Stack space reserved per core (hw4)
+#define MAX_CORES 16
+#define DATA_LIMIT 0x1800000 // hw4 scratchpad window and frame pool start here
+
+typedef enum { KERNEL_STREAM, KERNEL_STRIDE, KERNEL_RANDOM, KERNEL_CHASE, KERNEL_MATMUL, KERNEL_MIX, KERNEL_SHARE } Kernel;
+
+static const char* kernel_names[] = { "stream", "stride", "random", "chase", "matmul", "mix", "share" };
+
+Kernel kernel;
+uint32_t working_set = 0x100000; // Bytes, split evenly across cores
+uint32_t stride = 0; // Bytes between accesses, or the node size of the chase
+uint32_t passes = 1;
+int read_percent = -1; // Remaining accesses are stores
+int random_addresses = 0;
+uint32_t accesses = 0; // Per pass, random addressing only
+uint32_t seed = 0x2545F491;
+uint32_t matrix_size = 64;
+uint32_t block_size = 16;
+uint32_t data_base = 0x100000;
+int num_cores = 1;
+int listing = 0;
+
+Assembler* as;
+
+// Assembles one line and echoes it with -l, along with the nop the assembler puts in a delay slot
+static void emit(const char* format, ...) {
+    char text[ASM_LINE_LENGTH];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    int delay_slots = as->delay_slots;
+    asmLine(as, text);
+    if (listing) {
+        printf("%s%s\n", strchr(text, ':') || text[0] == '.' || text[0] == '#' ? "" : "    ", text);
+        if (as->delay_slots != delay_slots) {
+            printf("    nop # delay slot\n");
+        }
+    }
+}
+
+// hw3 stops once the jump reaches the exit address, before the instruction ahead of it writes back
+static void emitReturn() {
+    emit("nop");
+    emit("jr $ra");
+}
+
+static uint32_t xorshift(uint32_t* state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+// 1K/1M suffixes are accepted for sizes
+static uint32_t parseSize(const char* text) {
+    char* end;
+    unsigned long long value = strtoull(text, &end, 0);
+    if (*end == 'K' || *end == 'k') {
+        value <<= 10;
+        end++;
+    } else if (*end == 'M' || *end == 'm') {
+        value <<= 20;
+        end++;
+    }
+    if (end == text || *end != '\0' || value > 0xFFFFFFFFull) {
+        fprintf(stderr, "Invalid size: %s\n", text);
+        exit(1);
+    }
+    return (uint32_t)value;
+}
+
+// $s0/$s1 = this core's slice of the working set, $s2 = pass counter, $v0 = checksum
+static void emitPrologue(uint32_t slice) {
+    emit("# %s: %u bytes per core at 0x%X, %u pass%s", kernel_names[kernel], slice, data_base, passes, passes == 1 ? "" : "es");
+    emit("li $s0, %u", data_base);
+    if (num_cores > 1) {
+        emit("li $t0, %u", slice);
+        emit("mul $t0, $t0, $a0");
+        emit("addu $s0, $s0, $t0");
+    }
+    emit("li $t0, %u", slice);
+    emit("addu $s1, $s0, $t0");
+    emit("li $s2, %u", passes);
+    emit("move $v0, $zero");
+}
+
+// Stream, stride, random and mix share one loop; $s6 counts the accesses left in the pass
+static void emitAccessLoop(uint32_t slice) {
+    uint32_t count = random_addresses ? (accesses ? accesses : slice / 4) : (slice + stride - 1) / stride;
+    emitPrologue(slice);
+    emit("li $s3, %u", stride);
+    if (random_addresses) {
+        emit("li $s4, %u", seed);
+        emit("sll $t0, $a0, 16"); // Each core draws its own sequence
+        emit("xor $s4, $s4, $t0");
+        emit("li $s5, %u", (slice - 1) & ~3u);
+    }
+    if (read_percent != 0 && read_percent != 100) {
+        emit("move $s7, $zero"); // Store ratio accumulator
+    }
+    emit("pass:");
+    emit("move $t0, $s0");
+    emit("li $s6, %u", count);
+    emit("loop:");
+    if (random_addresses) { // xorshift32 picks a word in the slice
+        emit("sll $t2, $s4, 13");
+        emit("xor $s4, $s4, $t2");
+        emit("srl $t2, $s4, 17");
+        emit("xor $s4, $s4, $t2");
+        emit("sll $t2, $s4, 5");
+        emit("xor $s4, $s4, $t2");
+        emit("and $t0, $s4, $s5");
+        emit("addu $t0, $t0, $s0");
+    }
+    if (read_percent == 100) {
+        emit("lw $t1, 0($t0)");
+        emit("addu $v0, $v0, $t1");
+    } else if (read_percent == 0) {
+        emit("sw $t0, 0($t0)");
+    } else { // Stores are spread evenly: one whenever the accumulator passes 100
+        emit("addiu $s7, $s7, %d", 100 - read_percent);
+        emit("slti $t2, $s7, 100");
+        emit("bne $t2, $zero, read");
+        emit("addiu $s7, $s7, -100");
+        emit("sw $t0, 0($t0)");
+        emit("j next");
+        emit("read:");
+        emit("lw $t1, 0($t0)");
+        emit("addu $v0, $v0, $t1");
+        emit("next:");
+    }
+    if (!random_addresses) {
+        emit("addu $t0, $t0, $s3");
+    }
+    emit("addiu $s6, $s6, -1");
+    emit("bne $s6, $zero, loop");
+    emit("addiu $s2, $s2, -1");
+    emit("bne $s2, $zero, pass");
+    emitReturn();
+}
+
+// Each core walks its own random cycle through all nodes of its slice (Sattolo's shuffle), so every
+// load depends on the previous one. The final node address is the checksum.
+static void emitChase(uint32_t slice) {
+    uint32_t nodes = slice / stride;
+    uint64_t steps = (uint64_t)nodes * passes;
+    if (steps > 0xFFFFFFFFull) {
+        fprintf(stderr, "Too many steps: %llu\n", (unsigned long long)steps);
+        exit(1);
+    }
+    emitPrologue(slice);
+    emit("move $t0, $s0");
+    emit("li $s6, %u", (uint32_t)steps);
+    emit("loop:");
+    emit("lw $t0, 0($t0)");
+    emit("addiu $s6, $s6, -1");
+    emit("bne $s6, $zero, loop");
+    emit("move $v0, $t0");
+    emitReturn();
+
+    uint32_t* next = malloc(nodes * sizeof(uint32_t));
+    if (next == NULL) {
+        fprintf(stderr, "Out of memory for %u nodes\n", nodes);
+        exit(1);
+    }
+    uint32_t state = seed;
+    emit(".org 0x%X", data_base);
+    emit("# %u nodes of %u bytes per core", nodes, stride);
+    for (int core = 0; core < num_cores; ++core) {
+        uint32_t base = data_base + core * slice;
+        for (uint32_t i = 0; i < nodes; ++i) {
+            next[i] = i;
+        }
+        for (uint32_t i = nodes - 1; i > 0; --i) {
+            uint32_t j = xorshift(&state) % i;
+            uint32_t swap = next[i];
+            next[i] = next[j];
+            next[j] = swap;
+        }
+        uint32_t node = 0;
+        for (uint64_t step = 0; step < steps; ++step) {
+            node = next[node];
+        }
+        printf("Core %d: $v0 = 0x%X\n", core, base + node * stride);
+        for (uint32_t i = 0; i < nodes; ++i) {
+            as->pc = base + i * stride;
+            asmEmit(as, base + next[i] * stride);
+        }
+    }
+    free(next);
+}
+
+// C += A * B over n x n word matrices in bs x bs blocks; cores split the block rows of C
+static void emitMatmul() {
+    uint32_t row = matrix_size * 4;
+    uint32_t matrix = matrix_size * row;
+    uint32_t rows = matrix_size / num_cores;
+    emit("# matmul: %ux%u words in %ux%u blocks at 0x%X (A, B, C), %u pass%s", matrix_size, matrix_size, block_size,
+         block_size, data_base, passes, passes == 1 ? "" : "es");
+    emit("li $s0, %u", data_base); // A
+    emit("li $s1, %u", data_base + matrix); // B
+    emit("li $s2, %u", data_base + 2 * matrix); // C
+    emit("li $s3, %u", row);
+    emit("li $s4, %u", block_size * 4); // Block width in bytes
+    emit("li $s5, %u", block_size * row); // Block height in bytes
+    emit("li $t0, %u", rows * row);
+    emit("mul $s6, $t0, $a0"); // First row of this core
+    emit("addu $s6, $s6, $t0"); // End row
+    emit("li $fp, %u", passes);
+    emit("move $v0, $zero");
+    emit("pass:");
+    emit("li $t0, %u", rows * row);
+    emit("mul $t0, $t0, $a0");
+    emit("ii:");
+    emit("move $t1, $zero");
+    emit("jj:");
+    emit("move $t2, $zero"); // kk column offset in A
+    emit("move $t3, $zero"); // kk row offset in B
+    emit("kk:");
+    emit("move $t4, $t0");
+    emit("addu $t5, $t0, $s5");
+    emit("i:");
+    emit("move $t6, $t1");
+    emit("addu $t7, $t1, $s4");
+    emit("j:");
+    emit("addu $a1, $s2, $t4");
+    emit("addu $a1, $a1, $t6"); // &C[i][j]
+    emit("lw $s7, 0($a1)");
+    emit("addu $a2, $s0, $t4");
+    emit("addu $a2, $a2, $t2"); // &A[i][kk]
+    emit("addu $a3, $s1, $t3");
+    emit("addu $a3, $a3, $t6"); // &B[kk][j]
+    emit("addu $t8, $a2, $s4");
+    emit("k:");
+    emit("lw $t9, 0($a2)");
+    emit("lw $v1, 0($a3)");
+    emit("mul $t9, $t9, $v1");
+    emit("addu $s7, $s7, $t9");
+    emit("addiu $a2, $a2, 4");
+    emit("addu $a3, $a3, $s3");
+    emit("bne $a2, $t8, k");
+    emit("sw $s7, 0($a1)");
+    emit("addu $v0, $v0, $s7");
+    emit("addiu $t6, $t6, 4");
+    emit("bne $t6, $t7, j");
+    emit("addu $t4, $t4, $s3");
+    emit("bne $t4, $t5, i");
+    emit("addu $t2, $t2, $s4");
+    emit("addu $t3, $t3, $s5");
+    emit("bne $t2, $s3, kk");
+    emit("addu $t1, $t1, $s4");
+    emit("bne $t1, $s3, jj");
+    emit("addu $t0, $t0, $s5");
+    emit("bne $t0, $s6, ii");
+    emit("addiu $fp, $fp, -1");
+    emit("bne $fp, $zero, pass");
+    emitReturn();
+}
+
+// Every core adds 1 to one shared counter per pass with LL/SC; core 0 then waits for all of them and
+// returns the total. Catches cores that do not see each other's memory (hw4 -c n -t pipt).
+static void emitShare() {
+    emit("# share: %d cores add %u each to the counter at 0x%X", num_cores, passes, data_base);
+    emit("li $s0, %u", data_base);
+    emit("li $s2, %u", passes);
+    emit("add:");
+    emit("ll $t0, 0($s0)");
+    emit("addiu $t0, $t0, 1");
+    emit("sc $t0, 0($s0)");
+    emit("beq $t0, $zero, add");
+    emit("addiu $s2, $s2, -1");
+    emit("bne $s2, $zero, add");
+    emit("move $v0, $zero");
+    emit("bne $a0, $zero, done");
+    emit("li $t1, %u", num_cores * passes);
+    emit("wait:");
+    emit("lw $v0, 0($s0)");
+    emit("bne $v0, $t1, wait");
+    emit("done:");
+    emitReturn();
+    printf("Core 0: $v0 = 0x%X\n", num_cores * passes);
+}
+
+static void usage(const char* program) {
+    fprintf(stderr, "Usage: %s stream|stride|random|chase|matmul|mix|share [options] output.bin\n", program);
+    fprintf(stderr, "  -w bytes   working set, split across cores (default 1M)\n");
+    fprintf(stderr, "  -s bytes   stride, or chase node size (default 4 for stream, 64 otherwise)\n");
+    fprintf(stderr, "  -i n       passes over the working set (default 1)\n");
+    fprintf(stderr, "  -r percent loads among the accesses (default 100, 50 for mix)\n");
+    fprintf(stderr, "  -R         random addresses for mix\n");
+    fprintf(stderr, "  -n n       accesses per pass with random addresses (default working set / 4)\n");
+    fprintf(stderr, "  -S seed    random seed\n");
+    fprintf(stderr, "  -m n       matrix dimension for matmul (default 64)\n");
+    fprintf(stderr, "  -b n       block size for matmul (default 16)\n");
+    fprintf(stderr, "  -a address data base address, page aligned (default 0x100000)\n");
+    fprintf(stderr, "  -c n       cores sharing the work, as hw4 -c (default 1)\n");
+    fprintf(stderr, "  -l         print the assembly listing\n");
+    exit(1);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        usage(argv[0]);
+    }
+    int found = 0;
+    for (int i = 0; i < (int)(sizeof(kernel_names) / sizeof(kernel_names[0])); ++i) {
+        if (strcmp(argv[1], kernel_names[i]) == 0) {
+            kernel = (Kernel)i;
+            found = 1;
+        }
+    }
+    if (!found) {
+        usage(argv[0]);
+    }
+    const char* output = NULL;
+    for (int i = 2; i < argc; ++i) {
+        if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+            working_set = parseSize(argv[++i]);
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            stride = parseSize(argv[++i]);
+        } else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+            passes = parseSize(argv[++i]);
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            read_percent = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-R") == 0) {
+            random_addresses = 1;
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            accesses = parseSize(argv[++i]);
+        } else if (strcmp(argv[i], "-S") == 0 && i + 1 < argc) {
+            seed = parseSize(argv[++i]);
+        } else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            matrix_size = parseSize(argv[++i]);
+        } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            block_size = parseSize(argv[++i]);
+        } else if (strcmp(argv[i], "-a") == 0 && i + 1 < argc) {
+            data_base = parseSize(argv[++i]);
+        } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            num_cores = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-l") == 0) {
+            listing = 1;
+        } else if (argv[i][0] != '-' && output == NULL) {
+            output = argv[i];
+        } else {
+            usage(argv[0]);
+        }
+    }
+
+    if (kernel == KERNEL_RANDOM) {
+        random_addresses = 1;
+    }
+    if (stride == 0) {
+        stride = kernel == KERNEL_STREAM ? 4 : 64;
+    }
+    if (read_percent < 0) {
+        read_percent = kernel == KERNEL_MIX ? 50 : 100;
+    }
+    if (kernel == KERNEL_MATMUL) {
+        working_set = 3 * matrix_size * matrix_size * 4;
+    }
+    uint32_t slice = working_set / (num_cores > 0 ? num_cores : 1);
+    if (output == NULL || num_cores < 1 || num_cores > MAX_CORES || passes == 0 || read_percent > 100 ||
+        stride == 0 || stride % 4 != 0 || stride > 0x7FFF0000 || data_base % 4096 != 0 || slice < stride || slice % 4 != 0) {
+        usage(argv[0]);
+    }
+    if (random_addresses && (slice & (slice - 1)) != 0) {
+        fprintf(stderr, "Random addressing needs a power-of-two working set per core (%u bytes)\n", slice);
+        return 1;
+    }
+    if (kernel == KERNEL_MATMUL && (block_size == 0 || matrix_size % block_size != 0 ||
+                                    (matrix_size / num_cores) % block_size != 0)) {
+        fprintf(stderr, "The matrix dimension must split into whole blocks per core\n");
+        return 1;
+    }
+    // The data may not overlap the stacks below 16MB or the regions hw4 reserves above them
+    uint64_t data_end = (uint64_t)data_base + working_set;
+    if (data_base < 0x10000 || (data_base < STACK_TOP && data_end > STACK_TOP - (uint32_t)num_cores * STACK_STRIDE) ||
+        data_end > DATA_LIMIT) {
+        fprintf(stderr, "Data at 0x%X-0x%llX overlaps the code, the stacks or the scratchpad\n", data_base,
+                (unsigned long long)data_end);
+        return 1;
+    }
+
+    as = asmCreate();
+    switch (kernel) {
+        case KERNEL_CHASE:
+            emitChase(slice);
+            break;
+        case KERNEL_MATMUL:
+            emitMatmul();
+            break;
+        case KERNEL_SHARE:
+            emitShare();
+            break;
+        default:
+            emitAccessLoop(slice);
+            break;
+    }
+    if (!asmFinish(as)) {
+        fprintf(stderr, "Assembly failed: %s\n", as->error);
+        return 1;
+    }
+    if (!asmWrite(as, output)) {
+        fprintf(stderr, "Error writing %s\n", output);
+        return 1;
+    }
+    printf("Wrote %s: %u bytes\n", output, as->size);
+    asmFree(as);
+    return 0;
+}
@@ -0,0 +1,741 @@
+// Small two-pass MIPS assembler for building test images. It covers the instructions the simulators
+// implement and produces a big-endian image starting at address 0, the layout the simulators load.
+// Every branch and jump is followed by a nop: hw3 executes the instruction after a control transfer as its
+// delay slot, while hw2 and hw4 have none, so only an empty slot runs the same program on all three.
+//
+//   Assembler* a = asmCreate();
+//   asmLine(a, "loop: lw $t1, 0($t0)");  asmPrintf(a, "addiu $t0, $t0, %d", 4);  ...
+//   if (!asmFinish(a)) fprintf(stderr, "%s\n", a->error);
+//   asmWrite(a, "kernel.bin");
+//
+// Syntax: one statement per line, '#' comments, "label:" prefixes, registers by number ($8, $f2) or name
+// ($t0, $sp). Pseudo-instructions: nop, move, li, la, b, beqz, bnez. Directives: .org, .align (power of
+// two), .space, .word (numbers or labels).
+#ifndef MIPSASM_H
+#define MIPSASM_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <ctype.h>
+
+#include "isa.h"
+
+#define ASM_MAX_IMAGE 0x4000000 // Simulator memory size
+#define ASM_NAME_LENGTH 48
+#define ASM_LINE_LENGTH 256
+
+// Integer instructions and the FP loads and stores come from isa.h; these are the COP1 forms it leaves
+// to arith.h
+typedef enum {
+    ASM_FP3, // fd, fs, ft
+    ASM_FP2, // fd, fs
+    ASM_FPCMP, // fs, ft
+    ASM_FPMOVE, // rt, fs
+    ASM_BC1, // label
+} AsmFormat;
+
+typedef struct {
+    const char* name;
+    AsmFormat format;
+    uint32_t funct; // The rs field for moves and the tf bit for bc1
+} AsmOpcode;
+
+static const AsmOpcode asm_cop1_opcodes[] = {
+    { "mfc1", ASM_FPMOVE, 0x00 }, { "mtc1", ASM_FPMOVE, 0x04 }, { "bc1f", ASM_BC1, 0 }, { "bc1t", ASM_BC1, 1 },
+};
+
+// COP1 arithmetic; the mnemonic carries the format as a suffix (add.d, cvt.s.w, c.lt.s)
+static const AsmOpcode asm_fp_opcodes[] = {
+    { "add", ASM_FP3, 0x00 }, { "sub", ASM_FP3, 0x01 }, { "mul", ASM_FP3, 0x02 },
+    { "div", ASM_FP3, 0x03 }, { "sqrt", ASM_FP2, 0x04 }, { "abs", ASM_FP2, 0x05 },
+    { "mov", ASM_FP2, 0x06 }, { "neg", ASM_FP2, 0x07 }, { "round.w", ASM_FP2, 0x0C },
+    { "trunc.w", ASM_FP2, 0x0D }, { "ceil.w", ASM_FP2, 0x0E }, { "floor.w", ASM_FP2, 0x0F },
+    { "cvt.s", ASM_FP2, 0x20 }, { "cvt.d", ASM_FP2, 0x21 }, { "cvt.w", ASM_FP2, 0x24 },
+    { "c.f", ASM_FPCMP, 0x30 }, { "c.un", ASM_FPCMP, 0x31 }, { "c.eq", ASM_FPCMP, 0x32 },
+    { "c.ueq", ASM_FPCMP, 0x33 }, { "c.olt", ASM_FPCMP, 0x34 }, { "c.ult", ASM_FPCMP, 0x35 },
+    { "c.ole", ASM_FPCMP, 0x36 }, { "c.ule", ASM_FPCMP, 0x37 }, { "c.lt", ASM_FPCMP, 0x3C },
+    { "c.le", ASM_FPCMP, 0x3E },
+};
+
+static const char* asm_register_names[32] = {
+    "zero", "at", "v0", "v1", "a0", "a1", "a2", "a3", "t0", "t1", "t2", "t3", "t4", "t5", "t6", "t7",
+    "s0", "s1", "s2", "s3", "s4", "s5", "s6", "s7", "t8", "t9", "k0", "k1", "gp", "sp", "fp", "ra",
+};
+
+typedef enum { FIX_BRANCH, FIX_JUMP, FIX_HI, FIX_LO, FIX_OFFSET, FIX_WORD } AsmFixupKind;
+
+typedef struct {
+    char name[ASM_NAME_LENGTH];
+    uint32_t address;
+} AsmLabel;
+
+typedef struct {
+    AsmFixupKind kind;
+    uint32_t address; // Word to patch
+    char label[ASM_NAME_LENGTH];
+    int32_t addend;
+    int line;
+} AsmFixup;
+
+typedef struct {
+    uint8_t* image;
+    uint32_t size, capacity; // Bytes written so far (the image ends at the highest address used)
+    uint32_t pc;
+    AsmLabel* labels;
+    int label_count, label_capacity;
+    AsmFixup* fixups;
+    int fixup_count, fixup_capacity;
+    int line; // Statements seen, for error messages
+    int delay_slots; // nops inserted after branches and jumps
+    char error[ASM_LINE_LENGTH + 64]; // First error; later statements are ignored
+} Assembler;
+
+static inline Assembler* asmCreate() {
+    Assembler* a = calloc(1, sizeof(Assembler));
+    if (a == NULL) {
+        fprintf(stderr, "Out of memory for the assembler\n");
+        exit(1);
+    }
+    return a;
+}
+
+static inline void asmFree(Assembler* a) {
+    free(a->image);
+    free(a->labels);
+    free(a->fixups);
+    free(a);
+}
+
+static inline int asmFail(Assembler* a, const char* format, ...) {
+    if (a->error[0] == '\0') {
+        int length = snprintf(a->error, sizeof(a->error), "line %d: ", a->line);
+        va_list args;
+        va_start(args, format);
+        vsnprintf(a->error + length, sizeof(a->error) - length, format, args);
+        va_end(args);
+    }
+    return 0;
+}
+
+// Makes room for the bytes up to end; the gap is zero-filled
+static inline int asmReserve(Assembler* a, uint32_t end) {
+    if (end > ASM_MAX_IMAGE) {
+        return asmFail(a, "image would end at 0x%X, past the end of memory", end);
+    }
+    if (end > a->capacity) {
+        uint32_t capacity = a->capacity ? a->capacity : 4096;
+        while (capacity < end) {
+            capacity *= 2;
+        }
+        uint8_t* image = realloc(a->image, capacity);
+        if (image == NULL) {
+            return asmFail(a, "out of memory");
+        }
+        memset(image + a->capacity, 0, capacity - a->capacity);
+        a->image = image;
+        a->capacity = capacity;
+    }
+    if (end > a->size) {
+        a->size = end;
+    }
+    return 1;
+}
+
+static inline int asmEmit(Assembler* a, uint32_t word) {
+    if (a->pc % 4 != 0) {
+        return asmFail(a, "instruction or word at unaligned address 0x%X", a->pc);
+    }
+    if (!asmReserve(a, a->pc + 4)) {
+        return 0;
+    }
+    a->image[a->pc] = word >> 24; // Big-endian
+    a->image[a->pc + 1] = word >> 16;
+    a->image[a->pc + 2] = word >> 8;
+    a->image[a->pc + 3] = word;
+    a->pc += 4;
+    return 1;
+}
+
+static inline uint32_t asmReadWord(Assembler* a, uint32_t address) {
+    return (a->image[address] << 24) | (a->image[address + 1] << 16) | (a->image[address + 2] << 8) | a->image[address + 3];
+}
+
+static inline void asmPatchWord(Assembler* a, uint32_t address, uint32_t word) {
+    a->image[address] = word >> 24;
+    a->image[address + 1] = word >> 16;
+    a->image[address + 2] = word >> 8;
+    a->image[address + 3] = word;
+}
+
+static inline AsmLabel* asmFindLabel(Assembler* a, const char* name) {
+    for (int i = 0; i < a->label_count; ++i) {
+        if (strcmp(a->labels[i].name, name) == 0) {
+            return &a->labels[i];
+        }
+    }
+    return NULL;
+}
+
+static inline int asmDefineLabel(Assembler* a, const char* name, uint32_t address) {
+    if (strlen(name) >= ASM_NAME_LENGTH) {
+        return asmFail(a, "label too long: %s", name);
+    }
+    if (asmFindLabel(a, name) != NULL) {
+        return asmFail(a, "label defined twice: %s", name);
+    }
+    if (a->label_count == a->label_capacity) {
+        a->label_capacity = a->label_capacity ? a->label_capacity * 2 : 64;
+        a->labels = realloc(a->labels, a->label_capacity * sizeof(AsmLabel));
+        if (a->labels == NULL) {
+            fprintf(stderr, "Out of memory for the assembler\n");
+            exit(1);
+        }
+    }
+    strcpy(a->labels[a->label_count].name, name);
+    a->labels[a->label_count++].address = address;
+    return 1;
+}
+
+// Labels may be used before they are defined; everything is patched by asmFinish
+static inline int asmAddFixup(Assembler* a, AsmFixupKind kind, const char* label, int32_t addend) {
+    if (strlen(label) >= ASM_NAME_LENGTH) {
+        return asmFail(a, "label too long: %s", label);
+    }
+    if (a->fixup_count == a->fixup_capacity) {
+        a->fixup_capacity = a->fixup_capacity ? a->fixup_capacity * 2 : 64;
+        a->fixups = realloc(a->fixups, a->fixup_capacity * sizeof(AsmFixup));
+        if (a->fixups == NULL) {
+            fprintf(stderr, "Out of memory for the assembler\n");
+            exit(1);
+        }
+    }
+    AsmFixup* fixup = &a->fixups[a->fixup_count++];
+    fixup->kind = kind;
+    fixup->address = a->pc;
+    strcpy(fixup->label, label);
+    fixup->addend = addend;
+    fixup->line = a->line;
+    return 1;
+}
+
+// Register number, or -1 with the error set
+static inline int asmRegister(Assembler* a, const char* text, int fp) {
+    if (text[0] != '$') {
+        return asmFail(a, "expected a register: %s", text) - 1;
+    }
+    text++;
+    if (fp) {
+        if (text[0] != 'f' || !isdigit((unsigned char)text[1])) {
+            return asmFail(a, "expected an FP register: $%s", text) - 1;
+        }
+        text++;
+    }
+    if (isdigit((unsigned char)text[0])) {
+        char* end;
+        long number = strtol(text, &end, 10);
+        if (*end == '\0' && number >= 0 && number < 32) {
+            return number;
+        }
+    } else if (!fp) {
+        for (int i = 0; i < 32; ++i) {
+            if (strcmp(text, asm_register_names[i]) == 0) {
+                return i;
+            }
+        }
+        if (strcmp(text, "s8") == 0) {
+            return 30;
+        }
+    }
+    return asmFail(a, "unknown register: $%s", text) - 1;
+}
+
+static inline int asmIsNumber(const char* text) {
+    return isdigit((unsigned char)text[0]) || ((text[0] == '-' || text[0] == '+') && isdigit((unsigned char)text[1]));
+}
+
+static inline int asmNumber(Assembler* a, const char* text, int64_t* value) {
+    char* end;
+    *value = strtoll(text, &end, 0);
+    if (end == text || *end != '\0') {
+        return asmFail(a, "expected a number: %s", text);
+    }
+    return 1;
+}
+
+// "label", "label+8" or "label-4"
+static inline int asmSymbol(Assembler* a, const char* text, char* label, int32_t* addend) {
+    size_t length = strcspn(text, "+-");
+    if (length == 0 || length >= ASM_NAME_LENGTH) {
+        return asmFail(a, "expected a label: %s", text);
+    }
+    memcpy(label, text, length);
+    label[length] = '\0';
+    *addend = 0;
+    if (text[length] != '\0') {
+        int64_t value;
+        if (!asmNumber(a, text + length, &value)) {
+            return 0;
+        }
+        *addend = (int32_t)value;
+    }
+    return 1;
+}
+
+static inline int asmImmediate(Assembler* a, const char* text, int is_unsigned, uint32_t* field) {
+    int64_t value;
+    if (!asmNumber(a, text, &value)) {
+        return 0;
+    }
+    if (is_unsigned ? value < -32768 || value > 65535 : value < -32768 || value > 32767) {
+        return asmFail(a, "immediate out of range: %s", text);
+    }
+    *field = (uint32_t)value & 0xFFFF;
+    return 1;
+}
+
+// Branch or jump target, a label or an absolute address
+static inline int asmTarget(Assembler* a, const char* text, AsmFixupKind kind) {
+    char label[ASM_NAME_LENGTH];
+    int32_t addend;
+    if (asmIsNumber(text)) {
+        int64_t value;
+        if (!asmNumber(a, text, &value)) {
+            return 0;
+        }
+        snprintf(label, sizeof(label), ".");
+        return asmAddFixup(a, kind, label, (int32_t)value);
+    }
+    return asmSymbol(a, text, label, &addend) && asmAddFixup(a, kind, label, addend);
+}
+
+// "offset(base)"; the offset may be empty or a label
+static inline int asmMemoryOperand(Assembler* a, const char* text, uint32_t* offset, int* base) {
+    const char* open = strchr(text, '(');
+    size_t length = open ? (size_t)(open - text) : 0;
+    if (open == NULL || text[strlen(text) - 1] != ')' || length >= 32) {
+        return asmFail(a, "expected offset($base): %s", text);
+    }
+    char number[32], reg[16];
+    memcpy(number, text, length);
+    number[length] = '\0';
+    size_t reg_length = strlen(open + 1) - 1;
+    if (reg_length >= sizeof(reg)) {
+        return asmFail(a, "expected offset($base): %s", text);
+    }
+    memcpy(reg, open + 1, reg_length);
+    reg[reg_length] = '\0';
+    *offset = 0;
+    if (length > 0 && asmIsNumber(number)) {
+        if (!asmImmediate(a, number, 0, offset)) {
+            return 0;
+        }
+    } else if (length > 0) { // A label in the low 32KB, as in lw $t0, table($zero)
+        char label[ASM_NAME_LENGTH];
+        int32_t addend;
+        if (!asmSymbol(a, number, label, &addend) || !asmAddFixup(a, FIX_OFFSET, label, addend)) {
+            return 0;
+        }
+    }
+    *base = asmRegister(a, reg, 0);
+    return *base >= 0;
+}
+
+static inline int asmOperandCount(Assembler* a, const char* mnemonic, int count, int expected) {
+    return count == expected ? 1 : asmFail(a, "%s takes %d operand%s", mnemonic, expected, expected == 1 ? "" : "s");
+}
+
+// Parses count registers into out; 0 (with the error set) when any is bad
+static inline int asmRegisters(Assembler* a, char** operands, int count, int fp, int* out) {
+    for (int i = 0; i < count; ++i) {
+        out[i] = asmRegister(a, operands[i], fp);
+        if (out[i] < 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Operands and encoding follow the instruction's syntax in isa.h
+static inline int asmIsaInstruction(Assembler* a, const IsaInfo* info, const char* mnemonic, char** operands, int count) {
+    uint32_t word = (uint32_t)info->opcode << 26 | (info->opcode == 0x00 || info->opcode == 0x1C ? info->key : 0);
+    int r[3];
+    uint32_t immediate;
+    switch ((IsaSyntax)info->syntax) {
+        case ISA_SYNTAX_NONE:
+            return asmOperandCount(a, mnemonic, count, 0) && asmEmit(a, word);
+        case ISA_SYNTAX_R3:
+            return asmOperandCount(a, mnemonic, count, 3) && asmRegisters(a, operands, 3, 0, r) &&
+                   asmEmit(a, word | r[1] << 21 | r[2] << 16 | r[0] << 11);
+        case ISA_SYNTAX_SHIFT:
+            if (!asmOperandCount(a, mnemonic, count, 3) || !asmRegisters(a, operands, 2, 0, r) ||
+                !asmImmediate(a, operands[2], 1, &immediate)) {
+                return 0;
+            }
+            if (immediate > 31) {
+                return asmFail(a, "shift amount out of range: %s", operands[2]);
+            }
+            return asmEmit(a, word | r[1] << 16 | r[0] << 11 | immediate << 6);
+        case ISA_SYNTAX_RS:
+            return asmOperandCount(a, mnemonic, count, 1) && asmRegisters(a, operands, 1, 0, r) &&
+                   asmEmit(a, word | r[0] << 21);
+        case ISA_SYNTAX_RD:
+            return asmOperandCount(a, mnemonic, count, 1) && asmRegisters(a, operands, 1, 0, r) &&
+                   asmEmit(a, word | r[0] << 11);
+        case ISA_SYNTAX_RS_RT:
+            return asmOperandCount(a, mnemonic, count, 2) && asmRegisters(a, operands, 2, 0, r) &&
+                   asmEmit(a, word | r[0] << 21 | r[1] << 16);
+        case ISA_SYNTAX_I:
+            return asmOperandCount(a, mnemonic, count, 3) && asmRegisters(a, operands, 2, 0, r) &&
+                   asmImmediate(a, operands[2], info->immediate == ISA_IMM_ZERO, &immediate) &&
+                   asmEmit(a, word | r[1] << 21 | r[0] << 16 | immediate);
+        case ISA_SYNTAX_LUI:
+            return asmOperandCount(a, mnemonic, count, 2) && asmRegisters(a, operands, 1, 0, r) &&
+                   asmImmediate(a, operands[1], 1, &immediate) && asmEmit(a, word | r[0] << 16 | immediate);
+        case ISA_SYNTAX_BRANCH:
+            return asmOperandCount(a, mnemonic, count, 3) && asmRegisters(a, operands, 2, 0, r) &&
+                   asmTarget(a, operands[2], FIX_BRANCH) && asmEmit(a, word | r[0] << 21 | r[1] << 16);
+        case ISA_SYNTAX_JUMP:
+            return asmOperandCount(a, mnemonic, count, 1) && asmTarget(a, operands[0], FIX_JUMP) && asmEmit(a, word);
+        case ISA_SYNTAX_MEM:
+        case ISA_SYNTAX_FMEM:
+            if (!asmOperandCount(a, mnemonic, count, 2)) {
+                return 0;
+            }
+            r[0] = asmRegister(a, operands[0], info->syntax == ISA_SYNTAX_FMEM);
+            return r[0] >= 0 && asmMemoryOperand(a, operands[1], &immediate, &r[1]) &&
+                   asmEmit(a, word | r[1] << 21 | r[0] << 16 | immediate);
+        case ISA_SYNTAX_COP1:
+            break;
+    }
+    return asmFail(a, "unknown instruction: %s", mnemonic);
+}
+
+static inline int asmInstruction(Assembler* a, const char* mnemonic, char** operands, int count) {
+    for (int op = ISA_NOP + 1; op < ISA_OP_COUNT; ++op) {
+        if (isa_info[op].syntax != ISA_SYNTAX_COP1 && strcmp(mnemonic, isa_info[op].name) == 0) {
+            return asmIsaInstruction(a, &isa_info[op], mnemonic, operands, count);
+        }
+    }
+    const AsmOpcode* op = NULL;
+    uint32_t fmt = 0;
+    for (size_t i = 0; i < sizeof(asm_cop1_opcodes) / sizeof(asm_cop1_opcodes[0]); ++i) {
+        if (strcmp(mnemonic, asm_cop1_opcodes[i].name) == 0) {
+            op = &asm_cop1_opcodes[i];
+        }
+    }
+    const char* suffix = strrchr(mnemonic, '.');
+    if (op == NULL && suffix != NULL && suffix[2] == '\0' && (suffix[1] == 's' || suffix[1] == 'd' || suffix[1] == 'w')) {
+        char base[16];
+        size_t length = suffix - mnemonic;
+        if (length < sizeof(base)) {
+            memcpy(base, mnemonic, length);
+            base[length] = '\0';
+            for (size_t i = 0; i < sizeof(asm_fp_opcodes) / sizeof(asm_fp_opcodes[0]); ++i) {
+                if (strcmp(base, asm_fp_opcodes[i].name) == 0) {
+                    op = &asm_fp_opcodes[i];
+                }
+            }
+            fmt = suffix[1] == 's' ? FMT_S : suffix[1] == 'd' ? FMT_D : FMT_W;
+        }
+    }
+    if (op == NULL) {
+        return asmFail(a, "unknown instruction: %s", mnemonic);
+    }
+
+    int r[3];
+    switch (op->format) {
+        case ASM_FP3:
+            return asmOperandCount(a, mnemonic, count, 3) && asmRegisters(a, operands, 3, 1, r) &&
+                   asmEmit(a, 0x11u << 26 | fmt << 21 | r[2] << 16 | r[1] << 11 | r[0] << 6 | op->funct);
+        case ASM_FP2:
+            return asmOperandCount(a, mnemonic, count, 2) && asmRegisters(a, operands, 2, 1, r) &&
+                   asmEmit(a, 0x11u << 26 | fmt << 21 | r[1] << 11 | r[0] << 6 | op->funct);
+        case ASM_FPCMP: // Condition code 0
+            return asmOperandCount(a, mnemonic, count, 2) && asmRegisters(a, operands, 2, 1, r) &&
+                   asmEmit(a, 0x11u << 26 | fmt << 21 | r[1] << 16 | r[0] << 11 | op->funct);
+        case ASM_FPMOVE:
+            if (!asmOperandCount(a, mnemonic, count, 2) || !asmRegisters(a, operands, 1, 0, r)) {
+                return 0;
+            }
+            r[1] = asmRegister(a, operands[1], 1);
+            return r[1] >= 0 && asmEmit(a, 0x11u << 26 | op->funct << 21 | r[0] << 16 | r[1] << 11);
+        case ASM_BC1:
+            return asmOperandCount(a, mnemonic, count, 1) && asmTarget(a, operands[0], FIX_BRANCH) &&
+                   asmEmit(a, 0x11u << 26 | COP1_BC << 21 | op->funct << 16);
+    }
+    return asmFail(a, "unknown instruction: %s", mnemonic);
+}
+
+// li and la use lui/addiu; la is always two instructions; li is one when the value fits a signed 16-bit immediate.
+static inline int asmPseudo(Assembler* a, const char* mnemonic, char** operands, int count, int* handled) {
+    char text[ASM_LINE_LENGTH];
+    *handled = 1;
+    if (strcmp(mnemonic, "nop") == 0) {
+        return asmOperandCount(a, mnemonic, count, 0) && asmEmit(a, 0);
+    }
+    if (strcmp(mnemonic, "move") == 0) {
+        if (!asmOperandCount(a, mnemonic, count, 2)) {
+            return 0;
+        }
+        char* args[3] = { operands[0], operands[1], "$zero" };
+        return asmInstruction(a, "addu", args, 3);
+    }
+    if (strcmp(mnemonic, "li") == 0) {
+        int64_t value;
+        if (!asmOperandCount(a, mnemonic, count, 2) || !asmNumber(a, operands[1], &value)) {
+            return 0;
+        }
+        if (value < -2147483648LL || value > 4294967295LL) {
+            return asmFail(a, "li value out of range: %s", operands[1]);
+        }
+        char* args[3] = { operands[0], "$zero", text };
+        if (value >= -32768 && value <= 32767) {
+            snprintf(text, sizeof(text), "%d", (int)value);
+            return asmInstruction(a, "addiu", args, 3);
+        }
+        uint32_t bits = (uint32_t)value;
+        char* lui_args[2] = { operands[0], text };
+        snprintf(text, sizeof(text), "%u", ((bits + 0x8000) >> 16) & 0xFFFF); // Carries into the sign-extended low half
+        if (!asmInstruction(a, "lui", lui_args, 2)) {
+            return 0;
+        }
+        if ((bits & 0xFFFF) == 0) {
+            return 1;
+        }
+        args[1] = operands[0];
+        snprintf(text, sizeof(text), "%d", (int16_t)(bits & 0xFFFF));
+        return asmInstruction(a, "addiu", args, 3);
+    }
+    if (strcmp(mnemonic, "la") == 0) {
+        char label[ASM_NAME_LENGTH];
+        int32_t addend;
+        int rt;
+        if (!asmOperandCount(a, mnemonic, count, 2) || (rt = asmRegister(a, operands[0], 0)) < 0 ||
+            !asmSymbol(a, operands[1], label, &addend)) {
+            return 0;
+        }
+        return asmAddFixup(a, FIX_HI, label, addend) && asmEmit(a, 0x0Fu << 26 | rt << 16) &&
+               asmAddFixup(a, FIX_LO, label, addend) && asmEmit(a, 0x09u << 26 | rt << 21 | rt << 16);
+    }
+    if (strcmp(mnemonic, "b") == 0) {
+        if (!asmOperandCount(a, mnemonic, count, 1)) {
+            return 0;
+        }
+        char* args[3] = { "$zero", "$zero", operands[0] };
+        return asmInstruction(a, "beq", args, 3);
+    }
+    if (strcmp(mnemonic, "beqz") == 0 || strcmp(mnemonic, "bnez") == 0) {
+        if (!asmOperandCount(a, mnemonic, count, 2)) {
+            return 0;
+        }
+        char* args[3] = { operands[0], "$zero", operands[1] };
+        return asmInstruction(a, mnemonic[1] == 'e' ? "beq" : "bne", args, 3);
+    }
+    *handled = 0;
+    return 1;
+}
+
+static inline int asmDirective(Assembler* a, const char* name, char** operands, int count) {
+    int64_t value;
+    if (strcmp(name, ".org") == 0) {
+        if (!asmOperandCount(a, name, count, 1) || !asmNumber(a, operands[0], &value)) {
+            return 0;
+        }
+        if (value < 0 || value > ASM_MAX_IMAGE) {
+            return asmFail(a, ".org out of range: %s", operands[0]);
+        }
+        a->pc = (uint32_t)value;
+        return 1;
+    }
+    if (strcmp(name, ".align") == 0) {
+        if (!asmOperandCount(a, name, count, 1) || !asmNumber(a, operands[0], &value)) {
+            return 0;
+        }
+        if (value < 0 || value > 24) {
+            return asmFail(a, ".align out of range: %s", operands[0]);
+        }
+        uint32_t alignment = 1u << value;
+        a->pc = (a->pc + alignment - 1) & ~(alignment - 1);
+        return 1;
+    }
+    if (strcmp(name, ".space") == 0) {
+        if (!asmOperandCount(a, name, count, 1) || !asmNumber(a, operands[0], &value)) {
+            return 0;
+        }
+        if (value < 0 || value > ASM_MAX_IMAGE - a->pc) {
+            return asmFail(a, ".space out of range: %s", operands[0]);
+        }
+        a->pc += (uint32_t)value;
+        return asmReserve(a, a->pc);
+    }
+    if (strcmp(name, ".word") == 0) {
+        for (int i = 0; i < count; ++i) {
+            if (asmIsNumber(operands[i])) {
+                if (!asmNumber(a, operands[i], &value) || !asmEmit(a, (uint32_t)value)) {
+                    return 0;
+                }
+            } else {
+                char label[ASM_NAME_LENGTH];
+                int32_t addend;
+                if (!asmSymbol(a, operands[i], label, &addend) || !asmAddFixup(a, FIX_WORD, label, addend) || !asmEmit(a, 0)) {
+                    return 0;
+                }
+            }
+        }
+        return 1;
+    }
+    return asmFail(a, "unknown directive: %s", name);
+}
+
+// Assembles one statement; returns 0 and sets a->error on the first error
+static inline int asmLine(Assembler* a, const char* source) {
+    char text[ASM_LINE_LENGTH];
+    a->line++;
+    if (a->error[0] != '\0') {
+        return 0;
+    }
+    if (strlen(source) >= sizeof(text)) {
+        return asmFail(a, "line too long");
+    }
+    strcpy(text, source);
+    text[strcspn(text, "#\n")] = '\0';
+
+    char* cursor = text;
+    while (1) { // Labels
+        while (isspace((unsigned char)*cursor)) {
+            cursor++;
+        }
+        char* colon = strchr(cursor, ':');
+        if (colon == NULL || (size_t)(colon - cursor) != strcspn(cursor, " \t:")) {
+            break;
+        }
+        *colon = '\0';
+        if (!asmDefineLabel(a, cursor, a->pc)) {
+            return 0;
+        }
+        cursor = colon + 1;
+    }
+    if (*cursor == '\0') {
+        return 1;
+    }
+
+    char* mnemonic = cursor;
+    cursor += strcspn(cursor, " \t");
+    if (*cursor != '\0') {
+        *cursor++ = '\0';
+    }
+    char* operands[8];
+    int count = 0;
+    for (char* operand = strtok(cursor, ","); operand != NULL; operand = strtok(NULL, ",")) {
+        while (isspace((unsigned char)*operand)) {
+            operand++;
+        }
+        char* end = operand + strlen(operand);
+        while (end > operand && isspace((unsigned char)end[-1])) {
+            *--end = '\0';
+        }
+        if (count == 8) {
+            return asmFail(a, "too many operands");
+        }
+        operands[count++] = operand;
+    }
+
+    if (mnemonic[0] == '.' && strchr(mnemonic + 1, '.') == NULL) {
+        return asmDirective(a, mnemonic, operands, count);
+    }
+    int handled;
+    int ok = asmPseudo(a, mnemonic, operands, count, &handled);
+    if (!handled) {
+        ok = asmInstruction(a, mnemonic, operands, count);
+    }
+    if (ok && a->pc >= 4) { // Fill the delay slot; labels and fixups only change the offset bits
+        IsaClass cls = isaDecode(asmReadWord(a, a->pc - 4)).cls;
+        if (cls == ISA_CLASS_BRANCH || cls == ISA_CLASS_BRANCH_FP || cls == ISA_CLASS_JUMP || cls == ISA_CLASS_JUMP_REG) {
+            a->delay_slots++;
+            return asmEmit(a, 0);
+        }
+    }
+    return ok;
+}
+
+static inline int asmPrintf(Assembler* a, const char* format, ...) {
+    char text[ASM_LINE_LENGTH];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    if (length < 0 || length >= (int)sizeof(text)) {
+        a->line++;
+        return asmFail(a, "line too long");
+    }
+    return asmLine(a, text);
+}
+
+// Resolves every label reference; returns 0 and sets a->error if one is undefined or out of reach
+static inline int asmFinish(Assembler* a) {
+    for (int i = 0; i < a->fixup_count && a->error[0] == '\0'; ++i) {
+        AsmFixup* fixup = &a->fixups[i];
+        uint32_t target = fixup->addend;
+        if (strcmp(fixup->label, ".") != 0) {
+            AsmLabel* label = asmFindLabel(a, fixup->label);
+            if (label == NULL) {
+                a->line = fixup->line;
+                return asmFail(a, "undefined label: %s", fixup->label);
+            }
+            target += label->address;
+        }
+        uint32_t word = asmReadWord(a, fixup->address);
+        switch (fixup->kind) {
+            case FIX_BRANCH: {
+                int32_t offset = (int32_t)(target - (fixup->address + 4)) >> 2;
+                if (target % 4 != 0 || offset < -32768 || offset > 32767) {
+                    a->line = fixup->line;
+                    return asmFail(a, "branch target out of range: %s", fixup->label);
+                }
+                word |= (uint32_t)offset & 0xFFFF;
+                break;
+            }
+            case FIX_JUMP:
+                if (target % 4 != 0 || (target & 0xF0000000) != ((fixup->address + 4) & 0xF0000000)) {
+                    a->line = fixup->line;
+                    return asmFail(a, "jump target out of range: %s", fixup->label);
+                }
+                word |= (target >> 2) & 0x3FFFFFF;
+                break;
+            case FIX_HI:
+                word |= ((target + 0x8000) >> 16) & 0xFFFF;
+                break;
+            case FIX_LO:
+                word |= target & 0xFFFF;
+                break;
+            case FIX_OFFSET:
+                if (target > 0x7FFF) {
+                    a->line = fixup->line;
+                    return asmFail(a, "label does not fit a 16-bit offset: %s", fixup->label);
+                }
+                word |= target;
+                break;
+            case FIX_WORD:
+                word = target;
+                break;
+        }
+        asmPatchWord(a, fixup->address, word);
+    }
+    return a->error[0] == '\0';
+}
+
+static inline int asmWrite(Assembler* a, const char* filename) {
+    FILE* file = fopen(filename, "wb");
+    if (file == NULL) {
+        perror(filename);
+        return 0;
+    }
+    size_t written = fwrite(a->image, 1, a->size, file);
+    fclose(file);
+    return written == a->size;
+}
+
+#endif
@@ -0,0 +1,405 @@
+// SimPoint-style phase analysis. hw2 profiles a basic-block vector per interval of a fixed number of
+// instructions: the instructions executed in every block, keyed by the block's first PC. Each vector is
+// normalized and reduced by a random projection, the intervals are clustered with k-means, and the
+// interval nearest each centroid stands for its cluster, weighted by the share of instructions in it.
+// hw3 and hw4 read the resulting file and simulate only those intervals in detail. Link with -lm.
+#ifndef SIMPOINT_H
+#define SIMPOINT_H
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "isa.h"
+
+#define SIMPOINT_DIMENSIONS 15 // Projected vector size, as in SimPoint
+#define SIMPOINT_MAX_CLUSTERS 30 // Upper bound of the cluster count searched
+#define SIMPOINT_BLOCKS 4096 // Distinct blocks per interval; more are dropped from the vector
+#define SIMPOINT_SEEDS 5 // k-means restarts per cluster count; the lowest distortion is kept
+#define SIMPOINT_ITERATIONS 100
+#define SIMPOINT_BIC_THRESHOLD 0.9 // Smallest k whose BIC reaches this fraction of the range seen
+
+typedef struct {
+    uint32_t pc;
+    uint64_t instructions; // 0 while the slot is free
+} SimpointBlock;
+
+typedef struct {
+    uint64_t interval_length;
+    int max_clusters;
+    // Interval being profiled
+    SimpointBlock blocks[SIMPOINT_BLOCKS];
+    int used[SIMPOINT_BLOCKS]; // Slots taken in blocks, to clear them
+    int used_count;
+    uint64_t dropped; // Instructions of blocks that found the table full
+    uint32_t block_start, last_pc;
+    int block_ended; // Last instruction transferred control
+    uint64_t block_instructions, interval_instructions;
+    // Finished intervals
+    double* vectors; // interval_count * SIMPOINT_DIMENSIONS
+    uint64_t* lengths; // Instructions of each interval; only the last one may be short
+    int interval_count, capacity;
+    uint64_t instructions; // Whole program
+    uint64_t tail; // Instructions after the last interval, too few to cluster
+    // Clustering
+    int cluster_count;
+    int* assignment;
+    double bic[SIMPOINT_MAX_CLUSTERS + 1];
+    int representatives[SIMPOINT_MAX_CLUSTERS];
+    double weights[SIMPOINT_MAX_CLUSTERS];
+} SimpointProfile;
+
+// What hw3 and hw4 read back: the intervals to simulate, in program order
+typedef struct {
+    int interval;
+    double weight;
+} SimpointPoint;
+
+typedef struct {
+    uint64_t interval_length, instructions;
+    int count;
+    SimpointPoint points[SIMPOINT_MAX_CLUSTERS];
+} SimpointSet;
+
+static inline SimpointProfile* simpointCreate(uint64_t interval_length, int max_clusters) {
+    SimpointProfile* profile = calloc(1, sizeof(SimpointProfile));
+    if (profile == NULL) {
+        perror("Error allocating the SimPoint profile");
+        exit(1);
+    }
+    profile->interval_length = interval_length;
+    profile->max_clusters = max_clusters;
+    profile->block_ended = 1;
+    return profile;
+}
+
+static inline uint64_t simpointMix(uint64_t key) {
+    key += 0x9E3779B97F4A7C15ull;
+    key = (key ^ (key >> 30)) * 0xBF58476D1CE4E5B9ull;
+    key = (key ^ (key >> 27)) * 0x94D049BB133111EBull;
+    return key ^ (key >> 31);
+}
+
+// Entry of the random projection matrix for a block and a dimension, uniform in [-1, 1). Computed from
+// the PC, so the matrix needs no storage and is the same in every run.
+static inline double simpointProjection(uint32_t pc, int dimension) {
+    return (simpointMix(((uint64_t)pc << 8) | (uint64_t)dimension) >> 11) * (2.0 / 9007199254740992.0) - 1.0;
+}
+
+static inline void simpointAddBlock(SimpointProfile* profile) {
+    if (profile->block_instructions == 0) {
+        return;
+    }
+    uint32_t index = (uint32_t)simpointMix(profile->block_start) % SIMPOINT_BLOCKS;
+    for (int probe = 0; probe < SIMPOINT_BLOCKS; ++probe) {
+        SimpointBlock* block = &profile->blocks[(index + probe) % SIMPOINT_BLOCKS];
+        if (block->instructions == 0) {
+            block->pc = profile->block_start;
+            profile->used[profile->used_count++] = (index + probe) % SIMPOINT_BLOCKS;
+        }
+        if (block->pc == profile->block_start) {
+            block->instructions += profile->block_instructions;
+            profile->block_instructions = 0;
+            return;
+        }
+    }
+    profile->dropped += profile->block_instructions;
+    profile->block_instructions = 0;
+}
+
+// Projects the normalized vector of the interval just finished and clears the table for the next one
+static inline void simpointEndInterval(SimpointProfile* profile) {
+    simpointAddBlock(profile);
+    if (profile->interval_count == profile->capacity) {
+        profile->capacity = profile->capacity ? profile->capacity * 2 : 256;
+        profile->vectors = realloc(profile->vectors, profile->capacity * SIMPOINT_DIMENSIONS * sizeof(double));
+        profile->lengths = realloc(profile->lengths, profile->capacity * sizeof(uint64_t));
+        if (profile->vectors == NULL || profile->lengths == NULL) {
+            fprintf(stderr, "Out of memory for basic-block vectors\n");
+            exit(1);
+        }
+    }
+    double* vector = &profile->vectors[profile->interval_count * SIMPOINT_DIMENSIONS];
+    memset(vector, 0, SIMPOINT_DIMENSIONS * sizeof(double));
+    for (int i = 0; i < profile->used_count; ++i) {
+        SimpointBlock* block = &profile->blocks[profile->used[i]];
+        double share = (double)block->instructions / profile->interval_instructions;
+        for (int d = 0; d < SIMPOINT_DIMENSIONS; ++d) {
+            vector[d] += share * simpointProjection(block->pc, d);
+        }
+        block->instructions = 0;
+    }
+    profile->used_count = 0;
+    profile->lengths[profile->interval_count++] = profile->interval_instructions;
+    profile->instructions += profile->interval_instructions;
+    profile->interval_instructions = 0;
+}
+
+// One executed instruction. A block starts after a branch, jump or syscall, or wherever control arrives
+// other than from the instruction before; a block cut by an interval boundary counts in both intervals.
+static inline void simpointRetire(SimpointProfile* profile, uint32_t pc, uint32_t instruction) {
+    if (profile->block_ended || pc != profile->last_pc + 4) {
+        simpointAddBlock(profile);
+        profile->block_start = pc;
+    }
+    profile->block_instructions++;
+    profile->interval_instructions++;
+    IsaClass cls = isa_info[isaOp(instruction)].cls;
+    profile->block_ended = cls == ISA_CLASS_BRANCH || cls == ISA_CLASS_BRANCH_FP || cls == ISA_CLASS_JUMP ||
+                           cls == ISA_CLASS_JUMP_REG || cls == ISA_CLASS_SYSCALL;
+    profile->last_pc = pc;
+    if (profile->interval_instructions == profile->interval_length) {
+        simpointEndInterval(profile);
+    }
+}
+
+static inline double simpointDistance(const double* a, const double* b) {
+    double sum = 0.0;
+    for (int d = 0; d < SIMPOINT_DIMENSIONS; ++d) {
+        sum += (a[d] - b[d]) * (a[d] - b[d]);
+    }
+    return sum;
+}
+
+// Lloyd's k-means from k distinct intervals picked by seed; returns the distortion (sum of squared
+// distances to the centroids) and leaves the assignment and centroids behind
+static inline double simpointKmeansOnce(const SimpointProfile* profile, int k, uint64_t seed, int* assignment,
+                                        double* centroids) {
+    int n = profile->interval_count;
+    for (int c = 0; c < k; ++c) {
+        int pick;
+        int unique;
+        do { // Distinct starting intervals; k never exceeds n
+            seed = simpointMix(seed);
+            pick = (int)(seed % (uint64_t)n);
+            unique = 1;
+            for (int other = 0; other < c; ++other) {
+                unique &= assignment[other] != pick;
+            }
+        } while (!unique);
+        assignment[c] = pick; // Borrowed to remember the picks
+        memcpy(&centroids[c * SIMPOINT_DIMENSIONS], &profile->vectors[pick * SIMPOINT_DIMENSIONS],
+               SIMPOINT_DIMENSIONS * sizeof(double));
+    }
+    for (int i = 0; i < n; ++i) {
+        assignment[i] = -1;
+    }
+    int* sizes = calloc(k, sizeof(int));
+    double distortion = 0.0;
+    for (int iteration = 0; iteration < SIMPOINT_ITERATIONS; ++iteration) {
+        int changed = 0;
+        distortion = 0.0;
+        for (int i = 0; i < n; ++i) {
+            const double* vector = &profile->vectors[i * SIMPOINT_DIMENSIONS];
+            int best = 0;
+            double best_distance = simpointDistance(vector, centroids);
+            for (int c = 1; c < k; ++c) {
+                double distance = simpointDistance(vector, &centroids[c * SIMPOINT_DIMENSIONS]);
+                if (distance < best_distance) {
+                    best = c;
+                    best_distance = distance;
+                }
+            }
+            changed |= assignment[i] != best;
+            assignment[i] = best;
+            distortion += best_distance;
+        }
+        if (!changed) {
+            break;
+        }
+        memset(centroids, 0, k * SIMPOINT_DIMENSIONS * sizeof(double));
+        memset(sizes, 0, k * sizeof(int));
+        for (int i = 0; i < n; ++i) {
+            sizes[assignment[i]]++;
+            for (int d = 0; d < SIMPOINT_DIMENSIONS; ++d) {
+                centroids[assignment[i] * SIMPOINT_DIMENSIONS + d] += profile->vectors[i * SIMPOINT_DIMENSIONS + d];
+            }
+        }
+        for (int c = 0; c < k; ++c) {
+            for (int d = 0; d < SIMPOINT_DIMENSIONS && sizes[c] > 0; ++d) {
+                centroids[c * SIMPOINT_DIMENSIONS + d] /= sizes[c]; // An emptied cluster keeps a zero centroid
+            }
+        }
+    }
+    free(sizes);
+    return distortion;
+}
+
+// Best of SIMPOINT_SEEDS runs; the same k always gives the same clustering
+static inline double simpointKmeans(const SimpointProfile* profile, int k, int* assignment, double* centroids) {
+    int n = profile->interval_count;
+    int* trial = malloc((n > k ? n : k) * sizeof(int));
+    double* trial_centroids = malloc(k * SIMPOINT_DIMENSIONS * sizeof(double));
+    double best = -1.0;
+    for (int seed = 0; seed < SIMPOINT_SEEDS; ++seed) {
+        double distortion = simpointKmeansOnce(profile, k, (uint64_t)k * 1000 + seed, trial, trial_centroids);
+        if (best < 0 || distortion < best) {
+            best = distortion;
+            memcpy(assignment, trial, n * sizeof(int));
+            memcpy(centroids, trial_centroids, k * SIMPOINT_DIMENSIONS * sizeof(double));
+        }
+    }
+    free(trial);
+    free(trial_centroids);
+    return best;
+}
+
+// Bayesian information criterion of a clustering, modelling each cluster as a spherical Gaussian with
+// one shared variance (Pelleg and Moore, as SimPoint scores its k)
+static inline double simpointBic(const SimpointProfile* profile, int k, const int* assignment, double distortion) {
+    int n = profile->interval_count;
+    double variance = n > k ? distortion / ((double)SIMPOINT_DIMENSIONS * (n - k)) : 0.0;
+    if (variance < 1e-12) {
+        variance = 1e-12; // Identical intervals
+    }
+    int* sizes = calloc(k, sizeof(int));
+    for (int i = 0; i < n; ++i) {
+        sizes[assignment[i]]++;
+    }
+    double likelihood = -0.5 * n * SIMPOINT_DIMENSIONS * log(2.0 * M_PI * variance) -
+                        0.5 * SIMPOINT_DIMENSIONS * (n > k ? n - k : 0);
+    for (int c = 0; c < k; ++c) {
+        if (sizes[c] > 0) {
+            likelihood += sizes[c] * log((double)sizes[c] / n);
+        }
+    }
+    free(sizes);
+    double parameters = (double)k * (SIMPOINT_DIMENSIONS + 1);
+    return likelihood - 0.5 * parameters * log((double)n);
+}
+
+// Closes the last interval, picks k by BIC and chooses one interval per cluster. A last interval under
+// half the length would be a cluster of its own, so it is left out unless it is the whole program.
+static inline void simpointFinish(SimpointProfile* profile) {
+    if (profile->interval_instructions >= (profile->interval_length + 1) / 2 ||
+        (profile->interval_count == 0 && profile->interval_instructions > 0)) {
+        simpointEndInterval(profile);
+    } else {
+        profile->tail = profile->interval_instructions;
+        profile->instructions += profile->tail;
+    }
+    int n = profile->interval_count;
+    if (n == 0) {
+        return;
+    }
+    int max_k = profile->max_clusters < n ? profile->max_clusters : n;
+    profile->assignment = malloc(n * sizeof(int));
+    double* centroids = malloc(max_k * SIMPOINT_DIMENSIONS * sizeof(double));
+    double low = 0.0, high = 0.0;
+    for (int k = 1; k <= max_k; ++k) {
+        double distortion = simpointKmeans(profile, k, profile->assignment, centroids);
+        profile->bic[k] = simpointBic(profile, k, profile->assignment, distortion);
+        low = k == 1 || profile->bic[k] < low ? profile->bic[k] : low;
+        high = k == 1 || profile->bic[k] > high ? profile->bic[k] : high;
+    }
+    int k = 1;
+    while (k < max_k && profile->bic[k] < low + SIMPOINT_BIC_THRESHOLD * (high - low)) {
+        ++k;
+    }
+    simpointKmeans(profile, k, profile->assignment, centroids);
+
+    // Nearest interval to each centroid; clusters that ended up empty are dropped
+    profile->cluster_count = 0;
+    for (int c = 0; c < k; ++c) {
+        int nearest = -1;
+        double nearest_distance = 0.0;
+        uint64_t instructions = 0;
+        for (int i = 0; i < n; ++i) {
+            if (profile->assignment[i] != c) {
+                continue;
+            }
+            double distance = simpointDistance(&profile->vectors[i * SIMPOINT_DIMENSIONS], &centroids[c * SIMPOINT_DIMENSIONS]);
+            if (nearest < 0 || distance < nearest_distance) {
+                nearest = i;
+                nearest_distance = distance;
+            }
+            instructions += profile->lengths[i];
+        }
+        if (nearest >= 0) {
+            profile->representatives[profile->cluster_count] = nearest;
+            profile->weights[profile->cluster_count++] = (double)instructions / (profile->instructions - profile->tail);
+        }
+    }
+    free(centroids);
+}
+
+static inline void simpointPrint(FILE* out, const SimpointProfile* profile) {
+    int max_k = profile->max_clusters < profile->interval_count ? profile->max_clusters : profile->interval_count;
+    fprintf(out, "\n*********** SimPoints ************\n");
+    fprintf(out, "%d intervals of %" PRIu64 " instructions, %d clusters chosen from 1-%d by BIC\n", profile->interval_count,
+            profile->interval_length, profile->cluster_count, max_k);
+    if (profile->dropped > 0) {
+        fprintf(out, "%" PRIu64 " instructions left out of the vectors, block table full\n", profile->dropped);
+    }
+    fprintf(out, "BIC:");
+    for (int k = 1; k <= max_k; ++k) {
+        fprintf(out, " %.1f", profile->bic[k]);
+    }
+    fprintf(out, "\nInterval  First instruction  Weight\n");
+    for (int c = 0; c < profile->cluster_count; ++c) {
+        fprintf(out, "%8d  %17" PRIu64 "  %.4f\n", profile->representatives[c],
+                (uint64_t)profile->representatives[c] * profile->interval_length, profile->weights[c]);
+    }
+}
+
+// One "point interval weight" line per cluster, after the interval length and the instruction count
+static inline void simpointWrite(const SimpointProfile* profile, const char* filename, const char* binary) {
+    FILE* file = fopen(filename, "w");
+    if (file == NULL) {
+        perror("Error opening SimPoint file");
+        exit(1);
+    }
+    fprintf(file, "# %s: %d intervals, %d clusters\n", binary, profile->interval_count, profile->cluster_count);
+    fprintf(file, "length %" PRIu64 "\n", profile->interval_length);
+    fprintf(file, "instructions %" PRIu64 "\n", profile->instructions);
+    for (int c = 0; c < profile->cluster_count; ++c) {
+        fprintf(file, "point %d %.6f\n", profile->representatives[c], profile->weights[c]);
+    }
+    fclose(file);
+}
+
+static int simpointComparePoints(const void* a, const void* b) {
+    return ((const SimpointPoint*)a)->interval - ((const SimpointPoint*)b)->interval;
+}
+
+// Reads a file written by simpointWrite; the points come back in program order with weights summing to 1
+static inline void simpointRead(const char* filename, SimpointSet* set) {
+    FILE* file = fopen(filename, "r");
+    if (file == NULL) {
+        perror("Error opening SimPoint file");
+        exit(1);
+    }
+    memset(set, 0, sizeof(SimpointSet));
+    char line[256];
+    double total = 0.0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        SimpointPoint point;
+        if (line[0] == '#' || line[0] == '\n') {
+            continue;
+        } else if (sscanf(line, "length %" SCNu64, &set->interval_length) == 1 ||
+                   sscanf(line, "instructions %" SCNu64, &set->instructions) == 1) {
+            continue;
+        } else if (sscanf(line, "point %d %lf", &point.interval, &point.weight) == 2 && point.interval >= 0 &&
+                   point.weight >= 0 && set->count < SIMPOINT_MAX_CLUSTERS) {
+            set->points[set->count++] = point;
+            total += point.weight;
+        } else {
+            fprintf(stderr, "%s: bad line: %s", filename, line);
+            exit(1);
+        }
+    }
+    fclose(file);
+    if (set->interval_length == 0 || set->count == 0 || total <= 0) {
+        fprintf(stderr, "%s has no interval length or no points\n", filename);
+        exit(1);
+    }
+    for (int i = 0; i < set->count; ++i) {
+        set->points[i].weight /= total;
+    }
+    qsort(set->points, set->count, sizeof(SimpointPoint), simpointComparePoints);
+}
+
+#endif
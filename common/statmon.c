@@ -0,0 +1,62 @@
+// Live view of a simulator's shared statistics segment (hw2/hw3/hw4 -l name).
+// Build: gcc -O2 -o statmon statmon.c    Usage: statmon name [refresh ms]
+#include "stats.h"
+
+#include <time.h>
+
+// Consistent copy of the segment; the simulator is never blocked, the reader retries instead
+static void readSegment(const StatsShared* shared, StatsShared* copy) {
+    while (1) {
+        uint64_t before = __atomic_load_n(&shared->sequence, __ATOMIC_ACQUIRE);
+        if (before & 1) {
+            continue;
+        }
+        memcpy(copy, shared, sizeof(StatsShared));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&shared->sequence, __ATOMIC_RELAXED) == before) {
+            return;
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s name [refresh ms]\n", argv[0]);
+        return 1;
+    }
+    int refresh = argc > 2 ? atoi(argv[2]) : 1000;
+    char name[64];
+    snprintf(name, sizeof(name), "/%s", argv[1]);
+
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        perror("Error opening shared statistics segment");
+        return 1;
+    }
+    const StatsShared* shared = mmap(NULL, sizeof(StatsShared), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shared == MAP_FAILED || shared->magic != STATS_MAGIC || shared->version != STATS_VERSION) {
+        fprintf(stderr, "%s is not a statistics segment\n", name);
+        return 1;
+    }
+
+    static StatsShared copy;
+    uint64_t last_sequence = 0;
+    while (1) {
+        readSegment(shared, &copy);
+        if (copy.sequence != last_sequence) {
+            last_sequence = copy.sequence;
+            printf("\n[pid %d] cycle %" PRIu64 "%s\n", copy.pid, copy.cycle, copy.finished ? " (finished)" : "");
+            for (uint32_t i = 0; i < copy.count && i < STATS_MAX; ++i) {
+                printf("  %-40s %20" PRIu64 " %14.4f\n", copy.entries[i].name, copy.entries[i].value, copy.entries[i].real);
+            }
+            fflush(stdout);
+        }
+        if (copy.finished) {
+            break;
+        }
+        struct timespec delay = { refresh / 1000, (refresh % 1000) * 1000000L };
+        nanosleep(&delay, NULL);
+    }
+    return 0;
+}
@@ -0,0 +1,286 @@
+// Named 64-bit statistics shared by the simulators: counters, histograms and formulas.
+// Snapshots go to a CSV time series every stats_interval cycles and to a shared-memory
+// segment that statmon (or any other reader) can follow while the simulation runs.
+#ifndef STATS_H
+#define STATS_H
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define STATS_MAX 128 // Registered statistics
+#define STATS_MAX_BUCKETS 32 // Buckets of one histogram
+#define STATS_NAME_SIZE 48 // Name length in the shared segment, including the terminator
+#define STATS_MAGIC 0x53544154 // "STAT"
+#define STATS_VERSION 1
+#define STATS_DEFAULT_INTERVAL 10000 // Cycles between snapshots when only an output is given
+
+typedef enum { STAT_COUNTER, STAT_HISTOGRAM, STAT_FORMULA } StatKind;
+
+typedef struct {
+    const char* name;
+    const char* description;
+    StatKind kind;
+    const uint64_t* value; // Counter: the simulator's own variable
+    int instances; // Counter: instances summed, stride bytes apart (one per core)
+    size_t stride;
+    double (*formula)(void);
+    uint64_t bucket_width; // Histogram: bucket i counts [i * width, (i + 1) * width), the last one also everything above
+    int bucket_count;
+    uint64_t buckets[STATS_MAX_BUCKETS];
+    uint64_t samples, sum;
+} Stat;
+
+typedef struct {
+    char name[STATS_NAME_SIZE];
+    uint64_t value; // Counters, histogram sample counts
+    double real; // Formulas, histogram means
+} StatsSharedEntry;
+
+// Seqlock: the writer makes sequence odd while it updates; a reader copies the segment
+// and retries if sequence was odd or changed in between. The writer never waits.
+typedef struct {
+    uint32_t magic, version;
+    int32_t pid;
+    int32_t finished;
+    uint64_t sequence;
+    uint64_t cycle;
+    uint32_t count;
+    StatsSharedEntry entries[STATS_MAX];
+} StatsShared;
+
+static Stat stats[STATS_MAX];
+static int stats_count = 0;
+static uint64_t stats_interval = 0; // 0 disables snapshots
+static uint64_t stats_next_snapshot = UINT64_MAX; // Never while snapshots are disabled
+static uint64_t stats_last_snapshot = UINT64_MAX;
+static FILE* stats_series = NULL;
+static int stats_series_header = 0;
+static StatsShared* stats_shared = NULL;
+static char stats_shared_name[64];
+
+static inline Stat* statsRegister(const char* name, const char* description, StatKind kind) {
+    if (stats_count == STATS_MAX) {
+        fprintf(stderr, "Too many statistics, %s not registered\n", name);
+        exit(1);
+    }
+    Stat* stat = &stats[stats_count++];
+    memset(stat, 0, sizeof(Stat));
+    stat->name = name;
+    stat->description = description;
+    stat->kind = kind;
+    return stat;
+}
+
+// Sum of instances copies of a counter that live stride bytes apart, e.g. one field of every core
+static inline Stat* statsCounterArray(const char* name, const char* description, const uint64_t* value, int instances,
+                                      size_t stride) {
+    Stat* stat = statsRegister(name, description, STAT_COUNTER);
+    stat->value = value;
+    stat->instances = instances;
+    stat->stride = stride;
+    return stat;
+}
+
+static inline Stat* statsCounter(const char* name, const char* description, const uint64_t* value) {
+    return statsCounterArray(name, description, value, 1, 0);
+}
+
+static inline Stat* statsFormula(const char* name, const char* description, double (*formula)(void)) {
+    Stat* stat = statsRegister(name, description, STAT_FORMULA);
+    stat->formula = formula;
+    return stat;
+}
+
+static inline Stat* statsHistogram(const char* name, const char* description, uint64_t bucket_width, int bucket_count) {
+    Stat* stat = statsRegister(name, description, STAT_HISTOGRAM);
+    stat->bucket_width = bucket_width > 0 ? bucket_width : 1;
+    stat->bucket_count = bucket_count < 1 ? 1 : bucket_count > STATS_MAX_BUCKETS ? STATS_MAX_BUCKETS : bucket_count;
+    return stat;
+}
+
+// Safe to call from several simulator threads at once
+static inline void statsSample(Stat* stat, uint64_t value) {
+    uint64_t bucket = value / stat->bucket_width;
+    if (bucket >= (uint64_t)stat->bucket_count) {
+        bucket = stat->bucket_count - 1;
+    }
+    __atomic_fetch_add(&stat->buckets[bucket], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stat->samples, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stat->sum, value, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t statsValue(const Stat* stat) {
+    if (stat->kind == STAT_HISTOGRAM) {
+        return stat->samples;
+    }
+    if (stat->kind == STAT_FORMULA) {
+        return (uint64_t)stat->formula();
+    }
+    uint64_t total = 0;
+    for (int i = 0; i < stat->instances; ++i) {
+        total += *(const uint64_t*)((const char*)stat->value + i * stat->stride);
+    }
+    return total;
+}
+
+static inline double statsReal(const Stat* stat) {
+    if (stat->kind == STAT_FORMULA) {
+        return stat->formula();
+    }
+    if (stat->kind == STAT_HISTOGRAM) {
+        return stat->samples ? (double)stat->sum / stat->samples : 0.0;
+    }
+    return (double)statsValue(stat);
+}
+
+static inline int statsEnabled() {
+    return stats_interval > 0;
+}
+
+// Snapshot every interval cycles; an output without an interval uses the default one
+static inline void statsSetInterval(uint64_t interval) {
+    stats_interval = interval;
+    stats_next_snapshot = interval;
+}
+
+static inline void statsOpenSeries(const char* filename) {
+    stats_series = fopen(filename, "w");
+    if (stats_series == NULL) {
+        perror("Error opening statistics file");
+        exit(1);
+    }
+    if (stats_interval == 0) {
+        statsSetInterval(STATS_DEFAULT_INTERVAL);
+    }
+}
+
+static inline void statsOpenShared(const char* name) {
+    snprintf(stats_shared_name, sizeof(stats_shared_name), "/%s", name);
+    int fd = shm_open(stats_shared_name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, sizeof(StatsShared)) != 0) {
+        perror("Error creating shared statistics segment");
+        exit(1);
+    }
+    stats_shared = mmap(NULL, sizeof(StatsShared), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (stats_shared == MAP_FAILED) {
+        perror("Error mapping shared statistics segment");
+        exit(1);
+    }
+    stats_shared->magic = STATS_MAGIC;
+    stats_shared->version = STATS_VERSION;
+    stats_shared->pid = getpid();
+    if (stats_interval == 0) {
+        statsSetInterval(STATS_DEFAULT_INTERVAL);
+    }
+}
+
+static inline void statsPublish(uint64_t cycle) {
+    StatsShared* shared = stats_shared;
+    __atomic_store_n(&shared->sequence, shared->sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    shared->cycle = cycle;
+    shared->count = stats_count;
+    for (int i = 0; i < stats_count; ++i) {
+        StatsSharedEntry* entry = &shared->entries[i];
+        if (entry->name[0] == '\0') {
+            snprintf(entry->name, sizeof(entry->name), "%s", stats[i].name);
+        }
+        entry->value = statsValue(&stats[i]);
+        entry->real = statsReal(&stats[i]);
+    }
+    __atomic_store_n(&shared->sequence, shared->sequence + 1, __ATOMIC_RELEASE);
+}
+
+// One CSV row: cycle, then every statistic; histograms contribute their sample count and mean
+static inline void statsSnapshot(uint64_t cycle) {
+    if (stats_series != NULL) {
+        if (!stats_series_header) {
+            fprintf(stats_series, "cycle");
+            for (int i = 0; i < stats_count; ++i) {
+                if (stats[i].kind == STAT_HISTOGRAM) {
+                    fprintf(stats_series, ",%s.samples,%s.mean", stats[i].name, stats[i].name);
+                } else {
+                    fprintf(stats_series, ",%s", stats[i].name);
+                }
+            }
+            fprintf(stats_series, "\n");
+            stats_series_header = 1;
+        }
+        fprintf(stats_series, "%" PRIu64, cycle);
+        for (int i = 0; i < stats_count; ++i) {
+            if (stats[i].kind == STAT_COUNTER) {
+                fprintf(stats_series, ",%" PRIu64, statsValue(&stats[i]));
+            } else if (stats[i].kind == STAT_HISTOGRAM) {
+                fprintf(stats_series, ",%" PRIu64 ",%.4f", stats[i].samples, statsReal(&stats[i]));
+            } else {
+                fprintf(stats_series, ",%.6f", statsReal(&stats[i]));
+            }
+        }
+        fprintf(stats_series, "\n");
+    }
+    if (stats_shared != NULL) {
+        statsPublish(cycle);
+    }
+    stats_last_snapshot = cycle;
+    stats_next_snapshot = (cycle / stats_interval + 1) * stats_interval;
+}
+
+// Called from the simulation loop; costs one compare until the next snapshot is due
+static inline void statsTick(uint64_t cycle) {
+    if (cycle >= stats_next_snapshot) {
+        statsSnapshot(cycle);
+    }
+}
+
+static inline void statsPrint(FILE* file) {
+    for (int i = 0; i < stats_count; ++i) {
+        Stat* stat = &stats[i];
+        if (stat->kind == STAT_COUNTER) {
+            fprintf(file, "%-40s %20" PRIu64 "  # %s\n", stat->name, statsValue(stat), stat->description);
+        } else if (stat->kind == STAT_FORMULA) {
+            fprintf(file, "%-40s %20.4f  # %s\n", stat->name, statsReal(stat), stat->description);
+        } else {
+            fprintf(file, "%-40s %20" PRIu64 "  # %s (mean %.2f)\n", stat->name, stat->samples, stat->description,
+                    statsReal(stat));
+            for (int b = 0; b < stat->bucket_count; ++b) {
+                char label[96];
+                if (b == stat->bucket_count - 1) {
+                    snprintf(label, sizeof(label), "%s::%" PRIu64 "+", stat->name, b * stat->bucket_width);
+                } else {
+                    snprintf(label, sizeof(label), "%s::%" PRIu64 "-%" PRIu64, stat->name, b * stat->bucket_width,
+                             (b + 1) * stat->bucket_width - 1);
+                }
+                fprintf(file, "%-40s %20" PRIu64 "\n", label, stat->buckets[b]);
+            }
+        }
+    }
+}
+
+// Final snapshot; the shared segment is marked finished and its name removed, readers keep their mapping
+static inline void statsFinish(uint64_t cycle) {
+    if (!statsEnabled()) {
+        return;
+    }
+    if (cycle != stats_last_snapshot) {
+        statsSnapshot(cycle);
+    }
+    if (stats_series != NULL) {
+        fclose(stats_series);
+        stats_series = NULL;
+    }
+    if (stats_shared != NULL) {
+        __atomic_store_n(&stats_shared->finished, 1, __ATOMIC_RELEASE);
+        munmap(stats_shared, sizeof(StatsShared));
+        shm_unlink(stats_shared_name);
+        stats_shared = NULL;
+    }
+}
+
+#endif
@@ -0,0 +1,446 @@
+// Guest system calls shared by the simulators. The `syscall` instruction takes its number from $v0:
+// below 4000 it is a SPIM/MARS service, from 4000 up a Linux O32 call (which also reports errors through
+// $a3). Files opened read-only are mapped and served from host memory; written files, stdin and stdout
+// go through large stdio buffers, so a guest read or write normally costs no host system call.
+// Everything here runs only when a syscall executes; the simulators call it from their `syscall` case.
+#ifndef SYSCALL_H
+#define SYSCALL_H
+
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "arith.h"
+
+#define SYSCALL_MAX_FILES 16
+#define SYSCALL_CHUNK 65536 // Bytes moved between guest memory and a host stream at a time
+#define SYSCALL_STREAM_BUFFER (1 << 20) // stdio buffer of each file the guest writes
+#define SYSCALL_PATH_MAX 1024
+#define SYSCALL_CLOCK_HZ 1000000000ULL // Simulated cycles per second, for the time services
+#define SYSCALL_O32_BASE 4000
+
+// Guest open() flags (MIPS Linux values; SPIM uses 0, 1 and 9 from the same set)
+#define GUEST_O_ACCMODE 0x0003
+#define GUEST_O_APPEND 0x0008
+#define GUEST_O_CREAT 0x0100
+#define GUEST_O_TRUNC 0x0200
+#define GUEST_O_EXCL 0x0400
+
+// Moves bytes between guest memory, in guest address order, and a host buffer; returns 0 on a bad address
+typedef int (*GuestCopy)(void* context, uint32_t address, uint8_t* buffer, uint32_t length, int to_guest);
+
+typedef struct {
+    int open;
+    FILE* stream; // Written files and the standard streams
+    uint8_t* data; // Read-only files: the whole file, mapped
+    size_t size, position;
+} GuestFile;
+
+typedef struct {
+    GuestFile files[SYSCALL_MAX_FILES];
+    GuestCopy copy;
+    uint8_t* scratch; // SYSCALL_CHUNK bytes
+    uint32_t brk, heap_start, heap_limit;
+    int exited, exit_code;
+    uint64_t calls, bytes_read, bytes_written;
+} SyscallState;
+
+static inline void syscallInit(SyscallState* state, GuestCopy copy, uint32_t heap_start, uint32_t heap_limit) {
+    memset(state, 0, sizeof(SyscallState));
+    state->copy = copy;
+    state->brk = state->heap_start = heap_start;
+    state->heap_limit = heap_limit;
+    FILE* standard[3] = { stdin, stdout, stderr };
+    for (int fd = 0; fd < 3; ++fd) {
+        state->files[fd].open = 1;
+        state->files[fd].stream = standard[fd];
+    }
+}
+
+static inline void syscallCloseFile(GuestFile* file) {
+    if (file->data != NULL) {
+        munmap(file->data, file->size);
+    } else if (file->stream != NULL && file->stream != stdin && file->stream != stdout && file->stream != stderr) {
+        fclose(file->stream);
+    } else if (file->stream != NULL) {
+        fflush(file->stream);
+    }
+    memset(file, 0, sizeof(GuestFile));
+}
+
+// Flushes and closes whatever the guest left open
+static inline void syscallFinish(SyscallState* state) {
+    for (int fd = 0; fd < SYSCALL_MAX_FILES; ++fd) {
+        if (state->files[fd].open) {
+            syscallCloseFile(&state->files[fd]);
+        }
+    }
+    free(state->scratch);
+    state->scratch = NULL;
+}
+
+static inline GuestFile* syscallFile(SyscallState* state, uint32_t fd) {
+    return fd < SYSCALL_MAX_FILES && state->files[fd].open ? &state->files[fd] : NULL;
+}
+
+static inline uint8_t* syscallScratch(SyscallState* state) {
+    if (state->scratch == NULL) {
+        state->scratch = malloc(SYSCALL_CHUNK);
+        if (state->scratch == NULL) {
+            fprintf(stderr, "Out of memory for the syscall buffer\n");
+            exit(1);
+        }
+    }
+    return state->scratch;
+}
+
+// NUL-terminated guest string; 0 if it faults or does not fit
+static inline int syscallString(SyscallState* state, void* context, uint32_t address, char* text, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        if (!state->copy(context, address + i, (uint8_t*)&text[i], 1, 0)) {
+            return 0;
+        }
+        if (text[i] == '\0') {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// One line of stdin, the way a terminal delivers it
+static inline size_t syscallReadLine(FILE* stream, uint8_t* buffer, size_t size) {
+    size_t count = 0;
+    int c;
+    while (count < size && (c = getc(stream)) != EOF) {
+        buffer[count++] = c;
+        if (c == '\n') {
+            break;
+        }
+    }
+    return count;
+}
+
+// Returns the byte count, or a negative errno
+static inline int64_t syscallRead(SyscallState* state, void* context, uint32_t fd, uint32_t address, uint32_t length) {
+    GuestFile* file = syscallFile(state, fd);
+    if (file == NULL) {
+        return -EBADF;
+    }
+    if (file->stream == NULL) { // Straight from the mapping; an empty file has none
+        if (file->data == NULL) {
+            return 0;
+        }
+        size_t count = file->size - file->position < length ? file->size - file->position : length;
+        if (count > 0 && !state->copy(context, address, file->data + file->position, count, 1)) {
+            return -EFAULT;
+        }
+        file->position += count;
+        state->bytes_read += count;
+        return count;
+    }
+    uint8_t* buffer = syscallScratch(state);
+    uint32_t total = 0;
+    while (total < length) {
+        size_t want = length - total < SYSCALL_CHUNK ? length - total : SYSCALL_CHUNK;
+        size_t count = file->stream == stdin ? syscallReadLine(stdin, buffer, want) : fread(buffer, 1, want, file->stream);
+        if (count > 0 && !state->copy(context, address + total, buffer, count, 1)) {
+            return -EFAULT;
+        }
+        total += count;
+        if (count < want || file->stream == stdin) {
+            break;
+        }
+    }
+    state->bytes_read += total;
+    return total;
+}
+
+static inline int64_t syscallWrite(SyscallState* state, void* context, uint32_t fd, uint32_t address, uint32_t length) {
+    GuestFile* file = syscallFile(state, fd);
+    if (file == NULL || file->stream == NULL || file->stream == stdin) {
+        return -EBADF;
+    }
+    uint8_t* buffer = syscallScratch(state);
+    for (uint32_t done = 0; done < length;) {
+        uint32_t count = length - done < SYSCALL_CHUNK ? length - done : SYSCALL_CHUNK;
+        if (!state->copy(context, address + done, buffer, count, 0)) {
+            return -EFAULT;
+        }
+        fwrite(buffer, 1, count, file->stream);
+        done += count;
+    }
+    state->bytes_written += length;
+    return length;
+}
+
+// Read-only files are mapped whole; anything that cannot be mapped (pipes, devices) falls back to stdio
+static inline int64_t syscallOpen(SyscallState* state, void* context, uint32_t path_address, uint32_t flags, uint32_t mode) {
+    char path[SYSCALL_PATH_MAX];
+    if (!syscallString(state, context, path_address, path, sizeof(path))) {
+        return -EFAULT;
+    }
+    int fd = 3;
+    while (fd < SYSCALL_MAX_FILES && state->files[fd].open) {
+        ++fd;
+    }
+    if (fd == SYSCALL_MAX_FILES) {
+        return -EMFILE;
+    }
+
+    int access = flags & GUEST_O_ACCMODE;
+    int host_flags = access == 0 ? O_RDONLY : access == 1 ? O_WRONLY : O_RDWR;
+    host_flags |= (flags & GUEST_O_APPEND ? O_APPEND : 0) | (flags & GUEST_O_CREAT ? O_CREAT : 0) |
+                  (flags & GUEST_O_TRUNC ? O_TRUNC : 0) | (flags & GUEST_O_EXCL ? O_EXCL : 0);
+    int host_fd = open(path, host_flags, mode);
+    if (host_fd < 0) {
+        return -errno;
+    }
+
+    GuestFile* file = &state->files[fd];
+    struct stat info;
+    if (access == 0 && fstat(host_fd, &info) == 0 && S_ISREG(info.st_mode)) {
+        file->size = info.st_size;
+        file->data = info.st_size > 0 ? mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, host_fd, 0) : NULL;
+        if (file->data == MAP_FAILED) {
+            file->data = NULL;
+        }
+        if (file->data != NULL || info.st_size == 0) {
+            close(host_fd);
+            file->open = 1;
+            return fd;
+        }
+    }
+    file->stream = fdopen(host_fd, access == 0 ? "rb" : access == 1 ? (flags & GUEST_O_APPEND ? "ab" : "wb")
+                                                                    : (flags & GUEST_O_APPEND ? "a+b" : "r+b"));
+    if (file->stream == NULL) {
+        close(host_fd);
+        return -errno;
+    }
+    setvbuf(file->stream, NULL, _IOFBF, SYSCALL_STREAM_BUFFER);
+    file->open = 1;
+    return fd;
+}
+
+static inline int64_t syscallClose(SyscallState* state, uint32_t fd) {
+    GuestFile* file = syscallFile(state, fd);
+    if (file == NULL) {
+        return -EBADF;
+    }
+    syscallCloseFile(file);
+    return 0;
+}
+
+// Word in guest byte order
+static inline int syscallStoreWord(SyscallState* state, void* context, uint32_t address, uint32_t value) {
+    uint8_t bytes[4] = { value >> 24, value >> 16, value >> 8, value };
+    return state->copy(context, address, bytes, 4, 1);
+}
+
+// For a forked copy of the simulator: guest writes are dropped and reads of streams see end of file, so the
+// copy leaves the parent's files and input alone. The inherited streams are abandoned with whatever the
+// parent had buffered, so the copy must end with _exit().
+static inline void syscallDetach(SyscallState* state) {
+    int null_fd = open("/dev/null", O_RDWR);
+    FILE* sink = fdopen(null_fd, "r+");
+    if (sink == NULL) {
+        perror("Error opening /dev/null");
+        _exit(1);
+    }
+    dup2(null_fd, 0); // SPIM read services use stdin directly
+    for (int fd = 0; fd < SYSCALL_MAX_FILES; ++fd) {
+        if (state->files[fd].stream != NULL) {
+            state->files[fd].stream = sink;
+        }
+    }
+}
+
+static inline void syscallExit(SyscallState* state, int code) {
+    state->exited = 1;
+    state->exit_code = code;
+    for (int fd = 0; fd < SYSCALL_MAX_FILES; ++fd) {
+        if (state->files[fd].stream != NULL) {
+            fflush(state->files[fd].stream);
+        }
+    }
+}
+
+// SPIM/MARS services; results go to $v0 (or $a0/$a1, $f0)
+static inline void syscallSpim(SyscallState* state, uint32_t* reg, ArithState* fpu, void* context, uint64_t cycles) {
+    FILE* out = state->files[1].stream;
+    if (out == NULL && ((reg[2] >= 1 && reg[2] <= 4) || reg[2] == 11)) {
+        return; // The guest closed fd 1, so prints go nowhere
+    }
+    char text[64];
+    switch (reg[2]) {
+        case 1: // print_int
+            fprintf(out, "%d", (int32_t)reg[4]);
+            break;
+        case 2: // print_float
+            fprintf(out, "%g", arithGetSingle(fpu, 12));
+            break;
+        case 3: // print_double
+            fprintf(out, "%.17g", arithGetDouble(fpu, 12));
+            break;
+        case 4: { // print_string
+            uint8_t c;
+            for (uint32_t address = reg[4]; state->copy(context, address, &c, 1, 0) && c != 0; ++address) {
+                putc(c, out);
+            }
+            break;
+        }
+        case 5: // read_int
+        case 6: // read_float
+        case 7: { // read_double
+            size_t count = syscallReadLine(stdin, (uint8_t*)text, sizeof(text) - 1);
+            text[count] = '\0';
+            if (reg[2] == 5) {
+                reg[2] = (uint32_t)strtol(text, NULL, 10);
+            } else if (reg[2] == 6) {
+                arithSetSingle(fpu, 0, strtod(text, NULL));
+            } else {
+                arithSetDouble(fpu, 0, strtod(text, NULL));
+            }
+            break;
+        }
+        case 8: { // read_string: at most $a1 - 1 characters, NUL-terminated
+            if (reg[5] == 0) {
+                break;
+            }
+            uint8_t* buffer = syscallScratch(state);
+            size_t count = syscallReadLine(stdin, buffer, reg[5] - 1 < SYSCALL_CHUNK - 1 ? reg[5] - 1 : SYSCALL_CHUNK - 1);
+            buffer[count] = '\0';
+            state->copy(context, reg[4], buffer, count + 1, 1);
+            break;
+        }
+        case 9: { // sbrk
+            uint32_t old = state->brk;
+            if ((int32_t)reg[4] > (int32_t)(state->heap_limit - old) || (int32_t)reg[4] < (int32_t)(state->heap_start - old)) {
+                reg[2] = 0xFFFFFFFF;
+            } else {
+                state->brk += reg[4];
+                reg[2] = old;
+            }
+            break;
+        }
+        case 10: // exit
+            syscallExit(state, 0);
+            break;
+        case 11: // print_char
+            putc(reg[4] & 0xFF, out);
+            break;
+        case 12: { // read_char
+            int c = getc(stdin);
+            reg[2] = c == EOF ? 0 : (uint32_t)c;
+            break;
+        }
+        case 13: { // open: flags 0 read, 1 write (create, truncate), 9 append (create)
+            uint32_t flags = reg[5];
+            if (flags & GUEST_O_ACCMODE) {
+                flags |= GUEST_O_CREAT | (flags & GUEST_O_APPEND ? 0 : GUEST_O_TRUNC);
+            }
+            reg[2] = syscallOpen(state, context, reg[4], flags, 0644);
+            break;
+        }
+        case 14: // read
+            reg[2] = syscallRead(state, context, reg[4], reg[5], reg[6]);
+            break;
+        case 15: // write
+            reg[2] = syscallWrite(state, context, reg[4], reg[5], reg[6]);
+            break;
+        case 16: // close
+            syscallClose(state, reg[4]);
+            break;
+        case 17: // exit2
+            syscallExit(state, (int32_t)reg[4]);
+            break;
+        case 30: { // time: milliseconds of simulated time in $a0 (low) and $a1 (high)
+            uint64_t ms = cycles / (SYSCALL_CLOCK_HZ / 1000);
+            reg[4] = (uint32_t)ms;
+            reg[5] = (uint32_t)(ms >> 32);
+            break;
+        }
+        default:
+            printf("Unsupported syscall: %d\n", reg[2]);
+    }
+}
+
+// Linux O32: arguments in $a0-$a3, result in $v0, $a3 = 0 on success or 1 with the errno in $v0
+static inline void syscallO32(SyscallState* state, uint32_t* reg, void* context, uint64_t cycles) {
+    int64_t result;
+    switch (reg[2] - SYSCALL_O32_BASE) {
+        case 1: // exit
+        case 246: // exit_group
+            syscallExit(state, (int32_t)reg[4]);
+            result = 0;
+            break;
+        case 3: // read
+            result = syscallRead(state, context, reg[4], reg[5], reg[6]);
+            break;
+        case 4: // write
+            result = syscallWrite(state, context, reg[4], reg[5], reg[6]);
+            break;
+        case 5: // open
+            result = syscallOpen(state, context, reg[4], reg[5], reg[6]);
+            break;
+        case 6: // close
+            result = syscallClose(state, reg[4]);
+            break;
+        case 13: // time
+            result = cycles / SYSCALL_CLOCK_HZ;
+            if (reg[4] != 0 && !syscallStoreWord(state, context, reg[4], result)) {
+                result = -EFAULT;
+            }
+            break;
+        case 45: // brk: 0 or an address out of range only asks for the current break
+            if (reg[4] >= state->heap_start && reg[4] <= state->heap_limit) {
+                state->brk = reg[4];
+            }
+            result = state->brk;
+            break;
+        case 263: { // clock_gettime: every clock is simulated time
+            uint64_t seconds = cycles / SYSCALL_CLOCK_HZ;
+            uint64_t nanoseconds = (cycles % SYSCALL_CLOCK_HZ) * (1000000000ULL / SYSCALL_CLOCK_HZ);
+            result = syscallStoreWord(state, context, reg[5], seconds) && syscallStoreWord(state, context, reg[5] + 4, nanoseconds)
+                         ? 0 : -EFAULT;
+            break;
+        }
+        default:
+            printf("Unsupported syscall: %d\n", reg[2]);
+            result = -ENOSYS;
+    }
+    reg[2] = result < 0 ? (uint32_t)-result : (uint32_t)result;
+    reg[7] = result < 0;
+}
+
+// Executes the syscall in $v0; returns 1 when the guest has exited. cycles is the simulated time so far.
+__attribute__((cold)) static inline int syscallHandle(SyscallState* state, uint32_t* reg, ArithState* fpu, void* context,
+                                                      uint64_t cycles) {
+    state->calls++;
+    if (reg[2] >= SYSCALL_O32_BASE) {
+        syscallO32(state, reg, context, cycles);
+    } else {
+        syscallSpim(state, reg, fpu, context, cycles);
+    }
+    return state->exited;
+}
+
+static inline void syscallPrint(FILE* file, SyscallState* state) {
+    if (state->calls == 0) {
+        return;
+    }
+    fprintf(file, "Syscalls: %" PRIu64 ", bytes read/written: %" PRIu64 "/%" PRIu64 "", state->calls, state->bytes_read,
+            state->bytes_written);
+    if (state->exited) {
+        fprintf(file, ", exit code: %d", state->exit_code);
+    }
+    fprintf(file, "\n");
+}
+
+#endif
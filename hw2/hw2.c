@@ -3,22 +3,61 @@
 #include <stdint.h>
 #include <string.h>
 
+#include "../common/stats.h"
+#include "../common/hostprof.h"
+#include "../common/guestprof.h"
+#include "../common/arith.h"
+#include "../common/isa.h"
+#include "../common/syscall.h"
+#include "../common/simpoint.h"
+
 
 #define MEMORY_SIZE 0x4000000 // 64MB memory
+#define HEAP_LIMIT 0xF00000 // The heap stops 1MB below the initial stack
 uint8_t memory[MEMORY_SIZE];
 uint32_t reg[32]; // 32bit registers
+ArithState arith; // HI/LO and the FPU
+SyscallState syscalls;
+uint32_t binary_size = 0;
 uint32_t pc = 0; // program counter
 uint32_t instruction; // current instruction
-int instruction_count = 0, r_type_count = 0, i_type_count = 0, j_type_count = 0, memory_access_count = 0, branch_taken_count = 0;
+uint64_t instruction_count = 0, r_type_count = 0, i_type_count = 0, j_type_count = 0, memory_access_count = 0, branch_taken_count = 0;
+const char* binary_filename = "simple3.bin";
+GuestProfile* guest_profile = NULL; // Set by -g or -y
+const char* guest_profile_prefix = NULL;
+SimpointProfile* simpoint_profile = NULL; // Set by -B
+uint64_t simpoint_interval = 0;
+int simpoint_max_clusters = 10;
+const char* simpoint_filename = "simpoints.txt";
+
+#ifdef HOST_PROFILE
+// Host profile regions
+enum { PROF_STEP, PROF_FETCH, PROF_EXECUTE, PROF_MEM_WRITE, PROF_REGION_COUNT };
+const char* prof_region_names[PROF_REGION_COUNT] = { "step", "fetch", "execute", "memWrite" };
+int prof_use_perf = 0;
+#endif
 
 // Function declarations
 uint32_t fetch();
 void decode(uint32_t instruction);
-void execute(uint32_t instruction);
+void execute(const IsaDecoded* d);
 void loadBinary(const char* filename);
+uint32_t memRead(uint32_t address);
+int guestCopy(void* context, uint32_t address, uint8_t* buffer, uint32_t length, int to_guest);
+void parseArguments(int argc, char* argv[]);
+void registerStats();
+double memoryAccessRatio();
 
 
-int main() {
+int main(int argc, char* argv[]) {
+    registerStats();
+    parseArguments(argc, argv);
+    if (guest_profile_prefix != NULL || guestprof_symbol_count > 0) {
+        guest_profile = guestprofCreate(0); // Instructions only
+    }
+    if (simpoint_interval > 0) {
+        simpoint_profile = simpointCreate(simpoint_interval, simpoint_max_clusters);
+    }
 
     // Initialize registers
     for (int i = 0; i < 29; ++i) {
@@ -29,58 +68,86 @@ int main() {
 
     memset(memory, 0, MEMORY_SIZE); // Initialize memory
 
-    loadBinary("simple3.bin"); // Change file
+    loadBinary(binary_filename);
+    syscallInit(&syscalls, guestCopy, (binary_size + 0xFFF) & ~0xFFFu, HEAP_LIMIT); // The heap starts on the page after the image
 
+    PROF_INIT(prof_region_names, PROF_REGION_COUNT, prof_use_perf);
     while (pc < MEMORY_SIZE && pc != 0xFFFFFFFF) {
+        PROF_SCOPE(PROF_STEP);
+        uint32_t instruction_pc = pc;
         uint32_t instruction = fetch();
-        printf("Cycle: %d, PC: %0X, Instruction: %08X\n", instruction_count+1, pc, instruction);
+        printf("Cycle: %" PRIu64 ", PC: %0X, Instruction: %08X\n", instruction_count+1, pc, instruction);
         pc += 4;
         decode(instruction);
+        if (guest_profile != NULL) {
+            guestprofRetire(guest_profile, instruction_pc, instruction, pc, 0, 0, 0);
+        }
+        if (simpoint_profile != NULL) {
+            simpointRetire(simpoint_profile, instruction_pc, instruction);
+        }
         // printf("Value in reg[2] after cycle %d: %d\n", instruction_count+1, reg[2]); - r2 반환 확인용
         instruction_count++;
+        statsTick(instruction_count); // One instruction per cycle
     }
+    statsFinish(instruction_count);
+    syscallFinish(&syscalls);
 
     printf("\n*********** Result ************\n");
     printf("Final value in r2: %d\n", reg[2]);
-    printf("Total executed instructions: %d\n", instruction_count);
-    printf("R-type instructions: %d\n", r_type_count);
-    printf("I-type instructions: %d\n", i_type_count);
-    printf("J-type instructions: %d\n", j_type_count);
-    printf("Memory access instructions: %d\n", memory_access_count);
-    printf("Taken branches: %d\n", branch_taken_count);
+    printf("Total executed instructions: %" PRIu64 "\n", instruction_count);
+    printf("R-type instructions: %" PRIu64 "\n", r_type_count);
+    printf("I-type instructions: %" PRIu64 "\n", i_type_count);
+    printf("J-type instructions: %" PRIu64 "\n", j_type_count);
+    printf("Memory access instructions: %" PRIu64 "\n", memory_access_count);
+    printf("Taken branches: %" PRIu64 "\n", branch_taken_count);
+    syscallPrint(stdout, &syscalls);
+    if (statsEnabled()) {
+        printf("\n");
+        statsPrint(stdout);
+    }
+    if (guest_profile != NULL) {
+        guestprofPrint(stdout, &guest_profile, 1);
+        if (guest_profile_prefix != NULL) {
+            guestprofWrite(&guest_profile, 1, guest_profile_prefix);
+        }
+    }
+    if (simpoint_profile != NULL) {
+        simpointFinish(simpoint_profile);
+        simpointPrint(stdout, simpoint_profile);
+        simpointWrite(simpoint_profile, simpoint_filename, binary_filename);
+    }
+    PROF_REPORT(stdout, instruction_count);
 
     return 0;
 }
 
 
 uint32_t fetch() {
+    PROF_SCOPE(PROF_FETCH);
     // Read in big-endian
-    instruction = (memory[pc] << 24) | (memory[pc+1] << 16) | (memory[pc+2] << 8) | memory[pc+3];
+    instruction = isaWordFromBytes(&memory[pc]);
     return instruction;
 }
 
 
 void decode(uint32_t instruction) {
-    uint32_t opcode = instruction >> 26;
-    if (opcode == 0x00) { // R-type
-        r_type_count++;
-    } else if (opcode == 0x02 || opcode == 0x03) { // J-type
-        j_type_count++;
-    } else { // I-type
-        i_type_count++;
-    }
-    execute(instruction);
+    PROF_OPCODE(instruction >> 26);
+    IsaDecoded d = isaDecode(instruction);
+    switch (isa_info[d.op].format) {
+        case ISA_FORMAT_R: r_type_count++; break;
+        case ISA_FORMAT_J: j_type_count++; break;
+        default: i_type_count++; break;
+    }
+    execute(&d);
 }
 
 
 void memWrite(uint32_t address, uint32_t value) {
+    PROF_SCOPE(PROF_MEM_WRITE);
     if (address < MEMORY_SIZE) {
         // Check if the address is a multiple of 4 (word-aligned)
         if (address % 4 == 0) {
-            memory[address] = (value >> 24) & 0xFF;
-            memory[address + 1] = (value >> 16) & 0xFF;
-            memory[address + 2] = (value >> 8) & 0xFF;
-            memory[address + 3] = value & 0xFF;
+            isaWordToBytes(&memory[address], value);
         } else {
             printf("Memory write error: Address is not word-aligned\n");
         }
@@ -90,82 +157,126 @@ void memWrite(uint32_t address, uint32_t value) {
 }
 
 
-void writeBack(uint32_t rd, uint32_t value) {
-    reg[rd] = value;  // Write the value to the specified register
+uint32_t memRead(uint32_t address) {
+    if (address % 4 == 0 && address < MEMORY_SIZE) {
+        return isaWordFromBytes(&memory[address]);
+    }
+    printf("Memory access error: Invalid address %08X\n", address);
+    return 0;
 }
 
 
-void execute(uint32_t instruction) {
-    uint32_t opcode = instruction >> 26;
-    uint32_t rs = (instruction >> 21) & 0x1F;
-    uint32_t rt = (instruction >> 16) & 0x1F;
-    uint32_t rd = (instruction >> 11) & 0x1F;
-    uint32_t shamt = (instruction >> 6) & 0x1F;
-    uint32_t funct = instruction & 0x3F;
-    int16_t immediate = instruction & 0xFFFF;
-    uint32_t address = instruction & 0x3FFFFFF;
-    int32_t sign_extended_immediate = (int32_t)immediate;
-    uint32_t value, mem_address;
-
-
-    switch (opcode) {
-        case 0x00: // R-type instructions
-            switch (funct) {
-                case 0x08: // jr
-                    pc = reg[rs];
-                    break;
-                case 0x21: // addu 
-                    value = reg[rs] + reg[rt];  
-                    writeBack(rd, value);
-                    break;
-            }
-            break;
-        case 0x02: // J
-            pc = (pc & 0xF0000000) | (address << 2);
-            break;
-        case 0x03: // JAL
-            reg[31] = pc;  
-            pc = (pc & 0xF0000000) | (address << 2);
-            break;
-        case 0x08: // ADDI
-            value = reg[rs] + immediate;
-            writeBack(rt, value);
-            break;
-        case 0x09: // ADDIU
-            value = reg[rs] + sign_extended_immediate;
-            writeBack(rt, value);  
-            break;
-        case 0x0A: // SLTI
-            reg[rt] = (int32_t)reg[rs] < sign_extended_immediate ? 1 : 0;
-            break;
-        case 0x05: // BNE
-            if (reg[rs] != reg[rt]) {
-                pc += sign_extended_immediate << 2;
-                branch_taken_count++;
-            }
-            break;
-        case 0x0F: // LI
-            reg[rt] = immediate;
-            break;
-        case 0x23: // LW
-            mem_address = reg[rs] + sign_extended_immediate;
-            if (mem_address % 4 == 0 && mem_address < MEMORY_SIZE) {
-                value = (memory[mem_address] << 24) | (memory[mem_address + 1] << 16) |
-                        (memory[mem_address + 2] << 8) | memory[mem_address + 3];
-                writeBack(rt, value);
-            } else {
-                printf("Memory access error: Invalid address %08X\n", mem_address);
-            }
-            memory_access_count++;
-            break;
-        case 0x2B: // SW
-            memWrite(reg[rs] + sign_extended_immediate, reg[rt]);
-            memory_access_count++;
-            break;
-        default:
-            printf("Unsupported opcode: %X\n", opcode);
+// Guest bytes are laid out in address order, so syscall buffers are plain copies
+int guestCopy(void* context, uint32_t address, uint8_t* buffer, uint32_t length, int to_guest) {
+    (void)context;
+    if (address >= MEMORY_SIZE || length > MEMORY_SIZE - address) {
+        return 0;
     }
+    if (to_guest) {
+        memcpy(&memory[address], buffer, length);
+    } else {
+        memcpy(buffer, &memory[address], length);
+    }
+    return 1;
+}
 
+
+void writeBack(uint32_t rd, uint32_t value) {
+    if (rd != 0) { // Register 0 is always 0
+        reg[rd] = value;  // Write the value to the specified register
+    }
+}
+
+
+// One handler per instruction class; the ISA table supplies operands and ALU semantics. pc already
+// points past the instruction.
+void execute(const IsaDecoded* d) {
+    PROF_SCOPE(PROF_EXECUTE);
+    static void* const handlers[ISA_CLASS_COUNT] = { ISA_CLASS_LIST(ISA_CLASS_HANDLER) };
+    uint32_t rs_value = reg[d->rs], rt_value = reg[d->rt];
+    uint32_t mem_address = rs_value + d->immediate;
+    uint32_t value;
+    goto *handlers[d->cls];
+
+class_INVALID:
+    printf("Unsupported instruction: %08X\n", d->instruction);
+    return;
+class_ALU:
+    writeBack(d->dest, isaAluResult(d, rs_value, rt_value));
+    return;
+class_HILO: // mfhi, mflo
+    writeBack(d->dest, isaAlu(isa_info[d->op].alu, arith.hi, arith.lo));
+    return;
+class_MULDIV:
+    arithMulDiv(&arith, d->funct, rs_value, rt_value);
+    return;
+class_BRANCH:
+    if (isaAluResult(d, rs_value, rt_value)) {
+        pc += d->immediate << 2;
+        branch_taken_count++;
+    }
+    return;
+class_BRANCH_FP: // bc1f, bc1t
+    if (arithCondition(&arith, d->rt >> 2) == (int)(d->rt & 1)) {
+        pc += d->immediate << 2;
+        branch_taken_count++;
+    }
+    return;
+class_JUMP:
+    writeBack(d->dest, pc); // jal links
+    pc = (pc & 0xF0000000) | d->immediate;
+    return;
+class_JUMP_REG:
+    pc = rs_value;
+    return;
+class_LOAD:
+class_LOAD_LINKED: // One hart, so the reservation always holds
+    if (mem_address % 4 == 0 && mem_address < MEMORY_SIZE) {
+        value = isaWordFromBytes(&memory[mem_address]);
+        writeBack(d->dest, value);
+    } else {
+        printf("Memory access error: Invalid address %08X\n", mem_address);
+    }
+    memory_access_count++;
+    return;
+class_STORE:
+class_STORE_CONDITIONAL:
+    memWrite(mem_address, rt_value);
+    writeBack(d->dest, 1); // sc succeeds
+    memory_access_count++;
+    return;
+class_FP_LOAD: // lwc1, ldc1
+    if (isa_info[d->op].operands & ISA_DOUBLE) {
+        arith.fpr[(d->rt & ~1u) + 1] = memRead(mem_address); // Big-endian: high word first
+        arith.fpr[d->rt & ~1u] = memRead(mem_address + 4);
+    } else {
+        arith.fpr[d->rt] = memRead(mem_address);
+    }
+    memory_access_count++;
+    return;
+class_FP_STORE: // swc1, sdc1
+    if (isa_info[d->op].operands & ISA_DOUBLE) {
+        memWrite(mem_address, arith.fpr[(d->rt & ~1u) + 1]);
+        memWrite(mem_address + 4, arith.fpr[d->rt & ~1u]);
+    } else {
+        memWrite(mem_address, arith.fpr[d->rt]);
+    }
+    memory_access_count++;
+    return;
+class_COP1: {
+    int handled = arithCop1(&arith, d->instruction, rt_value, &value);
+    if (handled == 2) {
+        writeBack(d->dest, value); // mfc1, cfc1
+    } else if (!handled) {
+        printf("Unsupported COP1 instruction: %08X\n", d->instruction);
+    }
+    return;
+}
+class_SYSCALL:
+    if (syscallHandle(&syscalls, reg, &arith, NULL, instruction_count)) {
+        pc = 0xFFFFFFFF;
+    }
+    return;
 }
 
 
@@ -175,6 +286,64 @@ void loadBinary(const char* filename) {
         perror("Error opening file");
         exit(1);
     }
-    fread(memory, sizeof(uint8_t), MEMORY_SIZE, file);
+    binary_size = fread(memory, sizeof(uint8_t), MEMORY_SIZE, file);
     fclose(file);
 }
+
+
+// Usage: hw2 [-i interval] [-T series.csv] [-l shared memory name] [-g profile prefix] [-y symbols.elf] [-H]
+//            [-B interval[:max clusters]] [-F simpoint file] [binary]
+// -g and -y turn on the guest profiler; -g also writes prefix.instructions.folded and prefix.pcs.csv
+// -B profiles basic-block vectors per interval of that many instructions, clusters them and writes the
+// representative intervals and their weights to the -F file (simpoints.txt), for hw3 -F and hw4 -F
+// -H adds perf_event counters to the host profile of a -DHOST_PROFILE build
+void parseArguments(int argc, char* argv[]) {
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+            statsSetInterval(strtoull(argv[++i], NULL, 0));
+        } else if (strcmp(argv[i], "-T") == 0 && i + 1 < argc) {
+            statsOpenSeries(argv[++i]);
+        } else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+            statsOpenShared(argv[++i]);
+        } else if (strcmp(argv[i], "-g") == 0 && i + 1 < argc) {
+            guest_profile_prefix = argv[++i];
+        } else if (strcmp(argv[i], "-y") == 0 && i + 1 < argc) {
+            guestprofLoadSymbols(argv[++i]);
+        } else if (strcmp(argv[i], "-B") == 0 && i + 1 < argc) {
+            int fields = sscanf(argv[++i], "%" SCNu64 ":%d", &simpoint_interval, &simpoint_max_clusters);
+            if (fields < 1 || simpoint_interval == 0 || simpoint_max_clusters < 1 ||
+                simpoint_max_clusters > SIMPOINT_MAX_CLUSTERS) {
+                fprintf(stderr, "SimPoint interval must be instructions[:max clusters, 1 to %d]\n", SIMPOINT_MAX_CLUSTERS);
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "-F") == 0 && i + 1 < argc) {
+            simpoint_filename = argv[++i];
+#ifdef HOST_PROFILE
+        } else if (strcmp(argv[i], "-H") == 0) {
+            prof_use_perf = 1;
+#endif
+        } else if (argv[i][0] != '-') {
+            binary_filename = argv[i];
+        } else {
+            fprintf(stderr, "Usage: %s [-i interval] [-T series.csv] [-l shared memory name] [-g profile prefix] [-y symbols.elf]\n"
+                            "       [-H] [-B interval[:max clusters]] [-F simpoint file] [binary]\n", argv[0]);
+            exit(1);
+        }
+    }
+}
+
+
+void registerStats() {
+    statsCounter("instructions", "Executed instructions", &instruction_count);
+    statsCounter("r_type", "R-type instructions", &r_type_count);
+    statsCounter("i_type", "I-type instructions", &i_type_count);
+    statsCounter("j_type", "J-type instructions", &j_type_count);
+    statsCounter("memory_accesses", "Load and store instructions", &memory_access_count);
+    statsCounter("taken_branches", "Taken branches", &branch_taken_count);
+    statsFormula("memory_access_ratio", "Loads and stores per instruction", memoryAccessRatio);
+}
+
+
+double memoryAccessRatio() {
+    return instruction_count ? (double)memory_access_count / instruction_count : 0.0;
+}
@@ -2,20 +2,129 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#include "../common/stats.h"
+#include "../common/hostprof.h"
+#include "../common/guestprof.h"
+#include "../common/arith.h"
+#include "../common/isa.h"
+#include "../common/syscall.h"
+#include "../common/simpoint.h"
 
 #define MEMORY_SIZE 0x4000000 // 64MB memory
+#define HEAP_LIMIT 0xF00000 // The heap stops 1MB below the initial stack
+#define TRACE_WINDOW 64 // In-flight instructions remembered for the O3PipeView trace
+#define TICKS_PER_CYCLE 1000 // O3PipeView uses gem5 ticks; 1000 per cycle is a 1GHz clock
+#define MAX_FETCH_QUEUE 32 // Upper bound for -q; well inside TRACE_WINDOW with the rest of the pipeline
+#define MAX_FETCH_WIDTH 8
+#define MAX_LOOP_BUFFER 64 // Upper bound for -b
+#define MAX_HOST_WORKERS 64 // Upper bound for -j
+#define TRACE(call) do { if (trace_enabled) { PROF_SCOPE(PROF_TRACE); call; } } while (0) // Untraced runs only pay for the flag test
+
+typedef enum { STAGE_IF, STAGE_ID, STAGE_EX, STAGE_MEM, STAGE_WB, STAGE_COUNT } Stage;
+typedef enum { TRACE_KONATA, TRACE_O3PIPEVIEW } TraceFormat;
+typedef enum { HAZARD_NONE, HAZARD_RAW, HAZARD_WAW, HAZARD_STRUCTURAL, HAZARD_SERIALIZE } Hazard;
+
+typedef struct {
+    int id; // Dynamic instruction number, 0 when the slot is free
+    uint32_t pc;
+    uint32_t instruction;
+    uint64_t cycle[STAGE_COUNT]; // Cycle the instruction entered each stage
+    int stalled; // A Konata stall marker is open
+} TraceRecord;
+
 uint8_t instr_memory[MEMORY_SIZE]; // Instruction memory
 uint8_t data_memory[MEMORY_SIZE];  // Data memory
 uint32_t reg[32]; // 32bit registers
 uint32_t pc = 0; // program counter
-int clock_cycle = 0;
-int instruction_count = 0, memory_access_count = 0, register_ops_count = 0, branch_count = 0, jump_count = 0;
-int predict_correct = 0, mis_predict = 0, total_predict = 0;
+uint64_t clock_cycle = 0;
+uint64_t instruction_count = 0, memory_access_count = 0, register_ops_count = 0, branch_count = 0, jump_count = 0;
+uint64_t predict_correct = 0, mis_predict = 0, total_predict = 0;
+const char* binary_filename = "simple3.bin";
+GuestProfile* guest_profile = NULL; // Set by -g or -y
+const char* guest_profile_prefix = NULL;
+
+// Multi-cycle units; the scoreboard holds an instruction in EX until its operands and unit are free
+ArithState arith; // HI/LO and the FPU
+uint64_t fp_ready[32], gpr_ready[32], hilo_ready = 0, fcsr_ready = 0; // First cycle a consumer may enter EX
+uint64_t unit_busy_until[UNIT_COUNT]; // Non-pipelined units accept nothing before this cycle
+uint64_t unit_ops[UNIT_COUNT];
+uint64_t raw_stalls = 0, waw_stalls = 0, structural_stalls = 0, serialize_stalls = 0;
+int ex_stalled = 0; // EX kept its instruction this cycle, so ID and IF keep theirs
+uint64_t ex_stall_cycles = 0; // Cycles the instruction now in ID/EX has waited
+const char* hazard_names[] = { "none", "RAW", "WAW", "structural", "serialize" };
+
+// Event-driven cycle skipping: while EX holds a stalled instruction behind empty MEM and WB stages, the
+// clock jumps to the next scoreboard event instead of stepping through identical cycles
+typedef enum { SKIP_ON, SKIP_OFF, SKIP_VERIFY } SkipMode;
+typedef struct {
+    uint64_t end; // Cycle the skip would have jumped to; 0 when nothing is pending
+    uint64_t stalls[HAZARD_SERIALIZE + 1]; // Expected counters at that cycle
+    uint64_t ex_stall_cycles;
+    int trace_id; // Instruction that must still be held in ID/EX
+} SkipCheck;
+SkipMode skip_mode = SKIP_ON; // -E steps every cycle, -D steps and checks every skip against the result
+SkipCheck skip_check = {0};
+uint64_t skip_count = 0, skipped_cycles = 0;
+SyscallState syscalls;
+uint32_t binary_size = 0;
+
+// Sampled simulation (-F): a functional pass forks a detailed copy of the simulator at each simpoint.
+// hw2 has no delay slots, so its instruction count, which the simpoints use, is instruction_count less
+// the delay slots of taken branches, j and jr; jal returns past its delay slot, where hw2 returns to it.
+typedef struct {
+    int id; // Index in simpoint_set
+    uint64_t start; // First measured instruction, as hw2 counts them
+    uint64_t instructions, cycles;
+    uint64_t mispredicts, stalls, front_end_stalls, icache_misses;
+} IntervalStats;
+
+typedef struct {
+    pid_t pid;
+    int fd; // Read end of the result pipe
+} IntervalJob;
+
+uint64_t delay_slots = 0;
+SimpointSet simpoint_set = {0};
+uint64_t simpoint_warmup = 0; // Detailed but unmeasured instructions before each simpoint
+int host_workers = 1; // -j: detailed processes at once
+int functional_pending = 0; // The functional pass is in a delay slot, going to functional_target next
+uint32_t functional_target = 0;
+IntervalJob interval_jobs[MAX_HOST_WORKERS];
+int interval_running = 0;
+IntervalStats interval_results[SIMPOINT_MAX_CLUSTERS];
+int interval_count = 0;
+
+#ifdef HOST_PROFILE
+// Host profile regions
+enum { PROF_CYCLE, PROF_FETCH, PROF_DECODE, PROF_EXECUTE, PROF_MEM_ACCESS, PROF_WRITE_BACK, PROF_FORWARD, PROF_TRACE,
+       PROF_REGION_COUNT };
+const char* prof_region_names[PROF_REGION_COUNT] = { "cycle", "fetch", "decode", "execute", "mem_access", "write_back",
+                                                     "forward", "trace" };
+int prof_use_perf = 0;
+#endif
+
+// Pipeline trace
+int trace_enabled = 0;
+FILE* trace_file = NULL;
+TraceFormat trace_format = TRACE_KONATA;
+uint64_t trace_start = 0, trace_end = UINT64_MAX; // Instructions fetched in this cycle range are traced
+int next_trace_id = 1;
+int trace_first_id = 0, trace_last_id = -1; // Traced instructions
+int trace_retired_id = 0; // Last instruction written out as retired or flushed
+int trace_pending_retire = 0; // Left WB this cycle; retired when the next cycle starts
+uint64_t trace_cycle = 0; // Last cycle written to the trace, once the first instruction is traced
+TraceRecord trace_window[TRACE_WINDOW];
+const char* stage_names[STAGE_COUNT] = { "IF", "ID", "EX", "MEM", "WB" };
 
 // Pipeline registers
 typedef struct {
     uint32_t instruction;
     uint32_t pc;
+    int trace_id;
+    int loop_wrap; // Delay slot of the buffered loop; fetch went on at the loop start
 } IF_ID;
 
 typedef struct {
@@ -24,30 +133,63 @@ typedef struct {
     uint32_t rs;
     uint32_t rt;
     uint32_t rd;
-    int16_t immediate;
-    uint32_t address;
+    IsaDecoded decoded;
     uint32_t reg_rs_value;
     uint32_t reg_rt_value;
+    int trace_id;
 } ID_EX;
 
 typedef struct {
     uint32_t instruction;
     uint32_t pc;
+    IsaOp op;
     uint32_t alu_result;
     uint32_t rt;
     uint32_t rd;
     uint32_t reg_rt_value;
+    int trace_id;
 } EX_MEM;
 
 typedef struct {
     uint32_t instruction;
     uint32_t pc;
+    IsaOp op;
     uint32_t mem_data;
     uint32_t alu_result;
     uint32_t rd;
+    int trace_id;
 } MEM_WB;
 
-IF_ID if_id = {0};
+// Front end: fetch fills a queue that decode drains one instruction per cycle. The defaults (width 1,
+// depth 1, perfect I-cache, no loop buffer) behave like the single IF/ID register it replaces.
+typedef int (*FetchLatency)(uint32_t address); // Extra cycles before the fetch block at address arrives
+IF_ID fetch_queue[MAX_FETCH_QUEUE]; // Ring; the head is the instruction decode takes next
+int fetch_queue_head = 0, fetch_queue_count = 0;
+int fetch_queue_depth = 1, fetch_width = 1;
+int fetch_block_size = 0; // Fetch stops at this boundary in bytes; 0 means no boundary
+int fetch_pending = 0; // Instructions of a block in flight, starting at pc
+uint64_t fetch_ready_cycle = 0; // Cycle the block in flight arrives
+int redirect_pending = 0; // A branch resolved before its delay slot was fetched
+uint32_t redirect_target = 0;
+uint64_t front_end_stalls = 0, fetch_squashed = 0;
+
+// Optional I-cache, tags only; -I swaps it in for the perfect one
+int icache_size = 0, icache_line = 0, icache_ways = 0, icache_sets = 0, icache_hit_latency = 0, icache_miss_latency = 0;
+uint32_t* icache_tags = NULL; // icache_sets * icache_ways, 0 when invalid (tags are stored plus one)
+uint64_t* icache_last_use = NULL; // Cycle of the last hit, for LRU
+uint64_t icache_accesses = 0, icache_misses = 0;
+int fetch_latency_perfect(uint32_t address);
+int fetch_latency_icache(uint32_t address);
+FetchLatency fetch_latency = fetch_latency_perfect;
+
+// Loop stream buffer: a backward branch taken twice in a row whose body, branch and delay slot fit
+// is captured; fetch then streams those instructions from the buffer without touching the I-cache
+int loop_buffer_size = 0; // 0 disables the buffer
+uint32_t loop_buffer[MAX_LOOP_BUFFER];
+uint32_t loop_start = 0, loop_end = 0; // Branch target and delay slot of the captured loop
+int loop_valid = 0;
+uint32_t loop_candidate = 0xFFFFFFFF; // Backward branch taken last
+uint64_t loop_buffer_hits = 0, loop_captures = 0;
 ID_EX id_ex = {0};
 EX_MEM ex_mem = {0};
 MEM_WB mem_wb = {0};
@@ -55,7 +197,13 @@ MEM_WB mem_wb = {0};
 // int needStall = 0;
 
 // Function declarations
+void cycle();
 void fetch();
+void fetch_enqueue(int count);
+void redirect(uint32_t target);
+void loop_buffer_train(uint32_t branch_pc, uint32_t target, int taken);
+int loop_predicted(uint32_t branch_pc);
+void icache_configure(const char* spec);
 void decode();
 void execute();
 void mem_access();
@@ -64,289 +212,705 @@ void load_binary(const char* filename, uint8_t* memory);
 void forward();
 void mem_write(uint32_t address, uint32_t value);
 void write_back_reg(uint32_t rd, uint32_t value);
+uint32_t mem_read(uint32_t address);
+int guest_copy(void* context, uint32_t address, uint8_t* buffer, uint32_t length, int to_guest);
+Hazard scoreboard_check(const IsaDecoded* d);
+void scoreboard_issue(const IsaDecoded* d);
+uint64_t next_event(Hazard* hazard);
+void skip_to(uint64_t end, Hazard hazard);
+void skip_verify(uint64_t end, Hazard hazard);
+uint64_t program_position();
+void functional_step();
+void interval_run();
+void parse_arguments(int argc, char* argv[]);
+void register_stats();
+double ipc();
+double mispredict_rate();
+int is_traced(int id);
+void trace_open(const char* filename, TraceFormat format);
+void trace_cycle_start(uint64_t cycle);
+void trace_emit_retire();
+void trace_write_o3(TraceRecord* record, uint64_t retire_cycle);
+void trace_fetch(int id, uint32_t pc, uint32_t instruction);
+void trace_stage(int id, Stage stage);
+void trace_retire(int id);
+void trace_flush(int id);
+void trace_stall(int id, Stage stage);
+void trace_forward(int consumer, int producer, uint32_t reg_number, Stage source);
+void trace_close();
 // void detect_and_insert_stall();
 // void stall_pipeline();
 
-int main() {
+int main(int argc, char* argv[]) {
+    register_stats();
+    parse_arguments(argc, argv);
+    if (guest_profile_prefix != NULL || guestprof_symbol_count > 0) {
+        guest_profile = guestprofCreate(GP_METRIC(GP_CYCLES) | GP_METRIC(GP_MISPREDICTS));
+    }
+
     // Initialize registers
     for (int i = 0; i < 29; ++i) {
         reg[i] = 0;
     }
     reg[29] = 0x1000000; // Initialize SP
     reg[31] = 0xFFFFFFF; // Initialize LR
+    id_ex.decoded = isaDecode(0); // The empty pipeline holds nops
 
     memset(instr_memory, 0, MEMORY_SIZE); // Initialize instruction memory
     memset(data_memory, 0, MEMORY_SIZE);  // Initialize data memory
 
-    load_binary("simple3.bin", instr_memory); // Load binary file into instruction memory
+    load_binary(binary_filename, instr_memory); // Load binary file into instruction memory
+    memcpy(data_memory, instr_memory, binary_size); // Initialized data of the image, for loads and syscalls
+    syscallInit(&syscalls, guest_copy, (binary_size + 0xFFF) & ~0xFFFu, HEAP_LIMIT); // The heap starts on the page after the image
+    if (simpoint_set.count > 0) {
+        interval_run();
+        return 0;
+    }
 
+    PROF_INIT(prof_region_names, PROF_REGION_COUNT, prof_use_perf);
     while (pc < MEMORY_SIZE && pc != 0xFFFFFFFF) {
-        printf("Cycle %d: PC = 0x%08X\n", clock_cycle, if_id.pc);
-        write_back();
-        mem_access();
-        execute();
-        forward();
-        decode();
-        // detect_and_insert_stall(); // Detect and insert stalling
-        fetch();
-        clock_cycle++;
-
-        
+        cycle();
     }
+    TRACE(trace_close());
+    statsFinish(clock_cycle);
+    syscallFinish(&syscalls);
 
     // Output
     printf("*******************************************************\n");
-    printf("Cycle: %d\n", clock_cycle);
+    printf("Cycle: %" PRIu64 "\n", clock_cycle);
     printf("R[2]: %d\n", reg[2]);
-    printf("Number of instructions: %d\n", instruction_count);
-    printf("Number of memory access instructions: %d\n", memory_access_count);
-    printf("Number of Register ops: %d\n", register_ops_count);
-    printf("Number of branch instruction: %d\n", branch_count);
-    printf("Number of jump instruction: %d\n", jump_count);
-    printf("Predict correct: %d, mis predict: %d, total predict: %d\n", predict_correct, mis_predict, total_predict);
+    printf("Number of instructions: %" PRIu64 "\n", instruction_count);
+    printf("Number of memory access instructions: %" PRIu64 "\n", memory_access_count);
+    printf("Number of Register ops: %" PRIu64 "\n", register_ops_count);
+    printf("Number of branch instruction: %" PRIu64 "\n", branch_count);
+    printf("Number of jump instruction: %" PRIu64 "\n", jump_count);
+    printf("Predict correct: %" PRIu64 ", mis predict: %" PRIu64 ", total predict: %" PRIu64 "\n", predict_correct,
+           mis_predict, total_predict);
+    uint64_t any_unit_ops = 0;
+    for (int unit = UNIT_INT_MUL; unit < UNIT_COUNT; ++unit) {
+        any_unit_ops += unit_ops[unit];
+    }
+    if (any_unit_ops > 0) {
+        printf("Functional units (ops/latency):");
+        for (int unit = UNIT_INT_MUL; unit < UNIT_COUNT; ++unit) {
+            printf(" %s %" PRIu64 "/%d%s", arith_units[unit].name, unit_ops[unit], arith_units[unit].latency,
+                   arith_units[unit].pipelined ? "" : "n");
+        }
+        printf("\n");
+    }
+    if (any_unit_ops > 0 || serialize_stalls > 0) {
+        printf("Scoreboard stalls (RAW/WAW/structural/serialize): %" PRIu64 "/%" PRIu64 "/%" PRIu64 "/%" PRIu64 "\n", raw_stalls,
+               waw_stalls, structural_stalls, serialize_stalls);
+    }
+    if (fetch_width > 1 || fetch_queue_depth > 1 || fetch_latency != fetch_latency_perfect || loop_buffer_size > 0) {
+        printf("Front end: fetch width %d, queue %d, %" PRIu64 " stall cycles, %" PRIu64 " squashed fetches\n", fetch_width,
+               fetch_queue_depth, front_end_stalls, fetch_squashed);
+    }
+    if (fetch_latency == fetch_latency_icache) {
+        printf("I-cache: %d bytes, %d-byte lines, %d ways, %" PRIu64 " accesses, %" PRIu64 " misses\n", icache_size,
+               icache_line, icache_ways, icache_accesses, icache_misses);
+    }
+    if (loop_buffer_size > 0) {
+        printf("Loop buffer: %d entries, %" PRIu64 " captures, %" PRIu64 "/%" PRIu64 " fetches hit (%.2f%%)\n", loop_buffer_size,
+               loop_captures, loop_buffer_hits, instruction_count + fetch_squashed,
+               instruction_count ? 100.0 * loop_buffer_hits / (instruction_count + fetch_squashed) : 0.0);
+    }
+    if (skip_count > 0) {
+        printf("Cycle skipping: %" PRIu64 " cycles in %" PRIu64 " skips%s\n", skipped_cycles, skip_count,
+               skip_mode == SKIP_VERIFY ? ", all checked against stepping" : "");
+    }
+    syscallPrint(stdout, &syscalls);
+    if (statsEnabled()) {
+        printf("*******************************************************\n");
+        statsPrint(stdout);
+    }
+    if (guest_profile != NULL) {
+        guestprofPrint(stdout, &guest_profile, 1);
+        if (guest_profile_prefix != NULL) {
+            guestprofWrite(&guest_profile, 1, guest_profile_prefix);
+        }
+    }
     printf("*******************************************************\n");
+    PROF_REPORT(stdout, instruction_count);
 
     return 0;
 }
 
+// One clock cycle, or a jump over stall cycles in which nothing but the stall counters would change
+void cycle() {
+    PROF_SCOPE(PROF_CYCLE); // Host time of a cycle goes to the opcode in EX
+    if (skip_mode != SKIP_OFF && !trace_enabled) { // A trace records every cycle
+        Hazard hazard;
+        uint64_t end = next_event(&hazard);
+        if (skip_mode == SKIP_VERIFY) {
+            skip_verify(end, hazard);
+        } else if (end != 0) {
+            skip_to(end, hazard);
+            return;
+        }
+    }
+    printf("Cycle %" PRIu64 ": PC = 0x%08X\n", clock_cycle, fetch_queue[fetch_queue_head].pc);
+    TRACE(trace_cycle_start(clock_cycle));
+    write_back();
+    mem_access();
+    forward();
+    execute();
+    decode();
+    // detect_and_insert_stall(); // Detect and insert stalling
+    fetch();
+    clock_cycle++;
+    statsTick(clock_cycle);
+}
+
+// Delivers a block that has arrived, then starts the next one if the queue has room for it
 void fetch() {
-    if (pc + 4 <= MEMORY_SIZE) {
-        if_id.instruction = (instr_memory[pc] << 24) | (instr_memory[pc + 1] << 16) | (instr_memory[pc + 2] << 8) | instr_memory[pc + 3];
-        if_id.pc = pc;
+    PROF_SCOPE(PROF_FETCH);
+    if (fetch_pending > 0) {
+        if (clock_cycle < fetch_ready_cycle) {
+            return;
+        }
+        fetch_enqueue(fetch_pending);
+        fetch_pending = 0;
+    }
+    int space = fetch_queue_depth - fetch_queue_count;
+    if (pc > MEMORY_SIZE - 4 || space == 0) { // Also stops at the 0xFFFFFFFF exit sentinel
+        return;
+    }
+    int count = fetch_width < space ? fetch_width : space;
+    if (loop_valid && pc >= loop_start && pc <= loop_end) {
+        int left = (loop_end - pc) / 4 + 1;
+        count = count < left ? count : left;
+        loop_buffer_hits += count;
+        int wrap = count == left && !redirect_pending; // A pending redirect already decides what follows
+        fetch_enqueue(count);
+        if (wrap) { // Predict the loop branch taken and stream the next trip
+            fetch_queue[(fetch_queue_head + fetch_queue_count - 1) % MAX_FETCH_QUEUE].loop_wrap = 1;
+            pc = loop_start;
+        }
+        return;
+    }
+    if (fetch_block_size > 0) {
+        int left = (fetch_block_size - pc % fetch_block_size) / 4;
+        count = count < left ? count : left;
+    }
+    if ((MEMORY_SIZE - pc) / 4 < (uint32_t)count) {
+        count = (MEMORY_SIZE - pc) / 4;
+    }
+    int latency = fetch_latency(pc);
+    if (latency == 0) {
+        fetch_enqueue(count);
+    } else {
+        fetch_pending = count;
+        fetch_ready_cycle = clock_cycle + latency;
+    }
+}
+
+// Append count instructions from pc to the fetch queue; a pending redirect takes effect after the delay slot
+void fetch_enqueue(int count) {
+    for (int i = 0; i < count; ++i) {
+        IF_ID* entry = &fetch_queue[(fetch_queue_head + fetch_queue_count) % MAX_FETCH_QUEUE];
+        if (loop_valid && pc >= loop_start && pc <= loop_end) {
+            entry->instruction = loop_buffer[(pc - loop_start) / 4];
+        } else {
+            entry->instruction = isaWordFromBytes(&instr_memory[pc]);
+        }
+        entry->pc = pc;
+        entry->trace_id = next_trace_id++;
+        entry->loop_wrap = 0;
+        fetch_queue_count++;
+        TRACE(trace_fetch(entry->trace_id, entry->pc, entry->instruction));
         pc += 4;
         instruction_count++;
-        printf("Fetch: PC = 0x%08X, Instruction = 0x%08X\n\n", if_id.pc, if_id.instruction);
+        printf("Fetch: PC = 0x%08X, Instruction = 0x%08X\n\n", entry->pc, entry->instruction);
+        if (redirect_pending) {
+            redirect_pending = 0;
+            pc = redirect_target;
+            return;
+        }
+    }
+}
+
+// Taken control transfer from EX. The instruction after it is its delay slot: if already fetched it stays
+// at the head of the queue and everything behind it is squashed, otherwise fetch delivers it first.
+void redirect(uint32_t target) {
+    if (fetch_queue_count == 0) {
+        redirect_pending = 1;
+        redirect_target = target;
+        return;
     }
+    for (int i = 1; i < fetch_queue_count; ++i) {
+        TRACE(trace_flush(fetch_queue[(fetch_queue_head + i) % MAX_FETCH_QUEUE].trace_id));
+        instruction_count--;
+        fetch_squashed++;
+    }
+    fetch_queue_count = 1;
+    fetch_pending = 0; // A block in flight was on the wrong path
+    pc = target;
 }
 
+// Resolved branch from EX: capture a short loop on the second taken trip
+void loop_buffer_train(uint32_t branch_pc, uint32_t target, int taken) {
+    if (loop_buffer_size == 0 || !taken) {
+        return;
+    }
+    if (target > branch_pc) {
+        return; // Forward branches inside a loop body leave the candidate alone
+    }
+    if ((branch_pc + 4 - target) / 4 + 1 > (uint32_t)loop_buffer_size) {
+        loop_candidate = 0xFFFFFFFF;
+        return;
+    }
+    if (loop_valid && loop_start == target && loop_end == branch_pc + 4) {
+        return;
+    }
+    if (loop_candidate != branch_pc) {
+        loop_candidate = branch_pc;
+        return;
+    }
+    loop_start = target;
+    loop_end = branch_pc + 4;
+    for (uint32_t address = loop_start; address <= loop_end; address += 4) {
+        loop_buffer[(address - loop_start) / 4] = isaWordFromBytes(&instr_memory[address]);
+    }
+    loop_valid = 1;
+    loop_captures++;
+    printf("Loop buffer: captured 0x%08X-0x%08X\n", loop_start, loop_end);
+}
+
+// Whether fetch streamed the loop start after this branch's delay slot, or will once it fetches the slot
+int loop_predicted(uint32_t branch_pc) {
+    if (fetch_queue_count > 0) {
+        return fetch_queue[fetch_queue_head].loop_wrap;
+    }
+    return loop_valid && branch_pc + 4 == loop_end && pc == loop_end && fetch_pending == 0;
+}
+
+int fetch_latency_perfect(uint32_t address) {
+    (void)address;
+    return 0;
+}
+
+// Set-associative LRU lookup; a miss fills the line at once and charges the miss latency
+int fetch_latency_icache(uint32_t address) {
+    uint32_t line = address / icache_line;
+    uint32_t* tags = &icache_tags[(line % icache_sets) * icache_ways];
+    uint64_t* last_use = &icache_last_use[(line % icache_sets) * icache_ways];
+    int victim = 0;
+    icache_accesses++;
+    for (int way = 0; way < icache_ways; ++way) {
+        if (tags[way] == line + 1) {
+            last_use[way] = clock_cycle;
+            return icache_hit_latency;
+        }
+        if (last_use[way] < last_use[victim] || (tags[way] == 0 && tags[victim] != 0)) {
+            victim = way;
+        }
+    }
+    icache_misses++;
+    tags[victim] = line + 1;
+    last_use[victim] = clock_cycle;
+    printf("Fetch: I-cache miss at 0x%08X\n", address);
+    return icache_miss_latency;
+}
+
+// -I size:line:ways:miss latency[:hit latency]
+void icache_configure(const char* spec) {
+    int fields = sscanf(spec, "%d:%d:%d:%d:%d", &icache_size, &icache_line, &icache_ways, &icache_miss_latency,
+                        &icache_hit_latency);
+    if (fields < 4 || icache_line < 4 || (icache_line & (icache_line - 1)) != 0 || icache_ways < 1 ||
+        icache_size <= 0 || icache_size % (icache_line * icache_ways) != 0 || icache_miss_latency < 0 ||
+        icache_hit_latency < 0) {
+        fprintf(stderr, "Bad I-cache spec (size:line:ways:miss latency[:hit latency]): %s\n", spec);
+        exit(1);
+    }
+    icache_sets = icache_size / (icache_line * icache_ways);
+    icache_tags = calloc((size_t)icache_sets * icache_ways, sizeof(uint32_t));
+    icache_last_use = calloc((size_t)icache_sets * icache_ways, sizeof(uint64_t));
+    if (icache_tags == NULL || icache_last_use == NULL) {
+        fprintf(stderr, "Out of memory for a %d-byte I-cache\n", icache_size);
+        exit(1);
+    }
+    fetch_block_size = icache_line;
+    fetch_latency = fetch_latency_icache;
+}
+
+// Takes the head of the fetch queue, or sends a bubble down when the front end has nothing to give
 void decode() {
-    uint32_t instruction = if_id.instruction;
+    PROF_SCOPE(PROF_DECODE);
+    if (ex_stalled) {
+        return;
+    }
+    IF_ID bubble = {0};
+    IF_ID* entry = &bubble;
+    if (fetch_queue_count > 0) {
+        entry = &fetch_queue[fetch_queue_head];
+        fetch_queue_head = (fetch_queue_head + 1) % MAX_FETCH_QUEUE;
+        fetch_queue_count--;
+    } else {
+        front_end_stalls++;
+    }
+    uint32_t instruction = entry->instruction;
     id_ex.instruction = instruction;
-    id_ex.pc = if_id.pc;
-    id_ex.rs = (instruction >> 21) & 0x1F;
-    id_ex.rt = (instruction >> 16) & 0x1F;
-    id_ex.rd = (instruction >> 11) & 0x1F;
-    id_ex.immediate = instruction & 0xFFFF;
-    id_ex.address = instruction & 0x3FFFFFF;
+    id_ex.pc = entry->pc;
+    id_ex.trace_id = entry->trace_id;
+    TRACE(trace_stage(id_ex.trace_id, STAGE_ID));
+    id_ex.decoded = isaDecode(instruction);
+    id_ex.rs = id_ex.decoded.rs;
+    id_ex.rt = id_ex.decoded.rt;
+    id_ex.rd = id_ex.decoded.dest;
     id_ex.reg_rs_value = reg[id_ex.rs];
     id_ex.reg_rt_value = reg[id_ex.rt];
     printf("Decode: PC = 0x%08X, Instruction = 0x%08X\n", id_ex.pc, id_ex.instruction);
 }
 
+// One handler per instruction class, picked from the ISA table. Results are computed here and carried
+// down the pipeline to WB in alu_result; loads and stores only form their address.
 void execute() {
+    PROF_SCOPE(PROF_EXECUTE);
+    static void* const handlers[ISA_CLASS_COUNT] = { ISA_CLASS_LIST(ISA_CLASS_HANDLER) };
+    const IsaDecoded* d = &id_ex.decoded;
+    const IsaInfo* info = &isa_info[d->op];
     uint32_t opcode = id_ex.instruction >> 26;
+    PROF_OPCODE(opcode);
+    uint64_t mispredicts = mis_predict;
     uint32_t rs = id_ex.rs;
     uint32_t rt = id_ex.rt;
-    uint32_t rd = id_ex.rd;
-    int16_t immediate = id_ex.immediate;
-    uint32_t address = id_ex.address;
-    int32_t sign_extended_immediate = (int16_t)immediate;
-    uint32_t value;
+    uint32_t value = 0;
+    int taken;
+
+    ex_stalled = 0;
+    if (id_ex.trace_id != 0) {
+        Hazard hazard = scoreboard_check(d);
+        if (hazard != HAZARD_NONE) {
+            raw_stalls += hazard == HAZARD_RAW;
+            waw_stalls += hazard == HAZARD_WAW;
+            structural_stalls += hazard == HAZARD_STRUCTURAL;
+            serialize_stalls += hazard == HAZARD_SERIALIZE;
+            memset(&ex_mem, 0, sizeof(ex_mem)); // Bubble
+            TRACE(trace_stall(id_ex.trace_id, STAGE_ID));
+            if (fetch_queue_count > 0) {
+                TRACE(trace_stall(fetch_queue[fetch_queue_head].trace_id, STAGE_IF));
+            }
+            ex_stalled = 1;
+            ex_stall_cycles++;
+            printf("Execute: %s stall, instruction 0x%08X held in ID\n", hazard_names[hazard], id_ex.instruction);
+            return;
+        }
+        scoreboard_issue(d);
+    }
 
     ex_mem.instruction = id_ex.instruction;
     ex_mem.pc = id_ex.pc;
+    ex_mem.op = d->op;
+    ex_mem.trace_id = id_ex.trace_id;
+    TRACE(trace_stage(ex_mem.trace_id, STAGE_EX));
     ex_mem.rt = rt;
-    ex_mem.rd = rd;
+    ex_mem.rd = d->dest;
     ex_mem.reg_rt_value = id_ex.reg_rt_value;
+    ex_mem.alu_result = id_ex.reg_rs_value + d->immediate; // Address of loads and stores
 
     printf("Executing instruction: 0x%08X\n", id_ex.instruction);
     printf("rs: R[%d] = 0x%08X, rt: R[%d] = 0x%08X\n", rs, id_ex.reg_rs_value, rt, id_ex.reg_rt_value);
     printf("opcode: %X\n", opcode);
 
+    switch (info->counter) {
+        case ISA_COUNT_REGISTER: register_ops_count++; break;
+        case ISA_COUNT_MEMORY: memory_access_count++; break;
+        case ISA_COUNT_BRANCH: branch_count++; total_predict++; break;
+        case ISA_COUNT_JUMP: jump_count++; break;
+        default: break;
+    }
+    goto *handlers[d->cls];
 
-    switch (opcode) {
-        case 0x00: // R-type instructions
-            if (id_ex.instruction != 0x00000000) { // Ensure not to count NOP as a register operation
-                register_ops_count++;
-            }
-            switch (id_ex.instruction & 0x3F) {
-                case 0x20: // add
-                    value = (int32_t)id_ex.reg_rs_value + (int32_t)id_ex.reg_rt_value;
-                    ex_mem.alu_result = value;
-                    break;
-                case 0x21: // addu
-                    value = id_ex.reg_rs_value + id_ex.reg_rt_value;
-                    ex_mem.alu_result = value;
-                    break;
-                case 0x22: // sub
-                    value = (int32_t)id_ex.reg_rs_value - (int32_t)id_ex.reg_rt_value;
-                    ex_mem.alu_result = value;
-                    break;
-                case 0x24: // and
-                    value = id_ex.reg_rs_value & id_ex.reg_rt_value;
-                    ex_mem.alu_result = value;
-                    break;
-                case 0x25: // or
-                    value = id_ex.reg_rs_value | id_ex.reg_rt_value;
-                    ex_mem.alu_result = value;
-                    break;
-                case 0x2A: // slt
-                    value = (int32_t)id_ex.reg_rs_value < (int32_t)id_ex.reg_rt_value ? 1 : 0;
-                    ex_mem.alu_result = value;
-                    break;
-                case 0x00: // sll
-                    value = id_ex.reg_rt_value << id_ex.immediate;
-                    ex_mem.alu_result = value;
-                    break;
-                case 0x02: // srl
-                    value = id_ex.reg_rt_value >> id_ex.immediate;
-                    ex_mem.alu_result = value;
-                    break;
-                case 0x08: // jr
-                    jump_count++;
-                    pc = id_ex.reg_rs_value;
-                    printf("Execute: JR to PC = 0x%08X\n", pc);
-                    break;
-                default:
-                    printf("Unsupported R-type funct: %X\n", id_ex.instruction & 0x3F);
-            }
-            break;
-        case 0x02: // J
-            jump_count++;
-            pc = (pc & 0xF0000000) | (address << 2);
-            printf("Execute: J to PC = 0x%08X\n", pc);
-            break;
-        case 0x03: // JAL
-            jump_count++;
-            reg[31] = pc;
-            pc = (pc & 0xF0000000) | (address << 2);
-            printf("Execute: JAL to PC = 0x%08X\n", pc);
-            break;
-        case 0x04: // BEQ
-            branch_count++;
-            total_predict++;
-            if (id_ex.reg_rs_value == id_ex.reg_rt_value) {
-                pc += (sign_extended_immediate << 2);
-                predict_correct++;
-                printf("Execute: BEQ taken to PC = 0x%08X\n", pc);
-            } else {
-                mis_predict++;
-                printf("Execute: BEQ not taken\n");
-            }
-            break;
-        case 0x05: // BNE
-            branch_count++;
-            total_predict++;
-            printf("BNE Execution: id_ex.reg_rs_value = %d, id_ex.reg_rt_value = %d\n", id_ex.reg_rs_value, id_ex.reg_rt_value);
-            if (id_ex.reg_rs_value != id_ex.reg_rt_value) {
-                pc += sign_extended_immediate << 2;
-                predict_correct++;
-                printf("Execute: BNE taken to PC = 0x%08X\n", pc);
-            } else {
-                mis_predict++;
-                printf("Execute: BNE not taken\n");
-            }
-            break;
+class_INVALID:
+    ex_mem.rd = 0;
+    printf("Unsupported instruction: 0x%08X\n", id_ex.instruction);
+    goto done;
+class_ALU:
+    ex_mem.alu_result = isaAluResult(d, id_ex.reg_rs_value, id_ex.reg_rt_value);
+    if (d->op == ISA_SLTI) {
+        printf("SLTI -> rs: %d, rt: %d, value: %d\n", id_ex.reg_rs_value, ex_mem.rd, ex_mem.alu_result);
+    }
+    goto done;
+class_HILO: // mfhi, mflo
+    ex_mem.alu_result = isaAlu(info->alu, arith.hi, arith.lo);
+    goto done;
+class_MULDIV: // mult, multu, div, divu, mthi, mtlo write HI/LO at issue
+    arithMulDiv(&arith, d->funct, id_ex.reg_rs_value, id_ex.reg_rt_value);
+    goto done;
+class_BRANCH:
+    taken = isaAluResult(d, id_ex.reg_rs_value, id_ex.reg_rt_value);
+    goto branch;
+class_BRANCH_FP: // bc1f, bc1t
+    taken = arithCondition(&arith, rt >> 2) == (int)(rt & 1);
+branch:
+    if (d->op == ISA_BNE) {
+        printf("BNE Execution: id_ex.reg_rs_value = %d, id_ex.reg_rt_value = %d\n", id_ex.reg_rs_value, id_ex.reg_rt_value);
+    }
+    loop_buffer_train(id_ex.pc, isaBranchTarget(d, id_ex.pc), taken);
+    if (taken) {
+        if (!loop_predicted(id_ex.pc) || isaBranchTarget(d, id_ex.pc) != loop_start) { // Else the buffer streams it
+            redirect(isaBranchTarget(d, id_ex.pc)); // The instruction after the branch goes to ID next, as a delay slot
+        }
+        delay_slots++;
+        predict_correct++;
+        printf("Execute: %s taken to PC = 0x%08X\n", info->name, isaBranchTarget(d, id_ex.pc));
+    } else {
+        if (loop_predicted(id_ex.pc)) {
+            redirect(id_ex.pc + 8); // Loop exit: squash the trip the loop buffer streamed
+        }
+        mis_predict++;
+        printf("Execute: %s not taken\n", info->name);
+    }
+    goto done;
+class_JUMP:
+    write_back_reg(d->dest, id_ex.pc + 8); // jal links at once, like the redirect
+    ex_mem.rd = 0;
+    redirect(isaJumpTarget(d, id_ex.pc));
+    delay_slots += d->dest == 0; // jal returns past its delay slot
+    printf("Execute: %s to PC = 0x%08X\n", info->name, isaJumpTarget(d, id_ex.pc));
+    goto done;
+class_JUMP_REG:
+    redirect(id_ex.reg_rs_value);
+    delay_slots++;
+    printf("Execute: JR to PC = 0x%08X\n", id_ex.reg_rs_value);
+    goto done;
+class_LOAD:
+class_STORE:
+class_LOAD_LINKED:
+class_STORE_CONDITIONAL:
+class_FP_LOAD:
+class_FP_STORE: // The address is formed above; the FP register is read or written in MEM
+    goto done;
+class_COP1:
+    if (arithCop1(&arith, id_ex.instruction, id_ex.reg_rt_value, &value) == 0) {
+        printf("Unsupported COP1 instruction: 0x%08X\n", id_ex.instruction);
+    }
+    ex_mem.alu_result = value; // mfc1, cfc1; the others have no destination
+    goto done;
+class_SYSCALL: // Everything older has written back, so the registers are current
+    if (syscallHandle(&syscalls, reg, &arith, NULL, clock_cycle)) {
+        pc = 0xFFFFFFFF;
+    }
+    goto done;
 
-        case 0x08: // ADDI
-            register_ops_count++;
-            value = id_ex.reg_rs_value + immediate;
-            ex_mem.alu_result = value;
-            ex_mem.rd = rt; 
-            break;
-        case 0x09: // ADDIU
-            register_ops_count++;
-            value = id_ex.reg_rs_value + sign_extended_immediate;
-            ex_mem.alu_result = value;
-            ex_mem.rd = rt; 
-            break;
-        case 0x0A: // SLTI
-            register_ops_count++;
-            value = (int32_t)id_ex.reg_rs_value < sign_extended_immediate ? 1 : 0;
-            ex_mem.alu_result = value;
-            ex_mem.rd = rt; 
-            printf("SLTI -> rs: %d, rt: %d, value: %d\n", id_ex.reg_rs_value, ex_mem.rd, value);
-            break;
-        case 0x0C: // ANDI
-            register_ops_count++;
-            value = id_ex.reg_rs_value & (id_ex.immediate & 0xFFFF);
-            ex_mem.alu_result = value;
-            ex_mem.rd = rt; 
-            break;
-        case 0x0D: // ORI
-            register_ops_count++;
-            value = id_ex.reg_rs_value | (id_ex.immediate & 0xFFFF);
-            ex_mem.alu_result = value;
-            ex_mem.rd = rt; 
-            break;
-        case 0x0E: // XORI
-            register_ops_count++;
-            value = id_ex.reg_rs_value ^ (id_ex.immediate & 0xFFFF);
-            ex_mem.alu_result = value;
-            ex_mem.rd = rt; 
-            break;
-        case 0x0F: // LUI
-            register_ops_count++;
-            value = id_ex.immediate << 16;
-            ex_mem.alu_result = value;
-            ex_mem.rd = rt; 
-            break;
-        case 0x23: // LW
-            memory_access_count++;
-            ex_mem.alu_result = id_ex.reg_rs_value + sign_extended_immediate;
-            ex_mem.rd = rs; 
-            break;
-        case 0x2B: // SW
-            memory_access_count++;
-            ex_mem.alu_result = id_ex.reg_rs_value + sign_extended_immediate;
-            ex_mem.rd = rt; 
-            break;
-        default:
-            printf("Unsupported opcode: %X\n", opcode);
+done:
+    // The cycle is charged to the instruction in EX; the empty pipeline at start-up has no instruction yet
+    if (guest_profile != NULL && id_ex.trace_id != 0) {
+        guestprofRetire(guest_profile, id_ex.pc, id_ex.instruction, pc, 1 + ex_stall_cycles, 0, mis_predict - mispredicts);
+    }
+    ex_stall_cycles = 0;
+}
+
+// Source registers still being produced, or a destination an older instruction would write later
+Hazard scoreboard_check(const IsaDecoded* d) {
+    const IsaInfo* info = &isa_info[d->op];
+    ArithUnit unit = isaUnit(d);
+    ArithOperands operands = arithOperands(d->instruction);
+    uint64_t done = clock_cycle + arith_units[unit].latency;
+
+    int reads_rs = info->operands & ISA_READ_RS;
+    int reads_rt = info->operands & ISA_READ_RT;
+    if ((reads_rs && gpr_ready[d->rs] > clock_cycle) || (reads_rt && gpr_ready[d->rt] > clock_cycle) ||
+        ((operands.flags & ARITH_READ_HILO) && hilo_ready > clock_cycle) ||
+        ((operands.flags & ARITH_READ_FCSR) && fcsr_ready > clock_cycle)) {
+        return HAZARD_RAW;
+    }
+    for (int i = 0; i < 32; ++i) {
+        if ((operands.fp_read >> i & 1) && fp_ready[i] > clock_cycle) {
+            return HAZARD_RAW;
+        }
+    }
+    if ((operands.gpr_write != 0 && gpr_ready[operands.gpr_write] > done) ||
+        ((operands.flags & ARITH_WRITE_HILO) && hilo_ready > done) ||
+        ((operands.flags & ARITH_WRITE_FCSR) && fcsr_ready > done)) {
+        return HAZARD_WAW;
+    }
+    for (int i = 0; i < 32; ++i) {
+        if ((operands.fp_write >> i & 1) && fp_ready[i] > done) {
+            return HAZARD_WAW;
+        }
+    }
+    if (unit != UNIT_NONE && !arith_units[unit].pipelined && unit_busy_until[unit] > clock_cycle) {
+        return HAZARD_STRUCTURAL;
+    }
+    if (d->cls == ISA_CLASS_SYSCALL && mem_wb.trace_id != 0) { // syscall waits for older writes
+        return HAZARD_SERIALIZE;
+    }
+    return HAZARD_NONE;
+}
+
+// Results are computed at issue; the scoreboard only decides when consumers may see them
+void scoreboard_issue(const IsaDecoded* d) {
+    ArithUnit unit = isaUnit(d);
+    ArithOperands operands = arithOperands(d->instruction);
+    uint64_t done = clock_cycle + arith_units[unit].latency;
+
+    if (unit != UNIT_NONE) {
+        unit_ops[unit]++;
+        if (!arith_units[unit].pipelined) {
+            unit_busy_until[unit] = done;
+        }
+    }
+    for (int i = 0; i < 32; ++i) {
+        if (operands.fp_write >> i & 1) {
+            fp_ready[i] = done;
+        }
+    }
+    if (operands.gpr_write != 0) {
+        gpr_ready[operands.gpr_write] = done;
+    }
+    if (operands.flags & ARITH_WRITE_HILO) {
+        hilo_ready = done;
+    }
+    if (operands.flags & ARITH_WRITE_FCSR) {
+        fcsr_ready = done;
+    }
+}
+
+// First cycle at which the stalled instruction's hazard can change, or 0 when the pipeline may change
+// before then. scoreboard_check() only compares the clock with ready times, so between two consecutive
+// ready times (or ready time minus latency, for WAW) every cycle repeats the same stall. Snapshots of
+// the time series must still see every cycle, so the skip stops at the next one.
+uint64_t next_event(Hazard* hazard) {
+    if (!ex_stalled || ex_mem.trace_id != 0 || mem_wb.trace_id != 0 || fetch_queue_count < fetch_queue_depth) {
+        return 0; // A queue with room still fills while EX waits
+    }
+    *hazard = scoreboard_check(&id_ex.decoded);
+    if (*hazard == HAZARD_NONE || *hazard == HAZARD_SERIALIZE) {
+        return 0;
+    }
+    uint64_t latency = arith_units[isaUnit(&id_ex.decoded)].latency;
+    uint64_t events[32 + 32 + 2 + UNIT_COUNT];
+    int count = 0;
+    for (int i = 0; i < 32; ++i) {
+        events[count++] = gpr_ready[i];
+        events[count++] = fp_ready[i];
+    }
+    events[count++] = hilo_ready;
+    events[count++] = fcsr_ready;
+    for (int unit = 0; unit < UNIT_COUNT; ++unit) {
+        events[count++] = unit_busy_until[unit];
+    }
+    uint64_t next = stats_next_snapshot;
+    for (int i = 0; i < count; ++i) {
+        if (events[i] > clock_cycle && events[i] < next) {
+            next = events[i];
+        }
+        if (events[i] > clock_cycle + latency && events[i] - latency < next) {
+            next = events[i] - latency;
+        }
+    }
+    return next > clock_cycle + 1 && next != UINT64_MAX ? next : 0;
+}
+
+// The stalled cycles up to end, as execute() would have counted them
+void skip_to(uint64_t end, Hazard hazard) {
+    uint64_t cycles = end - clock_cycle;
+    raw_stalls += hazard == HAZARD_RAW ? cycles : 0;
+    waw_stalls += hazard == HAZARD_WAW ? cycles : 0;
+    structural_stalls += hazard == HAZARD_STRUCTURAL ? cycles : 0;
+    ex_stall_cycles += cycles;
+    printf("Skip: cycles %" PRIu64 "-%" PRIu64 ", %s stall, instruction 0x%08X held in ID\n\n", clock_cycle, end - 1,
+           hazard_names[hazard], id_ex.instruction);
+    clock_cycle = end;
+    statsTick(clock_cycle);
+    skip_count++;
+    skipped_cycles += cycles;
+}
+
+// Differential mode: remember what a skip would have produced and compare once stepping gets there
+void skip_verify(uint64_t end, Hazard hazard) {
+    uint64_t stalls[HAZARD_SERIALIZE + 1] = { 0, raw_stalls, waw_stalls, structural_stalls, serialize_stalls };
+    if (skip_check.end != 0 && clock_cycle == skip_check.end) {
+        if (memcmp(stalls, skip_check.stalls, sizeof(stalls)) != 0 || ex_stall_cycles != skip_check.ex_stall_cycles ||
+            id_ex.trace_id != skip_check.trace_id) {
+            fprintf(stderr, "Cycle skip to %" PRIu64 " disagrees with stepping: RAW/WAW/structural %" PRIu64 "/%" PRIu64
+                            "/%" PRIu64 ", expected %" PRIu64 "/%" PRIu64 "/%" PRIu64 "\n", clock_cycle, raw_stalls,
+                    waw_stalls, structural_stalls, skip_check.stalls[HAZARD_RAW], skip_check.stalls[HAZARD_WAW],
+                    skip_check.stalls[HAZARD_STRUCTURAL]);
+            exit(1);
+        }
+        skip_check.end = 0;
+    }
+    if (end != 0 && skip_check.end == 0) {
+        uint64_t cycles = end - clock_cycle;
+        memcpy(skip_check.stalls, stalls, sizeof(stalls));
+        skip_check.stalls[hazard] += cycles;
+        skip_check.ex_stall_cycles = ex_stall_cycles + cycles;
+        skip_check.trace_id = id_ex.trace_id;
+        skip_check.end = end;
+        skip_count++;
+        skipped_cycles += cycles;
     }
 }
 
 void mem_access() {
-    uint32_t instruction = ex_mem.instruction;
-    uint32_t opcode = instruction >> 26;
-    uint32_t mem_address;
+    PROF_SCOPE(PROF_MEM_ACCESS);
+    const IsaInfo* info = &isa_info[ex_mem.op];
+    uint32_t mem_address = ex_mem.alu_result;
     uint32_t value;
+    int pair = (info->operands & ISA_DOUBLE) != 0;
 
     mem_wb.instruction = ex_mem.instruction;
     mem_wb.pc = ex_mem.pc;
+    mem_wb.op = ex_mem.op;
+    mem_wb.trace_id = ex_mem.trace_id;
+    TRACE(trace_stage(mem_wb.trace_id, STAGE_MEM));
     mem_wb.alu_result = ex_mem.alu_result;
     mem_wb.rd = ex_mem.rd;
 
-    switch (opcode) {
-        case 0x23: // LW
-            mem_address = ex_mem.alu_result;
+    switch (info->cls) {
+        case ISA_CLASS_LOAD:
+        case ISA_CLASS_LOAD_LINKED: // One hart, so the reservation always holds
             if (mem_address % 4 == 0 && mem_address < MEMORY_SIZE - 3) { // Ensure we do not read out of bounds
-                value = (data_memory[mem_address] << 24) | (data_memory[mem_address + 1] << 16) |
-                        (data_memory[mem_address + 2] << 8) | data_memory[mem_address + 3];
+                value = isaWordFromBytes(&data_memory[mem_address]);
                 mem_wb.mem_data = value;
                 printf("Memory Access: LW from address 0x%08X, Data = 0x%08X\n", mem_address, value);
             } else {
                 printf("Memory access error: Invalid address %08X\n", mem_address);
             }
             break;
-        case 0x2B: // SW
-            mem_write(ex_mem.alu_result, ex_mem.reg_rt_value);
-            printf("Memory Access: SW to address 0x%08X, Data = 0x%08X\n", ex_mem.alu_result, ex_mem.reg_rt_value);
+        case ISA_CLASS_STORE:
+        case ISA_CLASS_STORE_CONDITIONAL:
+            mem_write(mem_address, ex_mem.reg_rt_value);
+            mem_wb.mem_data = 1; // sc succeeds
+            printf("Memory Access: SW to address 0x%08X, Data = 0x%08X\n", mem_address, ex_mem.reg_rt_value);
+            break;
+        case ISA_CLASS_FP_LOAD: // ldc1: big-endian, so the high word (odd register) comes first
+            if (pair) {
+                arith.fpr[(ex_mem.rt & ~1u) + 1] = mem_read(mem_address);
+                arith.fpr[ex_mem.rt & ~1u] = mem_read(mem_address + 4);
+            } else {
+                arith.fpr[ex_mem.rt] = mem_read(mem_address);
+            }
+            break;
+        case ISA_CLASS_FP_STORE:
+            if (pair) {
+                mem_write(mem_address, arith.fpr[(ex_mem.rt & ~1u) + 1]);
+                mem_write(mem_address + 4, arith.fpr[ex_mem.rt & ~1u]);
+            } else {
+                mem_write(mem_address, arith.fpr[ex_mem.rt]);
+            }
+            break;
+        default:
             break;
     }
 }
 
+// Instructions without a destination carry rd 0, so only the loaded or computed value needs choosing
 void write_back() {
+    PROF_SCOPE(PROF_WRITE_BACK);
     uint32_t instruction = mem_wb.instruction;
-    uint32_t opcode = instruction >> 26;
+    IsaClass cls = isa_info[mem_wb.op].cls;
     uint32_t rd = mem_wb.rd;
+    TRACE(trace_stage(mem_wb.trace_id, STAGE_WB));
+    TRACE(trace_retire(mem_wb.trace_id));
 
-    switch (opcode) {
-        case 0x00: // R-type
-            write_back_reg(rd, mem_wb.alu_result);
-            break;
-        case 0x08: // ADDI
-        case 0x09: // ADDIU
-        case 0x0A: // SLTI
-        case 0x0C: // ANDI
-        case 0x0D: // ORI
-        case 0x0E: // XORI
-        case 0x0F: // LUI
-            write_back_reg(rd, mem_wb.alu_result);
-            break;
-        case 0x23: // LW
-            write_back_reg(rd, mem_wb.mem_data);
-            break;
+    if (cls == ISA_CLASS_LOAD || cls == ISA_CLASS_LOAD_LINKED || cls == ISA_CLASS_STORE_CONDITIONAL) {
+        write_back_reg(rd, mem_wb.mem_data);
+    } else {
+        write_back_reg(rd, mem_wb.alu_result);
     }
     printf("Write Back: Instruction = 0x%08X, Register[%d] = 0x%08X\n", instruction, rd, reg[rd]);
 }
@@ -354,10 +918,7 @@ void write_back() {
 void mem_write(uint32_t address, uint32_t value) {
     if (address < MEMORY_SIZE - 3) { // Ensure we do not write out of bounds
         if (address % 4 == 0) { // Check if the address is a multiple of 4 (word-aligned)
-            data_memory[address] = (value >> 24) & 0xFF;
-            data_memory[address + 1] = (value >> 16) & 0xFF;
-            data_memory[address + 2] = (value >> 8) & 0xFF;
-            data_memory[address + 3] = value & 0xFF;
+            isaWordToBytes(&data_memory[address], value);
         } else {
             printf("Memory write error: Address is not word-aligned\n");
         }
@@ -366,6 +927,28 @@ void mem_write(uint32_t address, uint32_t value) {
     }
 }
 
+// Syscall buffers live in data memory, where loads and stores go, one byte per address
+int guest_copy(void* context, uint32_t address, uint8_t* buffer, uint32_t length, int to_guest) {
+    (void)context;
+    if (address >= MEMORY_SIZE || length > MEMORY_SIZE - address) {
+        return 0;
+    }
+    if (to_guest) {
+        memcpy(&data_memory[address], buffer, length);
+    } else {
+        memcpy(buffer, &data_memory[address], length);
+    }
+    return 1;
+}
+
+uint32_t mem_read(uint32_t address) {
+    if (address % 4 == 0 && address < MEMORY_SIZE - 3) {
+        return isaWordFromBytes(&data_memory[address]);
+    }
+    printf("Memory access error: Invalid address %08X\n", address);
+    return 0;
+}
+
 void write_back_reg(uint32_t rd, uint32_t value) {
     if (rd != 0) { // Register 0 is always 0 in MIPS
         reg[rd] = value;  // Write the value to the specified register
@@ -378,30 +961,568 @@ void load_binary(const char* filename, uint8_t* memory) {
         perror("Error opening file");
         exit(1);
     }
-    fread(memory, sizeof(uint8_t), MEMORY_SIZE, file);
+    binary_size = fread(memory, sizeof(uint8_t), MEMORY_SIZE, file);
     fclose(file);
 }
 
+// Runs just before execute, when the instruction ahead has just left MEM and the one two ahead has
+// written back, both after id_ex read its registers
 void forward() {
-    // Forwarding from MEM stage to EX stage
-    if (ex_mem.rd != 0) {
-        if (ex_mem.rd == id_ex.rs) {
-            id_ex.reg_rs_value = ex_mem.alu_result;
-        }
-        if (ex_mem.rd == id_ex.rt) {
-            id_ex.reg_rt_value = ex_mem.alu_result;
-        }
-    }
+    PROF_SCOPE(PROF_FORWARD);
+    // Written back this cycle: the register file is written in the first half of the cycle
+    id_ex.reg_rs_value = reg[id_ex.rs];
+    id_ex.reg_rt_value = reg[id_ex.rt];
 
-    // Forwarding from WB stage to EX stage
+    // Forwarding from the end of MEM to EX, loaded data included
     if (mem_wb.rd != 0) {
+        IsaClass cls = isa_info[mem_wb.op].cls;
+        uint32_t value = cls == ISA_CLASS_LOAD || cls == ISA_CLASS_LOAD_LINKED || cls == ISA_CLASS_STORE_CONDITIONAL
+                             ? mem_wb.mem_data : mem_wb.alu_result;
         if (mem_wb.rd == id_ex.rs) {
-            id_ex.reg_rs_value = mem_wb.alu_result;
+            id_ex.reg_rs_value = value;
+            TRACE(trace_forward(id_ex.trace_id, mem_wb.trace_id, id_ex.rs, STAGE_MEM));
         }
         if (mem_wb.rd == id_ex.rt) {
-            id_ex.reg_rt_value = mem_wb.alu_result;
+            id_ex.reg_rt_value = value;
+            TRACE(trace_forward(id_ex.trace_id, mem_wb.trace_id, id_ex.rt, STAGE_MEM));
+        }
+    }
+}
+
+// Instructions executed so far as hw2 and hw4 count them, the unit of the simpoints
+uint64_t program_position() {
+    return instruction_count - delay_slots;
+}
+
+// Runs the instruction at pc at once, without the pipeline or the clock; a taken transfer takes effect
+// after its delay slot, as in the pipeline
+void functional_step() {
+    uint32_t instruction = isaWordFromBytes(&instr_memory[pc]);
+    IsaDecoded d = isaDecode(instruction);
+    uint32_t rs_value = reg[d.rs], rt_value = reg[d.rt];
+    uint32_t mem_address = rs_value + d.immediate;
+    uint32_t next_pc = functional_pending ? functional_target : pc + 4;
+    uint32_t value = 0;
+    int pair = (isa_info[d.op].operands & ISA_DOUBLE) != 0;
+    int taken = 0;
+
+    functional_pending = 0;
+    instruction_count++;
+    switch (d.cls) {
+        case ISA_CLASS_ALU:
+            write_back_reg(d.dest, isaAluResult(&d, rs_value, rt_value));
+            break;
+        case ISA_CLASS_HILO:
+            write_back_reg(d.dest, isaAlu(isa_info[d.op].alu, arith.hi, arith.lo));
+            break;
+        case ISA_CLASS_MULDIV:
+            arithMulDiv(&arith, d.funct, rs_value, rt_value);
+            break;
+        case ISA_CLASS_BRANCH:
+        case ISA_CLASS_BRANCH_FP:
+            taken = d.cls == ISA_CLASS_BRANCH ? (int)isaAluResult(&d, rs_value, rt_value)
+                                              : arithCondition(&arith, d.rt >> 2) == (int)(d.rt & 1);
+            functional_target = isaBranchTarget(&d, pc);
+            delay_slots += taken;
+            break;
+        case ISA_CLASS_JUMP:
+            write_back_reg(d.dest, pc + 8);
+            taken = 1;
+            functional_target = isaJumpTarget(&d, pc);
+            delay_slots += d.dest == 0;
+            break;
+        case ISA_CLASS_JUMP_REG:
+            taken = 1;
+            functional_target = rs_value;
+            delay_slots++;
+            break;
+        case ISA_CLASS_LOAD:
+        case ISA_CLASS_LOAD_LINKED:
+            write_back_reg(d.dest, mem_read(mem_address));
+            break;
+        case ISA_CLASS_STORE:
+        case ISA_CLASS_STORE_CONDITIONAL:
+            mem_write(mem_address, rt_value);
+            write_back_reg(d.dest, 1); // sc succeeds
+            break;
+        case ISA_CLASS_FP_LOAD:
+            if (pair) {
+                arith.fpr[(d.rt & ~1u) + 1] = mem_read(mem_address);
+                arith.fpr[d.rt & ~1u] = mem_read(mem_address + 4);
+            } else {
+                arith.fpr[d.rt] = mem_read(mem_address);
+            }
+            break;
+        case ISA_CLASS_FP_STORE:
+            if (pair) {
+                mem_write(mem_address, arith.fpr[(d.rt & ~1u) + 1]);
+                mem_write(mem_address + 4, arith.fpr[d.rt & ~1u]);
+            } else {
+                mem_write(mem_address, arith.fpr[d.rt]);
+            }
+            break;
+        case ISA_CLASS_COP1:
+            if (arithCop1(&arith, instruction, rt_value, &value) == 0) {
+                printf("Unsupported COP1 instruction: 0x%08X\n", instruction);
+            }
+            write_back_reg(d.dest, value);
+            break;
+        case ISA_CLASS_SYSCALL:
+            if (syscallHandle(&syscalls, reg, &arith, NULL, clock_cycle)) {
+                next_pc = 0xFFFFFFFF;
+            }
+            break;
+        default:
+            printf("Unsupported instruction: 0x%08X\n", instruction);
+            break;
+    }
+    functional_pending = taken;
+    pc = next_pc;
+}
+
+// Body of a forked copy: run the pipeline through the warm-up, measure one interval, report through the
+// pipe and leave without flushing anything
+void interval_child(int id, uint64_t start, uint64_t length, int fd) {
+    syscallDetach(&syscalls);
+    while (pc < MEMORY_SIZE && pc != 0xFFFFFFFF && program_position() < start) {
+        cycle();
+    }
+    IntervalStats stats = { id, program_position(), instruction_count, clock_cycle, mis_predict,
+                            raw_stalls + waw_stalls + structural_stalls + serialize_stalls, front_end_stalls, icache_misses };
+    while (pc < MEMORY_SIZE && pc != 0xFFFFFFFF && program_position() < start + length) {
+        cycle();
+    }
+    stats.instructions = instruction_count - stats.instructions;
+    stats.cycles = clock_cycle - stats.cycles;
+    stats.mispredicts = mis_predict - stats.mispredicts;
+    stats.stalls = raw_stalls + waw_stalls + structural_stalls + serialize_stalls - stats.stalls;
+    stats.front_end_stalls = front_end_stalls - stats.front_end_stalls;
+    stats.icache_misses = icache_misses - stats.icache_misses;
+    _exit(write(fd, &stats, sizeof(stats)) == sizeof(stats) ? 0 : 1);
+}
+
+// Wait for any interval process and keep what it sent
+void interval_collect() {
+    int status;
+    pid_t pid = wait(&status);
+    int slot = 0;
+    while (slot < interval_running && interval_jobs[slot].pid != pid) {
+        ++slot;
+    }
+    if (pid < 0 || slot == interval_running) {
+        return;
+    }
+    IntervalStats stats;
+    ssize_t size = read(interval_jobs[slot].fd, &stats, sizeof(stats));
+    close(interval_jobs[slot].fd);
+    interval_jobs[slot] = interval_jobs[--interval_running];
+    if (size != sizeof(stats)) {
+        fprintf(stderr, "Interval process %d died without a result\n", (int)pid);
+        exit(1);
+    }
+    interval_results[stats.id] = stats;
+    interval_count++;
+}
+
+// Checkpoint the functional state by forking; the copy simulates from here in detail
+void interval_launch(int id, uint64_t start, uint64_t length) {
+    while (interval_running >= host_workers) {
+        interval_collect();
+    }
+    int fds[2];
+    if (pipe(fds) != 0) {
+        perror("Error creating a pipe");
+        exit(1);
+    }
+    fflush(NULL); // Nothing buffered may be written twice
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("Error forking an interval");
+        exit(1);
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        interval_child(id, start, length, fds[1]);
+    }
+    close(fds[1]);
+    interval_jobs[interval_running].pid = pid;
+    interval_jobs[interval_running].fd = fds[0];
+    interval_running++;
+}
+
+// Functional pass over the whole program that forks a detailed copy warmup instructions before each
+// simpoint, then the per-instruction rates of the simpoints weighted and scaled to the whole program.
+// Processes, because all simulator state is global; fork() makes each checkpoint copy-on-write.
+void interval_run() {
+    struct timespec start_time, end_time;
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+
+    // Debug output of every pass goes to /dev/null; the guest keeps the real stdout
+    fflush(stdout);
+    int guest_fd = dup(1);
+    int null_fd = open("/dev/null", O_WRONLY);
+    FILE* guest_out = fdopen(guest_fd, "w");
+    if (guest_fd < 0 || null_fd < 0 || guest_out == NULL) {
+        perror("Error redirecting output");
+        exit(1);
+    }
+    syscalls.files[1].stream = guest_out;
+    dup2(null_fd, 1);
+    close(null_fd);
+
+    int next = 0;
+    while (pc < MEMORY_SIZE && pc != 0xFFFFFFFF) {
+        if (next < simpoint_set.count && !functional_pending) { // The pipeline starts empty, so not in a delay slot
+            uint64_t start = (uint64_t)simpoint_set.points[next].interval * simpoint_set.interval_length;
+            if (program_position() + simpoint_warmup >= start) {
+                interval_launch(next, start, simpoint_set.interval_length);
+                next++;
+                continue;
+            }
         }
+        functional_step();
+    }
+    while (interval_running > 0) {
+        interval_collect();
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+
+    fflush(guest_out);
+    fflush(stdout);
+    dup2(guest_fd, 1);
+    fclose(guest_out);
+    syscalls.files[1].stream = stdout;
+    syscallFinish(&syscalls);
+
+    if (program_position() != simpoint_set.instructions) {
+        fprintf(stderr, "Warning: the simpoints were profiled over %" PRIu64 " instructions, this run has %" PRIu64 "\n",
+                simpoint_set.instructions, program_position());
+    }
+    printf("*******************************************************\n");
+    printf("Functional pass: %" PRIu64 " instructions (%" PRIu64 " without delay slots), %d simpoints of %" PRIu64
+           " with %" PRIu64 " warm-up, %d processes\n", instruction_count, program_position(), interval_count,
+           simpoint_set.interval_length, simpoint_warmup, host_workers);
+    printf("Interval  First instruction  Instructions  Cycles  CPI  Mispredicts  Stalls  Front end stalls  Weight\n");
+    double estimate[5] = {0}; // Weighted per-instruction rates of the measured counters
+    double weight_total = 0.0; // Of the simpoints that ran, to renormalize over
+    int measured = 0;
+    for (int i = 0; i < interval_count; ++i) {
+        IntervalStats* stats = &interval_results[i];
+        double weight = simpoint_set.points[i].weight;
+        printf("%8d  %17" PRIu64 "  %12" PRIu64 "  %6" PRIu64 "  %.3f  %11" PRIu64 "  %6" PRIu64 "  %16" PRIu64 "  %.4f\n",
+               simpoint_set.points[i].interval, stats->start, stats->instructions, stats->cycles,
+               stats->instructions ? (double)stats->cycles / stats->instructions : 0.0, stats->mispredicts, stats->stalls,
+               stats->front_end_stalls, weight);
+        if (stats->instructions > 0) {
+            weight_total += weight;
+            measured++;
+            estimate[0] += weight * stats->cycles / stats->instructions;
+            estimate[1] += weight * stats->mispredicts / stats->instructions;
+            estimate[2] += weight * stats->stalls / stats->instructions;
+            estimate[3] += weight * stats->front_end_stalls / stats->instructions;
+            estimate[4] += weight * stats->icache_misses / stats->instructions;
+        }
+    }
+    if (measured < simpoint_set.count) {
+        fprintf(stderr, "Warning: %d of %d simpoints lie past the end of the program; weighting the rest\n",
+                simpoint_set.count - measured, simpoint_set.count);
+    }
+    for (int i = 0; i < 5 && weight_total > 0; ++i) {
+        estimate[i] /= weight_total;
+    }
+    printf("Weighted: %" PRIu64 " instructions, %.0f cycles, CPI %.4f, %.0f mispredicts, %.0f scoreboard stalls, "
+           "%.0f front end stalls", instruction_count, estimate[0] * instruction_count, estimate[0],
+           estimate[1] * instruction_count, estimate[2] * instruction_count, estimate[3] * instruction_count);
+    if (fetch_latency == fetch_latency_icache) {
+        printf(", %.0f I-cache misses", estimate[4] * instruction_count);
+    }
+    printf("\nR[2]: %d\n", reg[2]);
+    printf("Host time: %.3f s\n", (end_time.tv_sec - start_time.tv_sec) + (end_time.tv_nsec - start_time.tv_nsec) / 1e9);
+    printf("*******************************************************\n");
+}
+
+// Usage: hw3 [-k konata.log] [-o o3pipeview.trace] [-r start:end] [-i interval] [-T series.csv] [-l shared memory name] [-g profile prefix]
+//            [-y symbols.elf] [-u unit:latency[:p|n]] [-H] [-E | -D] [-w width] [-q depth] [-I icache] [-b entries]
+//            [-F simpoint file[:warmup]] [-j workers] [binary]
+// -g and -y turn on the guest profiler; -g also writes prefix.<metric>.folded and prefix.pcs.csv
+// -u sets a functional unit's latency and whether it is pipelined (imul, idiv, fadd, fmul, fdiv)
+// -H adds perf_event counters to the host profile of a -DHOST_PROFILE build
+// -E steps through every stall cycle instead of skipping to the next event; -D steps and checks each skip
+// -w and -q set the fetch width and fetch queue depth, -I adds an I-cache (size:line:ways:miss latency[:hit latency])
+// and -b a loop stream buffer of that many instructions
+// -F runs the program functionally and simulates only the intervals in a file from hw2 -B in detail, in up
+// to -j processes at once, each after warmup detailed instructions, and weights them into whole-program estimates
+void parse_arguments(int argc, char* argv[]) {
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-k") == 0 && i + 1 < argc) {
+            trace_open(argv[++i], TRACE_KONATA);
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            trace_open(argv[++i], TRACE_O3PIPEVIEW);
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%" SCNu64 ":%" SCNu64, &trace_start, &trace_end) != 2 || trace_end < trace_start) {
+                fprintf(stderr, "Cycle range must be start:end\n");
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+            statsSetInterval(strtoull(argv[++i], NULL, 0));
+        } else if (strcmp(argv[i], "-T") == 0 && i + 1 < argc) {
+            statsOpenSeries(argv[++i]);
+        } else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+            statsOpenShared(argv[++i]);
+        } else if (strcmp(argv[i], "-g") == 0 && i + 1 < argc) {
+            guest_profile_prefix = argv[++i];
+        } else if (strcmp(argv[i], "-y") == 0 && i + 1 < argc) {
+            guestprofLoadSymbols(argv[++i]);
+        } else if (strcmp(argv[i], "-u") == 0 && i + 1 < argc) {
+            if (!arithConfigureUnit(argv[++i])) {
+                fprintf(stderr, "Bad unit spec (imul|idiv|fadd|fmul|fdiv:latency[:p|n]): %s\n", argv[i]);
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "-E") == 0) {
+            skip_mode = SKIP_OFF;
+        } else if (strcmp(argv[i], "-D") == 0) {
+            skip_mode = SKIP_VERIFY;
+        } else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+            fetch_width = atoi(argv[++i]);
+            if (fetch_width < 1 || fetch_width > MAX_FETCH_WIDTH) {
+                fprintf(stderr, "Fetch width must be between 1 and %d\n", MAX_FETCH_WIDTH);
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "-q") == 0 && i + 1 < argc) {
+            fetch_queue_depth = atoi(argv[++i]);
+            if (fetch_queue_depth < 1 || fetch_queue_depth > MAX_FETCH_QUEUE) {
+                fprintf(stderr, "Fetch queue depth must be between 1 and %d\n", MAX_FETCH_QUEUE);
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "-I") == 0 && i + 1 < argc) {
+            icache_configure(argv[++i]);
+        } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            loop_buffer_size = atoi(argv[++i]);
+            if (loop_buffer_size < 0 || loop_buffer_size > MAX_LOOP_BUFFER) {
+                fprintf(stderr, "Loop buffer entries must be between 0 and %d\n", MAX_LOOP_BUFFER);
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "-F") == 0 && i + 1 < argc) {
+            char* filename = argv[++i];
+            char* warmup = strrchr(filename, ':');
+            if (warmup != NULL) {
+                *warmup++ = '\0';
+                simpoint_warmup = strtoull(warmup, NULL, 0);
+            }
+            simpointRead(filename, &simpoint_set);
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            host_workers = atoi(argv[++i]);
+            if (host_workers < 1 || host_workers > MAX_HOST_WORKERS) {
+                fprintf(stderr, "Host workers must be between 1 and %d\n", MAX_HOST_WORKERS);
+                exit(1);
+            }
+#ifdef HOST_PROFILE
+        } else if (strcmp(argv[i], "-H") == 0) {
+            prof_use_perf = 1;
+#endif
+        } else if (argv[i][0] != '-') {
+            binary_filename = argv[i];
+        } else {
+            fprintf(stderr, "Usage: %s [-k konata.log] [-o o3pipeview.trace] [-r start:end] [-i interval] [-T series.csv]\n"
+                            "       [-l shared memory name] [-g profile prefix] [-y symbols.elf] [-u unit:latency[:p|n]] [-H] [-E | -D]\n"
+                            "       [-w width] [-q depth] [-I size:line:ways:miss[:hit]] [-b entries] [-F simpoint file[:warmup]]\n"
+                            "       [-j workers] [binary]\n", argv[0]);
+            exit(1);
+        }
+    }
+}
+
+void register_stats() {
+    statsCounter("cycles", "Simulated cycles", &clock_cycle);
+    statsCounter("instructions", "Fetched instructions", &instruction_count);
+    statsCounter("memory_accesses", "Load and store instructions", &memory_access_count);
+    statsCounter("register_ops", "Register operations", &register_ops_count);
+    statsCounter("branches", "Branch instructions", &branch_count);
+    statsCounter("jumps", "Jump instructions", &jump_count);
+    statsCounter("predict_correct", "Correctly predicted branches", &predict_correct);
+    statsCounter("mispredicts", "Mispredicted branches", &mis_predict);
+    statsCounter("raw_stalls", "Cycles EX waited for an operand", &raw_stalls);
+    statsCounter("waw_stalls", "Cycles EX waited to keep register writes in order", &waw_stalls);
+    statsCounter("structural_stalls", "Cycles EX waited for a non-pipelined unit", &structural_stalls);
+    statsCounter("front_end_stalls", "Cycles decode found the fetch queue empty", &front_end_stalls);
+    statsCounter("icache_misses", "I-cache misses", &icache_misses);
+    statsCounter("loop_buffer_hits", "Instructions fetched from the loop buffer", &loop_buffer_hits);
+    statsFormula("ipc", "Instructions per cycle", ipc);
+    statsFormula("mispredict_rate", "Mispredicted branches per branch", mispredict_rate);
+}
+
+double ipc() {
+    return clock_cycle ? (double)instruction_count / clock_cycle : 0.0;
+}
+
+double mispredict_rate() {
+    return total_predict ? (double)mis_predict / total_predict : 0.0;
+}
+
+// Only instructions fetched inside the cycle range are written; they are followed until they leave the pipeline
+int is_traced(int id) {
+    return id != 0 && id >= trace_first_id && id <= trace_last_id;
+}
+
+void trace_open(const char* filename, TraceFormat format) {
+    trace_file = fopen(filename, "w");
+    if (trace_file == NULL) {
+        perror("Error opening trace file");
+        exit(1);
+    }
+    trace_format = format;
+    trace_enabled = 1;
+    if (format == TRACE_KONATA) {
+        fprintf(trace_file, "Kanata\t0004\n");
+    }
+}
+
+// Konata advances time with relative cycle records; the instruction that left WB last cycle retires here
+void trace_cycle_start(uint64_t cycle) {
+    if (trace_format == TRACE_KONATA && trace_first_id != 0 && cycle > trace_cycle) {
+        fprintf(trace_file, "C\t%" PRIu64 "\n", cycle - trace_cycle);
+        trace_cycle = cycle;
+    }
+    trace_emit_retire();
+    if (cycle > trace_end && trace_retired_id >= trace_last_id) {
+        trace_close(); // Nothing left in flight: stop paying for the trace
+    }
+}
+
+void trace_emit_retire() {
+    int id = trace_pending_retire;
+    if (id == 0) {
+        return;
+    }
+    trace_pending_retire = 0;
+    TraceRecord* record = &trace_window[id % TRACE_WINDOW];
+    if (trace_format == TRACE_KONATA) {
+        fprintf(trace_file, "R\t%d\t%d\t0\n", id, id);
+    } else {
+        trace_write_o3(record, record->cycle[STAGE_WB]);
+    }
+    record->id = 0;
+    trace_retired_id = id;
+}
+
+// One O3PipeView block per instruction; rename, dispatch and issue have no stage of their own in this pipeline
+void trace_write_o3(TraceRecord* record, uint64_t retire_cycle) {
+    char text[64];
+    isaDisassemble(record->instruction, text, sizeof(text));
+    int store = (record->instruction >> 26) == 0x2B && retire_cycle != 0;
+    fprintf(trace_file, "O3PipeView:fetch:%" PRIu64 ":0x%08x:0:%d:%s\n", record->cycle[STAGE_IF] * TICKS_PER_CYCLE, record->pc,
+            record->id, text);
+    fprintf(trace_file, "O3PipeView:decode:%" PRIu64 "\n", record->cycle[STAGE_ID] * TICKS_PER_CYCLE);
+    fprintf(trace_file, "O3PipeView:rename:%" PRIu64 "\n", record->cycle[STAGE_ID] * TICKS_PER_CYCLE);
+    fprintf(trace_file, "O3PipeView:dispatch:%" PRIu64 "\n", record->cycle[STAGE_EX] * TICKS_PER_CYCLE);
+    fprintf(trace_file, "O3PipeView:issue:%" PRIu64 "\n", record->cycle[STAGE_EX] * TICKS_PER_CYCLE);
+    fprintf(trace_file, "O3PipeView:complete:%" PRIu64 "\n", record->cycle[STAGE_MEM] * TICKS_PER_CYCLE);
+    fprintf(trace_file, "O3PipeView:retire:%" PRIu64 ":store:%" PRIu64 "\n", retire_cycle * TICKS_PER_CYCLE,
+            store ? retire_cycle * TICKS_PER_CYCLE : 0);
+}
+
+void trace_fetch(int id, uint32_t pc, uint32_t instruction) {
+    if (clock_cycle < trace_start || clock_cycle > trace_end) {
+        return;
+    }
+    if (trace_first_id == 0) {
+        trace_first_id = id;
+        trace_retired_id = id - 1;
+        if (trace_format == TRACE_KONATA) {
+            fprintf(trace_file, "C=\t%" PRIu64 "\n", clock_cycle);
+            trace_cycle = clock_cycle;
+        }
+    }
+    trace_last_id = id;
+    TraceRecord* record = &trace_window[id % TRACE_WINDOW];
+    memset(record, 0, sizeof(TraceRecord));
+    record->id = id;
+    record->pc = pc;
+    record->instruction = instruction;
+    if (trace_format == TRACE_KONATA) {
+        char text[64];
+        isaDisassemble(instruction, text, sizeof(text));
+        fprintf(trace_file, "I\t%d\t%d\t0\n", id, id);
+        fprintf(trace_file, "L\t%d\t0\t%08X: %s\n", id, pc, text);
+    }
+    trace_stage(id, STAGE_IF);
+}
+
+void trace_stage(int id, Stage stage) {
+    if (!is_traced(id) || id <= trace_retired_id) {
+        return;
+    }
+    TraceRecord* record = &trace_window[id % TRACE_WINDOW];
+    record->cycle[stage] = clock_cycle;
+    if (trace_format == TRACE_KONATA) {
+        if (record->stalled) {
+            fprintf(trace_file, "E\t%d\t1\tstall\n", id);
+            record->stalled = 0;
+        }
+        fprintf(trace_file, "S\t%d\t0\t%s\n", id, stage_names[stage]);
+    }
+}
+
+void trace_retire(int id) {
+    if (is_traced(id) && id > trace_retired_id) {
+        trace_pending_retire = id;
+    }
+}
+
+// A squashed instruction; O3PipeView marks it with a zero retire tick. Wrong-path fetches are squashed
+// while older instructions are still in flight, so only an in-order flush advances the retired id.
+void trace_flush(int id) {
+    TraceRecord* record = &trace_window[id % TRACE_WINDOW];
+    if (!is_traced(id) || id <= trace_retired_id || record->id != id) {
+        return;
+    }
+    if (trace_format == TRACE_KONATA) {
+        fprintf(trace_file, "R\t%d\t%d\t1\n", id, id);
+    } else {
+        trace_write_o3(record, 0);
+    }
+    record->id = 0;
+    if (id == trace_retired_id + 1) {
+        trace_retired_id = id;
+    }
+}
+
+// Stalls and forwarding only exist in the Konata format; O3PipeView has no record for them
+void trace_stall(int id, Stage stage) {
+    TraceRecord* record = &trace_window[id % TRACE_WINDOW];
+    if (is_traced(id) && trace_format == TRACE_KONATA && !record->stalled) {
+        record->stalled = 1;
+        fprintf(trace_file, "S\t%d\t1\tstall\n", id);
+        fprintf(trace_file, "L\t%d\t1\tstall in %s at cycle %" PRIu64 "\n", id, stage_names[stage], clock_cycle);
+    }
+}
+
+void trace_forward(int consumer, int producer, uint32_t reg_number, Stage source) {
+    static int last_consumer = 0, last_producer = 0; // rs == rt forwards the same value twice
+    if (consumer == producer || (consumer == last_consumer && producer == last_producer)) {
+        return;
+    }
+    last_consumer = consumer;
+    last_producer = producer;
+    if (is_traced(consumer) && is_traced(producer) && trace_format == TRACE_KONATA) {
+        fprintf(trace_file, "W\t%d\t%d\t0\n", consumer, producer);
+        fprintf(trace_file, "L\t%d\t1\t$%d forwarded from %s (#%d) at cycle %" PRIu64 "\n", consumer, reg_number,
+                stage_names[source], producer, clock_cycle);
+    }
+}
+
+// Whatever is still in the pipeline when the program ends never retires
+void trace_close() {
+    if (trace_format == TRACE_KONATA && trace_first_id != 0 && clock_cycle > trace_cycle) {
+        fprintf(trace_file, "C\t%" PRIu64 "\n", clock_cycle - trace_cycle);
+    }
+    trace_emit_retire();
+    for (int id = trace_retired_id + 1; id <= trace_last_id; ++id) {
+        trace_flush(id);
     }
+    fclose(trace_file);
+    trace_file = NULL;
+    trace_enabled = 0;
 }
 
 // void detect_and_insert_stall() {
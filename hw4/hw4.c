@@ -2,448 +2,3300 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#include "../common/stats.h"
+#include "../common/hostprof.h"
+#include "../common/guestprof.h"
+#include "../common/arith.h"
+#include "../common/isa.h"
+#include "../common/syscall.h"
+#include "../common/simpoint.h"
 
 #define MEMORY_SIZE 0x4000000 // 64MB memory
-#define CACHE_SIZE 256 // 256 bytes
-#define CACHE_LINE_SIZE 64 // 64 bytes per cache line
-#define CACHE_WAYS 4 // 4-way set associative cache
-#define SET_COUNT (CACHE_SIZE / (CACHE_LINE_SIZE * CACHE_WAYS))
-#define MEMORY_LATENCY 1000 // Memory access latency in cycles
+#define CACHE_SIZE 256 // Default cache size: 256 bytes
+#define CACHE_LINE_SIZE 64 // Default: 64 bytes per cache line
+#define CACHE_WAYS 4 // Default: 4-way set associative cache
+#define MAX_LINE_SIZE 128 // Largest line size accepted at run time
+#define MAX_WAYS 32 // Largest associativity accepted at run time
+#define DRAM_CHANNELS 2 // Independent memory channels
+#define DRAM_RANKS 2 // Ranks per channel
+#define DRAM_BANKS 8 // Banks per rank
+#define DRAM_ROW_SIZE 2048 // Bytes in one row of a bank
+#define DRAM_QUEUE_SIZE 32 // Memory controller request queue entries
+#define DRAM_WRITE_HIGH_WATERMARK 16 // Queued writes that force a write drain
+#define BUS_LATENCY 100 // Cache-to-cache transfer / upgrade latency in cycles
+#define MAX_CORES 8 // Maximum number of simulated cores
+#define QUANTUM 1000 // Instructions each core runs between synchronization barriers
+#define STACK_STRIDE 0x100000 // Stack space reserved per core
+#define SHARING_TABLE_SIZE 1024 // Lines tracked for coherence hot-spot reporting
+#define HOT_LINE_COUNT 10 // Hot lines printed in the result
+#define RRPV_MAX 3 // 2-bit re-reference prediction values
+#define BRRIP_LONG_INSERT 32 // BRRIP inserts at RRPV_MAX - 1 once every this many fills
+#define DUEL_PERIOD 32 // One SRRIP and one BRRIP leader set in every DUEL_PERIOD sets
+#define PSEL_MAX 1023 // 10-bit DRRIP policy selector
+#define LRFU_HALF_LIFE 16 // Accesses after which an LRFU reference counts half
+#define LRFU_UNIT 0x10000 // Weight of one reference in the fixed-point CRF
+#define PC_TABLE_SIZE 4096 // Distinct PCs tracked for per-PC miss counts
+#define HEATMAP_WIDTH 64 // Sets per heatmap row
+#define MAX_WRITE_BUFFER_ENTRIES 64 // Upper bound for -b
+#define MAX_VICTIM_ENTRIES 64 // Upper bound for -v
+#define WRITE_DRAIN_CYCLES 100 // Cycles to drain one write buffer entry to memory
+#define VICTIM_LATENCY 4 // Extra cycles to swap a line back from the victim cache
+#define MAX_TLB_ENTRIES 1024 // Upper bound for the TLB sizes
+#define L1_TLB_LATENCY 1 // L1 TLB lookup, only visible with PIPT indexing
+#define SMALL_PAGE_SHIFT 12 // 4KB pages
+#define LARGE_PAGE_SHIFT 21 // 2MB pages, one per first-level entry
+#define PTE_VALID 0x1
+#define PTE_LARGE 0x2 // First-level entry maps a 2MB page instead of pointing to a table
+#define FRAME_POOL_BASE 0x2000000 // Physical frames handed out on first touch
+#define FRAME_POOL_END 0x3000000
+#define PAGE_TABLE_AREA 0x3000000 // One page table for all cores, which share an address space
+#define PAGE_TABLE_REGION 0x200000
+#define MISS_LATENCY_BUCKET 25 // Cycles per bucket of the miss latency histogram
+#define MISS_LATENCY_BUCKETS 32
+// Registers the sum of one Core field over all cores
+#define CORE_COUNTER(name, field, description) statsCounterArray(name, description, &cores[0].field, num_cores, sizeof(Core))
+#define SPM_LATENCY 1 // Scratchpad access, fixed
+#define DMA_SETUP_CYCLES 10 // Register decode and descriptor setup before the first line moves
+#define DMA_SRC 0x0 // DMA register offsets from dma_base
+#define DMA_DST 0x4
+#define DMA_LENGTH 0x8
+#define DMA_CONTROL 0xC // Write DMA_START to begin; reads return the status
+#define DMA_REGISTER_SPAN 0x10
+#define DMA_START 0x1
+#define DMA_IDLE 0x0 // Status values
+#define DMA_BUSY 0x1
+#define DMA_DONE 0x2
+#define DMA_ERROR 0x4
+#define REPLAY_BATCH 1023 // Records per queue batch; with its count a batch is exactly 8KB
+#define REPLAY_QUEUE_DEPTH 16 // Batches in flight between the reader and one worker
+#define REPLAY_SHARD_SETS 64 // Consecutive sets owned by one replay worker
+#define REPLAY_READ_RECORDS 65536 // Trace records read per fread
+#define MAX_REPLAY_WORKERS 64
 
-typedef enum { RANDOM, FIFO, LRU, SCA } ReplacementPolicy;
+typedef enum { RANDOM, FIFO, LRU, SCA, PLRU, SRRIP, BRRIP, DRRIP, LFU, LRFU } ReplacementPolicy;
 typedef enum { WRITE_BACK, WRITE_THROUGH } WritePolicy;
+typedef enum { MESI, MOESI } CoherenceProtocol;
+typedef enum { INVALID, SHARED, EXCLUSIVE, OWNED, MODIFIED } LineState;
+typedef enum { BUS_RD, BUS_RDX, BUS_UPGR } BusOp;
+typedef enum { OPEN_PAGE, CLOSED_PAGE } PagePolicy;
+typedef enum { MAP_PAGE_INTERLEAVED, MAP_LINE_INTERLEAVED } AddressMapping;
+typedef enum { DRAIN_WHEN_FULL, DRAIN_WHEN_IDLE } DrainPolicy;
+typedef enum { VM_OFF, VM_PIPT, VM_VIPT } VirtualMemoryMode;
+typedef enum { MISS_COMPULSORY, MISS_CAPACITY, MISS_CONFLICT, MISS_COHERENCE, MISS_TYPES } MissType;
 
 typedef struct {
-    uint8_t data[CACHE_LINE_SIZE];
+    uint8_t data[MAX_LINE_SIZE];
     uint32_t tag;
-    int valid;
-    int dirty;
-    int lru_counter;
+    LineState state;
+    int age; // Position in the set's LRU stack, 0 is most recently used
     int second_chance;
+    int rrpv; // Re-reference prediction value for the RRIP family
+    int frequency; // Reference count for LFU
+    uint32_t crf; // Combined recency and frequency for LRFU, fixed point
+    uint64_t last_access; // Access clock of the last reference, for LRFU decay
+    uint32_t word_mask; // Words touched by the owning core since the line was filled
 } CacheLine;
 
 typedef struct {
-    CacheLine lines[CACHE_WAYS];
+    CacheLine* lines; // cache_ways lines
     int fifo_index;
+    uint32_t plru_bits; // Tree-PLRU node bits, node n at bit n (root is node 1)
 } CacheSet;
 
-CacheSet cache[SET_COUNT];
+typedef struct {
+    CacheLine line;
+    uint32_t set_index; // Set the line was evicted from; line.tag is relative to it
+    uint64_t last_use; // Access clock of the last insertion, for LRU
+} VictimEntry;
+
+typedef struct {
+    uint32_t line_address;
+    uint32_t word_mask; // Words written while the entry waited
+    uint64_t insert_cycle;
+} WriteBufferEntry;
+
+typedef struct {
+    uint32_t line_address;
+    int prev, next; // LRU list, head is most recently used
+    int hash_next; // Next entry in the same bucket
+    int invalidated; // Removed from the real cache by another core's write
+} ShadowEntry;
+
+// Fully-associative LRU cache of line addresses, used to tell capacity from conflict misses
+typedef struct {
+    ShadowEntry* entries; // One per line of the real cache
+    int* buckets;
+    int bucket_count;
+    int capacity, head, tail, count;
+} ShadowCache;
+
+typedef struct {
+    uint32_t tag, set_index, offset;
+} CacheIndex;
+
+typedef struct {
+    uint32_t vpn; // Virtual address >> page_shift
+    uint32_t pfn; // Physical address >> page_shift
+    int page_shift;
+    int valid;
+    uint64_t last_use;
+} TlbEntry;
+
+// Fully associative, LRU
+typedef struct {
+    TlbEntry* entries;
+    int size;
+    uint64_t accesses, misses;
+} Tlb;
+
+typedef struct {
+    uint32_t source, destination, length; // Programmed through the registers
+    uint32_t status;
+    uint64_t done_cycle; // Copy becomes visible once the core reaches this cycle
+} DmaEngine;
+
+// Splits an address and searches its set; chosen once the geometry is known
+typedef CacheLine* (*CacheLookup)(CacheSet* sets, uint32_t address, CacheIndex* index);
+
+typedef struct {
+    uint64_t accesses, misses;
+    uint64_t miss_types[MISS_TYPES];
+} AccessStats;
+
+typedef struct {
+    uint32_t pc;
+    int used;
+    AccessStats stats;
+} PcEntry;
+
+typedef struct {
+    int id;
+    uint32_t reg[32]; // 32bit registers
+    uint32_t pc; // program counter
+    uint32_t instruction; // current instruction
+    ArithState arith; // HI/LO and the FPU
+    CacheSet* cache; // private cache, set_count sets
+    pthread_mutex_t cache_lock;
+    uint32_t ll_address; // line address reserved by LL
+    int ll_valid;
+    uint32_t random_state; // Per-core xorshift state for RANDOM and BRRIP
+    uint64_t access_clock; // Cache accesses so far, orders accesses within one instruction
+    int psel; // DRRIP set-dueling selector
+    uint8_t* seen_lines; // Lines this core has ever referenced, one bit each
+    ShadowCache shadow;
+    AccessStats* set_stats; // Per set
+    PcEntry pc_table[PC_TABLE_SIZE];
+    uint64_t pc_table_overflow; // Accesses from PCs that did not fit in pc_table
+    uint64_t miss_types[MISS_TYPES];
+    VictimEntry victim_cache[MAX_VICTIM_ENTRIES];
+    WriteBufferEntry write_buffer[MAX_WRITE_BUFFER_ENTRIES]; // Oldest first
+    int write_buffer_count;
+    uint64_t write_drain_ready_cycle; // Memory write port is busy until this cycle
+    uint64_t write_buffer_inserts, write_buffer_coalesced;
+    uint64_t write_buffer_full_stalls, write_buffer_stall_cycles;
+    uint64_t memory_write_transactions, memory_write_bytes;
+    uint64_t victim_hits;
+    Tlb itlb, dtlb, l2_tlb;
+    uint64_t tlb_clock;
+    uint64_t page_walks, walk_cycles, page_faults;
+    uint8_t* spm; // Private scratchpad, spm_size bytes, same byte layout as memory
+    GuestProfile* profile; // Guest profiler, NULL unless enabled
+    DmaEngine dma;
+    uint64_t spm_accesses, spm_cycles;
+    uint64_t cached_data_accesses, cached_data_cycles; // Loads and stores that went through the cache
+    uint64_t dma_transfers, dma_bytes, dma_busy_cycles;
+    uint64_t instruction_count, memory_access_count, branch_taken_count, branch_total_count;
+    uint64_t cache_hit_count, cache_miss_count;
+    uint64_t miss_cycles; // Cycles spent waiting for misses to be filled
+    uint64_t total_cycles;
+    uint64_t register_operation_count;
+    uint64_t unit_ops[UNIT_COUNT]; // Instructions issued to each multi-cycle unit
+} Core;
+
+// Victim choice and state update of the replacement policy; chosen once the policy is known
+typedef CacheLine* (*VictimSelect)(Core* core, uint32_t set_index);
+typedef void (*ReplacementUpdate)(Core* core, uint32_t set_index, CacheLine* line, int fill);
+
+typedef struct {
+    uint64_t bus_reads, bus_read_exclusives, bus_upgrades;
+    uint64_t writebacks, cache_to_cache_transfers;
+    uint64_t invalidations, false_sharing_invalidations;
+    uint64_t sc_success, sc_failure;
+} CoherenceStats;
+
+typedef struct {
+    int row_open;
+    uint32_t open_row;
+    uint64_t ready_cycle; // Earliest cycle the bank accepts the next command
+    uint64_t activate_cycle; // Cycle of the last ACTIVATE, for tRAS
+} DramBank;
+
+typedef struct {
+    DramBank banks[DRAM_RANKS][DRAM_BANKS];
+    uint64_t bus_ready_cycle; // Data bus of the channel is busy until this cycle
+} DramChannel;
+
+typedef struct {
+    uint32_t channel, rank, bank, row;
+} DramAddress;
+
+typedef struct {
+    uint32_t address;
+    int write;
+} DramRequest;
+
+typedef struct {
+    uint64_t reads, writes;
+    uint64_t row_hits, row_empty, row_conflicts;
+    uint64_t read_latency_total;
+    uint64_t write_drains;
+} DramStats;
+
+typedef struct {
+    uint32_t line_address;
+    int used;
+    uint64_t invalidations;
+    uint64_t false_sharing;
+} SharingEntry;
+
+// Trace records are one word each: the address with bits 1:0 cleared and bit 0 set for a write
+typedef struct {
+    uint32_t record;
+    uint64_t seq; // Position in the whole trace
+} ReplayRecord;
+
+typedef struct {
+    uint32_t count;
+    uint32_t unused; // Keeps the records 8-byte aligned
+    ReplayRecord records[REPLAY_BATCH];
+} __attribute__((aligned(64))) ReplayBatch;
+
+// One replay thread and its single-producer single-consumer queue of batches
+typedef struct {
+    Core core; // Copy of cores[0]: shares its cache and per-set arrays, keeps its own counters
+    ReplayBatch batches[REPLAY_QUEUE_DEPTH];
+    uint64_t head __attribute__((aligned(64))); // Batches published by the reader
+    uint64_t tail __attribute__((aligned(64))); // Batches finished by the worker
+    int done;
+    uint64_t full_waits; // Times the reader found this queue full
+} ReplayWorker;
+
+// Measured part of one detailed interval, sent back by its process
+typedef struct {
+    int id; // Interval number, -1 for the whole-program reference
+    uint64_t start; // First measured instruction
+    uint64_t instructions, cycles;
+    uint64_t hits, misses, miss_cycles;
+} IntervalStats;
+
+typedef struct {
+    pid_t pid;
+    int fd; // Read end of the result pipe
+} IntervalJob;
+
+Core cores[MAX_CORES];
+int num_cores = 1;
+int cache_size = CACHE_SIZE;
+int line_size = CACHE_LINE_SIZE;
+int cache_ways = CACHE_WAYS;
+int set_count; // Derived from the three above by configureCache()
+int line_shift; // log2(line_size)
+int set_shift = -1; // log2(set_count), -1 when set_count is not a power of two
+uint32_t set_mask;
+uint32_t full_line_mask; // One bit per word of a line
+CacheLookup cache_lookup; // Set by selectCacheLookup()
+const char* cache_lookup_name = "generic";
+VictimSelect victim_select; // Set by selectReplacement()
+ReplacementUpdate replacement_update;
+int hit_latency = 1; // Cache hit latency in cycles
+int dram_trcd = 60; // ACTIVATE to READ/WRITE delay in cycles
+int dram_tcl = 60; // READ to first data delay in cycles
+int dram_trp = 60; // PRECHARGE to ACTIVATE delay in cycles
+int dram_tras = 140; // ACTIVATE to PRECHARGE minimum in cycles
+int dram_tburst = 16; // Cycles to move one cache line over the channel
+int dram_controller_latency = 40; // Controller and interconnect overhead per read
 uint8_t memory[MEMORY_SIZE];
-uint32_t reg[32]; // 32bit registers
-uint32_t pc = 0; // program counter
-uint32_t instruction; // current instruction
-int instruction_count = 0, memory_access_count = 0, branch_taken_count = 0, branch_total_count = 0;
-int cache_hit_count = 0, cache_miss_count = 0;
-int total_cycles = 0;
-int register_operation_count = 0;
+pthread_mutex_t bus_lock; // Serializes bus transactions and main memory
+pthread_barrier_t quantum_barrier;
+SyscallState syscalls; // Shared by all cores: one process, one file table and heap
+pthread_mutex_t syscall_lock;
+volatile int simulation_done = 0;
+CoherenceStats coherence = {0};
+SharingEntry sharing_table[SHARING_TABLE_SIZE];
+DramChannel dram[DRAM_CHANNELS];
+DramRequest dram_queue[DRAM_QUEUE_SIZE]; // Pending requests in arrival order
+int dram_queue_count = 0;
+int dram_write_count = 0;
+DramStats dram_stats = {0};
 
 ReplacementPolicy replacement_policy = LRU;
 WritePolicy write_policy = WRITE_BACK;
+int write_allocate = 1; // Write misses bring the line into the cache
+int write_buffer_entries = 8; // 0 makes every memory write synchronous
+DrainPolicy drain_policy = DRAIN_WHEN_IDLE;
+int victim_entries = 0; // Victim cache disabled by default
+VirtualMemoryMode vm_mode = VM_OFF; // Addresses are physical unless -t is given
+int page_shift = SMALL_PAGE_SHIFT; // Page size used for new mappings
+int itlb_entries = 32, dtlb_entries = 32, l2_tlb_entries = 512;
+int l2_tlb_latency = 7;
+uint32_t binary_size = 0; // Pages below this are mapped onto the loaded image
+uint32_t next_frame = FRAME_POOL_BASE; // Shared by all cores, taken atomically
+uint32_t next_page_table = PAGE_TABLE_AREA + (1 << (32 - LARGE_PAGE_SHIFT)) * 4; // Second-level tables, after the first level
+int spm_base = 0x1800000; // Scratchpad window, between the stacks and the frame pool
+int spm_size = 0; // 0 disables the scratchpad and the DMA engine
+int dma_base = 0x1FFF000; // DMA registers
+CoherenceProtocol coherence_protocol = MESI;
+PagePolicy page_policy = OPEN_PAGE;
+AddressMapping address_mapping = MAP_LINE_INTERLEAVED;
+const char* binary_filename = "simple3.bin";
+FILE* trace_file = NULL; // -o: every cache access is appended here
+pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+const char* replay_filename = NULL; // -R: replay this trace instead of running a binary
+int host_workers = 1; // -j: replay threads for -R, detailed interval processes for -k
+uint64_t interval_length = 0; // -k: instructions per detailed interval, 0 runs the whole program in detail
+uint64_t interval_warmup = 0; // Detailed but unmeasured instructions before each interval
+int interval_reference = 0; // -K: also run the whole program in detail and report the error
+int functional_mode = 0; // Checkpointing pass: cacheAccess() only moves data
+SimpointSet simpoint_set = {0}; // -F: simulate only these intervals and weight them; count 0 simulates all
+
+#ifdef HOST_PROFILE
+// Host profile regions
+enum { PROF_STEP, PROF_FETCH, PROF_EXECUTE, PROF_TRANSLATE, PROF_CACHE_ACCESS, PROF_BUS_WAIT, PROF_MISS, PROF_SNOOP,
+       PROF_DRAM, PROF_MEM_WRITE, PROF_BARRIER, PROF_REGION_COUNT };
+const char* prof_region_names[PROF_REGION_COUNT] = { "stepCore", "fetch", "execute", "translate", "cacheAccess", "bus_lock wait",
+                                                     "miss fill", "snoopBus", "dram", "memWrite", "barrier" };
+int prof_use_perf = 0;
+#endif
+Stat* miss_latency_stat;
+uint32_t random_seed = 1; // Same seed, same run
+const char* export_prefix = NULL; // Write <prefix>_sets.csv and <prefix>_pcs.csv when set
+const char* guest_profile_prefix = NULL; // Write <prefix>.<metric>.folded and <prefix>.pcs.csv when set
+int guest_profile_enabled = 0; // -g or -y
+const char* miss_type_names[] = { "compulsory", "capacity", "conflict", "coherence" };
+const char* replacement_policy_names[] = { "random", "fifo", "lru", "sca", "plru", "srrip", "brrip", "drrip", "lfu", "lrfu" };
 
 // Function declarations
-uint32_t fetch();
-void decode(uint32_t instruction);
-void execute(uint32_t instruction);
+void parseArguments(int argc, char* argv[]);
+void coreInitialize(Core* core, int id);
+void* coreThread(void* arg);
+int isRunning(Core* core);
+void stepCore(Core* core);
+void functionalStep(Core* core);
+uint32_t fetch(Core* core);
+void decode(Core* core, uint32_t instruction);
+void execute(Core* core, const IsaDecoded* d);
+void writeBack(Core* core, uint32_t rd, uint32_t value);
 void loadBinary(const char* filename);
 uint32_t memAccess(uint32_t address, uint32_t value, int write);
 void memWrite(uint32_t address, uint32_t value);
-void cacheInitialize();
-int cacheAccess(uint32_t address, uint8_t* data, int write);
+void cacheInitialize(Core* core);
+int cacheAccess(Core* core, uint32_t address, uint8_t* data, int write);
+CacheLine* findCacheLine(CacheSet* set, uint32_t tag);
+uint32_t lineAddress(uint32_t tag, uint32_t set_index);
+void configureCache();
+void loadConfig(const char* filename);
+void selectCacheLookup();
+void selectReplacement();
+int snoopBus(Core* requester, uint32_t set_index, uint32_t tag, BusOp op, uint32_t offset, uint8_t* supplied_data, int* supplied);
+void recordInvalidation(uint32_t line_address, int false_sharing);
+DramAddress dramMapAddress(uint32_t address);
+int dramIsRowHit(DramRequest* request);
+uint64_t dramIssue(DramRequest* request, uint64_t now);
+int dramSchedule(int drain_writes);
+int dramRead(uint32_t address, uint64_t now);
+void dramWrite(uint32_t address, uint64_t now);
 float calculateAMAT();
-CacheLine* selectCacheLine(CacheSet* set);
+void registerStats();
+uint64_t simulatedCycles();
+uint64_t totalInstructions();
+int quantumBarrier();
+double statCycles();
+double statIPC();
+double statMissRate();
+double statAMAT();
+double statRowHitRate();
+CacheLine* selectCacheLine(Core* core, uint32_t set_index);
+void updateReplacement(Core* core, uint32_t set_index, CacheLine* line, int fill);
+uint32_t nextRandom(Core* core);
+void shadowInitialize(ShadowCache* shadow, int capacity);
+int shadowFind(ShadowCache* shadow, uint32_t line_address);
+int shadowAccess(ShadowCache* shadow, uint32_t line_address, int* invalidated);
+void shadowUnlink(ShadowCache* shadow, int index);
+void shadowInvalidate(ShadowCache* shadow, uint32_t line_address);
+MissType classifyMiss(Core* core, uint32_t line_address, int shadow_hit, int invalidated);
+AccessStats* pcStats(Core* core, uint32_t pc);
+void printHeatmap();
+CacheLine* findVictimLine(Core* core, uint32_t set_index, uint32_t tag);
+void evictLine(Core* core, uint32_t set_index, CacheLine* evicted);
+void writeBackLine(Core* core, uint32_t set_index, CacheLine* line);
+void writeBufferRetire(Core* core, uint64_t start);
+void writeBufferDrainIdle(Core* core);
+void writeBufferInsert(Core* core, uint32_t line_address, uint32_t word_mask);
+void writeBufferFlush(Core* core);
+void exportMissStats(const char* prefix);
+void tlbInitialize(Tlb* tlb, int size);
+TlbEntry* tlbLookup(Tlb* tlb, uint32_t address, uint64_t clock);
+TlbEntry* tlbInsert(Tlb* tlb, uint32_t vpn, uint32_t pfn, int shift, uint64_t clock);
+uint32_t translate(Core* core, uint32_t address, int instruction);
+uint32_t pageWalk(Core* core, uint32_t address, int* shift);
+uint32_t readPTE(Core* core, uint32_t address);
+void writePTE(Core* core, uint32_t address, uint32_t value);
+uint32_t allocateFrame(uint32_t address, int shift);
+int isLocalAddress(uint32_t address);
+int dataAccess(Core* core, uint32_t address, uint8_t* data, int write);
+int fpMemAccess(Core* core, uint32_t address, uint32_t* value, int write);
+void spmAccess(Core* core, uint32_t address, uint8_t* data, int write);
+void dmaRegisterAccess(Core* core, uint32_t address, uint8_t* data, int write);
+void dmaStart(Core* core);
+void dmaUpdate(Core* core);
+uint8_t* dmaPointer(Core* core, uint32_t address, uint32_t length);
+int guestCopy(void* context, uint32_t address, uint8_t* buffer, uint32_t length, int to_guest);
+void dmaSnoop(uint32_t line_address, int write, uint64_t now);
+void printResult();
+void printGuestProfile();
+void traceRecord(uint32_t address, int write);
+void replayTrace(const char* filename);
+void intervalRun();
 
 // Main function
-int main() {
-    // Initialize registers
-    for (int i = 0; i < 32; ++i) {
-        reg[i] = 0;
+int main(int argc, char* argv[]) {
+    parseArguments(argc, argv);
+    configureCache();
+    if (replay_filename != NULL) {
+        coreInitialize(&cores[0], 0);
+        replayTrace(replay_filename);
+        return 0;
     }
-    reg[29] = 0x1000000; // Initialize SP
-    reg[31] = 0xFFFFFFFF; // Initialize LR
+    registerStats();
 
     memset(memory, 0, MEMORY_SIZE); // Initialize memory
-    cacheInitialize(); // Initialize cache
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE); // SC holds the bus across its store
+    pthread_mutex_init(&bus_lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    pthread_barrier_init(&quantum_barrier, NULL, num_cores);
+    pthread_mutex_init(&syscall_lock, NULL);
 
-    loadBinary("simple3.bin"); // Load binary file
-
-    while (pc < MEMORY_SIZE && pc != 0xFFFFFFFF) {
-        uint32_t instruction = fetch();
-        printf("Fetched instruction at PC: %08X, Instruction: %08X\n", pc, instruction); // Debug output
-        decode(instruction);
-        instruction_count++;
+    for (int i = 0; i < num_cores; ++i) {
+        coreInitialize(&cores[i], i);
     }
 
-    printf("\n******************* Result ********************\n");
-    printf("Total number of cycles of execution: %d\n", total_cycles);
-    printf("Number of memory (load/store) operations: %d\n", memory_access_count);
-    printf("Number of register operations: %d\n", register_operation_count);
-    printf("Number of branches (total/taken): %d/%d\n", branch_total_count, branch_taken_count);
-    printf("Cache hit/miss: %d/%d\n", cache_hit_count, cache_miss_count);
-    printf("Average Memory Access Time (AMAT): %.2f cycles\n", calculateAMAT());
-    printf("*************************************************");
+    loadBinary(binary_filename); // Load binary file
+    // The heap runs from the page after the image up to the lowest core stack
+    syscallInit(&syscalls, guestCopy, (binary_size + 0xFFF) & ~0xFFFu, 0x1000000 - num_cores * STACK_STRIDE);
 
-    return 0;
-}
+    if (interval_length > 0) {
+        intervalRun();
+        return 0;
+    }
 
-// Initialize cache
-void cacheInitialize() {
-    for (int i = 0; i < SET_COUNT; i++) {
-        for (int j = 0; j < CACHE_WAYS; j++) {
-            cache[i].lines[j].valid = 0;
-            cache[i].lines[j].dirty = 0;
-            cache[i].lines[j].lru_counter = 0;
-            cache[i].lines[j].second_chance = 0;
-            memset(cache[i].lines[j].data, 0, CACHE_LINE_SIZE);
-        }
-        cache[i].fifo_index = 0;
+    PROF_INIT(prof_region_names, PROF_REGION_COUNT, prof_use_perf);
+    pthread_t threads[MAX_CORES];
+    for (int i = 0; i < num_cores; ++i) {
+        pthread_create(&threads[i], NULL, coreThread, &cores[i]);
+    }
+    for (int i = 0; i < num_cores; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    for (int i = 0; i < num_cores; ++i) {
+        writeBufferFlush(&cores[i]); // Writes still buffered at exit count as traffic
+    }
+    statsFinish(simulatedCycles());
+    syscallFinish(&syscalls);
+
+    printResult();
+    printGuestProfile();
+    PROF_REPORT(stdout, totalInstructions());
+    if (trace_file != NULL) {
+        fclose(trace_file);
     }
+
+    pthread_barrier_destroy(&quantum_barrier);
+    pthread_mutex_destroy(&bus_lock);
+    pthread_mutex_destroy(&syscall_lock);
+    return 0;
 }
 
-// Select cache line based on replacement policy
-CacheLine* selectCacheLine(CacheSet* set) {
-    switch (replacement_policy) {
-        case RANDOM:
-            return &set->lines[rand() % CACHE_WAYS];
-        case FIFO:
-            return &set->lines[set->fifo_index++ % CACHE_WAYS];
-        case LRU: {
-            CacheLine* lru_line = &set->lines[0];
-            for (int i = 1; i < CACHE_WAYS; ++i) {
-                if (set->lines[i].lru_counter < lru_line->lru_counter) {
-                    lru_line = &set->lines[i];
-                }
+// Parse command line options: [-c cores] [-p mesi|moesi] [-m open|closed] [-a page|line] [-r policy] [-s seed] [-x prefix]
+//                            [-w wb|wt] [-n] [-b entries] [-d full|idle] [-v entries]
+//                            [-S cache size] [-L line size] [-W ways] [-f config file]
+//                            [-t pipt|vipt] [-P 4k|2m] [-M scratchpad size]
+//                            [-i interval] [-T series.csv] [-l shared memory name]
+//                            [-g profile prefix] [-y symbols.elf] [-H]
+//                            [-o trace] [-R trace] [-j workers] [-k interval[:warmup]] [-F simpoint file[:warmup]] [-K]
+//                            [binary]
+// -g and -y turn on the guest profiler
+// -o records every cache access; -R replays such a trace against the configured cache only,
+// sharded by set over -j worker threads. Replay splits misses into compulsory and the rest.
+// -k runs the program functionally and simulates every interval of that many instructions in detail
+// in up to -j processes at once, each after warmup detailed instructions; -K adds a full detailed run
+// -F does the same for only the intervals in a file from hw2 -B and weights them into whole-program estimates
+// -H adds perf_event counters to the host profile of a -DHOST_PROFILE build
+void parseArguments(int argc, char* argv[]) {
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            num_cores = atoi(argv[++i]);
+            if (num_cores < 1 || num_cores > MAX_CORES) {
+                fprintf(stderr, "Core count must be between 1 and %d\n", MAX_CORES);
+                exit(1);
             }
-            return lru_line;
-        }
-        case SCA: {
-            CacheLine* sca_line = NULL;
-            for (int i = 0; i < CACHE_WAYS; ++i) {
-                if (set->lines[i].second_chance == 0) {
-                    sca_line = &set->lines[i];
-                    break;
+        } else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            ++i;
+            if (strcmp(argv[i], "mesi") == 0) {
+                coherence_protocol = MESI;
+            } else if (strcmp(argv[i], "moesi") == 0) {
+                coherence_protocol = MOESI;
+            } else {
+                fprintf(stderr, "Unknown coherence protocol: %s\n", argv[i]);
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            ++i;
+            if (strcmp(argv[i], "open") == 0) {
+                page_policy = OPEN_PAGE;
+            } else if (strcmp(argv[i], "closed") == 0) {
+                page_policy = CLOSED_PAGE;
+            } else {
+                fprintf(stderr, "Unknown page policy: %s\n", argv[i]);
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "-a") == 0 && i + 1 < argc) {
+            ++i;
+            if (strcmp(argv[i], "page") == 0) {
+                address_mapping = MAP_PAGE_INTERLEAVED;
+            } else if (strcmp(argv[i], "line") == 0) {
+                address_mapping = MAP_LINE_INTERLEAVED;
+            } else {
+                fprintf(stderr, "Unknown address mapping: %s\n", argv[i]);
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            ++i;
+            int found = 0;
+            for (int j = 0; j <= LRFU; ++j) {
+                if (strcmp(argv[i], replacement_policy_names[j]) == 0) {
+                    replacement_policy = (ReplacementPolicy)j;
+                    found = 1;
                 }
-                set->lines[i].second_chance = 0;
             }
-            if (sca_line == NULL) {
-                sca_line = &set->lines[0];
+            if (!found) {
+                fprintf(stderr, "Unknown replacement policy: %s\n", argv[i]);
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            random_seed = (uint32_t)strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "-x") == 0 && i + 1 < argc) {
+            export_prefix = argv[++i];
+        } else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+            ++i;
+            if (strcmp(argv[i], "wb") == 0) {
+                write_policy = WRITE_BACK;
+            } else if (strcmp(argv[i], "wt") == 0) {
+                write_policy = WRITE_THROUGH;
+            } else {
+                fprintf(stderr, "Unknown write policy: %s\n", argv[i]);
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "-n") == 0) {
+            write_allocate = 0;
+        } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            write_buffer_entries = atoi(argv[++i]);
+            if (write_buffer_entries < 0 || write_buffer_entries > MAX_WRITE_BUFFER_ENTRIES) {
+                fprintf(stderr, "Write buffer entries must be between 0 and %d\n", MAX_WRITE_BUFFER_ENTRIES);
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            ++i;
+            if (strcmp(argv[i], "full") == 0) {
+                drain_policy = DRAIN_WHEN_FULL;
+            } else if (strcmp(argv[i], "idle") == 0) {
+                drain_policy = DRAIN_WHEN_IDLE;
+            } else {
+                fprintf(stderr, "Unknown drain policy: %s\n", argv[i]);
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "-v") == 0 && i + 1 < argc) {
+            victim_entries = atoi(argv[++i]);
+            if (victim_entries < 0 || victim_entries > MAX_VICTIM_ENTRIES) {
+                fprintf(stderr, "Victim cache entries must be between 0 and %d\n", MAX_VICTIM_ENTRIES);
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "-S") == 0 && i + 1 < argc) {
+            cache_size = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-L") == 0 && i + 1 < argc) {
+            line_size = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-W") == 0 && i + 1 < argc) {
+            cache_ways = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            loadConfig(argv[++i]);
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            ++i;
+            if (strcmp(argv[i], "pipt") == 0) {
+                vm_mode = VM_PIPT;
+            } else if (strcmp(argv[i], "vipt") == 0) {
+                vm_mode = VM_VIPT;
+            } else {
+                fprintf(stderr, "Unknown cache indexing: %s\n", argv[i]);
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "-M") == 0 && i + 1 < argc) {
+            spm_size = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+            statsSetInterval(strtoull(argv[++i], NULL, 0));
+        } else if (strcmp(argv[i], "-T") == 0 && i + 1 < argc) {
+            statsOpenSeries(argv[++i]);
+        } else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+            statsOpenShared(argv[++i]);
+        } else if (strcmp(argv[i], "-g") == 0 && i + 1 < argc) {
+            guest_profile_prefix = argv[++i];
+            guest_profile_enabled = 1;
+        } else if (strcmp(argv[i], "-y") == 0 && i + 1 < argc) {
+            guestprofLoadSymbols(argv[++i]);
+            guest_profile_enabled = 1;
+#ifdef HOST_PROFILE
+        } else if (strcmp(argv[i], "-H") == 0) {
+            prof_use_perf = 1;
+#endif
+        } else if (strcmp(argv[i], "-u") == 0 && i + 1 < argc) {
+            if (!arithConfigureUnit(argv[++i])) {
+                fprintf(stderr, "Bad unit spec (imul|idiv|fadd|fmul|fdiv:latency[:p|n]): %s\n", argv[i]);
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "-P") == 0 && i + 1 < argc) {
+            ++i;
+            if (strcmp(argv[i], "4k") == 0) {
+                page_shift = SMALL_PAGE_SHIFT;
+            } else if (strcmp(argv[i], "2m") == 0) {
+                page_shift = LARGE_PAGE_SHIFT;
+            } else {
+                fprintf(stderr, "Unknown page size: %s\n", argv[i]);
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            trace_file = fopen(argv[++i], "wb");
+            if (trace_file == NULL) {
+                perror("Error opening trace file");
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc) {
+            int fields = sscanf(argv[++i], "%" SCNu64 ":%" SCNu64, &interval_length, &interval_warmup);
+            if (fields < 1 || interval_length == 0) {
+                fprintf(stderr, "Interval must be instructions[:warmup instructions]\n");
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "-F") == 0 && i + 1 < argc) {
+            char* filename = argv[++i];
+            char* warmup = strrchr(filename, ':');
+            if (warmup != NULL) {
+                *warmup++ = '\0';
+                interval_warmup = strtoull(warmup, NULL, 0);
             }
-            return sca_line;
+            simpointRead(filename, &simpoint_set);
+            interval_length = simpoint_set.interval_length;
+        } else if (strcmp(argv[i], "-K") == 0) {
+            interval_reference = 1;
+        } else if (strcmp(argv[i], "-R") == 0 && i + 1 < argc) {
+            replay_filename = argv[++i];
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            host_workers = atoi(argv[++i]);
+            if (host_workers < 1 || host_workers > MAX_REPLAY_WORKERS) {
+                fprintf(stderr, "Host workers must be between 1 and %d\n", MAX_REPLAY_WORKERS);
+                exit(1);
+            }
+        } else if (argv[i][0] != '-') {
+            binary_filename = argv[i];
+        } else {
+            fprintf(stderr, "Usage: %s [-c cores] [-p mesi|moesi] [-m open|closed] [-a page|line] [-r policy] [-s seed] [-x prefix]\n"
+                    "       [-w wb|wt] [-n] [-b entries] [-d full|idle] [-v entries]\n"
+                    "       [-S cache size] [-L line size] [-W ways] [-f config file]\n"
+                    "       [-t pipt|vipt] [-P 4k|2m] [-M scratchpad size]\n"
+                    "       [-i interval] [-T series.csv] [-l shared memory name]\n"
+                    "       [-g profile prefix] [-y symbols.elf] [-u unit:latency[:p|n]] [-H]\n"
+                    "       [-o trace] [-R trace] [-j workers] [-k interval[:warmup]] [-F simpoint file[:warmup]] [-K]\n"
+                    "       [binary]\n", argv[0]);
+            exit(1);
         }
-        default:
-            return &set->lines[0]; // 기본 값
     }
 }
 
-// Cache access function
-int cacheAccess(uint32_t address, uint8_t* data, int write) {
-    uint32_t tag = address / CACHE_SIZE;
-    uint32_t set_index = (address / CACHE_LINE_SIZE) % SET_COUNT;
-    uint32_t offset = address % CACHE_LINE_SIZE;
-    CacheSet* set = &cache[set_index];
+// Read "key = value" lines; '#' starts a comment. Options later on the command line still override.
+void loadConfig(const char* filename) {
+    struct { const char* key; int* value; } keys[] = {
+        { "cache_size", &cache_size }, { "line_size", &line_size }, { "ways", &cache_ways },
+        { "hit_latency", &hit_latency },
+        { "trcd", &dram_trcd }, { "tcl", &dram_tcl }, { "trp", &dram_trp }, { "tras", &dram_tras },
+        { "tburst", &dram_tburst }, { "controller_latency", &dram_controller_latency },
+        { "itlb_entries", &itlb_entries }, { "dtlb_entries", &dtlb_entries },
+        { "l2_tlb_entries", &l2_tlb_entries }, { "l2_tlb_latency", &l2_tlb_latency },
+        { "spm_base", &spm_base }, { "spm_size", &spm_size }, { "dma_base", &dma_base },
+    };
+    FILE* file = fopen(filename, "r");
+    if (file == NULL) {
+        perror("Error opening file");
+        exit(1);
+    }
 
-    for (int i = 0; i < CACHE_WAYS; i++) {
-        CacheLine* line = &set->lines[i];
-        if (line->valid && line->tag == tag) { // Cache hit
-            if (write) {
-                memcpy(line->data + offset, data, 4); // Writing 4 bytes
-                if (write_policy == WRITE_BACK) {
-                    line->dirty = 1;
-                } else {
-                    uint32_t mem_address = (line->tag * SET_COUNT + set_index) * CACHE_LINE_SIZE + offset;
-                    memWrite(mem_address, *((uint32_t*)data));
-                }
-            } else {
-                memcpy(data, line->data + offset, 4); // Reading 4 bytes
+    char text[256];
+    int line_number = 0;
+    while (fgets(text, sizeof(text), file) != NULL) {
+        line_number++;
+        char* comment = strchr(text, '#');
+        if (comment != NULL) {
+            *comment = '\0';
+        }
+        char key[64];
+        int value;
+        if (sscanf(text, " %63[a-z_] = %i", key, &value) != 2) {
+            if (strspn(text, " \t\r\n") != strlen(text)) {
+                fprintf(stderr, "%s:%d: expected key = value\n", filename, line_number);
+                exit(1);
             }
-            line->lru_counter = instruction_count;
-            line->second_chance = 1;
-            cache_hit_count++;
-            total_cycles += 1; // Cache hit latency
-            return 1; // Cache hit
+            continue;
         }
-    }
-
-    // Cache miss
-    CacheLine* line = selectCacheLine(set);
-    if (line->dirty) {
-        uint32_t mem_address = (line->tag * SET_COUNT + set_index) * CACHE_LINE_SIZE;
-        for (int i = 0; i < CACHE_LINE_SIZE; i += 4) {
-            uint32_t value = *((uint32_t*)(line->data + i));
-            memWrite(mem_address + i, value);
+        int found = 0;
+        for (int i = 0; i < (int)(sizeof(keys) / sizeof(keys[0])); ++i) {
+            if (strcmp(key, keys[i].key) == 0) {
+                *keys[i].value = value;
+                found = 1;
+            }
+        }
+        if (!found) {
+            fprintf(stderr, "%s:%d: unknown key %s\n", filename, line_number, key);
+            exit(1);
         }
     }
+    fclose(file);
+}
 
-    line->valid = 1;
-    line->tag = tag;
-    line->lru_counter = instruction_count;
-    line->second_chance = 1;
-    line->dirty = write_policy == WRITE_BACK ? write : 0;
-
-    uint32_t mem_address = (tag * SET_COUNT + set_index) * CACHE_LINE_SIZE;
-    for (int i = 0; i < CACHE_LINE_SIZE; i += 4) {
-        uint32_t value = memAccess(mem_address + i, 0, 0);
-        *((uint32_t*)(line->data + i)) = value;
+// Check the geometry and derive the set count, shifts and masks from it
+void configureCache() {
+    if (line_size < 4 || line_size > MAX_LINE_SIZE || (line_size & (line_size - 1)) != 0) {
+        fprintf(stderr, "Line size must be a power of two between 4 and %d bytes\n", MAX_LINE_SIZE);
+        exit(1);
     }
-
-    if (write) {
-        memcpy(line->data + offset, data, 4);
-    } else {
-        memcpy(data, line->data + offset, 4);
+    if (cache_ways < 1 || cache_ways > MAX_WAYS) {
+        fprintf(stderr, "Associativity must be between 1 and %d\n", MAX_WAYS);
+        exit(1);
+    }
+    if (cache_size <= 0 || cache_size % (line_size * cache_ways) != 0) {
+        fprintf(stderr, "Cache size must be a positive multiple of line size * ways (%d bytes)\n", line_size * cache_ways);
+        exit(1);
+    }
+    if (replacement_policy == PLRU && (cache_ways & (cache_ways - 1)) != 0) {
+        fprintf(stderr, "Tree-PLRU needs a power-of-two associativity\n");
+        exit(1);
+    }
+    if (hit_latency < 1 || dram_trcd < 0 || dram_tcl < 0 || dram_trp < 0 || dram_tras < 0 || dram_tburst < 0 ||
+        dram_controller_latency < 0) {
+        fprintf(stderr, "Latencies must not be negative, and the hit latency must be at least 1\n");
+        exit(1);
     }
 
-    printf("Cache miss: address=%08X, set_index=%d, tag=%d\n", address, set_index, tag); // Cache miss debug output
+    if (itlb_entries < 1 || dtlb_entries < 1 || l2_tlb_entries < 1 || itlb_entries > MAX_TLB_ENTRIES ||
+        dtlb_entries > MAX_TLB_ENTRIES || l2_tlb_entries > MAX_TLB_ENTRIES || l2_tlb_latency < 0) {
+        fprintf(stderr, "TLB sizes must be between 1 and %d entries\n", MAX_TLB_ENTRIES);
+        exit(1);
+    }
+    // VIPT indexes with untranslated bits only, so one way must fit in a page
+    if (vm_mode == VM_VIPT && cache_size / cache_ways > (1 << page_shift)) {
+        fprintf(stderr, "VIPT needs cache size / ways (%d bytes) to fit in a page (%d bytes)\n",
+                cache_size / cache_ways, 1 << page_shift);
+        exit(1);
+    }
 
-    cache_miss_count++;
-    total_cycles += MEMORY_LATENCY; // Cache miss latency
-    return 0; // Cache miss
-}
+    if (spm_size < 0 || spm_size % 4 != 0 || spm_base < 0 || spm_base % 4 != 0 || spm_base + spm_size > MEMORY_SIZE ||
+        dma_base < 0 || dma_base % 4 != 0 || dma_base + DMA_REGISTER_SPAN > MEMORY_SIZE) {
+        fprintf(stderr, "Scratchpad and DMA windows must be word-aligned and inside memory\n");
+        exit(1);
+    }
+    if (spm_size > 0 && dma_base < spm_base + spm_size && spm_base < dma_base + DMA_REGISTER_SPAN) {
+        fprintf(stderr, "DMA registers overlap the scratchpad\n");
+        exit(1);
+    }
 
-uint32_t fetch() {
-    uint8_t data[4];
-    cacheAccess(pc, data, 0);
-    instruction = (data[3] << 24) | (data[2] << 16) | (data[1] << 8) | data[0];
-    printf("Fetched instruction at PC: %08X, Instruction: %08X\n", pc, instruction); // Debug output
-    total_cycles++;
-    return instruction;
+    set_count = cache_size / (line_size * cache_ways);
+    line_shift = __builtin_ctz(line_size);
+    set_shift = (set_count & (set_count - 1)) == 0 ? __builtin_ctz(set_count) : -1;
+    set_mask = set_count - 1;
+    full_line_mask = line_size / 4 == 32 ? 0xFFFFFFFFu : (1u << (line_size / 4)) - 1;
+    selectCacheLookup();
+    selectReplacement();
 }
 
-void decode(uint32_t instruction) {
-    uint32_t opcode = instruction >> 26;
-    printf("Decoding instruction at PC: %08X, Instruction: %08X, opcode: %02X\n", pc, instruction, opcode); // Debug output
-    // if (opcode == 0x00) { // R-type
-    //     register_operation_count++; // R-type instruction is a register operation
-    // } else if (opcode == 0x02 || opcode == 0x03) { // J-type
-    // } else { // I-type
-    //     // Add register operations for I-type instructions
-    //     if (opcode == 0x08 || opcode == 0x09 || opcode == 0x0A || opcode == 0x0B || 
-    //         opcode == 0x0C || opcode == 0x0D || opcode == 0x0E || opcode == 0x0F) {
-    //         register_operation_count++;
-    //     }
-    // }
-    execute(instruction);
+// Initialize registers, cache and statistics of a core
+void coreInitialize(Core* core, int id) {
+    memset(core, 0, sizeof(Core));
+    core->id = id;
+    core->reg[4] = id; // $a0 carries the core id so guest threads can split work
+    core->reg[29] = 0x1000000 - id * STACK_STRIDE; // Initialize SP
+    core->reg[31] = 0xFFFFFFFF; // Initialize LR
+    core->pc = 0;
+    pthread_mutex_init(&core->cache_lock, NULL);
+    core->random_state = random_seed * 2654435761u + id + 1; // Never zero for small seeds
+    if (core->random_state == 0) {
+        core->random_state = 1;
+    }
+    core->psel = PSEL_MAX / 2;
+    core->cache = calloc(set_count, sizeof(CacheSet));
+    core->set_stats = calloc(set_count, sizeof(AccessStats));
+    core->seen_lines = calloc(MEMORY_SIZE / line_size / 8, 1);
+    CacheLine* lines = calloc((size_t)set_count * cache_ways, sizeof(CacheLine));
+    if (core->cache == NULL || core->set_stats == NULL || core->seen_lines == NULL || lines == NULL) {
+        fprintf(stderr, "Out of memory for a %d-byte cache\n", cache_size);
+        exit(1);
+    }
+    for (int i = 0; i < set_count; ++i) {
+        core->cache[i].lines = &lines[i * cache_ways];
+    }
+    cacheInitialize(core); // Initialize cache
+    shadowInitialize(&core->shadow, set_count * cache_ways);
+    tlbInitialize(&core->itlb, itlb_entries);
+    tlbInitialize(&core->dtlb, dtlb_entries);
+    tlbInitialize(&core->l2_tlb, l2_tlb_entries);
+    if (spm_size > 0) {
+        core->spm = calloc(spm_size, 1);
+        if (core->spm == NULL) {
+            fprintf(stderr, "Out of memory for a %d-byte scratchpad\n", spm_size);
+            exit(1);
+        }
+    }
+    if (guest_profile_enabled) {
+        core->profile = guestprofCreate(GP_METRIC(GP_CYCLES) | GP_METRIC(GP_MISSES));
+    }
 }
 
-void writeBack(uint32_t rd, uint32_t value) {
-    reg[rd] = value;  // Write the value to the specified register
-}
+// Host thread of one simulated core; cores meet at a barrier every QUANTUM instructions
+void* coreThread(void* arg) {
+    Core* core = (Core*)arg;
 
-uint32_t memAccess(uint32_t address, uint32_t value, int write) {
-    if (address < MEMORY_SIZE) {
-        if (address % 4 == 0) { // Ensure word alignment
-            if (write) {
-                memWrite(address, value);
-            } else {
-                return (memory[address] << 24) | (memory[address + 1] << 16) |
-                       (memory[address + 2] << 8) | memory[address + 3];
+    while (!simulation_done) {
+        for (int i = 0; i < QUANTUM && isRunning(core); ++i) {
+            stepCore(core);
+        }
+        if (quantumBarrier() == PTHREAD_BARRIER_SERIAL_THREAD) {
+            int done = 1;
+            for (int i = 0; i < num_cores; ++i) {
+                if (syscalls.exited) {
+                    cores[i].pc = 0xFFFFFFFF; // exit ends the whole process at the end of the quantum
+                }
+                if (isRunning(&cores[i])) {
+                    done = 0;
+                }
             }
-        } else {
-            printf("Memory access error: Address is not word-aligned\n");
+            simulation_done = done;
+            statsTick(simulatedCycles()); // Everyone else waits at the barrier, so the counters hold still
         }
-    } else {
-        printf("Memory access error: Address out of bounds\n");
+        quantumBarrier();
     }
-    return 0;
+    PROF_THREAD_EXIT();
+    return NULL;
 }
 
-void memWrite(uint32_t address, uint32_t value) {
-    if (address < MEMORY_SIZE) {
-        // Check if the address is a multiple of 4 (word-aligned)
-        if (address % 4 == 0) {
-            memory[address] = (value >> 24) & 0xFF;
-            memory[address + 1] = (value >> 16) & 0xFF;
-            memory[address + 2] = (value >> 8) & 0xFF;
-            memory[address + 3] = value & 0xFF;
-        } else {
-            printf("Memory write error: Address is not word-aligned\n");
-        }
-    } else {
-        printf("Memory write error: Address out of bounds\n");
+// Host time spent here is load imbalance between the core threads
+int quantumBarrier() {
+    PROF_SCOPE(PROF_BARRIER);
+    return pthread_barrier_wait(&quantum_barrier);
+}
+
+int isRunning(Core* core) {
+    return core->pc < MEMORY_SIZE && core->pc != 0xFFFFFFFF;
+}
+
+void stepCore(Core* core) {
+    PROF_SCOPE(PROF_STEP);
+    dmaUpdate(core);
+    uint32_t pc = core->pc;
+    uint64_t cycles = core->total_cycles, misses = core->cache_miss_count;
+    uint32_t instruction = fetch(core);
+    printf("Core %d: Fetched instruction at PC: %08X, Instruction: %08X\n", core->id, core->pc, instruction); // Debug output
+    decode(core, instruction);
+    core->instruction_count++;
+    if (core->profile != NULL) {
+        guestprofRetire(core->profile, pc, instruction, core->pc, core->total_cycles - cycles,
+                        core->cache_miss_count - misses, 0);
     }
 }
 
-void execute(uint32_t instruction) {
-    uint32_t opcode = instruction >> 26;
-    uint32_t rs = (instruction >> 21) & 0x1F;
-    uint32_t rt = (instruction >> 16) & 0x1F;
-    uint32_t rd = (instruction >> 11) & 0x1F;
-    uint32_t shamt = (instruction >> 6) & 0x1F;
-    uint32_t funct = instruction & 0x3F;
-    int16_t immediate = instruction & 0xFFFF;
-    uint32_t address = instruction & 0x3FFFFFF;
-    int32_t sign_extended_immediate = (int32_t)(int16_t)immediate; // sign-extend immediate
-    uint32_t value, mem_address;
-
-    printf("Executing instruction at PC: %08X, Instruction: %08X\n", pc, instruction); // Debug output
-
-    switch (opcode) {
-        case 0x00: // R-type instructions
-            register_operation_count++; // R-type instruction is a register operation
-            switch (funct) {
-                case 0x00: // sll
-                    value = reg[rt] << shamt;
-                    writeBack(rd, value);
-                    break;
-                case 0x02: // srl
-                    value = reg[rt] >> shamt;
-                    writeBack(rd, value);
-                    break;
-                case 0x08: // jr
-                    printf("Executing JR, PC before: %08X, JR to: %08X\n", pc, reg[rs]); // Debug output
-                    pc = reg[rs];
-                    break;
-                case 0x20: // add
-                    value = (int32_t)reg[rs] + (int32_t)reg[rt];
-                    writeBack(rd, value);
-                    break;
-                case 0x21: // addu
-                    value = reg[rs] + reg[rt];
-                    writeBack(rd, value);
-                    break;
-                case 0x22: // sub
-                    value = (int32_t)reg[rs] - (int32_t)reg[rt];
-                    writeBack(rd, value);
-                    break;
-                case 0x23: // subu
-                    value = reg[rs] - reg[rt];
-                    writeBack(rd, value);
-                    break;
-                case 0x24: // and
-                    value = reg[rs] & reg[rt];
-                    writeBack(rd, value);
-                    break;
-                case 0x25: // or
-                    value = reg[rs] | reg[rt];
-                    writeBack(rd, value);
-                    break;
-                case 0x26: // xor
-                    value = reg[rs] ^ reg[rt];
-                    writeBack(rd, value);
-                    break;
-                case 0x27: // nor
-                    value = ~(reg[rs] | reg[rt]);
-                    writeBack(rd, value);
-                    break;
-                case 0x2A: // slt
-                    reg[rd] = (int32_t)reg[rs] < (int32_t)reg[rt] ? 1 : 0;
-                    break;
-                case 0x2B: // sltu
-                    reg[rd] = reg[rs] < reg[rt] ? 1 : 0;
-                    break;
-                default:
-                    printf("Unsupported R-type funct: %X\n", funct);
-            }
+// Runs the instruction at pc at once, without timing, cache state or debug output. Memory goes through the
+// same translation and byte order as the detailed path, so a copy forked at any point continues from it.
+void functionalStep(Core* core) {
+    dmaUpdate(core);
+    uint8_t data[4];
+    cacheAccess(core, translate(core, core->pc, 1), data, 0);
+    uint32_t instruction = isaWordFromBytes(data);
+    IsaDecoded d = isaDecode(instruction);
+    uint32_t* reg = core->reg;
+    uint32_t rs_value = reg[d.rs], rt_value = reg[d.rt];
+    uint32_t mem_address = rs_value + d.immediate;
+    uint32_t next_pc = core->pc + 4;
+    uint32_t value = 0;
+    int pair = (isa_info[d.op].operands & ISA_DOUBLE) != 0;
+
+    switch (d.cls) {
+        case ISA_CLASS_ALU:
+            writeBack(core, d.dest, isaAluResult(&d, rs_value, rt_value));
             break;
-        case 0x02: // J
-            printf("Executing J, PC before: %08X, J to: %08X\n", pc, (pc & 0xF0000000) | (address << 2)); // Debug output
-            pc = (pc & 0xF0000000) | (address << 2);
+        case ISA_CLASS_HILO:
+            writeBack(core, d.dest, isaAlu(isa_info[d.op].alu, core->arith.hi, core->arith.lo));
             break;
-        case 0x03: // JAL
-            printf("Executing JAL, PC before: %08X, JAL to: %08X\n", pc, (pc & 0xF0000000) | (address << 2)); // Debug output
-            reg[31] = pc + 4;
-            pc = (pc & 0xF0000000) | (address << 2);
+        case ISA_CLASS_MULDIV:
+            arithMulDiv(&core->arith, d.funct, rs_value, rt_value);
             break;
-        case 0x04: // BEQ
-            branch_total_count++; // 전체 분기 수 증가
-            if (reg[rs] == reg[rt]) {
-                printf("Executing BEQ, PC before: %08X, BEQ to: %08X\n", pc, pc + (sign_extended_immediate << 2)); // Debug output
-                pc = pc + 4 + (sign_extended_immediate << 2);
-                branch_taken_count++;
+        case ISA_CLASS_BRANCH:
+            if (isaAluResult(&d, rs_value, rt_value)) {
+                next_pc = isaBranchTarget(&d, core->pc);
             }
             break;
-        case 0x05: // BNE
-            branch_total_count++; // 전체 분기 수 증가
-            if (reg[rs] != reg[rt]) {
-                printf("Executing BNE, PC before: %08X, BNE to: %08X\n", pc, pc + (sign_extended_immediate << 2)); // Debug output
-                pc = pc + 4 + (sign_extended_immediate << 2);
-                branch_taken_count++;
+        case ISA_CLASS_BRANCH_FP:
+            if (arithCondition(&core->arith, d.rt >> 2) == (int)(d.rt & 1)) {
+                next_pc = isaBranchTarget(&d, core->pc);
             }
             break;
-        case 0x08: // ADDI
-            register_operation_count++; // I-type instruction ADDI is a register operation
-            value = reg[rs] + immediate;
-            writeBack(rt, value);
-            break;
-        case 0x09: // ADDIU
-            register_operation_count++; // I-type instruction ADDIU is a register operation
-            value = reg[rs] + sign_extended_immediate;
-            writeBack(rt, value);
-            break;
-        case 0x0A: // SLTI
-            register_operation_count++; // I-type instruction SLTI is a register operation
-            reg[rt] = (int32_t)reg[rs] < sign_extended_immediate ? 1 : 0;
-            break;
-        case 0x0B: // SLTIU
-            register_operation_count++; // I-type instruction SLTIU is a register operation
-            reg[rt] = reg[rs] < (uint32_t)sign_extended_immediate ? 1 : 0;
+        case ISA_CLASS_JUMP:
+            next_pc = isaJumpTarget(&d, core->pc);
+            writeBack(core, d.dest, core->pc + 4);
             break;
-        case 0x0C: // ANDI
-            register_operation_count++; // I-type instruction ANDI is a register operation
-            reg[rt] = reg[rs] & (uint32_t)immediate;
+        case ISA_CLASS_JUMP_REG:
+            next_pc = rs_value;
             break;
-        case 0x0D: // ORI
-            register_operation_count++; // I-type instruction ORI is a register operation
-            reg[rt] = reg[rs] | (uint32_t)immediate;
+        case ISA_CLASS_LOAD:
+        case ISA_CLASS_LOAD_LINKED:
+            if (fpMemAccess(core, mem_address, &value, 0)) {
+                writeBack(core, d.dest, value);
+            }
+            if (d.cls == ISA_CLASS_LOAD_LINKED) {
+                core->ll_address = mem_address - mem_address % line_size;
+                core->ll_valid = 1;
+            }
             break;
-        case 0x0E: // XORI
-            register_operation_count++; // I-type instruction XORI is a register operation
-            reg[rt] = reg[rs] ^ (uint32_t)immediate;
+        case ISA_CLASS_STORE:
+            fpMemAccess(core, mem_address, &rt_value, 1);
             break;
-        case 0x0F: // LUI
-            register_operation_count++; // I-type instruction LUI is a register operation
-            reg[rt] = immediate << 16;
+        case ISA_CLASS_STORE_CONDITIONAL: {
+            int success = core->ll_valid && core->ll_address == mem_address - mem_address % line_size;
+            if (success) {
+                fpMemAccess(core, mem_address, &rt_value, 1);
+            }
+            core->ll_valid = 0;
+            writeBack(core, d.dest, success);
             break;
-        case 0x23: // LW
-            mem_address = reg[rs] + sign_extended_immediate;
-            if (mem_address % 4 == 0 && mem_address < MEMORY_SIZE) {
-                uint8_t data[4];
-                cacheAccess(mem_address, data, 0);
-                value = (data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
-                writeBack(rt, value);
-                printf("Loaded value to v0: %d\n", reg[rt]); // Debugging output
+        }
+        case ISA_CLASS_FP_LOAD:
+        case ISA_CLASS_FP_STORE:
+            if (pair) {
+                fpMemAccess(core, mem_address, &core->arith.fpr[(d.rt & ~1u) + 1], d.cls == ISA_CLASS_FP_STORE);
+                fpMemAccess(core, mem_address + 4, &core->arith.fpr[d.rt & ~1u], d.cls == ISA_CLASS_FP_STORE);
             } else {
-                printf("Memory access error: Address is not word-aligned or out of bounds\n");
+                fpMemAccess(core, mem_address, &core->arith.fpr[d.rt], d.cls == ISA_CLASS_FP_STORE);
             }
-            memory_access_count++;
             break;
-        case 0x2B: // SW
-            mem_address = reg[rs] + sign_extended_immediate;
-            if (mem_address % 4 == 0 && mem_address < MEMORY_SIZE) {
-                uint8_t data_sw[4] = {
-                    (reg[rt] >> 24) & 0xFF,
-                    (reg[rt] >> 16) & 0xFF,
-                    (reg[rt] >> 8) & 0xFF,
-                    reg[rt] & 0xFF
-                };
-                cacheAccess(mem_address, data_sw, 1);
-                printf("Stored value from v0: %d\n", reg[rt]); // Debugging output
-            } else {
-                printf("Memory access error: Address is not word-aligned or out of bounds\n");
+        case ISA_CLASS_COP1: {
+            int handled = arithCop1(&core->arith, instruction, rt_value, &value);
+            if (handled == 2) {
+                writeBack(core, d.dest, value);
+            } else if (!handled) {
+                printf("Unsupported COP1 instruction: %08X\n", instruction);
+            }
+            break;
+        }
+        case ISA_CLASS_SYSCALL:
+            if (syscallHandle(&syscalls, reg, &core->arith, core, core->total_cycles)) {
+                next_pc = 0xFFFFFFFF; // Exit sentinel
             }
-            memory_access_count++;
             break;
         default:
-            printf("Unsupported opcode: %X\n", opcode);
+            printf("Unsupported instruction: %08X\n", instruction);
+            break;
+    }
+    core->pc = next_pc;
+    core->instruction_count++;
+    core->total_cycles++; // Lets a DMA transfer started by the guest complete
+}
+
+void printResult() {
+    static Core total; // Only the statistics fields are summed; too large for the stack
+    for (int i = 0; i < num_cores; ++i) {
+        Core* core = &cores[i];
+        total.instruction_count += core->instruction_count;
+        total.memory_access_count += core->memory_access_count;
+        total.register_operation_count += core->register_operation_count;
+        total.branch_total_count += core->branch_total_count;
+        total.branch_taken_count += core->branch_taken_count;
+        total.cache_hit_count += core->cache_hit_count;
+        total.cache_miss_count += core->cache_miss_count;
+        if (core->total_cycles > total.total_cycles) {
+            total.total_cycles = core->total_cycles; // Cores run concurrently
+        }
+    }
+
+    printf("\n******************* Result ********************\n");
+    printf("Total number of cycles of execution: %" PRIu64 "\n", total.total_cycles);
+    printf("Number of memory (load/store) operations: %" PRIu64 "\n", total.memory_access_count);
+    printf("Number of register operations: %" PRIu64 "\n", total.register_operation_count);
+    printf("Number of branches (total/taken): %" PRIu64 "/%" PRIu64 "\n", total.branch_total_count, total.branch_taken_count);
+    printf("Cache: %d bytes, %d-byte lines, %d ways, %d sets (%s lookup)\n", cache_size, line_size, cache_ways, set_count,
+           cache_lookup_name);
+    printf("Cache hit/miss: %" PRIu64 "/%" PRIu64 " (%s replacement)\n", total.cache_hit_count, total.cache_miss_count,
+           replacement_policy_names[replacement_policy]);
+    uint64_t miss_types[MISS_TYPES] = {0};
+    for (int i = 0; i < num_cores; ++i) {
+        for (int t = 0; t < MISS_TYPES; ++t) {
+            miss_types[t] += cores[i].miss_types[t];
+        }
+    }
+    printf("Cache misses (compulsory/capacity/conflict/coherence): %" PRIu64 "/%" PRIu64 "/%" PRIu64 "/%" PRIu64 "\n",
+           miss_types[MISS_COMPULSORY], miss_types[MISS_CAPACITY], miss_types[MISS_CONFLICT], miss_types[MISS_COHERENCE]);
+    printf("Average Memory Access Time (AMAT): %.2f cycles\n", calculateAMAT());
+    printf("DRAM reads/writes: %" PRIu64 "/%" PRIu64 " (write drains: %" PRIu64 ")\n", dram_stats.reads, dram_stats.writes, dram_stats.write_drains);
+    printf("DRAM row hit/empty/conflict: %" PRIu64 "/%" PRIu64 "/%" PRIu64 "\n", dram_stats.row_hits, dram_stats.row_empty, dram_stats.row_conflicts);
+    printf("DRAM average read latency: %.2f cycles\n",
+           dram_stats.reads ? (float)dram_stats.read_latency_total / dram_stats.reads : 0.0f);
+
+    uint64_t inserts = 0, coalesced = 0, full_stalls = 0, stall_cycles = 0, transactions = 0, bytes = 0, victim_hits = 0;
+    for (int i = 0; i < num_cores; ++i) {
+        inserts += cores[i].write_buffer_inserts;
+        coalesced += cores[i].write_buffer_coalesced;
+        full_stalls += cores[i].write_buffer_full_stalls;
+        stall_cycles += cores[i].write_buffer_stall_cycles;
+        transactions += cores[i].memory_write_transactions;
+        bytes += cores[i].memory_write_bytes;
+        victim_hits += cores[i].victim_hits;
+    }
+    printf("Write policy: %s, %s\n", write_policy == WRITE_BACK ? "write-back" : "write-through",
+           write_allocate ? "write-allocate" : "no-write-allocate");
+    printf("Write buffer (%d entries, drain when %s): writes %" PRIu64 ", coalesced %" PRIu64 ", full stalls %" PRIu64 " (%" PRIu64 " cycles)\n",
+           write_buffer_entries, drain_policy == DRAIN_WHEN_FULL ? "full" : "idle", inserts, coalesced, full_stalls, stall_cycles);
+    printf("Memory write traffic: %" PRIu64 " transactions, %" PRIu64 " bytes\n", transactions, bytes);
+    printf("Victim cache (%d entries) hits: %" PRIu64 "\n", victim_entries, victim_hits);
+    syscallPrint(stdout, &syscalls);
+
+    if (spm_size > 0) {
+        uint64_t spm_accesses = 0, spm_cycles = 0, cached_accesses = 0, cached_cycles = 0;
+        uint64_t dma_transfers = 0, dma_bytes = 0, dma_busy_cycles = 0;
+        for (int i = 0; i < num_cores; ++i) {
+            spm_accesses += cores[i].spm_accesses;
+            spm_cycles += cores[i].spm_cycles;
+            cached_accesses += cores[i].cached_data_accesses;
+            cached_cycles += cores[i].cached_data_cycles;
+            dma_transfers += cores[i].dma_transfers;
+            dma_bytes += cores[i].dma_bytes;
+            dma_busy_cycles += cores[i].dma_busy_cycles;
+        }
+        printf("Scratchpad: %d bytes at %08X, DMA registers at %08X\n", spm_size, spm_base, dma_base);
+        printf("Scratchpad accesses: %" PRIu64 " (%" PRIu64 " cycles, %.2f per access)\n", spm_accesses, spm_cycles,
+               spm_accesses ? (float)spm_cycles / spm_accesses : 0.0f);
+        printf("Cached data accesses: %" PRIu64 " (%" PRIu64 " cycles, %.2f per access)\n", cached_accesses, cached_cycles,
+               cached_accesses ? (float)cached_cycles / cached_accesses : 0.0f);
+        printf("DMA transfers: %" PRIu64 ", bytes: %" PRIu64 ", busy cycles: %" PRIu64 "\n", dma_transfers, dma_bytes, dma_busy_cycles);
+    }
+
+    if (vm_mode != VM_OFF) {
+        uint64_t itlb[2] = {0}, dtlb[2] = {0}, l2_tlb[2] = {0}, walks = 0, walk_cycles = 0, faults = 0;
+        for (int i = 0; i < num_cores; ++i) {
+            itlb[0] += cores[i].itlb.accesses;
+            itlb[1] += cores[i].itlb.misses;
+            dtlb[0] += cores[i].dtlb.accesses;
+            dtlb[1] += cores[i].dtlb.misses;
+            l2_tlb[0] += cores[i].l2_tlb.accesses;
+            l2_tlb[1] += cores[i].l2_tlb.misses;
+            walks += cores[i].page_walks;
+            walk_cycles += cores[i].walk_cycles;
+            faults += cores[i].page_faults;
+        }
+        printf("Virtual memory: %s, %s pages\n", vm_mode == VM_PIPT ? "PIPT" : "VIPT", page_shift == SMALL_PAGE_SHIFT ? "4KB" : "2MB");
+        printf("ITLB miss rate: %" PRIu64 "/%" PRIu64 " (%.2f%%)\n", itlb[1], itlb[0], itlb[0] ? 100.0f * itlb[1] / itlb[0] : 0.0f);
+        printf("DTLB miss rate: %" PRIu64 "/%" PRIu64 " (%.2f%%)\n", dtlb[1], dtlb[0], dtlb[0] ? 100.0f * dtlb[1] / dtlb[0] : 0.0f);
+        printf("L2 TLB miss rate: %" PRIu64 "/%" PRIu64 " (%.2f%%)\n", l2_tlb[1], l2_tlb[0], l2_tlb[0] ? 100.0f * l2_tlb[1] / l2_tlb[0] : 0.0f);
+        printf("Page walks: %" PRIu64 ", walk cycles: %" PRIu64 " (%.2f per walk), page faults: %" PRIu64 "\n", walks, walk_cycles,
+               walks ? (float)walk_cycles / walks : 0.0f, faults);
+    }
+
+    uint64_t unit_ops[UNIT_COUNT] = {0}, any_unit_ops = 0;
+    for (int i = 0; i < num_cores; ++i) {
+        for (int unit = UNIT_INT_MUL; unit < UNIT_COUNT; ++unit) {
+            unit_ops[unit] += cores[i].unit_ops[unit];
+            any_unit_ops += cores[i].unit_ops[unit];
+        }
+    }
+    if (any_unit_ops > 0) {
+        printf("Functional units (ops/latency):");
+        for (int unit = UNIT_INT_MUL; unit < UNIT_COUNT; ++unit) {
+            printf(" %s %" PRIu64 "/%d%s", arith_units[unit].name, unit_ops[unit], arith_units[unit].latency,
+                   arith_units[unit].pipelined ? "" : "n");
+        }
+        printf("\n");
+    }
+
+    if (num_cores > 1) {
+        for (int i = 0; i < num_cores; ++i) {
+            Core* core = &cores[i];
+            printf("Core %d: cycles %" PRIu64 ", instructions %" PRIu64 ", cache hit/miss %" PRIu64 "/%" PRIu64 ", R[2] %d\n", core->id,
+                   core->total_cycles, core->instruction_count, core->cache_hit_count, core->cache_miss_count, core->reg[2]);
+        }
+        printf("Coherence protocol: %s\n", coherence_protocol == MESI ? "MESI" : "MOESI");
+        printf("Bus transactions (BusRd/BusRdX/BusUpgr): %" PRIu64 "/%" PRIu64 "/%" PRIu64 "\n",
+               coherence.bus_reads, coherence.bus_read_exclusives, coherence.bus_upgrades);
+        printf("Writebacks: %" PRIu64 ", cache-to-cache transfers: %" PRIu64 "\n", coherence.writebacks, coherence.cache_to_cache_transfers);
+        printf("Invalidations (total/false sharing): %" PRIu64 "/%" PRIu64 "\n", coherence.invalidations, coherence.false_sharing_invalidations);
+        printf("SC (success/failure): %" PRIu64 "/%" PRIu64 "\n", coherence.sc_success, coherence.sc_failure);
+
+        // Selection of the lines with the most false-sharing invalidations
+        printf("False-sharing hot lines:\n");
+        for (int n = 0; n < HOT_LINE_COUNT; ++n) {
+            SharingEntry* hottest = NULL;
+            for (int i = 0; i < SHARING_TABLE_SIZE; ++i) {
+                SharingEntry* entry = &sharing_table[i];
+                if (entry->used && entry->false_sharing > 0 && (hottest == NULL || entry->false_sharing > hottest->false_sharing)) {
+                    hottest = entry;
+                }
+            }
+            if (hottest == NULL) {
+                break;
+            }
+            printf("  line %08X: invalidations %" PRIu64 ", false sharing %" PRIu64 "\n",
+                   hottest->line_address, hottest->invalidations, hottest->false_sharing);
+            hottest->used = 0; // Already printed
+        }
+    }
+    if (statsEnabled()) {
+        statsPrint(stdout);
+    }
+    printHeatmap();
+    printf("*************************************************");
+
+    if (export_prefix != NULL) {
+        exportMissStats(export_prefix);
+    }
+}
+
+// Initialize cache
+void cacheInitialize(Core* core) {
+    for (int i = 0; i < set_count; i++) {
+        for (int j = 0; j < cache_ways; j++) {
+            core->cache[i].lines[j].state = INVALID;
+            core->cache[i].lines[j].age = j;
+            core->cache[i].lines[j].second_chance = 0;
+            core->cache[i].lines[j].rrpv = RRPV_MAX;
+            core->cache[i].lines[j].frequency = 0;
+            core->cache[i].lines[j].crf = 0;
+            core->cache[i].lines[j].last_access = 0;
+            core->cache[i].lines[j].word_mask = 0;
+            memset(core->cache[i].lines[j].data, 0, line_size);
+        }
+        core->cache[i].fifo_index = 0;
+        core->cache[i].plru_bits = 0;
+    }
+}
+
+// xorshift32, so runs are reproducible and cores do not share a generator
+uint32_t nextRandom(Core* core) {
+    uint32_t x = core->random_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    core->random_state = x;
+    return x;
+}
+
+// LRFU combined recency-frequency value of a line decayed to the current access clock
+static inline uint32_t lrfuValue(Core* core, CacheLine* line) {
+    uint64_t halvings = (core->access_clock - line->last_access) / LRFU_HALF_LIFE;
+    return halvings >= 32 ? 0 : line->crf >> halvings;
+}
+
+// DRRIP: leader sets always use their policy, followers use the one PSEL favours
+static inline ReplacementPolicy drripPolicy(Core* core, uint32_t set_index) {
+    if (set_index % DUEL_PERIOD == 0) {
+        return SRRIP;
     }
-    if (!(opcode == 0x02 || opcode == 0x03 || opcode == 0x04 || opcode == 0x05 || (opcode == 0x00 && funct == 0x08))) {
-        pc += 4;
+    if (set_index % DUEL_PERIOD == 1) {
+        return BRRIP;
     }
+    return core->psel > PSEL_MAX / 2 ? BRRIP : SRRIP;
 }
 
+static inline int victimLRU(CacheSet* set) {
+    for (int i = 0; i < cache_ways; ++i) {
+        if (set->lines[i].age == cache_ways - 1) {
+            return i;
+        }
+    }
+    return 0;
+}
 
-void loadBinary(const char* filename) {
-    FILE *file = fopen(filename, "rb");
-    if (file == NULL) {
-        perror("Error opening file");
-        exit(1);
+static inline int victimPLRU(CacheSet* set) {
+    int node = 1;
+    while (node < cache_ways) {
+        node = node * 2 + ((set->plru_bits >> node) & 1); // Follow the bits towards the older half
     }
-    size_t bytesRead = fread(memory, sizeof(uint8_t), MEMORY_SIZE, file);
-    fclose(file);
-    printf("Loaded %zu bytes from %s\n", bytesRead, filename);
+    return node - cache_ways;
 }
 
-float calculateAMAT() {
-    float hit_time = 1.0f; // Cache hit time in cycles
-    float miss_penalty = MEMORY_LATENCY; // Cache miss penalty in cycles
-    float miss_rate = (float)cache_miss_count / (cache_hit_count + cache_miss_count);
+static inline int victimRRIP(CacheSet* set) {
+    while (1) {
+        for (int i = 0; i < cache_ways; ++i) {
+            if (set->lines[i].rrpv >= RRPV_MAX) {
+                return i;
+            }
+        }
+        for (int i = 0; i < cache_ways; ++i) {
+            set->lines[i].rrpv++;
+        }
+    }
+}
+
+static inline int victimSCA(CacheSet* set) {
+    for (int i = 0; i < cache_ways; ++i) {
+        if (set->lines[i].second_chance == 0) {
+            return i;
+        }
+        set->lines[i].second_chance = 0;
+    }
+    return 0;
+}
+
+static inline int victimLFU(CacheSet* set) {
+    int victim = 0;
+    for (int i = 1; i < cache_ways; ++i) {
+        CacheLine* line = &set->lines[i];
+        CacheLine* best = &set->lines[victim];
+        if (line->frequency < best->frequency || (line->frequency == best->frequency && line->age > best->age)) {
+            victim = i;
+        }
+    }
+    return victim;
+}
+
+static inline int victimLRFU(Core* core, CacheSet* set) {
+    int victim = 0;
+    for (int i = 1; i < cache_ways; ++i) {
+        if (lrfuValue(core, &set->lines[i]) < lrfuValue(core, &set->lines[victim])) {
+            victim = i;
+        }
+    }
+    return victim;
+}
+
+// Victim of a full set under one policy; the policy is a constant in every instantiation below
+static inline CacheLine* selectVictim(ReplacementPolicy policy, Core* core, CacheSet* set) {
+    switch (policy) {
+        case RANDOM:
+            return &set->lines[nextRandom(core) % cache_ways];
+        case FIFO:
+            return &set->lines[set->fifo_index++ % cache_ways];
+        case LRU:
+            return &set->lines[victimLRU(set)];
+        case SCA:
+            return &set->lines[victimSCA(set)];
+        case PLRU:
+            return &set->lines[victimPLRU(set)];
+        case SRRIP:
+        case BRRIP:
+        case DRRIP:
+            return &set->lines[victimRRIP(set)];
+        case LFU:
+            return &set->lines[victimLFU(set)];
+        case LRFU:
+            return &set->lines[victimLRFU(core, set)];
+        default:
+            return &set->lines[0]; // 기본 값
+    }
+}
+
+// Replacement state of a line on a hit (fill = 0) or after it was filled (fill = 1). Only the state the
+// policy reads is kept; LFU keeps the LRU stack too, to break ties.
+static inline void updatePolicy(ReplacementPolicy policy, Core* core, uint32_t set_index, CacheLine* line, int fill) {
+    CacheSet* set = &core->cache[set_index];
+
+    if (policy == LRU || policy == LFU) {
+        for (int i = 0; i < cache_ways; ++i) {
+            if (set->lines[i].age < line->age) {
+                set->lines[i].age++;
+            }
+        }
+        line->age = 0;
+    }
+    if (policy == SCA) {
+        line->second_chance = 1;
+    }
+    if (policy == PLRU) { // Tree-PLRU: point every node on the path away from this way
+        for (int node = (int)(line - set->lines) + cache_ways; node > 1; node /= 2) {
+            if (node & 1) {
+                set->plru_bits &= ~(1u << (node / 2));
+            } else {
+                set->plru_bits |= 1u << (node / 2);
+            }
+        }
+    }
+    if (policy == SRRIP || policy == BRRIP || policy == DRRIP) {
+        ReplacementPolicy rrip = policy == DRRIP ? drripPolicy(core, set_index) : policy;
+        if (!fill) {
+            line->rrpv = 0;
+        } else if (rrip == BRRIP) {
+            line->rrpv = nextRandom(core) % BRRIP_LONG_INSERT == 0 ? RRPV_MAX - 1 : RRPV_MAX;
+        } else {
+            line->rrpv = RRPV_MAX - 1;
+        }
+    }
+    if (policy == DRRIP && fill) { // A miss in a leader set votes against its policy
+        if (set_index % DUEL_PERIOD == 0 && core->psel < PSEL_MAX) {
+            core->psel++;
+        } else if (set_index % DUEL_PERIOD == 1 && core->psel > 0) {
+            core->psel--;
+        }
+    }
+    if (policy == LFU) {
+        line->frequency = fill ? 1 : line->frequency + 1;
+    }
+    if (policy == LRFU) {
+        line->crf = (fill ? 0 : lrfuValue(core, line)) + LRFU_UNIT;
+        line->last_access = core->access_clock;
+    }
+}
+
+#define DEFINE_REPLACEMENT(POLICY) \
+    static CacheLine* selectVictim_##POLICY(Core* core, uint32_t set_index) { \
+        return selectVictim(POLICY, core, &core->cache[set_index]); \
+    } \
+    static void updatePolicy_##POLICY(Core* core, uint32_t set_index, CacheLine* line, int fill) { \
+        updatePolicy(POLICY, core, set_index, line, fill); \
+    }
+
+#define REPLACEMENT_POLICIES(X) X(RANDOM) X(FIFO) X(LRU) X(SCA) X(PLRU) X(SRRIP) X(BRRIP) X(DRRIP) X(LFU) X(LRFU)
+
+REPLACEMENT_POLICIES(DEFINE_REPLACEMENT)
+
+void selectReplacement() {
+#define SELECT_REPLACEMENT(POLICY) \
+    if (replacement_policy == POLICY) { \
+        victim_select = selectVictim_##POLICY; \
+        replacement_update = updatePolicy_##POLICY; \
+    }
+    REPLACEMENT_POLICIES(SELECT_REPLACEMENT)
+#undef SELECT_REPLACEMENT
+}
+
+// Select cache line based on replacement policy
+CacheLine* selectCacheLine(Core* core, uint32_t set_index) {
+    CacheSet* set = &core->cache[set_index];
+
+    for (int i = 0; i < cache_ways; ++i) {
+        if (set->lines[i].state == INVALID) {
+            return &set->lines[i]; // Lines invalidated by other cores are reused first
+        }
+    }
+    return victim_select(core, set_index);
+}
+
+// Update replacement state of a line on a hit (fill = 0) or after it was filled (fill = 1)
+void updateReplacement(Core* core, uint32_t set_index, CacheLine* line, int fill) {
+    replacement_update(core, set_index, line, fill);
+}
+
+CacheLine* findCacheLine(CacheSet* set, uint32_t tag) {
+    for (int i = 0; i < cache_ways; i++) {
+        CacheLine* line = &set->lines[i];
+        if (line->state != INVALID && line->tag == tag) {
+            return line;
+        }
+    }
+    return NULL;
+}
+
+uint32_t lineAddress(uint32_t tag, uint32_t set_index) {
+    return (tag * set_count + set_index) * line_size;
+}
+
+// Address split and tag search. Common power-of-two geometries get their own instantiation
+// with shifts, masks and a constant way count; everything else takes the generic path.
+
+#define DEFINE_CACHE_LOOKUP(LINE_SHIFT, WAYS) \
+    static CacheLine* cacheLookup_##LINE_SHIFT##_##WAYS(CacheSet* sets, uint32_t address, CacheIndex* index) { \
+        index->offset = address & ((1u << LINE_SHIFT) - 1); \
+        index->set_index = (address >> LINE_SHIFT) & set_mask; \
+        index->tag = address >> (LINE_SHIFT + set_shift); \
+        CacheLine* lines = sets[index->set_index].lines; \
+        for (int i = 0; i < WAYS; ++i) { \
+            if (lines[i].state != INVALID && lines[i].tag == index->tag) { \
+                return &lines[i]; \
+            } \
+        } \
+        return NULL; \
+    }
+
+// (log2 line size, ways) pairs with a specialized lookup
+#define FAST_PATH_GEOMETRIES(X) \
+    X(5, 1) X(5, 2) X(5, 4) X(5, 8) X(5, 16) \
+    X(6, 1) X(6, 2) X(6, 4) X(6, 8) X(6, 16) \
+    X(7, 1) X(7, 2) X(7, 4) X(7, 8) X(7, 16)
+
+FAST_PATH_GEOMETRIES(DEFINE_CACHE_LOOKUP)
+
+// Power-of-two sets with any associativity: shifts and masks, runtime way count
+static CacheLine* cacheLookupPow2(CacheSet* sets, uint32_t address, CacheIndex* index) {
+    index->offset = address & (line_size - 1);
+    index->set_index = (address >> line_shift) & set_mask;
+    index->tag = address >> (line_shift + set_shift);
+    return findCacheLine(&sets[index->set_index], index->tag);
+}
+
+// Any set count: division and modulo
+static CacheLine* cacheLookupGeneric(CacheSet* sets, uint32_t address, CacheIndex* index) {
+    index->offset = address % line_size;
+    index->set_index = (address / line_size) % set_count;
+    index->tag = address / (line_size * set_count);
+    return findCacheLine(&sets[index->set_index], index->tag);
+}
+
+void selectCacheLookup() {
+    if (set_shift < 0) {
+        cache_lookup = cacheLookupGeneric;
+        cache_lookup_name = "generic";
+        return;
+    }
+#define SELECT_CACHE_LOOKUP(LINE_SHIFT, WAYS) \
+    if (line_shift == LINE_SHIFT && cache_ways == WAYS) { \
+        cache_lookup = cacheLookup_##LINE_SHIFT##_##WAYS; \
+        cache_lookup_name = "specialized"; \
+        return; \
+    }
+    FAST_PATH_GEOMETRIES(SELECT_CACHE_LOOKUP)
+#undef SELECT_CACHE_LOOKUP
+    cache_lookup = cacheLookupPow2;
+    cache_lookup_name = "power-of-two";
+}
+
+// Keep the line count of a hot line; called with the bus held
+void recordInvalidation(uint32_t line_address, int false_sharing) {
+    uint32_t index = (line_address / line_size) % SHARING_TABLE_SIZE;
+    for (int probe = 0; probe < SHARING_TABLE_SIZE; ++probe) {
+        SharingEntry* entry = &sharing_table[(index + probe) % SHARING_TABLE_SIZE];
+        if (!entry->used) {
+            entry->used = 1;
+            entry->line_address = line_address;
+        }
+        if (entry->line_address == line_address) {
+            entry->invalidations++;
+            entry->false_sharing += false_sharing;
+            return;
+        }
+    }
+}
+
+// Snoop the caches of all other cores; called with the bus held.
+// Returns the number of remote copies, and copies dirty data into supplied_data when another cache owns the line.
+int snoopBus(Core* requester, uint32_t set_index, uint32_t tag, BusOp op, uint32_t offset, uint8_t* supplied_data, int* supplied) {
+    PROF_SCOPE(PROF_SNOOP);
+    uint32_t line_address = lineAddress(tag, set_index);
+    int copies = 0;
+
+    switch (op) {
+        case BUS_RD: coherence.bus_reads++; break;
+        case BUS_RDX: coherence.bus_read_exclusives++; break;
+        case BUS_UPGR: coherence.bus_upgrades++; break;
+    }
+
+    for (int i = 0; i < num_cores; ++i) {
+        Core* other = &cores[i];
+        if (other == requester) {
+            continue;
+        }
+        pthread_mutex_lock(&other->cache_lock);
+        CacheLine* line = findCacheLine(&other->cache[set_index], tag);
+        if (line == NULL) {
+            line = findVictimLine(other, set_index, tag);
+        }
+        if (line != NULL) {
+            copies++;
+            if (line->state == MODIFIED || line->state == OWNED) {
+                if (supplied_data != NULL && !*supplied) {
+                    memcpy(supplied_data, line->data, line_size);
+                    *supplied = 1;
+                    coherence.cache_to_cache_transfers++;
+                }
+                // MESI flushes the dirty line on a read; so does anyone invalidated by a writer that takes no data
+                if ((op == BUS_RD && coherence_protocol == MESI) || (op != BUS_RD && supplied_data == NULL)) {
+                    for (int j = 0; j < line_size; j += 4) {
+                        memWrite(line_address + j, isaWordFromBytes(line->data + j));
+                    }
+                    dramWrite(line_address, requester->total_cycles);
+                    coherence.writebacks++;
+                }
+            }
+            if (op == BUS_RD) {
+                if (line->state == MODIFIED) {
+                    line->state = coherence_protocol == MOESI ? OWNED : SHARED;
+                } else if (line->state == EXCLUSIVE) {
+                    line->state = SHARED;
+                }
+            } else {
+                // The writer's word was never touched by this core: the line only moves because of false sharing
+                int false_sharing = line->word_mask != 0 && !(line->word_mask & (1u << (offset / 4)));
+                line->state = INVALID;
+                coherence.invalidations++;
+                coherence.false_sharing_invalidations += false_sharing;
+                recordInvalidation(line_address, false_sharing);
+                shadowInvalidate(&other->shadow, line_address);
+                if (other->ll_valid && other->ll_address == line_address) {
+                    other->ll_valid = 0; // Break the LL reservation
+                }
+            }
+        }
+        pthread_mutex_unlock(&other->cache_lock);
+    }
+    return copies;
+}
+
+// Cache access function
+int cacheAccess(Core* core, uint32_t address, uint8_t* data, int write) {
+    PROF_SCOPE(PROF_CACHE_ACCESS);
+    CacheIndex index;
+
+    if (functional_mode) { // No cache state and no timing, so a detailed copy can start with cold caches
+        if (write) {
+            memWrite(address, isaWordFromBytes(data));
+        } else {
+            isaWordToBytes(data, memAccess(address, 0, 0));
+        }
+        return 1;
+    }
+    if (trace_file != NULL) {
+        traceRecord(address, write);
+    }
+
+    // Hit with sufficient permission needs no bus transaction
+    pthread_mutex_lock(&core->cache_lock);
+    CacheLine* line = cache_lookup(core->cache, address, &index);
+    uint32_t tag = index.tag;
+    uint32_t set_index = index.set_index;
+    uint32_t offset = index.offset;
+    CacheSet* set = &core->cache[set_index];
+    core->access_clock++;
+    int invalidated = 0;
+    int shadow_hit = shadowAccess(&core->shadow, address - offset, &invalidated);
+    AccessStats* pc_stats = pcStats(core, core->pc);
+    core->set_stats[set_index].accesses++;
+    pc_stats->accesses++;
+    if (line != NULL && (!write || (write_policy == WRITE_BACK && (line->state == MODIFIED || line->state == EXCLUSIVE)))) {
+        if (write) {
+            memcpy(line->data + offset, data, 4); // Writing 4 bytes
+            line->state = MODIFIED;
+        } else {
+            memcpy(data, line->data + offset, 4); // Reading 4 bytes
+        }
+        updateReplacement(core, set_index, line, 0);
+        line->word_mask |= 1u << (offset / 4);
+        core->cache_hit_count++;
+        core->total_cycles += hit_latency; // Cache hit latency
+        pthread_mutex_unlock(&core->cache_lock);
+        return 1; // Cache hit
+    }
+    pthread_mutex_unlock(&core->cache_lock);
+
+    {
+        PROF_SCOPE(PROF_BUS_WAIT);
+        pthread_mutex_lock(&bus_lock);
+    }
+    pthread_mutex_lock(&core->cache_lock);
+    line = findCacheLine(set, tag); // Another core may have invalidated the line meanwhile
+
+    if (line != NULL) { // Write hit on a shared line (or write-through): gain ownership
+        int copies = snoopBus(core, set_index, tag, BUS_UPGR, offset, NULL, NULL);
+        memcpy(line->data + offset, data, 4);
+        if (write_policy == WRITE_BACK) {
+            line->state = MODIFIED;
+        } else {
+            memWrite(address, isaWordFromBytes(data));
+            writeBufferInsert(core, address - offset, 1u << (offset / 4));
+            line->state = EXCLUSIVE;
+        }
+        updateReplacement(core, set_index, line, 0);
+        line->word_mask |= 1u << (offset / 4);
+        core->cache_hit_count++;
+        core->total_cycles += hit_latency; // Cache hit latency
+        if (copies > 0) {
+            core->total_cycles += BUS_LATENCY; // Upgrade waits for the invalidations
+        }
+        pthread_mutex_unlock(&core->cache_lock);
+        pthread_mutex_unlock(&bus_lock);
+        return 1; // Cache hit
+    }
+
+    // Cache miss
+    PROF_SCOPE(PROF_MISS);
+    MissType miss_type = classifyMiss(core, address - offset, shadow_hit, invalidated);
+    core->miss_types[miss_type]++;
+    core->set_stats[set_index].misses++;
+    core->set_stats[set_index].miss_types[miss_type]++;
+    pc_stats->misses++;
+    pc_stats->miss_types[miss_type]++;
+    int latency;
+
+    if (write && !write_allocate && findVictimLine(core, set_index, tag) == NULL) {
+        // No-write-allocate: the store goes around the cache; other copies are dropped
+        snoopBus(core, set_index, tag, BUS_RDX, offset, NULL, NULL);
+        memWrite(address, isaWordFromBytes(data));
+        writeBufferInsert(core, address - offset, 1u << (offset / 4));
+        latency = 1; // Posted like a hit
+    } else {
+        CacheLine* victim_line = findVictimLine(core, set_index, tag);
+        line = selectCacheLine(core, set_index);
+        CacheLine evicted = *line;
+        if (evicted.state != INVALID && core->ll_valid &&
+            core->ll_address == lineAddress(evicted.tag, set_index)) {
+            core->ll_valid = 0; // Reserved line left the cache
+        }
+
+        int copies = 0;
+        if (victim_line != NULL) {
+            // Bring the requested line back into the chosen slot; the slot keeps its own replacement state,
+            // which the fill below updates. evictLine() puts the evicted line in a free or the LRU victim entry.
+            line->tag = victim_line->tag;
+            line->state = victim_line->state;
+            line->word_mask = victim_line->word_mask;
+            memcpy(line->data, victim_line->data, line_size);
+            victim_line->state = INVALID;
+            if (evicted.state != INVALID) {
+                evictLine(core, set_index, &evicted);
+            }
+            if (write && (line->state == SHARED || line->state == OWNED || write_policy == WRITE_THROUGH)) {
+                copies = snoopBus(core, set_index, tag, BUS_UPGR, offset, NULL, NULL);
+            } else if (!write) {
+                copies = line->state == SHARED || line->state == OWNED;
+            }
+            latency = VICTIM_LATENCY + (copies > 0 && write ? BUS_LATENCY : 0);
+            core->victim_hits++;
+        } else {
+            if (evicted.state != INVALID) {
+                evictLine(core, set_index, &evicted);
+            }
+
+            uint8_t supplied_data[MAX_LINE_SIZE];
+            int supplied = 0;
+            copies = snoopBus(core, set_index, tag, write ? BUS_RDX : BUS_RD, offset, supplied_data, &supplied);
+
+            line->tag = tag;
+            line->word_mask = 0;
+            latency = BUS_LATENCY;
+            if (supplied) {
+                memcpy(line->data, supplied_data, line_size);
+            } else {
+                uint32_t mem_address = lineAddress(tag, set_index);
+                for (int i = 0; i < line_size; i += 4) {
+                    isaWordToBytes(line->data + i, memAccess(mem_address + i, 0, 0));
+                }
+                latency = dramRead(mem_address, core->total_cycles);
+            }
+        }
+        updateReplacement(core, set_index, line, 1);
+        line->word_mask |= 1u << (offset / 4);
+
+        if (write) {
+            memcpy(line->data + offset, data, 4);
+            if (write_policy == WRITE_BACK) {
+                line->state = MODIFIED;
+            } else {
+                memWrite(address, isaWordFromBytes(data));
+                writeBufferInsert(core, address - offset, 1u << (offset / 4));
+                line->state = EXCLUSIVE;
+            }
+        } else {
+            memcpy(data, line->data + offset, 4);
+            if (victim_line == NULL) {
+                line->state = copies > 0 ? SHARED : EXCLUSIVE;
+            }
+        }
+    }
+
+    printf("Core %d: Cache miss: address=%08X, set_index=%d, tag=%d, type=%s\n", core->id, address, set_index, tag,
+           miss_type_names[miss_type]); // Cache miss debug output
+
+    core->cache_miss_count++;
+    core->total_cycles += latency; // Cache miss latency
+    core->miss_cycles += latency;
+    statsSample(miss_latency_stat, latency);
+    pthread_mutex_unlock(&core->cache_lock);
+    pthread_mutex_unlock(&bus_lock);
+    return 0; // Cache miss
+}
+
+CacheLine* findVictimLine(Core* core, uint32_t set_index, uint32_t tag) {
+    for (int i = 0; i < victim_entries; ++i) {
+        VictimEntry* entry = &core->victim_cache[i];
+        if (entry->line.state != INVALID && entry->set_index == set_index && entry->line.tag == tag) {
+            return &entry->line;
+        }
+    }
+    return NULL;
+}
+
+// Move a line leaving the cache into the victim cache, writing back whatever that displaces
+void evictLine(Core* core, uint32_t set_index, CacheLine* evicted) {
+    if (victim_entries == 0) {
+        writeBackLine(core, set_index, evicted);
+        return;
+    }
+    VictimEntry* slot = &core->victim_cache[0];
+    for (int i = 0; i < victim_entries; ++i) {
+        VictimEntry* entry = &core->victim_cache[i];
+        if (entry->line.state == INVALID) {
+            slot = entry;
+            break;
+        }
+        if (entry->last_use < slot->last_use) {
+            slot = entry;
+        }
+    }
+    if (slot->line.state != INVALID) {
+        writeBackLine(core, slot->set_index, &slot->line);
+    }
+    slot->line = *evicted;
+    slot->set_index = set_index;
+    slot->last_use = core->access_clock;
+}
+
+void writeBackLine(Core* core, uint32_t set_index, CacheLine* line) {
+    if (line->state != MODIFIED && line->state != OWNED) {
+        return;
+    }
+    uint32_t mem_address = lineAddress(line->tag, set_index);
+    for (int i = 0; i < line_size; i += 4) {
+        memWrite(mem_address + i, isaWordFromBytes(line->data + i));
+    }
+    writeBufferInsert(core, mem_address, full_line_mask);
+    coherence.writebacks++;
+}
+
+// Send the oldest write buffer entry to memory, starting at the given cycle
+void writeBufferRetire(Core* core, uint64_t start) {
+    WriteBufferEntry* entry = &core->write_buffer[0];
+    dramWrite(entry->line_address, start);
+    core->memory_write_transactions++;
+    core->memory_write_bytes += __builtin_popcount(entry->word_mask) * 4;
+    core->write_buffer_count--;
+    memmove(&core->write_buffer[0], &core->write_buffer[1], core->write_buffer_count * sizeof(WriteBufferEntry));
+    core->write_drain_ready_cycle = start + WRITE_DRAIN_CYCLES;
+}
+
+// Retire the entries that would have drained in the background by now
+void writeBufferDrainIdle(Core* core) {
+    if (drain_policy != DRAIN_WHEN_IDLE) {
+        return;
+    }
+    while (core->write_buffer_count > 0) {
+        uint64_t start = core->write_buffer[0].insert_cycle;
+        if (start < core->write_drain_ready_cycle) {
+            start = core->write_drain_ready_cycle;
+        }
+        if (start + WRITE_DRAIN_CYCLES > core->total_cycles) {
+            break;
+        }
+        writeBufferRetire(core, start);
+    }
+}
+
+// Queue a write to memory, merging it into a pending entry for the same line when possible
+void writeBufferInsert(Core* core, uint32_t line_address, uint32_t word_mask) {
+    core->write_buffer_inserts++;
+    writeBufferDrainIdle(core);
+
+    for (int i = 0; i < core->write_buffer_count; ++i) {
+        if (core->write_buffer[i].line_address == line_address) {
+            core->write_buffer[i].word_mask |= word_mask;
+            core->write_buffer_coalesced++;
+            return;
+        }
+    }
+
+    if (core->write_buffer_count == write_buffer_entries) {
+        // Full: the core waits until the oldest entry is in memory
+        uint64_t start = core->total_cycles > core->write_drain_ready_cycle ? core->total_cycles : core->write_drain_ready_cycle;
+        uint64_t stall = start + WRITE_DRAIN_CYCLES - core->total_cycles;
+        if (write_buffer_entries == 0) {
+            dramWrite(line_address, start);
+            core->memory_write_transactions++;
+            core->memory_write_bytes += __builtin_popcount(word_mask) * 4;
+            core->write_drain_ready_cycle = start + WRITE_DRAIN_CYCLES;
+        } else {
+            writeBufferRetire(core, start);
+        }
+        core->write_buffer_full_stalls++;
+        core->write_buffer_stall_cycles += stall;
+        core->total_cycles += stall;
+        if (write_buffer_entries == 0) {
+            return;
+        }
+    }
+
+    WriteBufferEntry* entry = &core->write_buffer[core->write_buffer_count++];
+    entry->line_address = line_address;
+    entry->word_mask = word_mask;
+    entry->insert_cycle = core->total_cycles;
+}
+
+void writeBufferFlush(Core* core) {
+    while (core->write_buffer_count > 0) {
+        uint64_t start = core->write_buffer[0].insert_cycle;
+        if (start < core->write_drain_ready_cycle) {
+            start = core->write_drain_ready_cycle;
+        }
+        writeBufferRetire(core, start);
+    }
+}
+
+void shadowInitialize(ShadowCache* shadow, int capacity) {
+    shadow->capacity = capacity;
+    shadow->bucket_count = capacity * 2;
+    shadow->entries = calloc(capacity, sizeof(ShadowEntry));
+    shadow->buckets = calloc(shadow->bucket_count, sizeof(int));
+    for (int i = 0; i < shadow->bucket_count; ++i) {
+        shadow->buckets[i] = -1;
+    }
+    shadow->head = -1;
+    shadow->tail = -1;
+    shadow->count = 0;
+}
+
+int shadowFind(ShadowCache* shadow, uint32_t line_address) {
+    int index = shadow->buckets[(line_address / line_size) % shadow->bucket_count];
+    while (index != -1 && shadow->entries[index].line_address != line_address) {
+        index = shadow->entries[index].hash_next;
+    }
+    return index;
+}
+
+// Reference a line in the shadow cache; returns 1 when a fully-associative cache would have hit
+int shadowAccess(ShadowCache* shadow, uint32_t line_address, int* invalidated) {
+    int index = shadowFind(shadow, line_address);
+    int hit = index != -1;
+    ShadowEntry* entry;
+
+    if (hit) {
+        entry = &shadow->entries[index];
+        *invalidated = entry->invalidated;
+        entry->invalidated = 0;
+        if (index == shadow->head) {
+            return 1;
+        }
+        shadowUnlink(shadow, index); // Before moving to the front
+    } else {
+        if (shadow->count < shadow->capacity) {
+            index = shadow->count++;
+        } else {
+            // Evict the least recently used line and drop it from its bucket
+            index = shadow->tail;
+            entry = &shadow->entries[index];
+            shadowUnlink(shadow, index);
+            int* link = &shadow->buckets[(entry->line_address / line_size) % shadow->bucket_count];
+            while (*link != index) {
+                link = &shadow->entries[*link].hash_next;
+            }
+            *link = entry->hash_next;
+        }
+        entry = &shadow->entries[index];
+        entry->line_address = line_address;
+        entry->invalidated = 0;
+        int* bucket = &shadow->buckets[(line_address / line_size) % shadow->bucket_count];
+        entry->hash_next = *bucket;
+        *bucket = index;
+        if (shadow->tail == -1) {
+            shadow->tail = index;
+        }
+    }
+
+    entry->prev = -1;
+    entry->next = shadow->head;
+    if (shadow->head != -1) {
+        shadow->entries[shadow->head].prev = index;
+    }
+    shadow->head = index;
+    return hit;
+}
+
+// Takes an entry out of the LRU list; the head and tail move when it sits at either end
+void shadowUnlink(ShadowCache* shadow, int index) {
+    ShadowEntry* entry = &shadow->entries[index];
+    if (entry->prev != -1) {
+        shadow->entries[entry->prev].next = entry->next;
+    } else {
+        shadow->head = entry->next;
+    }
+    if (entry->next != -1) {
+        shadow->entries[entry->next].prev = entry->prev;
+    } else {
+        shadow->tail = entry->prev;
+    }
+}
+
+// A snoop removed the line from the real cache, so the next miss on it is a coherence miss
+void shadowInvalidate(ShadowCache* shadow, uint32_t line_address) {
+    int index = shadowFind(shadow, line_address);
+    if (index != -1) {
+        shadow->entries[index].invalidated = 1;
+    }
+}
+
+// 3C (+ coherence) classification of a miss
+MissType classifyMiss(Core* core, uint32_t line_address, int shadow_hit, int invalidated) {
+    uint32_t line = line_address / line_size;
+    if (!(core->seen_lines[line / 8] & (1 << (line % 8)))) {
+        core->seen_lines[line / 8] |= 1 << (line % 8);
+        return MISS_COMPULSORY;
+    }
+    if (!shadow_hit) {
+        return MISS_CAPACITY;
+    }
+    return invalidated ? MISS_COHERENCE : MISS_CONFLICT;
+}
+
+AccessStats* pcStats(Core* core, uint32_t pc) {
+    static AccessStats overflow_stats[MAX_CORES];
+    uint32_t index = (pc / 4) % PC_TABLE_SIZE;
+    for (int probe = 0; probe < PC_TABLE_SIZE; ++probe) {
+        PcEntry* entry = &core->pc_table[(index + probe) % PC_TABLE_SIZE];
+        if (!entry->used) {
+            entry->used = 1;
+            entry->pc = pc;
+        }
+        if (entry->pc == pc) {
+            return &entry->stats;
+        }
+    }
+    core->pc_table_overflow++;
+    return &overflow_stats[core->id];
+}
+
+// Hot functions and blocks over all cores; collapsed stacks get one root frame per core
+void printGuestProfile() {
+    if (!guest_profile_enabled) {
+        return;
+    }
+    GuestProfile* profiles[MAX_CORES];
+    for (int i = 0; i < num_cores; ++i) {
+        profiles[i] = cores[i].profile;
+    }
+    guestprofPrint(stdout, profiles, num_cores);
+    if (guest_profile_prefix != NULL) {
+        guestprofWrite(profiles, num_cores, guest_profile_prefix);
+    }
+}
+
+// One character per set, darker for a higher miss rate
+void printHeatmap() {
+    const char* shades = " .:-=+*#%@";
+    int shade_count = (int)strlen(shades);
+
+    printf("Per-set miss rate heatmap (' ' = 0%%, '@' = 100%%):\n");
+    for (int i = 0; i < num_cores; ++i) {
+        printf("Core %d:\n", cores[i].id);
+        for (int row = 0; row < set_count; row += HEATMAP_WIDTH) {
+            printf("  %5d |", row);
+            for (int set = row; set < row + HEATMAP_WIDTH && set < set_count; ++set) {
+                AccessStats* stats = &cores[i].set_stats[set];
+                int shade = stats->accesses ? stats->misses * (shade_count - 1) / stats->accesses : 0;
+                if (stats->misses > 0 && shade == 0) {
+                    shade = 1; // Any miss at all stays visible
+                }
+                putchar(shades[shade]);
+            }
+            printf("|\n");
+        }
+    }
+}
+
+// Write per-set and per-PC statistics as CSV
+void exportMissStats(const char* prefix) {
+    char filename[256];
+
+    snprintf(filename, sizeof(filename), "%s_sets.csv", prefix);
+    FILE* file = fopen(filename, "w");
+    if (file == NULL) {
+        perror("Error opening file");
+        return;
+    }
+    fprintf(file, "core,set,accesses,misses,compulsory,capacity,conflict,coherence\n");
+    for (int i = 0; i < num_cores; ++i) {
+        for (int set = 0; set < set_count; ++set) {
+            AccessStats* stats = &cores[i].set_stats[set];
+            fprintf(file, "%d,%d,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 "\n", cores[i].id, set, stats->accesses, stats->misses,
+                    stats->miss_types[MISS_COMPULSORY], stats->miss_types[MISS_CAPACITY],
+                    stats->miss_types[MISS_CONFLICT], stats->miss_types[MISS_COHERENCE]);
+        }
+    }
+    fclose(file);
+
+    snprintf(filename, sizeof(filename), "%s_pcs.csv", prefix);
+    file = fopen(filename, "w");
+    if (file == NULL) {
+        perror("Error opening file");
+        return;
+    }
+    fprintf(file, "core,pc,accesses,misses,compulsory,capacity,conflict,coherence\n");
+    for (int i = 0; i < num_cores; ++i) {
+        for (int j = 0; j < PC_TABLE_SIZE; ++j) {
+            PcEntry* entry = &cores[i].pc_table[j];
+            if (!entry->used) {
+                continue;
+            }
+            fprintf(file, "%d,%08X,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 "\n", cores[i].id, entry->pc, entry->stats.accesses, entry->stats.misses,
+                    entry->stats.miss_types[MISS_COMPULSORY], entry->stats.miss_types[MISS_CAPACITY],
+                    entry->stats.miss_types[MISS_CONFLICT], entry->stats.miss_types[MISS_COHERENCE]);
+        }
+        if (cores[i].pc_table_overflow > 0) {
+            printf("Core %d: %" PRIu64 " accesses from PCs beyond the PC table were not exported\n", cores[i].id, cores[i].pc_table_overflow);
+        }
+    }
+    fclose(file);
+    printf("\nMiss statistics written to %s_sets.csv and %s_pcs.csv\n", prefix, prefix);
+}
+
+// Append one access to the -o trace; cores share the file
+void traceRecord(uint32_t address, int write) {
+    uint32_t record = (address & ~3u) | (write ? 1 : 0);
+    pthread_mutex_lock(&trace_lock);
+    fwrite(&record, sizeof(record), 1, trace_file);
+    pthread_mutex_unlock(&trace_lock);
+}
+
+// One trace record against cores[0]'s cache. Sets never interact, so any thread may replay a set
+// as long as it is the only one touching it and sees that set's records in trace order.
+static inline void replayAccess(Core* core, uint32_t record, uint64_t seq) {
+    uint32_t address = record & ~3u;
+    int write = record & 1;
+    CacheIndex index;
+    CacheLine* line = cache_lookup(core->cache, address, &index);
+    core->access_clock = seq; // Same clock as a serial replay, for LRFU decay
+    core->set_stats[index.set_index].accesses++;
+    if (write && write_policy == WRITE_THROUGH) {
+        core->memory_write_transactions++;
+    }
+    if (line != NULL) {
+        updateReplacement(core, index.set_index, line, 0);
+        if (write && write_policy == WRITE_BACK) {
+            line->state = MODIFIED;
+        }
+        core->cache_hit_count++;
+        return;
+    }
+
+    // The seen bitmap is shared too: a byte covers 8 consecutive lines, which land in one shard
+    uint32_t line_number = address / line_size;
+    if (!(core->seen_lines[line_number / 8] & (1 << (line_number % 8)))) {
+        core->seen_lines[line_number / 8] |= 1 << (line_number % 8);
+        core->miss_types[MISS_COMPULSORY]++;
+        core->set_stats[index.set_index].miss_types[MISS_COMPULSORY]++;
+    }
+    core->set_stats[index.set_index].misses++;
+    core->cache_miss_count++;
+    if (write && !write_allocate) {
+        if (write_policy == WRITE_BACK) {
+            core->memory_write_transactions++; // Goes around the cache
+        }
+        return;
+    }
+    line = selectCacheLine(core, index.set_index);
+    if (line->state == MODIFIED) {
+        core->memory_write_transactions++; // Dirty victim
+    }
+    line->tag = index.tag;
+    line->state = write && write_policy == WRITE_BACK ? MODIFIED : EXCLUSIVE;
+    updateReplacement(core, index.set_index, line, 1);
+}
+
+ReplayWorker replay[MAX_REPLAY_WORKERS];
+
+// Hand the filling batch to the worker and wait for the next slot to be free
+static void replayPublish(ReplayWorker* worker) {
+    __atomic_store_n(&worker->head, worker->head + 1, __ATOMIC_RELEASE);
+    if (worker->head - __atomic_load_n(&worker->tail, __ATOMIC_ACQUIRE) >= REPLAY_QUEUE_DEPTH) {
+        worker->full_waits++;
+        while (worker->head - __atomic_load_n(&worker->tail, __ATOMIC_ACQUIRE) >= REPLAY_QUEUE_DEPTH) {
+            sched_yield();
+        }
+    }
+    worker->batches[worker->head % REPLAY_QUEUE_DEPTH].count = 0;
+}
+
+void* replayThread(void* arg) {
+    ReplayWorker* worker = (ReplayWorker*)arg;
+    uint64_t tail = 0;
+    while (1) {
+        if (tail == __atomic_load_n(&worker->head, __ATOMIC_ACQUIRE)) {
+            if (__atomic_load_n(&worker->done, __ATOMIC_ACQUIRE) && tail == __atomic_load_n(&worker->head, __ATOMIC_ACQUIRE)) {
+                break;
+            }
+            sched_yield();
+            continue;
+        }
+        ReplayBatch* batch = &worker->batches[tail % REPLAY_QUEUE_DEPTH];
+        for (uint32_t i = 0; i < batch->count; ++i) {
+            replayAccess(&worker->core, batch->records[i].record, batch->records[i].seq);
+        }
+        __atomic_store_n(&worker->tail, ++tail, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+// Replay a -o trace. With more than one worker the reader deals records out by set shard in
+// batches; each worker owns whole shards, so the result is the serial one.
+void replayTrace(const char* filename) {
+    FILE* file = fopen(filename, "rb");
+    uint32_t* records = malloc(REPLAY_READ_RECORDS * sizeof(uint32_t));
+    if (file == NULL || records == NULL) {
+        perror("Error opening trace file");
+        exit(1);
+    }
+
+    int workers = host_workers;
+    if (workers > 1 && (replacement_policy == RANDOM || replacement_policy == BRRIP || replacement_policy == DRRIP)) {
+        printf("Replay: %s draws on state shared by all sets, replaying serially\n", replacement_policy_names[replacement_policy]);
+        workers = 1;
+    }
+    if (workers > 1 && set_count % REPLAY_SHARD_SETS != 0) {
+        printf("Replay: %d sets do not split into %d-set shards, replaying serially\n", set_count, REPLAY_SHARD_SETS);
+        workers = 1;
+    }
+    if (workers > set_count / REPLAY_SHARD_SETS && workers > 1) {
+        workers = set_count / REPLAY_SHARD_SETS; // A worker without a shard would only wait
+    }
+
+    pthread_t threads[MAX_REPLAY_WORKERS];
+    for (int i = 0; i < workers && workers > 1; ++i) {
+        replay[i].core = cores[0];
+        pthread_create(&threads[i], NULL, replayThread, &replay[i]);
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint64_t seq = 0;
+    uint64_t total = 0;
+    size_t count;
+    while ((count = fread(records, sizeof(uint32_t), REPLAY_READ_RECORDS, file)) > 0) {
+        for (size_t i = 0; i < count; ++i, ++seq) {
+            uint32_t record = records[i];
+            if (record >= MEMORY_SIZE) {
+                fprintf(stderr, "Trace record %" PRIu64 ": address %08X is outside memory\n", total + i, record & ~3u);
+                exit(1);
+            }
+            if (workers == 1) {
+                replayAccess(&cores[0], record, seq);
+                continue;
+            }
+            uint32_t set_index = set_shift >= 0 ? (record >> line_shift) & set_mask : (record / line_size) % set_count;
+            ReplayWorker* worker = &replay[(set_index / REPLAY_SHARD_SETS) % workers];
+            ReplayBatch* batch = &worker->batches[worker->head % REPLAY_QUEUE_DEPTH];
+            batch->records[batch->count].record = record;
+            batch->records[batch->count].seq = seq;
+            if (++batch->count == REPLAY_BATCH) {
+                replayPublish(worker);
+            }
+        }
+        total += count;
+    }
+    fclose(file);
+    free(records);
+
+    uint64_t batches = 0, full_waits = 0;
+    for (int i = 0; i < workers && workers > 1; ++i) {
+        if (replay[i].batches[replay[i].head % REPLAY_QUEUE_DEPTH].count > 0) {
+            __atomic_store_n(&replay[i].head, replay[i].head + 1, __ATOMIC_RELEASE); // Last partial batch
+        }
+        __atomic_store_n(&replay[i].done, 1, __ATOMIC_RELEASE);
+    }
+    for (int i = 0; i < workers && workers > 1; ++i) {
+        pthread_join(threads[i], NULL);
+        Core* core = &replay[i].core;
+        cores[0].cache_hit_count += core->cache_hit_count;
+        cores[0].cache_miss_count += core->cache_miss_count;
+        cores[0].miss_types[MISS_COMPULSORY] += core->miss_types[MISS_COMPULSORY];
+        cores[0].memory_write_transactions += core->memory_write_transactions;
+        batches += replay[i].head;
+        full_waits += replay[i].full_waits;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    Core* core = &cores[0];
+    printf("\n******************* Replay ********************\n");
+    printf("Trace: %s, %" PRIu64 " accesses\n", filename, total);
+    printf("Cache: %d bytes, %d-byte lines, %d ways, %d sets (%s lookup)\n", cache_size, line_size, cache_ways, set_count,
+           cache_lookup_name);
+    printf("Replacement policy: %s, %s, %s\n", replacement_policy_names[replacement_policy],
+           write_policy == WRITE_BACK ? "write-back" : "write-through", write_allocate ? "write-allocate" : "no-write-allocate");
+    printf("Cache hits: %" PRIu64 ", misses: %" PRIu64 " (%.4f%%)\n", core->cache_hit_count, core->cache_miss_count,
+           total ? 100.0 * core->cache_miss_count / total : 0.0);
+    printf("Compulsory misses: %" PRIu64 ", other misses: %" PRIu64 "\n", core->miss_types[MISS_COMPULSORY],
+           core->cache_miss_count - core->miss_types[MISS_COMPULSORY]);
+    printf("Memory writes: %" PRIu64 "\n", core->memory_write_transactions);
+    if (workers > 1) {
+        printf("Replay workers: %d (%d-set shards), %" PRIu64 " batches, reader waited on a full queue %" PRIu64 " times\n",
+               workers, REPLAY_SHARD_SETS, batches, full_waits);
+    } else {
+        printf("Replay workers: 1\n");
+    }
+    printf("Host time: %.3f s (%.1f M accesses/s)\n", seconds, seconds > 0 ? total / seconds / 1e6 : 0.0);
+    if (export_prefix != NULL) {
+        exportMissStats(export_prefix);
+    }
+}
+
+IntervalJob interval_jobs[MAX_REPLAY_WORKERS];
+int interval_running = 0;
+IntervalStats* interval_results = NULL;
+int interval_count = 0, interval_capacity = 0;
+IntervalStats interval_reference_stats = { .id = -2 }; // -2 until the reference reports
+
+// Body of a forked copy: warm up, measure, report through the pipe and leave without flushing anything
+void intervalChild(int id, uint64_t warmup, uint64_t length, int fd) {
+    Core* core = &cores[0];
+    functional_mode = 0;
+    syscallDetach(&syscalls);
+    for (uint64_t i = 0; i < warmup && isRunning(core); ++i) {
+        stepCore(core);
+    }
+    IntervalStats stats = { id, core->instruction_count, core->instruction_count, core->total_cycles,
+                            core->cache_hit_count, core->cache_miss_count, core->miss_cycles };
+    for (uint64_t i = 0; i < length && isRunning(core); ++i) {
+        stepCore(core);
+    }
+    stats.instructions = core->instruction_count - stats.instructions;
+    stats.cycles = core->total_cycles - stats.cycles;
+    stats.hits = core->cache_hit_count - stats.hits;
+    stats.misses = core->cache_miss_count - stats.misses;
+    stats.miss_cycles = core->miss_cycles - stats.miss_cycles;
+    _exit(write(fd, &stats, sizeof(stats)) == sizeof(stats) ? 0 : 1);
+}
+
+// Wait for any interval process and keep what it sent
+void intervalCollect() {
+    int status;
+    pid_t pid = wait(&status);
+    int slot = 0;
+    while (slot < interval_running && interval_jobs[slot].pid != pid) {
+        ++slot;
+    }
+    if (pid < 0 || slot == interval_running) {
+        return;
+    }
+    IntervalStats stats;
+    ssize_t size = read(interval_jobs[slot].fd, &stats, sizeof(stats));
+    close(interval_jobs[slot].fd);
+    interval_jobs[slot] = interval_jobs[--interval_running];
+    if (size != sizeof(stats)) {
+        fprintf(stderr, "Interval process %d died without a result\n", (int)pid);
+        exit(1);
+    }
+    if (stats.id < 0) {
+        interval_reference_stats = stats;
+        return;
+    }
+    if (interval_count == interval_capacity) {
+        interval_capacity = interval_capacity ? interval_capacity * 2 : 64;
+        interval_results = realloc(interval_results, interval_capacity * sizeof(IntervalStats));
+        if (interval_results == NULL) {
+            fprintf(stderr, "Out of memory for interval results\n");
+            exit(1);
+        }
+    }
+    interval_results[interval_count++] = stats;
+}
+
+// Checkpoint the functional state by forking; the copy simulates from here in detail
+void intervalLaunch(int id, uint64_t warmup, uint64_t length) {
+    while (interval_running >= host_workers) {
+        intervalCollect();
+    }
+    int fds[2];
+    if (pipe(fds) != 0) {
+        perror("Error creating a pipe");
+        exit(1);
+    }
+    fflush(NULL); // Nothing buffered may be written twice
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("Error forking an interval");
+        exit(1);
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        intervalChild(id, warmup, length, fds[1]);
+    }
+    close(fds[1]);
+    interval_jobs[interval_running].pid = pid;
+    interval_jobs[interval_running].fd = fds[0];
+    interval_running++;
+}
+
+static int intervalCompare(const void* a, const void* b) {
+    return ((const IntervalStats*)a)->id - ((const IntervalStats*)b)->id;
+}
+
+static double relativeError(double value, double reference) {
+    return reference != 0 ? 100.0 * (value - reference) / reference : 0.0;
+}
+
+// Two-phase run of core 0: a functional pass forks a detailed copy at the start of every interval's
+// warm-up, and the measured parts are summed into whole-program statistics. With -F only the listed
+// intervals are forked, and their per-instruction rates are weighted and scaled to the whole program. Processes rather than
+// threads, because memory, DRAM and bus state are globals; fork() makes each checkpoint copy-on-write.
+void intervalRun() {
+    if (num_cores != 1) {
+        fprintf(stderr, "Interval simulation runs a single core\n");
+        exit(1);
+    }
+    Core* core = &cores[0];
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // Debug output of the detailed copies goes to /dev/null; the guest keeps the real stdout
+    fflush(stdout);
+    int guest_fd = dup(1);
+    int null_fd = open("/dev/null", O_WRONLY);
+    FILE* guest_out = fdopen(guest_fd, "w");
+    if (guest_fd < 0 || null_fd < 0 || guest_out == NULL) {
+        perror("Error redirecting output");
+        exit(1);
+    }
+    syscalls.files[1].stream = guest_out;
+    dup2(null_fd, 1);
+    close(null_fd);
+
+    if (interval_reference) {
+        intervalLaunch(-1, 0, UINT64_MAX);
+    }
+    functional_mode = 1;
+    int next = 0; // Interval, or entry of simpoint_set, to fork next
+    while (isRunning(core)) {
+        int interval = simpoint_set.count == 0 ? next : next < simpoint_set.count ? simpoint_set.points[next].interval : -1;
+        uint64_t interval_start = (uint64_t)interval * interval_length;
+        uint64_t fork_at = interval_start > interval_warmup ? interval_start - interval_warmup : 0;
+        if (interval >= 0 && core->instruction_count >= fork_at) {
+            // Only sparse points can find their fork point passed; their warm-up starts here instead
+            intervalLaunch(interval, interval_start - core->instruction_count, interval_length);
+            next++;
+            continue; // With a warm-up longer than an interval, later intervals may fork here too
+        }
+        functionalStep(core);
+    }
+    uint64_t functional_instructions = core->instruction_count;
+    while (interval_running > 0) {
+        intervalCollect();
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    fflush(guest_out);
+    fflush(stdout);
+    dup2(guest_fd, 1);
+    fclose(guest_out);
+    syscalls.files[1].stream = stdout;
+    syscallFinish(&syscalls);
+
+    qsort(interval_results, interval_count, sizeof(IntervalStats), intervalCompare);
+    IntervalStats total = {0};
+    printf("\n******************* Intervals ********************\n");
+    printf("Functional pass: %" PRIu64 " instructions, %d intervals of %" PRIu64 " with %" PRIu64 " warm-up, %d processes\n",
+           functional_instructions, interval_count, interval_length, interval_warmup, host_workers);
+    if (simpoint_set.count > 0 && simpoint_set.instructions != functional_instructions) {
+        fprintf(stderr, "Warning: the simpoints were profiled over %" PRIu64 " instructions, this run has %" PRIu64 "\n",
+                simpoint_set.instructions, functional_instructions);
+    }
+    printf("Interval  First instruction  Instructions  Cycles  CPI  Hits/Misses  AMAT%s\n", simpoint_set.count ? "  Weight" : "");
+    double estimate[4] = {0}; // Weighted per-instruction rates of cycles, hits, misses and miss cycles
+    double weight_total = 0.0; // Of the points that ran, to renormalize over
+    int measured = 0;
+    for (int i = 0; i < interval_count; ++i) {
+        IntervalStats* stats = &interval_results[i];
+        uint64_t accesses = stats->hits + stats->misses;
+        printf("%8d  %17" PRIu64 "  %12" PRIu64 "  %6" PRIu64 "  %.3f  %" PRIu64 "/%" PRIu64 "  %.3f", stats->id, stats->start,
+               stats->instructions, stats->cycles, stats->instructions ? (double)stats->cycles / stats->instructions : 0.0,
+               stats->hits, stats->misses, accesses ? hit_latency + (double)stats->miss_cycles / accesses : 0.0);
+        if (simpoint_set.count > 0) {
+            double weight = 0.0;
+            for (int p = 0; p < simpoint_set.count; ++p) {
+                if (simpoint_set.points[p].interval == stats->id) {
+                    weight = simpoint_set.points[p].weight;
+                }
+            }
+            printf("  %.4f", weight);
+            if (stats->instructions > 0) {
+                weight_total += weight;
+                measured++;
+                estimate[0] += weight * stats->cycles / stats->instructions;
+                estimate[1] += weight * stats->hits / stats->instructions;
+                estimate[2] += weight * stats->misses / stats->instructions;
+                estimate[3] += weight * stats->miss_cycles / stats->instructions;
+            }
+        }
+        printf("\n");
+        total.instructions += stats->instructions;
+        total.cycles += stats->cycles;
+        total.hits += stats->hits;
+        total.misses += stats->misses;
+        total.miss_cycles += stats->miss_cycles;
+    }
+    if (simpoint_set.count > 0) { // Scale the weighted rates to the whole program
+        if (measured < simpoint_set.count) {
+            fprintf(stderr, "Warning: %d of %d simpoints lie past the end of the program; weighting the rest\n",
+                    simpoint_set.count - measured, simpoint_set.count);
+        }
+        for (int i = 0; i < 4 && weight_total > 0; ++i) {
+            estimate[i] /= weight_total;
+        }
+        total.instructions = functional_instructions;
+        total.cycles = (uint64_t)(estimate[0] * functional_instructions + 0.5);
+        total.hits = (uint64_t)(estimate[1] * functional_instructions + 0.5);
+        total.misses = (uint64_t)(estimate[2] * functional_instructions + 0.5);
+        total.miss_cycles = (uint64_t)(estimate[3] * functional_instructions + 0.5);
+    }
+
+    IntervalStats* summary[2] = { &total, &interval_reference_stats };
+    const char* names[2] = { simpoint_set.count ? "Weighted" : "Merged", "Reference" };
+    double cpi[2], miss_rate[2], amat[2];
+    for (int i = 0; i < (interval_reference ? 2 : 1); ++i) {
+        IntervalStats* stats = summary[i];
+        uint64_t accesses = stats->hits + stats->misses;
+        cpi[i] = stats->instructions ? (double)stats->cycles / stats->instructions : 0.0;
+        miss_rate[i] = accesses ? (double)stats->misses / accesses : 0.0;
+        amat[i] = accesses ? hit_latency + (double)stats->miss_cycles / accesses : 0.0;
+        printf("%s: %" PRIu64 " instructions, %" PRIu64 " cycles, CPI %.4f, cache hit/miss %" PRIu64 "/%" PRIu64
+               " (miss rate %.4f%%), AMAT %.3f cycles\n", names[i], stats->instructions, stats->cycles, cpi[i], stats->hits,
+               stats->misses, 100.0 * miss_rate[i], amat[i]);
+    }
+    if (interval_reference) {
+        printf("Error against the reference: CPI %+.2f%%, miss rate %+.2f%%, AMAT %+.2f%%\n", relativeError(cpi[0], cpi[1]),
+               relativeError(miss_rate[0], miss_rate[1]), relativeError(amat[0], amat[1]));
+    }
+    printf("Host time: %.3f s\n", (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+}
+
+uint32_t fetch(Core* core) {
+    PROF_SCOPE(PROF_FETCH);
+    uint8_t data[4];
+    cacheAccess(core, translate(core, core->pc, 1), data, 0);
+    core->instruction = isaWordFromBytes(data);
+    printf("Core %d: Fetched instruction at PC: %08X, Instruction: %08X\n", core->id, core->pc, core->instruction); // Debug output
+    core->total_cycles++;
+    return core->instruction;
+}
+
+void decode(Core* core, uint32_t instruction) {
+    uint32_t opcode = instruction >> 26;
+    PROF_OPCODE(opcode);
+    printf("Core %d: Decoding instruction at PC: %08X, Instruction: %08X, opcode: %02X\n", core->id, core->pc, instruction, opcode); // Debug output
+    IsaDecoded d = isaDecode(instruction);
+    execute(core, &d);
+}
+
+void writeBack(Core* core, uint32_t rd, uint32_t value) {
+    if (rd != 0) { // Register 0 is always 0
+        core->reg[rd] = value;  // Write the value to the specified register
+    }
+}
+
+uint32_t memAccess(uint32_t address, uint32_t value, int write) {
+    if (address < MEMORY_SIZE) {
+        if (address % 4 == 0) { // Ensure word alignment
+            if (write) {
+                memWrite(address, value);
+            } else {
+                return isaWordFromBytes(&memory[address]);
+            }
+        } else {
+            printf("Memory access error: Address is not word-aligned\n");
+        }
+    } else {
+        printf("Memory access error: Address out of bounds\n");
+    }
+    return 0;
+}
+
+void memWrite(uint32_t address, uint32_t value) {
+    PROF_SCOPE(PROF_MEM_WRITE);
+    if (address < MEMORY_SIZE) {
+        // Check if the address is a multiple of 4 (word-aligned)
+        if (address % 4 == 0) {
+            isaWordToBytes(&memory[address], value);
+        } else {
+            printf("Memory write error: Address is not word-aligned\n");
+        }
+    } else {
+        printf("Memory write error: Address out of bounds\n");
+    }
+}
+
+// One handler per instruction class; the ISA table supplies operands, ALU semantics and counters.
+// Control transfers set next_pc, everything else falls through to pc + 4.
+void execute(Core* core, const IsaDecoded* d) {
+    PROF_SCOPE(PROF_EXECUTE);
+    static void* const handlers[ISA_CLASS_COUNT] = { ISA_CLASS_LIST(ISA_CLASS_HANDLER) };
+    uint32_t* reg = core->reg;
+    uint32_t rs_value = reg[d->rs], rt_value = reg[d->rt];
+    uint32_t mem_address = rs_value + d->immediate;
+    uint32_t next_pc = core->pc + 4;
+    uint32_t value;
+
+    printf("Core %d: Executing instruction at PC: %08X, Instruction: %08X\n", core->id, core->pc, d->instruction); // Debug output
+
+    switch (isa_info[d->op].counter) {
+        case ISA_COUNT_REGISTER: core->register_operation_count++; break;
+        case ISA_COUNT_MEMORY: core->memory_access_count++; break;
+        case ISA_COUNT_BRANCH: core->branch_total_count++; break; // 전체 분기 수 증가
+        default: break;
+    }
+    goto *handlers[d->cls];
+
+class_INVALID:
+    printf("Unsupported instruction: %08X\n", d->instruction);
+    goto done;
+class_ALU:
+    writeBack(core, d->dest, isaAluResult(d, rs_value, rt_value));
+    goto done;
+class_HILO: // mfhi, mflo
+    writeBack(core, d->dest, isaAlu(isa_info[d->op].alu, core->arith.hi, core->arith.lo));
+    goto done;
+class_MULDIV:
+    arithMulDiv(&core->arith, d->funct, rs_value, rt_value);
+    goto done;
+class_BRANCH:
+    if (isaAluResult(d, rs_value, rt_value)) {
+        const char* name = d->op == ISA_BEQ ? "BEQ" : "BNE";
+        printf("Executing %s, PC before: %08X, %s to: %08X\n", name, core->pc, name, core->pc + (d->immediate << 2)); // Debug output
+        next_pc = isaBranchTarget(d, core->pc);
+        core->branch_taken_count++;
+    }
+    goto done;
+class_BRANCH_FP: // bc1f, bc1t
+    if (arithCondition(&core->arith, d->rt >> 2) == (int)(d->rt & 1)) {
+        next_pc = isaBranchTarget(d, core->pc);
+        core->branch_taken_count++;
+    }
+    goto done;
+class_JUMP: {
+    const char* name = d->op == ISA_JAL ? "JAL" : "J";
+    next_pc = isaJumpTarget(d, core->pc);
+    printf("Executing %s, PC before: %08X, %s to: %08X\n", name, core->pc, name, next_pc); // Debug output
+    writeBack(core, d->dest, core->pc + 4); // jal links
+    goto done;
+}
+class_JUMP_REG:
+    printf("Executing JR, PC before: %08X, JR to: %08X\n", core->pc, rs_value); // Debug output
+    next_pc = rs_value;
+    goto done;
+class_LOAD:
+class_LOAD_LINKED:
+    if (mem_address % 4 == 0 && mem_address < MEMORY_SIZE) {
+        uint8_t data[4];
+        uint32_t physical_address = isLocalAddress(mem_address) ? mem_address : translate(core, mem_address, 0);
+        if (d->cls == ISA_CLASS_LOAD_LINKED) {
+            // Reserve the line and load it without letting another core in between
+            pthread_mutex_lock(&bus_lock);
+            core->ll_address = physical_address - physical_address % line_size;
+            core->ll_valid = 1;
+            dataAccess(core, physical_address, data, 0);
+            pthread_mutex_unlock(&bus_lock);
+        } else {
+            dataAccess(core, physical_address, data, 0);
+        }
+        value = isaWordFromBytes(data);
+        writeBack(core, d->dest, value);
+        printf("Loaded value to v0: %d\n", reg[d->rt]); // Debugging output
+    } else {
+        printf("Memory access error: Address is not word-aligned or out of bounds\n");
+    }
+    goto done;
+class_STORE:
+class_STORE_CONDITIONAL:
+    if (mem_address % 4 == 0 && mem_address < MEMORY_SIZE) {
+        uint8_t data_sw[4];
+        isaWordToBytes(data_sw, rt_value);
+        uint32_t physical_address = isLocalAddress(mem_address) ? mem_address : translate(core, mem_address, 0);
+        if (d->cls == ISA_CLASS_STORE_CONDITIONAL) {
+            // Check the reservation and store without letting another core in between
+            pthread_mutex_lock(&bus_lock);
+            int success = core->ll_valid && core->ll_address == physical_address - physical_address % line_size;
+            if (success) {
+                dataAccess(core, physical_address, data_sw, 1);
+                coherence.sc_success++;
+            } else {
+                coherence.sc_failure++;
+            }
+            core->ll_valid = 0;
+            pthread_mutex_unlock(&bus_lock);
+            writeBack(core, d->dest, success);
+        } else {
+            dataAccess(core, physical_address, data_sw, 1);
+        }
+        printf("Stored value from v0: %d\n", reg[d->rt]); // Debugging output
+    } else {
+        printf("Memory access error: Address is not word-aligned or out of bounds\n");
+    }
+    goto done;
+class_FP_LOAD:
+class_FP_STORE: {
+    int write = d->cls == ISA_CLASS_FP_STORE;
+    if (isa_info[d->op].operands & ISA_DOUBLE) {
+        // Big-endian: the high word, held in the odd register, comes first
+        fpMemAccess(core, mem_address, &core->arith.fpr[(d->rt & ~1u) + 1], write);
+        fpMemAccess(core, mem_address + 4, &core->arith.fpr[d->rt & ~1u], write);
+    } else {
+        fpMemAccess(core, mem_address, &core->arith.fpr[d->rt], write);
+    }
+    goto done;
+}
+class_COP1: {
+    int handled = arithCop1(&core->arith, d->instruction, rt_value, &value);
+    if (handled == 2) {
+        writeBack(core, d->dest, value); // mfc1, cfc1
+    } else if (!handled) {
+        printf("Unsupported COP1 instruction: %08X\n", d->instruction);
+    }
+    goto done;
+}
+class_SYSCALL:
+    pthread_mutex_lock(&syscall_lock);
+    if (syscallHandle(&syscalls, reg, &core->arith, core, core->total_cycles)) {
+        next_pc = 0xFFFFFFFF; // Exit sentinel
+    }
+    pthread_mutex_unlock(&syscall_lock);
+    goto done;
+
+done:
+    core->pc = next_pc;
+    ArithUnit unit = isaUnit(d);
+    if (unit != UNIT_NONE) {
+        // Cores execute one instruction at a time, so the whole unit latency is exposed
+        core->unit_ops[unit]++;
+        core->total_cycles += arith_units[unit].latency - 1;
+    }
+}
+
+// One word of an FP load or store, same byte order and memory path as LW/SW
+int fpMemAccess(Core* core, uint32_t address, uint32_t* value, int write) {
+    if (address % 4 != 0 || address >= MEMORY_SIZE) {
+        printf("Memory access error: Address is not word-aligned or out of bounds\n");
+        return 0;
+    }
+    uint8_t data[4];
+    isaWordToBytes(data, *value);
+    uint32_t physical_address = isLocalAddress(address) ? address : translate(core, address, 0);
+    dataAccess(core, physical_address, data, write);
+    if (!write) {
+        *value = isaWordFromBytes(data);
+    }
+    return 1;
+}
+
+
+// Split an address into DRAM coordinates according to the address mapping
+DramAddress dramMapAddress(uint32_t address) {
+    DramAddress result;
+    if (address_mapping == MAP_PAGE_INTERLEAVED) {
+        // row : rank : bank : channel : column - a whole row stays in one bank
+        uint32_t rest = address / DRAM_ROW_SIZE;
+        result.channel = rest % DRAM_CHANNELS;
+        rest /= DRAM_CHANNELS;
+        result.bank = rest % DRAM_BANKS;
+        rest /= DRAM_BANKS;
+        result.rank = rest % DRAM_RANKS;
+        result.row = rest / DRAM_RANKS;
+    } else {
+        // row : column : rank : bank : channel - consecutive lines spread over channels and banks
+        uint32_t rest = address / line_size;
+        result.channel = rest % DRAM_CHANNELS;
+        rest /= DRAM_CHANNELS;
+        result.bank = rest % DRAM_BANKS;
+        rest /= DRAM_BANKS;
+        result.rank = rest % DRAM_RANKS;
+        rest /= DRAM_RANKS;
+        result.row = rest / (DRAM_ROW_SIZE / line_size);
+    }
+    return result;
+}
+
+int dramIsRowHit(DramRequest* request) {
+    DramAddress target = dramMapAddress(request->address);
+    DramBank* bank = &dram[target.channel].banks[target.rank][target.bank];
+    return bank->row_open && bank->open_row == target.row;
+}
+
+// Issue one request to its bank and return the cycle its data transfer completes
+uint64_t dramIssue(DramRequest* request, uint64_t now) {
+    DramAddress target = dramMapAddress(request->address);
+    DramChannel* channel = &dram[target.channel];
+    DramBank* bank = &channel->banks[target.rank][target.bank];
+    uint64_t start = now > bank->ready_cycle ? now : bank->ready_cycle;
+    uint64_t column_cycle;
+
+    if (bank->row_open && bank->open_row == target.row) { // Row buffer hit
+        column_cycle = start;
+        dram_stats.row_hits++;
+    } else if (bank->row_open) { // Row buffer conflict: precharge the open row first
+        uint64_t precharge_cycle = bank->activate_cycle + dram_tras;
+        if (precharge_cycle < start) {
+            precharge_cycle = start;
+        }
+        bank->activate_cycle = precharge_cycle + dram_trp;
+        column_cycle = bank->activate_cycle + dram_trcd;
+        dram_stats.row_conflicts++;
+    } else { // Bank precharged
+        bank->activate_cycle = start;
+        column_cycle = start + dram_trcd;
+        dram_stats.row_empty++;
+    }
+
+    uint64_t data_cycle = column_cycle + dram_tcl;
+    if (data_cycle < channel->bus_ready_cycle) {
+        data_cycle = channel->bus_ready_cycle;
+    }
+    uint64_t done_cycle = data_cycle + dram_tburst;
+    channel->bus_ready_cycle = done_cycle;
+
+    if (page_policy == OPEN_PAGE) {
+        bank->row_open = 1;
+        bank->open_row = target.row;
+        bank->ready_cycle = column_cycle + dram_tburst;
+    } else { // Auto-precharge once the access is done and tRAS is met
+        uint64_t precharge_cycle = bank->activate_cycle + dram_tras;
+        if (precharge_cycle < done_cycle) {
+            precharge_cycle = done_cycle;
+        }
+        bank->row_open = 0;
+        bank->ready_cycle = precharge_cycle + dram_trp;
+    }
+    return done_cycle;
+}
+
+// FR-FCFS: pick the oldest row-hit request, otherwise the oldest request.
+// Writes are only picked on a row hit unless the write queue is being drained.
+int dramSchedule(int drain_writes) {
+    int oldest = -1;
+    for (int i = 0; i < dram_queue_count; ++i) {
+        DramRequest* request = &dram_queue[i];
+        int row_hit = dramIsRowHit(request);
+        if (request->write && !drain_writes && !row_hit) {
+            continue;
+        }
+        if (row_hit) {
+            return i;
+        }
+        if (oldest == -1) {
+            oldest = i;
+        }
+    }
+    return oldest;
+}
+
+// Service a line read, scheduling queued requests ahead of it as FR-FCFS allows; returns the read latency
+int dramRead(uint32_t address, uint64_t now) {
+    PROF_SCOPE(PROF_DRAM);
+    dram_queue[dram_queue_count++] = (DramRequest){ address, 0 };
+    dram_stats.reads++;
+
+    while (1) {
+        int index = dramSchedule(dram_write_count >= DRAM_WRITE_HIGH_WATERMARK);
+        DramRequest request = dram_queue[index];
+        memmove(&dram_queue[index], &dram_queue[index + 1], (dram_queue_count - index - 1) * sizeof(DramRequest));
+        dram_queue_count--;
+        uint64_t done_cycle = dramIssue(&request, now);
+        if (request.write) {
+            dram_write_count--;
+            continue;
+        }
+        int latency = done_cycle - now + dram_controller_latency;
+        dram_stats.read_latency_total += latency;
+        return latency;
+    }
+}
+
+// Post a write; the core does not wait, but the write occupies its bank and channel
+void dramWrite(uint32_t address, uint64_t now) {
+    PROF_SCOPE(PROF_DRAM);
+    dram_queue[dram_queue_count++] = (DramRequest){ address, 1 };
+    dram_write_count++;
+    dram_stats.writes++;
+
+    if (dram_write_count >= DRAM_WRITE_HIGH_WATERMARK || dram_queue_count == DRAM_QUEUE_SIZE) {
+        dram_stats.write_drains++;
+        while (dram_write_count > 0) {
+            int index = dramSchedule(1);
+            DramRequest request = dram_queue[index];
+            memmove(&dram_queue[index], &dram_queue[index + 1], (dram_queue_count - index - 1) * sizeof(DramRequest));
+            dram_queue_count--;
+            dram_write_count--;
+            dramIssue(&request, now);
+        }
+    }
+}
+
+void tlbInitialize(Tlb* tlb, int size) {
+    tlb->entries = calloc(size, sizeof(TlbEntry));
+    tlb->size = size;
+    tlb->accesses = 0;
+    tlb->misses = 0;
+}
+
+TlbEntry* tlbLookup(Tlb* tlb, uint32_t address, uint64_t clock) {
+    tlb->accesses++;
+    for (int i = 0; i < tlb->size; ++i) {
+        TlbEntry* entry = &tlb->entries[i];
+        if (entry->valid && (address >> entry->page_shift) == entry->vpn) {
+            entry->last_use = clock;
+            return entry;
+        }
+    }
+    tlb->misses++;
+    return NULL;
+}
+
+TlbEntry* tlbInsert(Tlb* tlb, uint32_t vpn, uint32_t pfn, int shift, uint64_t clock) {
+    TlbEntry* victim = &tlb->entries[0];
+    for (int i = 0; i < tlb->size; ++i) {
+        if (!tlb->entries[i].valid) {
+            victim = &tlb->entries[i];
+            break;
+        }
+        if (tlb->entries[i].last_use < victim->last_use) {
+            victim = &tlb->entries[i];
+        }
+    }
+    victim->vpn = vpn;
+    victim->pfn = pfn;
+    victim->page_shift = shift;
+    victim->valid = 1;
+    victim->last_use = clock;
+    return victim;
+}
+
+// Virtual to physical translation through L1 TLB, L2 TLB and the page walker
+uint32_t translate(Core* core, uint32_t address, int instruction) {
+    if (vm_mode == VM_OFF) {
+        return address;
+    }
+    PROF_SCOPE(PROF_TRANSLATE);
+    Tlb* l1_tlb = instruction ? &core->itlb : &core->dtlb;
+    core->tlb_clock++;
+    if (vm_mode == VM_PIPT) {
+        core->total_cycles += L1_TLB_LATENCY; // VIPT overlaps the L1 TLB with the cache lookup
+    }
+
+    TlbEntry* entry = tlbLookup(l1_tlb, address, core->tlb_clock);
+    if (entry == NULL) {
+        core->total_cycles += l2_tlb_latency;
+        TlbEntry* l2_entry = tlbLookup(&core->l2_tlb, address, core->tlb_clock);
+        uint32_t pfn;
+        int shift;
+        if (l2_entry != NULL) {
+            pfn = l2_entry->pfn;
+            shift = l2_entry->page_shift;
+        } else {
+            pfn = pageWalk(core, address, &shift) >> shift;
+            tlbInsert(&core->l2_tlb, address >> shift, pfn, shift, core->tlb_clock);
+        }
+        entry = tlbInsert(l1_tlb, address >> shift, pfn, shift, core->tlb_clock);
+    }
+    return (entry->pfn << entry->page_shift) | (address & ((1u << entry->page_shift) - 1));
+}
+
+// Page table entries are accessed through the cache like any other data, in load/store byte order
+uint32_t readPTE(Core* core, uint32_t address) {
+    uint8_t data[4];
+    cacheAccess(core, address, data, 0);
+    return isaWordFromBytes(data);
+}
+
+void writePTE(Core* core, uint32_t address, uint32_t value) {
+    uint8_t data[4];
+    isaWordToBytes(data, value);
+    cacheAccess(core, address, data, 1);
+}
+
+// Pages covering the loaded image map onto it; everything else gets a fresh frame
+uint32_t allocateFrame(uint32_t address, int shift) {
+    uint32_t page = address & ~((1u << shift) - 1);
+    if (page < binary_size) {
+        return page;
+    }
+    uint32_t size = 1u << shift;
+    uint32_t current = __atomic_load_n(&next_frame, __ATOMIC_RELAXED);
+    uint32_t frame;
+    do {
+        frame = (current + size - 1) & ~(size - 1); // Frames are naturally aligned
+        if (frame + size > FRAME_POOL_END) {
+            fprintf(stderr, "Out of physical frames mapping %08X\n", address);
+            exit(1);
+        }
+    } while (!__atomic_compare_exchange_n(&next_frame, &current, frame + size, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    return frame;
+}
+
+// Two-level walk: VA[31:21] indexes the first level, which holds a 2MB page or a table indexed by VA[20:12].
+// Missing entries are filled in on the spot, as a page fault handler would. The table is shared, so a fault
+// holds the bus and reads the entry again: another core may have mapped the page in the meantime.
+uint32_t pageWalk(Core* core, uint32_t address, int* shift) {
+    uint64_t start = core->total_cycles;
+    core->page_walks++;
+
+    uint32_t l1_address = PAGE_TABLE_AREA + (address >> LARGE_PAGE_SHIFT) * 4;
+    uint32_t pte = readPTE(core, l1_address);
+    if (!(pte & PTE_VALID)) {
+        pthread_mutex_lock(&bus_lock);
+        pte = readPTE(core, l1_address);
+        if (!(pte & PTE_VALID)) {
+            core->page_faults++;
+            if (page_shift == LARGE_PAGE_SHIFT) {
+                pte = allocateFrame(address, LARGE_PAGE_SHIFT) | PTE_LARGE | PTE_VALID;
+            } else {
+                pte = next_page_table | PTE_VALID;
+                next_page_table += 1 << SMALL_PAGE_SHIFT;
+                if (next_page_table > PAGE_TABLE_AREA + PAGE_TABLE_REGION) {
+                    fprintf(stderr, "Out of page table space\n");
+                    exit(1);
+                }
+            }
+            writePTE(core, l1_address, pte);
+        }
+        pthread_mutex_unlock(&bus_lock);
+    }
+
+    uint32_t physical;
+    if (pte & PTE_LARGE) {
+        *shift = LARGE_PAGE_SHIFT;
+        physical = pte & ~((1u << LARGE_PAGE_SHIFT) - 1);
+    } else {
+        uint32_t l2_address = (pte & ~((1u << SMALL_PAGE_SHIFT) - 1)) +
+                              ((address >> SMALL_PAGE_SHIFT) & ((1u << (LARGE_PAGE_SHIFT - SMALL_PAGE_SHIFT)) - 1)) * 4;
+        uint32_t l2_pte = readPTE(core, l2_address);
+        if (!(l2_pte & PTE_VALID)) {
+            pthread_mutex_lock(&bus_lock);
+            l2_pte = readPTE(core, l2_address);
+            if (!(l2_pte & PTE_VALID)) {
+                core->page_faults++;
+                l2_pte = allocateFrame(address, SMALL_PAGE_SHIFT) | PTE_VALID;
+                writePTE(core, l2_address, l2_pte);
+            }
+            pthread_mutex_unlock(&bus_lock);
+        }
+        *shift = SMALL_PAGE_SHIFT;
+        physical = l2_pte & ~((1u << SMALL_PAGE_SHIFT) - 1);
+    }
+
+    core->walk_cycles += core->total_cycles - start;
+    return physical;
+}
+
+// Scratchpad and DMA registers are core-local and untranslated, like an uncached kernel segment
+int isLocalAddress(uint32_t address) {
+    if (spm_size == 0) {
+        return 0;
+    }
+    return (address >= (uint32_t)spm_base && address < (uint32_t)(spm_base + spm_size)) ||
+           (address >= (uint32_t)dma_base && address < (uint32_t)(dma_base + DMA_REGISTER_SPAN));
+}
+
+// Route a load or store to the scratchpad, the DMA registers or the cache
+int dataAccess(Core* core, uint32_t address, uint8_t* data, int write) {
+    if (isLocalAddress(address)) {
+        if (address >= (uint32_t)dma_base && address < (uint32_t)(dma_base + DMA_REGISTER_SPAN)) {
+            dmaRegisterAccess(core, address, data, write);
+        } else {
+            spmAccess(core, address, data, write);
+        }
+        return 1;
+    }
+    uint64_t start = core->total_cycles;
+    int hit = cacheAccess(core, address, data, write);
+    core->cached_data_accesses++;
+    core->cached_data_cycles += core->total_cycles - start;
+    return hit;
+}
+
+// Words are kept in the same byte order as in memory so DMA can copy bytes unchanged
+void spmAccess(Core* core, uint32_t address, uint8_t* data, int write) {
+    uint8_t* word = core->spm + (address - spm_base);
+    if (write) {
+        memcpy(word, data, 4);
+    } else {
+        memcpy(data, word, 4);
+    }
+    core->spm_accesses++;
+    core->spm_cycles += SPM_LATENCY;
+    core->total_cycles += SPM_LATENCY;
+}
+
+void dmaRegisterAccess(Core* core, uint32_t address, uint8_t* data, int write) {
+    uint32_t* fields[] = { &core->dma.source, &core->dma.destination, &core->dma.length };
+    uint32_t offset = address - dma_base;
+    core->total_cycles += SPM_LATENCY;
+
+    if (!write) {
+        dmaUpdate(core);
+        uint32_t value = offset == DMA_CONTROL ? core->dma.status : *fields[offset / 4];
+        isaWordToBytes(data, value);
+        return;
+    }
+    uint32_t value = isaWordFromBytes(data);
+    if (core->dma.status == DMA_BUSY) {
+        printf("Core %d: DMA register write ignored while a transfer is running\n", core->id);
+    } else if (offset != DMA_CONTROL) {
+        *fields[offset / 4] = value;
+    } else if (value & DMA_START) {
+        dmaStart(core);
+    }
+}
+
+// Pointer to the bytes of an address range inside one region, or NULL if it crosses or leaves it
+uint8_t* dmaPointer(Core* core, uint32_t address, uint32_t length) {
+    if (address >= (uint32_t)spm_base && address < (uint32_t)(spm_base + spm_size)) {
+        return address + length <= (uint32_t)(spm_base + spm_size) ? core->spm + (address - spm_base) : NULL;
+    }
+    if (address < MEMORY_SIZE && length <= MEMORY_SIZE - address) {
+        return &memory[address];
+    }
+    return NULL;
+}
+
+// Syscalls move data like the DMA engine does, without a cache: dirty copies are written back before
+// the guest buffer is read and invalidated before it is written.
+int guestCopy(void* context, uint32_t address, uint8_t* buffer, uint32_t length, int to_guest) {
+    Core* core = (Core*)context;
+    if (length > 0xFFFFFFFF - address) {
+        return 0;
+    }
+    pthread_mutex_lock(&bus_lock);
+    uint32_t physical = 0;
+    for (uint32_t i = 0; i < length; ++i) {
+        uint32_t virtual_address = address + i;
+        if (i == 0 || virtual_address % (1u << SMALL_PAGE_SHIFT) == 0) {
+            physical = isLocalAddress(virtual_address) ? virtual_address : translate(core, virtual_address, 0);
+        } else {
+            physical++;
+        }
+        uint8_t* byte = dmaPointer(core, physical, 1);
+        if (byte == NULL) {
+            pthread_mutex_unlock(&bus_lock);
+            return 0;
+        }
+        if (!isLocalAddress(physical) && (i == 0 || physical % line_size == 0)) {
+            dmaSnoop(physical - physical % line_size, to_guest, core->total_cycles);
+        }
+        if (to_guest) {
+            *byte = buffer[i];
+        } else {
+            buffer[i] = *byte;
+        }
+    }
+    pthread_mutex_unlock(&bus_lock);
+    return 1;
+}
+
+// Reserve DRAM for every line the transfer touches; the data itself moves when the transfer completes
+void dmaStart(Core* core) {
+    DmaEngine* dma = &core->dma;
+    if (dma->length == 0 || dma->length % 4 != 0 || dma->source % 4 != 0 || dma->destination % 4 != 0 ||
+        dmaPointer(core, dma->source, dma->length) == NULL || dmaPointer(core, dma->destination, dma->length) == NULL) {
+        printf("Core %d: DMA error: source=%08X, destination=%08X, length=%d\n", core->id, dma->source, dma->destination,
+               dma->length);
+        dma->status = DMA_ERROR;
+        return;
+    }
+
+    pthread_mutex_lock(&bus_lock);
+    uint64_t now = core->total_cycles + DMA_SETUP_CYCLES;
+    for (uint32_t i = 0; i < dma->length; i += line_size) {
+        if (!isLocalAddress(dma->source + i)) {
+            now += dramRead(dma->source + i - (dma->source + i) % line_size, now);
+        }
+        if (!isLocalAddress(dma->destination + i)) {
+            dramWrite(dma->destination + i - (dma->destination + i) % line_size, now);
+            now += dram_tburst;
+        }
+    }
+    pthread_mutex_unlock(&bus_lock);
+
+    dma->status = DMA_BUSY;
+    dma->done_cycle = now;
+    core->dma_transfers++;
+    core->dma_bytes += dma->length;
+    core->dma_busy_cycles += now - core->total_cycles;
+    printf("Core %d: DMA started: %08X -> %08X, %d bytes, done at cycle %" PRIu64 "\n", core->id, dma->source, dma->destination,
+           dma->length, dma->done_cycle);
+}
+
+// Finish the running transfer once the core has caught up with its completion time
+void dmaUpdate(Core* core) {
+    DmaEngine* dma = &core->dma;
+    if (dma->status != DMA_BUSY || core->total_cycles < dma->done_cycle) {
+        return;
+    }
+
+    pthread_mutex_lock(&bus_lock);
+    // Main memory must be current before reading it, and cached copies of the destination must go
+    for (uint32_t i = 0; i < dma->length; i += 4) {
+        uint32_t source = dma->source + i, destination = dma->destination + i;
+        if (!isLocalAddress(source) && (i == 0 || source % line_size == 0)) {
+            dmaSnoop(source - source % line_size, 0, dma->done_cycle);
+        }
+        if (!isLocalAddress(destination) && (i == 0 || destination % line_size == 0)) {
+            dmaSnoop(destination - destination % line_size, 1, dma->done_cycle);
+        }
+    }
+    memmove(dmaPointer(core, dma->destination, dma->length), dmaPointer(core, dma->source, dma->length), dma->length);
+    pthread_mutex_unlock(&bus_lock);
+
+    dma->status = DMA_DONE;
+    printf("Core %d: DMA done at cycle %" PRIu64 "\n", core->id, dma->done_cycle);
+}
+
+// DMA is a bus master without a cache: dirty copies are written back, and a write also invalidates them
+void dmaSnoop(uint32_t line_address, int write, uint64_t now) {
+    for (int i = 0; i < num_cores; ++i) {
+        Core* other = &cores[i];
+        CacheIndex index;
+        pthread_mutex_lock(&other->cache_lock);
+        CacheLine* line = cache_lookup(other->cache, line_address, &index);
+        if (line == NULL) {
+            line = findVictimLine(other, index.set_index, index.tag);
+        }
+        if (line != NULL) {
+            if (line->state == MODIFIED || line->state == OWNED) {
+                for (int j = 0; j < line_size; j += 4) {
+                    memWrite(line_address + j, isaWordFromBytes(line->data + j));
+                }
+                dramWrite(line_address, now);
+                coherence.writebacks++;
+                line->state = line->state == MODIFIED ? EXCLUSIVE : SHARED;
+            }
+            if (write) {
+                line->state = INVALID;
+                coherence.invalidations++;
+                shadowInvalidate(&other->shadow, line_address);
+                if (other->ll_valid && other->ll_address == line_address) {
+                    other->ll_valid = 0;
+                }
+            }
+        }
+        pthread_mutex_unlock(&other->cache_lock);
+    }
+}
+
+void loadBinary(const char* filename) {
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL) {
+        perror("Error opening file");
+        exit(1);
+    }
+    size_t bytesRead = fread(memory, sizeof(uint8_t), MEMORY_SIZE, file);
+    fclose(file);
+    binary_size = bytesRead;
+    printf("Loaded %zu bytes from %s\n", bytesRead, filename);
+}
+
+// Counters are summed over cores; formulas and the histogram are computed from the same fields
+void registerStats() {
+    statsFormula("cycles", "Cycles of the slowest core", statCycles);
+    CORE_COUNTER("instructions", instruction_count, "Executed instructions");
+    CORE_COUNTER("memory_accesses", memory_access_count, "Load and store instructions");
+    CORE_COUNTER("register_ops", register_operation_count, "Register operations");
+    CORE_COUNTER("branches", branch_total_count, "Branch instructions");
+    CORE_COUNTER("taken_branches", branch_taken_count, "Taken branches");
+    statsFormula("ipc", "Instructions per cycle, all cores", statIPC);
+    CORE_COUNTER("cache.hits", cache_hit_count, "Cache hits");
+    CORE_COUNTER("cache.misses", cache_miss_count, "Cache misses");
+    CORE_COUNTER("cache.miss_cycles", miss_cycles, "Cycles spent on cache misses");
+    CORE_COUNTER("cache.compulsory", miss_types[MISS_COMPULSORY], "Compulsory misses");
+    CORE_COUNTER("cache.capacity", miss_types[MISS_CAPACITY], "Capacity misses");
+    CORE_COUNTER("cache.conflict", miss_types[MISS_CONFLICT], "Conflict misses");
+    CORE_COUNTER("cache.coherence", miss_types[MISS_COHERENCE], "Coherence misses");
+    CORE_COUNTER("cache.victim_hits", victim_hits, "Victim cache hits");
+    statsFormula("cache.miss_rate", "Misses per cache access", statMissRate);
+    statsFormula("cache.amat", "Average memory access time in cycles", statAMAT);
+    miss_latency_stat = statsHistogram("cache.miss_latency", "Cycles to fill a miss", MISS_LATENCY_BUCKET, MISS_LATENCY_BUCKETS);
+    CORE_COUNTER("write_buffer.inserts", write_buffer_inserts, "Writes entering the write buffer");
+    CORE_COUNTER("write_buffer.coalesced", write_buffer_coalesced, "Writes merged into a pending entry");
+    CORE_COUNTER("write_buffer.stall_cycles", write_buffer_stall_cycles, "Cycles stalled on a full write buffer");
+    CORE_COUNTER("memory.write_bytes", memory_write_bytes, "Bytes written to memory");
+    statsCounter("dram.reads", "DRAM line reads", &dram_stats.reads);
+    statsCounter("dram.writes", "DRAM line writes", &dram_stats.writes);
+    statsCounter("dram.row_hits", "Row buffer hits", &dram_stats.row_hits);
+    statsCounter("dram.row_conflicts", "Row buffer conflicts", &dram_stats.row_conflicts);
+    statsFormula("dram.row_hit_rate", "Row buffer hits per request", statRowHitRate);
+    statsCounter("coherence.bus_reads", "BusRd transactions", &coherence.bus_reads);
+    statsCounter("coherence.bus_read_exclusives", "BusRdX transactions", &coherence.bus_read_exclusives);
+    statsCounter("coherence.bus_upgrades", "BusUpgr transactions", &coherence.bus_upgrades);
+    statsCounter("coherence.invalidations", "Lines invalidated by another writer", &coherence.invalidations);
+    if (vm_mode != VM_OFF) {
+        CORE_COUNTER("tlb.itlb_misses", itlb.misses, "ITLB misses");
+        CORE_COUNTER("tlb.dtlb_misses", dtlb.misses, "DTLB misses");
+        CORE_COUNTER("tlb.page_walks", page_walks, "Page table walks");
+        CORE_COUNTER("tlb.walk_cycles", walk_cycles, "Cycles spent walking page tables");
+    }
+    if (spm_size > 0) {
+        CORE_COUNTER("spm.accesses", spm_accesses, "Scratchpad loads and stores");
+        CORE_COUNTER("spm.cached_accesses", cached_data_accesses, "Loads and stores through the cache");
+        CORE_COUNTER("dma.bytes", dma_bytes, "Bytes moved by DMA");
+    }
+}
+
+uint64_t simulatedCycles() {
+    uint64_t cycles = 0;
+    for (int i = 0; i < num_cores; ++i) {
+        if (cores[i].total_cycles > cycles) {
+            cycles = cores[i].total_cycles; // Cores run concurrently
+        }
+    }
+    return cycles;
+}
+
+double statCycles() {
+    return (double)simulatedCycles();
+}
+
+uint64_t totalInstructions() {
+    uint64_t instructions = 0;
+    for (int i = 0; i < num_cores; ++i) {
+        instructions += cores[i].instruction_count;
+    }
+    return instructions;
+}
+
+double statIPC() {
+    uint64_t cycles = simulatedCycles();
+    return cycles ? (double)totalInstructions() / cycles : 0.0;
+}
+
+double statMissRate() {
+    uint64_t hits = 0, misses = 0;
+    for (int i = 0; i < num_cores; ++i) {
+        hits += cores[i].cache_hit_count;
+        misses += cores[i].cache_miss_count;
+    }
+    return hits + misses ? (double)misses / (hits + misses) : 0.0;
+}
+
+double statAMAT() {
+    return calculateAMAT();
+}
+
+double statRowHitRate() {
+    uint64_t requests = dram_stats.row_hits + dram_stats.row_empty + dram_stats.row_conflicts;
+    return requests ? (double)dram_stats.row_hits / requests : 0.0;
+}
+
+float calculateAMAT() {
+    uint64_t hits = 0, misses = 0, miss_cycles = 0;
+    for (int i = 0; i < num_cores; ++i) {
+        hits += cores[i].cache_hit_count;
+        misses += cores[i].cache_miss_count;
+        miss_cycles += cores[i].miss_cycles;
+    }
+    float hit_time = hit_latency; // Cache hit time in cycles
+    float miss_penalty = misses ? (float)miss_cycles / misses : 0.0f; // Measured cache miss penalty in cycles
+    float miss_rate = (float)misses / (hits + misses);
     return hit_time + miss_rate * miss_penalty;
 }